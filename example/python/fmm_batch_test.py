@@ -0,0 +1,77 @@
+"""Smoke test of match_batch and of the arrays of match results"""
+from __future__ import print_function
+import gc
+import numpy as np
+from fmm import Network,NetworkGraph,STMATCH,STMATCHConfig
+
+network = Network("../data/edges.shp")
+graph = NetworkGraph(network)
+model = STMATCH(network,graph)
+config = STMATCHConfig()
+config.k = 4
+config.gps_error = 0.5
+config.radius = 0.4
+config.vmax = 30
+config.factor = 1.5
+points = [(0.200812146892656, 2.14088983050848),
+          (1.44262005649717, 2.14879943502825),
+          (3.06408898305084, 2.16066384180791),
+          (3.06408898305084, 2.7103813559322),
+          (3.70872175141242, 2.97930790960452),
+          (4.11606638418078, 2.62337570621469)]
+wkt = "LINESTRING(" + ",".join("%r %r" % p for p in points) + ")"
+result = model.match_wkt(wkt,config)
+cpath = list(result.cpath)
+assert len(cpath) > 0
+
+# The same trajectory twice, with ids 1 and 2
+ids = [1] * len(points) + [2] * len(points)
+xs = [p[0] for p in points] * 2
+ys = [p[1] for p in points] * 2
+batch = model.match_batch(ids,xs,ys,None,config)
+assert list(batch.ids) == [1, 2]
+assert list(batch.cpath_offsets) == [0, len(cpath), 2 * len(cpath)]
+assert list(batch.cpath) == cpath * 2
+np_batch = model.match_batch(np.array(ids, dtype=np.int32),
+                             np.array(xs), np.array(ys), None, config)
+for name in ["ids", "point_offsets", "opath", "cpath_offsets", "cpath",
+             "mgeom_x", "mgeom_y"]:
+    assert list(getattr(np_batch, name)) == list(getattr(batch, name)), name
+# Int64 ids are accepted as well
+np_batch = model.match_batch(np.array(ids, dtype=np.int64),
+                             np.array(xs), np.array(ys), None, config)
+assert list(np_batch.ids) == [1, 2]
+
+# Dtype and shape of the arrays
+assert result.cpath_array.dtype == np.int64
+assert list(result.cpath_array) == cpath
+assert result.indices_array.dtype == np.int32
+candidates = result.candidates_array
+assert candidates.shape == (len(result.candidates),)
+assert candidates.dtype.names == ("index", "edge_id", "source", "target",
+                                  "error", "offset", "length", "ep", "tp",
+                                  "spdist")
+assert candidates.dtype["edge_id"] == np.int64
+assert candidates.dtype["error"] == np.float64
+assert list(candidates["edge_id"]) == list(result.opath)
+mgeom = result.mgeom_array
+num_points = result.mgeom.get_num_points()
+assert mgeom.dtype == np.float64
+assert mgeom.shape == (num_points, 2)
+assert mgeom[0, 0] == result.mgeom.get_x(0)
+assert mgeom[-1, 1] == result.mgeom.get_y(num_points - 1)
+assert not mgeom.flags.writeable
+assert batch.array("cpath").dtype == np.int64
+assert batch.array("point_offsets").dtype == np.int32
+assert np.array_equal(batch.array("mgeom_x"), list(batch.mgeom_x))
+
+# The arrays keep the result alive after it is deleted
+expected_mgeom = mgeom.copy()
+cpath_array = result.cpath_array
+batch_cpath = batch.array("cpath")
+del result, batch
+gc.collect()
+assert list(cpath_array) == cpath
+assert list(batch_cpath) == cpath * 2
+assert np.array_equal(mgeom, expected_mgeom)
+print("Batch matching and result arrays passed")
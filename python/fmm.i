@@ -1,4 +1,6 @@
-%module fmm
+// The GIL is released only by the functions enabled with %thread
+%module(threads="1") fmm
+%nothread;
 %include exception.i
 %include "std_string.i"
 // %include "stdint.i"
@@ -51,12 +53,276 @@ using namespace FMM::MM;
 using namespace FMM::CONFIG;
 %}
 
+%{
+#include <type_traits>
+
+// Copy the elements of a buffer with element type S to a vector
+template<typename S, typename T>
+void pyfmm_copy_buffer(const Py_buffer &view, std::vector<T> *vec) {
+  const S *data = static_cast<const S *>(view.buf);
+  vec->assign(data, data + view.len / sizeof(S));
+}
+
+// Copy a sequence of numbers to a vector. An object supporting the buffer
+// protocol, e.g., a NumPy array, is copied without creating a Python
+// object for each element. None is copied as an empty vector.
+template<typename T>
+bool pyfmm_as_vector(PyObject *obj, std::vector<T> *vec) {
+  if (obj == Py_None) {
+    vec->clear();
+    return true;
+  }
+  Py_buffer view;
+  if (PyObject_CheckBuffer(obj) &&
+      PyObject_GetBuffer(obj, &view, PyBUF_FORMAT | PyBUF_C_CONTIGUOUS) == 0) {
+    const char *format = view.format == NULL ? "B" : view.format;
+    if (*format == '@' || *format == '=') ++format;
+    bool copied = true;
+    if (view.ndim > 1 || format[0] == 0 || format[1] != 0) {
+      copied = false;
+    } else {
+      switch (*format) {
+        case 'b': pyfmm_copy_buffer<signed char>(view, vec); break;
+        case 'B': pyfmm_copy_buffer<unsigned char>(view, vec); break;
+        case 'h': pyfmm_copy_buffer<short>(view, vec); break;
+        case 'H': pyfmm_copy_buffer<unsigned short>(view, vec); break;
+        case 'i': pyfmm_copy_buffer<int>(view, vec); break;
+        case 'I': pyfmm_copy_buffer<unsigned int>(view, vec); break;
+        case 'l': pyfmm_copy_buffer<long>(view, vec); break;
+        case 'L': pyfmm_copy_buffer<unsigned long>(view, vec); break;
+        case 'q': pyfmm_copy_buffer<long long>(view, vec); break;
+        case 'Q': pyfmm_copy_buffer<unsigned long long>(view, vec); break;
+        case 'f': pyfmm_copy_buffer<float>(view, vec); break;
+        case 'd': pyfmm_copy_buffer<double>(view, vec); break;
+        default: copied = false;
+      }
+    }
+    PyBuffer_Release(&view);
+    if (copied) return true;
+  }
+  PyErr_Clear();
+  PyObject *seq = PySequence_Fast(obj, "a sequence of numbers is expected");
+  if (seq == NULL) return false;
+  Py_ssize_t size = PySequence_Fast_GET_SIZE(seq);
+  vec->resize(size);
+  for (Py_ssize_t i = 0; i < size; ++i) {
+    PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+    (*vec)[i] = std::is_floating_point<T>::value ?
+      static_cast<T>(PyFloat_AsDouble(item)) :
+      static_cast<T>(PyLong_AsLongLong(item));
+    if (PyErr_Occurred()) {
+      Py_DECREF(seq);
+      return false;
+    }
+  }
+  Py_DECREF(seq);
+  return true;
+}
+%}
+
+// Columns of GPS points passed to match_batch
+%typemap(in) const std::vector<int> &ids (std::vector<int> temp),
+             const std::vector<double> &xs (std::vector<double> temp),
+             const std::vector<double> &ys (std::vector<double> temp),
+             const std::vector<double> &timestamps (std::vector<double> temp) {
+  if (!pyfmm_as_vector($input, &temp)) SWIG_fail;
+  $1 = &temp;
+}
+%thread FMM::MM::FastMapMatch::match_batch;
+%thread FMM::MM::STMATCH::match_batch;
+
+%{
+// Read only buffer over the memory of a match result, which keeps the
+// Python object owning the result alive while the buffer is referenced.
+struct PyFMMResultBuffer {
+  PyObject_HEAD
+  PyObject *owner;
+  const void *data;
+  Py_ssize_t itemsize;
+  const char *format;
+  int ndim;
+  Py_ssize_t shape[2];
+  Py_ssize_t strides[2];
+};
+
+static void pyfmm_buffer_dealloc(PyObject *self) {
+  Py_XDECREF(reinterpret_cast<PyFMMResultBuffer *>(self)->owner);
+  PyObject_Del(self);
+}
+
+static int pyfmm_buffer_get(PyObject *self, Py_buffer *view, int flags) {
+  PyFMMResultBuffer *buffer = reinterpret_cast<PyFMMResultBuffer *>(self);
+  if ((flags & PyBUF_WRITABLE) == PyBUF_WRITABLE) {
+    PyErr_SetString(PyExc_BufferError, "match result buffer is read only");
+    return -1;
+  }
+  // An empty buffer still needs a valid address
+  static const double empty = 0;
+  view->obj = self;
+  Py_INCREF(self);
+  view->buf = const_cast<void *>(
+    buffer->data == NULL ? static_cast<const void *>(&empty) : buffer->data);
+  view->len = buffer->itemsize;
+  for (int i = 0; i < buffer->ndim; ++i) view->len *= buffer->shape[i];
+  view->readonly = 1;
+  view->itemsize = buffer->itemsize;
+  view->format = (flags & PyBUF_FORMAT) ?
+    const_cast<char *>(buffer->format) : NULL;
+  view->ndim = buffer->ndim;
+  view->shape = (flags & PyBUF_ND) == PyBUF_ND ? buffer->shape : NULL;
+  view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ?
+    buffer->strides : NULL;
+  view->suboffsets = NULL;
+  view->internal = NULL;
+  return 0;
+}
+
+static PyBufferProcs pyfmm_buffer_procs;
+static PyTypeObject pyfmm_buffer_type = {PyVarObject_HEAD_INIT(NULL, 0)};
+
+// Create a buffer of count items of itemsize bytes, which has a second
+// dimension of columns items stored contiguously when columns > 0.
+static PyObject *pyfmm_new_buffer(
+    PyObject *owner, const void *data, Py_ssize_t count,
+    Py_ssize_t itemsize, const char *format, Py_ssize_t columns = 0) {
+  if (pyfmm_buffer_type.tp_name == NULL) {
+    pyfmm_buffer_procs.bf_getbuffer = pyfmm_buffer_get;
+    pyfmm_buffer_type.tp_name = "fmm.ResultBuffer";
+    pyfmm_buffer_type.tp_basicsize = sizeof(PyFMMResultBuffer);
+    pyfmm_buffer_type.tp_dealloc = pyfmm_buffer_dealloc;
+    pyfmm_buffer_type.tp_as_buffer = &pyfmm_buffer_procs;
+    pyfmm_buffer_type.tp_flags = Py_TPFLAGS_DEFAULT;
+#if PY_MAJOR_VERSION < 3
+    pyfmm_buffer_type.tp_flags |= Py_TPFLAGS_HAVE_NEWBUFFER;
+#endif
+    pyfmm_buffer_type.tp_doc = "Read only buffer of a match result";
+    if (PyType_Ready(&pyfmm_buffer_type) < 0) return NULL;
+  }
+  PyFMMResultBuffer *buffer =
+    PyObject_New(PyFMMResultBuffer, &pyfmm_buffer_type);
+  if (buffer == NULL) return NULL;
+  Py_INCREF(owner);
+  buffer->owner = owner;
+  buffer->data = count > 0 ? data : NULL;
+  buffer->format = format;
+  if (columns > 0) {
+    buffer->itemsize = itemsize / columns;
+    buffer->ndim = 2;
+    buffer->shape[0] = count;
+    buffer->shape[1] = columns;
+    buffer->strides[0] = itemsize;
+    buffer->strides[1] = itemsize / columns;
+  } else {
+    buffer->itemsize = itemsize;
+    buffer->ndim = 1;
+    buffer->shape[0] = count;
+    buffer->strides[0] = itemsize;
+  }
+  return reinterpret_cast<PyObject *>(buffer);
+}
+
+template<typename T> const char *pyfmm_format();
+template<> const char *pyfmm_format<int>() { return "i"; }
+template<> const char *pyfmm_format<long long>() { return "q"; }
+template<> const char *pyfmm_format<double>() { return "d"; }
+
+template<typename T>
+static PyObject *pyfmm_vector_buffer(
+    PyObject *owner, const std::vector<T> &vec) {
+  return pyfmm_new_buffer(owner, vec.data(), vec.size(), sizeof(T),
+                          pyfmm_format<T>());
+}
+
+// Points of a linestring as an N x 2 buffer of x and y
+static PyObject *pyfmm_linestring_buffer(
+    PyObject *owner, const FMM::CORE::LineString &line) {
+  static_assert(sizeof(FMM::CORE::Point) == 2 * sizeof(double),
+                "Point should store x and y only");
+  int n = line.get_num_points();
+  return pyfmm_new_buffer(owner, n > 0 ? &line.at(0) : NULL, n,
+                          sizeof(FMM::CORE::Point), "d", 2);
+}
+
+// Fields of PyCandidate in the struct syntax with native alignment
+static const char *PYFMM_CANDIDATE_FORMAT =
+  "T{i:index:q:edge_id:q:source:q:target:d:error:d:offset:d:length:"
+  "d:ep:d:tp:d:spdist:}";
+%}
+
+// The arrays of a result are exposed by the buffer protocol without copy,
+// as NumPy arrays if NumPy is installed, otherwise as memoryview objects.
+// They are valid as long as the result is not modified.
+%extend FMM::PYTHON::PyMatchResult {
+  PyObject *_buffer(PyObject *owner, const std::string &name) {
+    if (name == "opath") return pyfmm_vector_buffer(owner, $self->opath);
+    if (name == "cpath") return pyfmm_vector_buffer(owner, $self->cpath);
+    if (name == "indices") return pyfmm_vector_buffer(owner, $self->indices);
+    if (name == "candidates") {
+      return pyfmm_new_buffer(
+        owner, $self->candidates.data(), $self->candidates.size(),
+        sizeof(FMM::PYTHON::PyCandidate), PYFMM_CANDIDATE_FORMAT);
+    }
+    if (name == "mgeom") return pyfmm_linestring_buffer(owner, $self->mgeom);
+    if (name == "pgeom") return pyfmm_linestring_buffer(owner, $self->pgeom);
+    throw std::runtime_error("Unknown array " + name);
+  }
+  %pythoncode %{
+    opath_array = property(lambda self: _result_array(self, "opath"),
+                           doc="opath as an int64 array")
+    cpath_array = property(lambda self: _result_array(self, "cpath"),
+                           doc="cpath as an int64 array")
+    indices_array = property(lambda self: _result_array(self, "indices"),
+                             doc="indices as an int32 array")
+    candidates_array = property(
+      lambda self: _result_array(self, "candidates"),
+      doc="candidates as a structured array with the fields of PyCandidate")
+    mgeom_array = property(lambda self: _result_array(self, "mgeom"),
+                           doc="points of mgeom as an N x 2 float64 array")
+    pgeom_array = property(lambda self: _result_array(self, "pgeom"),
+                           doc="points of pgeom as an N x 2 float64 array")
+  %}
+}
+
+%extend FMM::PYTHON::PyBatchMatchResult {
+  PyObject *_buffer(PyObject *owner, const std::string &name) {
+    if (name == "ids") return pyfmm_vector_buffer(owner, $self->ids);
+    if (name == "point_offsets") {
+      return pyfmm_vector_buffer(owner, $self->point_offsets);
+    }
+    if (name == "opath") return pyfmm_vector_buffer(owner, $self->opath);
+    if (name == "indices") return pyfmm_vector_buffer(owner, $self->indices);
+    if (name == "error") return pyfmm_vector_buffer(owner, $self->error);
+    if (name == "offset") return pyfmm_vector_buffer(owner, $self->offset);
+    if (name == "ep") return pyfmm_vector_buffer(owner, $self->ep);
+    if (name == "tp") return pyfmm_vector_buffer(owner, $self->tp);
+    if (name == "spdist") return pyfmm_vector_buffer(owner, $self->spdist);
+    if (name == "pgeom_x") return pyfmm_vector_buffer(owner, $self->pgeom_x);
+    if (name == "pgeom_y") return pyfmm_vector_buffer(owner, $self->pgeom_y);
+    if (name == "cpath_offsets") {
+      return pyfmm_vector_buffer(owner, $self->cpath_offsets);
+    }
+    if (name == "cpath") return pyfmm_vector_buffer(owner, $self->cpath);
+    if (name == "mgeom_offsets") {
+      return pyfmm_vector_buffer(owner, $self->mgeom_offsets);
+    }
+    if (name == "mgeom_x") return pyfmm_vector_buffer(owner, $self->mgeom_x);
+    if (name == "mgeom_y") return pyfmm_vector_buffer(owner, $self->mgeom_y);
+    throw std::runtime_error("Unknown array " + name);
+  }
+  %pythoncode %{
+    def array(self, name):
+        """Get a column such as "cpath" as an array without copy"""
+        return _result_array(self, name)
+  %}
+}
+
 %template(IntVector) std::vector<int>;
 %template(IDVector) std::vector<long long>;
 %template(HexVector) std::vector<unsigned long long>;
 %template(UnsignedIntVector) std::vector<unsigned int>;
 %template(DoubleVector) std::vector<double>;
 %template(PyCandidateVector) std::vector<FMM::PYTHON::PyCandidate>;
+%template(OnlineMatchVector) std::vector<FMM::MM::OnlineMatch>;
 // %template(DoubleVVector) vector<vector<double> >;
 // %template(DoubleVVVector) vector<vector<vector<double> > >;
 // %template(IntSet) set<int>;
@@ -77,3 +343,16 @@ using namespace FMM::CONFIG;
 %include "mm/h3mm/h3_type.hpp"
 %include "mm/h3mm/h3_util.hpp"
 %include "mm/h3mm/h3mm.hpp"
+
+%pythoncode %{
+try:
+    import numpy as _numpy
+except ImportError:
+    _numpy = None
+
+def _result_array(result, name):
+    buffer = result._buffer(result, name)
+    if _numpy is None:
+        return memoryview(buffer)
+    return _numpy.asarray(buffer)
+%}
@@ -0,0 +1,37 @@
+/**
+ * Fast map matching.
+ *
+ * fmm_server command line program main function
+ */
+
+#include "mm/fmm/fmm_server.hpp"
+
+#include <csignal>
+
+using namespace FMM;
+using namespace FMM::MM;
+
+namespace {
+FMMServer *server = nullptr;
+void handle_signal(int) {
+  if (server != nullptr) server->stop();
+}
+}
+
+int main(int argc, char **argv){
+  FMMServerConfig config(argc,argv);
+  if (config.help_specified) {
+    FMMServerConfig::print_help();
+    return 0;
+  }
+  if (!config.validate()){
+    return 0;
+  }
+  FMMServer app(config);
+  server = &app;
+  std::signal(SIGINT, handle_signal);
+  std::signal(SIGTERM, handle_signal);
+  app.run();
+  server = nullptr;
+  return 0;
+};
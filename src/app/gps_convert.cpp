@@ -0,0 +1,66 @@
+/**
+ * Fast map matching.
+ *
+ * gps_convert command line program main function, which converts a GPS
+ * file into a binary trajectory file.
+ */
+
+#include "io/trajectory_file.hpp"
+#include "config/gps_config.hpp"
+#include "cxxopts/cxxopts.hpp"
+#include "util/util.hpp"
+#include "util/debug.hpp"
+
+using namespace FMM;
+using namespace FMM::CONFIG;
+
+void print_help() {
+  std::ostringstream oss;
+  oss << "gps_convert argument lists:\n";
+  GPSConfig::register_help(oss);
+  oss << "-o/--output (required) <string>: Output file name (.fmmt)\n";
+  oss << "-l/--log_level (optional) <int>: log level (2)\n";
+  oss << "-h/--help: help information\n";
+  std::cout << oss.str();
+}
+
+int main(int argc, char **argv) {
+  spdlog::set_pattern("[%^%l%$][%s:%-3#] %v");
+  cxxopts::Options options("gps_convert",
+                           "Convert GPS file into binary trajectory file");
+  GPSConfig::register_arg(options);
+  options.add_options()
+    ("o,output", "Output file name",
+    cxxopts::value<std::string>()->default_value(""))
+    ("l,log_level", "Log level", cxxopts::value<int>()->default_value("2"))
+    ("h,help", "Help information");
+  if (argc == 1) {
+    print_help();
+    return 0;
+  }
+  auto result = options.parse(argc, argv);
+  if (result.count("help") > 0) {
+    print_help();
+    return 0;
+  }
+  spdlog::set_level(
+    (spdlog::level::level_enum) result["log_level"].as<int>());
+  GPSConfig gps_config = GPSConfig::load_from_arg(result);
+  std::string output = result["output"].as<std::string>();
+  gps_config.print();
+  if (!gps_config.validate()) {
+    return 0;
+  }
+  if (!UTIL::check_file_extension(output, "fmmt")) {
+    SPDLOG_CRITICAL("Output file {} should have extension fmmt", output);
+    return 0;
+  }
+  auto begin_time = UTIL::get_current_time();
+  long long num_trajectories =
+    IO::convert_to_trajectory_file(gps_config, output);
+  double duration = UTIL::get_duration(begin_time,
+                                       UTIL::get_current_time());
+  SPDLOG_INFO("Convert {} trajectories in {} seconds", num_trajectories,
+              duration);
+  return 0;
+};
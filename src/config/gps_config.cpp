@@ -1,6 +1,7 @@
 #include "config/gps_config.hpp"
 #include "util/util.hpp"
 #include "util/debug.hpp"
+#include "io/compressed_file.hpp"
 
 void FMM::CONFIG::GPSConfig::print() const{
   int format = get_gps_format();
@@ -9,12 +10,16 @@ void FMM::CONFIG::GPSConfig::print() const{
     SPDLOG_INFO("File name: {} ",file);
     SPDLOG_INFO("ID name: {} ",id);
     SPDLOG_INFO("Timestamp name: {} ",timestamp);
+  } else if (format==3) {
+    SPDLOG_INFO("GPS format: binary trajectory");
+    SPDLOG_INFO("File name: {} ",file);
   } else if (format==1) {
     SPDLOG_INFO("GPS format: CSV trajectory");
     SPDLOG_INFO("File name: {} ",file);
     SPDLOG_INFO("ID name: {} ",id);
     SPDLOG_INFO("Geom name: {} ",geom);
     SPDLOG_INFO("Timestamp name: {} ",timestamp);
+    SPDLOG_INFO("Memory mapped: {} ",mmap);
   } else {
     SPDLOG_INFO("GPS format: CSV point");
     SPDLOG_INFO("File name: {} ",file);
@@ -22,6 +27,12 @@ void FMM::CONFIG::GPSConfig::print() const{
     SPDLOG_INFO("x name: {} ",x);
     SPDLOG_INFO("y name: {} ",y);
     SPDLOG_INFO("Timestamp name: {} ",timestamp);
+    SPDLOG_INFO("Memory mapped: {} ",mmap);
+    if (mmap)
+      SPDLOG_INFO("Parse threads: {} ",parse_threads);
+    SPDLOG_INFO("Unsorted: {} ",unsorted);
+    if (unsorted)
+      SPDLOG_INFO("Sort memory: {} MB",sort_memory);
   }
 };
 
@@ -34,6 +45,10 @@ std::string FMM::CONFIG::GPSConfig::to_string() const{
   oss << "x column : " << x << "\n";
   oss << "y column : " << y << "\n";
   oss << "GPS point : " << (gps_point?"true":"false") << "\n";
+  oss << "Memory mapped : " << (mmap?"true":"false") << "\n";
+  oss << "Unsorted : " << (unsorted?"true":"false") << "\n";
+  oss << "Sort memory : " << sort_memory << " MB\n";
+  oss << "Parse threads : " << parse_threads << "\n";
   return oss.str();
 };
 
@@ -49,6 +64,11 @@ FMM::CONFIG::GPSConfig FMM::CONFIG::GPSConfig::load_from_xml(
   config.y = xml_data.get("config.input.gps.y", "y");
   config.gps_point = !(!xml_data.get_child_optional(
       "config.input.gps.gps_point"));
+  config.mmap = !(!xml_data.get_child_optional("config.input.gps.mmap"));
+  config.unsorted = !(!xml_data.get_child_optional(
+      "config.input.gps.unsorted"));
+  config.sort_memory = xml_data.get("config.input.gps.sort_memory", 1024);
+  config.parse_threads = xml_data.get("config.input.gps.parse_threads", 0);
   return config;
 };
 
@@ -63,6 +83,12 @@ FMM::CONFIG::GPSConfig FMM::CONFIG::GPSConfig::load_from_arg(
   config.y = arg_data["gps_y"].as<std::string>();
   if (arg_data.count("gps_point")>0)
     config.gps_point = true;
+  if (arg_data.count("gps_mmap")>0)
+    config.mmap = true;
+  if (arg_data.count("gps_unsorted")>0)
+    config.unsorted = true;
+  config.sort_memory = arg_data["gps_sort_memory"].as<int>();
+  config.parse_threads = arg_data["gps_parse_threads"].as<int>();
   return config;
 };
 
@@ -80,11 +106,18 @@ void FMM::CONFIG::GPSConfig::register_arg(cxxopts::Options &options){
   cxxopts::value<std::string>()->default_value("geom"))
   ("gps_timestamp",   "GPS file timestamp column name",
   cxxopts::value<std::string>()->default_value("timestamp"))
-  ("gps_point","GPS point or not");
+  ("gps_point","GPS point or not")
+  ("gps_mmap","Memory map the CSV file")
+  ("gps_unsorted","GPS points not sorted by id and timestamp")
+  ("gps_sort_memory","Memory in MB to sort unsorted GPS points",
+  cxxopts::value<int>()->default_value("1024"))
+  ("gps_parse_threads","Threads parsing a memory mapped GPS point file",
+  cxxopts::value<int>()->default_value("0"));
 };
 
 void FMM::CONFIG::GPSConfig::register_help(std::ostringstream &oss){
-  oss<<"--gps (required) <string>: GPS file name\n";
+  oss<<"--gps (required) <string>: GPS file name, "
+    "- to read CSV data from the standard input\n";
   oss<<"--gps_id (optional) <string>: GPS id name (id)\n";
   oss<<"--gps_x (optional) <string>: GPS x name (x)\n";
   oss<<"--gps_y (optional) <string>: GPS y name (y)\n";
@@ -93,9 +126,23 @@ void FMM::CONFIG::GPSConfig::register_help(std::ostringstream &oss){
   oss<<"--gps_geom (optional) <string>: GPS geometry name (geom)\n";
   oss<<"--gps_point (optional): if specified read input data as gps point, "
     "otherwise (default) read input data as trajectory\n";
+  oss<<"--gps_mmap (optional): if specified, memory map a CSV file and "
+    "parse it in place, points are parsed in parallel\n";
+  oss<<"--gps_unsorted (optional): if specified, GPS points are grouped by "
+    "id and sorted by timestamp, spilling to TMPDIR if needed\n";
+  oss<<"--gps_sort_memory (optional) <int>: memory in MB to sort "
+    "unsorted GPS points (1024)\n";
+  oss<<"--gps_parse_threads (optional) <int>: threads parsing a memory "
+    "mapped GPS point file, 0 for all the OpenMP threads. The parse runs "
+    "next to the matching threads, use a small value to avoid "
+    "oversubscribing the cores (0)\n";
 };
 
 int FMM::CONFIG::GPSConfig::get_gps_format() const {
+  // The standard input is read as CSV
+  if (IO::is_standard_stream(file)) {
+    return gps_point ? 2 : 1;
+  }
   std::string fn_extension = file.substr(
       file.find_last_of(".") + 1);
   if (fn_extension == "csv" || fn_extension == "txt") {
@@ -106,6 +153,8 @@ int FMM::CONFIG::GPSConfig::get_gps_format() const {
     }
   } else if (fn_extension == "gpkg" || fn_extension == "shp") {
     return 0;
+  } else if (fn_extension == "fmmt") {
+    return 3;
   } else {
     SPDLOG_CRITICAL("GPS file extension {} unknown",fn_extension);
     return -1;
@@ -113,7 +162,12 @@ int FMM::CONFIG::GPSConfig::get_gps_format() const {
 };
 
 bool FMM::CONFIG::GPSConfig::validate() const {
-  if (!UTIL::file_exists(file))
+  if (IO::is_standard_stream(file)) {
+    if (mmap || unsorted) {
+      SPDLOG_CRITICAL("Standard input cannot be memory mapped or sorted");
+      return false;
+    }
+  } else if (!UTIL::file_exists(file))
   {
     SPDLOG_CRITICAL("GPS file {} not found",file);
     return false;
@@ -122,5 +176,14 @@ bool FMM::CONFIG::GPSConfig::validate() const {
     SPDLOG_CRITICAL("Unknown GPS format");
     return false;
   }
+  if (unsorted && sort_memory <= 0) {
+    SPDLOG_CRITICAL("Sort memory {} should be positive", sort_memory);
+    return false;
+  }
+  if (parse_threads < 0) {
+    SPDLOG_CRITICAL("Parse threads {} should not be negative",
+                    parse_threads);
+    return false;
+  }
   return true;
 };
@@ -30,18 +30,34 @@ struct GPSConfig {
             const std::string &x_arg="x",
             const std::string &y_arg="y",
             const std::string &timestamp_arg="timestamp",
-            bool gps_point_arg = false) :
+            bool gps_point_arg = false,
+            bool mmap_arg = false,
+            bool unsorted_arg = false,
+            int sort_memory_arg = 1024,
+            int parse_threads_arg = 0) :
     file(file_arg), id(id_arg), geom(geom_arg),
     x(x_arg),y(y_arg),timestamp(timestamp_arg),
-    gps_point(gps_point_arg)
+    gps_point(gps_point_arg), mmap(mmap_arg),
+    unsorted(unsorted_arg), sort_memory(sort_memory_arg),
+    parse_threads(parse_threads_arg)
   {};
-  std::string file; /**< filename */
+  std::string file; /**< filename, - for the standard input */
   std::string id; /**< id field/column name */
   std::string geom; /**< geometry field/column name */
   std::string x; /**< x field/column name */
   std::string y; /**< y field/column name */
   std::string timestamp; /**< timestamp field/column name */
   bool gps_point; /**< gps point stored or not */
+  bool mmap; /**< memory map a CSV file and parse it in place, the
+                   points of a CSV point file are parsed in parallel */
+  bool unsorted; /**< points of a CSV point file are not sorted by id and
+                       timestamp, they are sorted out of core */
+  int sort_memory; /**< memory in MB used to sort unsorted points */
+  int parse_threads; /**< threads parsing a memory mapped CSV point file,
+                          0 for the maximum number of OpenMP threads. The
+                          parse runs next to the matching threads, so a
+                          small value avoids oversubscribing the cores
+                          when matching in parallel. */
   /**
    * Validate the GPS configuration for file existence, parameter validation
    * @return true if validate success, otherwise false returned
@@ -54,9 +70,9 @@ struct GPSConfig {
   /**
    * Find the GPS format.
    *
-   * @return 0 for GDAL trajectory file, 1 for CSV trajectory file
-   * and 2 for CSV point file, otherwise -1 is returned for unknown
-   * format.
+   * @return 0 for GDAL trajectory file, 1 for CSV trajectory file,
+   * 2 for CSV point file and 3 for binary trajectory file (.fmmt),
+   * otherwise -1 is returned for unknown format.
    */
   int get_gps_format() const;
 
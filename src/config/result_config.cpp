@@ -1,6 +1,7 @@
 #include "config/result_config.hpp"
 #include "util/util.hpp"
 #include "util/debug.hpp"
+#include "io/compressed_file.hpp"
 #include <set>
 
 void FMM::CONFIG::ResultConfig::print() const {
@@ -33,12 +34,17 @@ void FMM::CONFIG::ResultConfig::print() const {
     ss << "speed ";
   SPDLOG_INFO("ResultConfig");
   SPDLOG_INFO("File: {}",file);
+  SPDLOG_INFO("Format: {}",get_result_format()==1?"binary":"CSV");
   SPDLOG_INFO("Fields: {}",ss.str());
+  SPDLOG_INFO("Ordered: {}",ordered);
+  SPDLOG_INFO("Precision: {}",output_config.precision);
 };
 
 std::string FMM::CONFIG::ResultConfig::to_string() const{
   std::ostringstream oss;
   oss << "Result file : " << file << "\n";
+  oss << "Result format : "
+      << (get_result_format()==1 ? "binary" : "CSV") << "\n";
   oss << "Output fields: ";
   if (output_config.write_opath)
     oss << "opath ";
@@ -66,6 +72,9 @@ std::string FMM::CONFIG::ResultConfig::to_string() const{
     oss << "duration ";
   if (output_config.write_speed)
     oss << "speed ";
+  oss << "\n";
+  oss << "Ordered: " << (ordered ? "true" : "false") << "\n";
+  oss << "Precision: " << output_config.precision << "\n";
   return oss.str();
 };
 
@@ -73,6 +82,9 @@ FMM::CONFIG::ResultConfig FMM::CONFIG::ResultConfig::load_from_xml(
   const boost::property_tree::ptree &xml_data) {
   ResultConfig config;
   config.file = xml_data.get<std::string>("config.output.file");
+  config.ordered = !(!xml_data.get_child_optional("config.output.ordered"));
+  config.output_config.precision =
+    xml_data.get("config.output.precision", 0);
   if (xml_data.get_child_optional("config.output.fields")) {
     // Fields specified
     // close the default output fields (cpath,mgeom are true by default)
@@ -140,6 +152,8 @@ FMM::CONFIG::ResultConfig FMM::CONFIG::ResultConfig::load_from_arg(
   const cxxopts::ParseResult &arg_data) {
   FMM::CONFIG::ResultConfig config;
   config.file = arg_data["output"].as<std::string>();
+  config.ordered = arg_data.count("ordered") > 0;
+  config.output_config.precision = arg_data["output_precision"].as<int>();
   if (arg_data.count("output_fields") > 0) {
     config.output_config.write_cpath = false;
     config.output_config.write_mgeom = false;
@@ -215,14 +229,54 @@ std::set<std::string> FMM::CONFIG::ResultConfig::string2set(
   return result;
 };
 
+int FMM::CONFIG::ResultConfig::get_result_format() const {
+  // Binary result file needs seeking, the standard output is CSV
+  if (is_standard_output()) return 0;
+  std::string fn_extension = file.substr(file.find_last_of(".") + 1);
+  if (fn_extension == "fmmr") {
+    return 1;
+  }
+  return 0;
+};
+
+bool FMM::CONFIG::ResultConfig::is_standard_output() const {
+  return IO::is_standard_stream(file);
+};
+
+bool FMM::CONFIG::ResultConfig::is_standard_output(int argc, char **argv) {
+  if (argc == 2) {
+    std::string configfile(argv[1]);
+    if (!UTIL::check_file_extension(configfile,"xml,XML")) return false;
+    boost::property_tree::ptree tree;
+    boost::property_tree::read_xml(configfile, tree);
+    return IO::is_standard_stream(tree.get("config.output.file", ""));
+  }
+  for (int i = 1; i < argc; ++i) {
+    std::string arg(argv[i]);
+    if ((arg == "-o" || arg == "--output") && i + 1 < argc &&
+        IO::is_standard_stream(argv[i + 1])) {
+      return true;
+    }
+    if (arg == "-o-" || arg == "--output=-") return true;
+  }
+  return false;
+};
+
 bool FMM::CONFIG::ResultConfig::validate() const {
-  if (UTIL::file_exists(file))
-  {
-    SPDLOG_WARN("Overwrite existing result file {}",file);
-  };
-  std::string output_folder = UTIL::get_file_directory(file);
-  if (!UTIL::folder_exist(output_folder)) {
-    SPDLOG_CRITICAL("Output folder {} not exists",output_folder);
+  if (!is_standard_output()) {
+    if (UTIL::file_exists(file))
+    {
+      SPDLOG_WARN("Overwrite existing result file {}",file);
+    };
+    std::string output_folder = UTIL::get_file_directory(file);
+    if (!UTIL::folder_exist(output_folder)) {
+      SPDLOG_CRITICAL("Output folder {} not exists",output_folder);
+      return false;
+    }
+  }
+  if (output_config.precision < 0) {
+    SPDLOG_CRITICAL("Output precision {} should not be negative",
+                    output_config.precision);
     return false;
   }
   return true;
@@ -233,12 +287,23 @@ void FMM::CONFIG::ResultConfig::register_arg(cxxopts::Options &options){
     ("o,output","Output file name",
     cxxopts::value<std::string>()->default_value(""))
     ("output_fields","Output fields",
-    cxxopts::value<std::string>()->default_value(""));
+    cxxopts::value<std::string>()->default_value(""))
+    ("ordered","Write results in the order of the input")
+    ("output_precision","Significant digits of floating point values",
+    cxxopts::value<int>()->default_value("0"));
 };
 
 void FMM::CONFIG::ResultConfig::register_help(std::ostringstream &oss){
-  oss<<"--output (required) <string>: Output file name\n";
+  oss<<"--output (required) <string>: Output file name,\n";
+  oss<<"  binary result file if it ends with .fmmr,\n";
+  oss<<"  compressed with gzip if it ends with .gz,\n";
+  oss<<"  - to write CSV results to the standard output\n";
   oss<<"--output_fields (optional) <string>: Output fields\n";
   oss<<"  opath,cpath,tpath,mgeom,pgeom,\n";
   oss<<"  offset,error,spdist,tp,ep,length,duration,speed,all\n";
+  oss<<"--ordered (optional): write results in the order of the input\n";
+  oss<<"--output_precision (optional) <int>: significant digits of\n";
+  oss<<"  floating point values (0), 0 for 12 digits for geometries and\n";
+  oss<<"  the values after them and 6 for the others, 17 for the\n";
+  oss<<"  shortest exact values\n";
 };
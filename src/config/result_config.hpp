@@ -51,19 +51,36 @@ struct OutputConfig {
                                   two points) will be exported */
   bool write_speed = false; /**< if true, speed (sp_dist/duration)
                                   will be exported */
+  int precision = 0; /**< significant digits of the floating point values,
+                          0 for 12 digits for the geometries and the
+                          values after them and 6 digits for the others,
+                          17 or more for the shortest digits that read
+                          back to the same value */
 };
 
 /**
  * Result Configuration class, defining output file and output fields
  */
 struct ResultConfig {
-  std::string file; /**< Output file to write the result */
+  std::string file; /**< Output file to write the result, - for the
+                         standard output */
   OutputConfig output_config; /**< Output fields to export */
+  bool ordered = false; /**< if true, the results are written in the order
+                             of the input trajectories */
   /**
    * Check the validation of the configuration
    * @return true if valid otherwise false
    */
   bool validate() const;
+  /**
+   * Get the format of the result file from its extension
+   * @return 1 for binary result file (.fmmr), 0 for CSV file otherwise
+   */
+  int get_result_format() const;
+  /**
+   * Check if the result is written to the standard output
+   */
+  bool is_standard_output() const;
   /**
    * Print the configuration information
    */
@@ -78,6 +95,16 @@ struct ResultConfig {
    * @return a set of strings
    */
   static std::set<std::string> string2set(const std::string &s);
+  /**
+   * Check if the result is written to the standard output from the
+   * arguments of a program, either -o/--output - or an xml configuration
+   * file with the output file -. It is called before the configuration is
+   * loaded so that the log can be kept out of the standard output.
+   * @param argc number of arguments
+   * @param argv raw argument data
+   * @return true if the output file is -
+   */
+  static bool is_standard_output(int argc, char **argv);
   /**
    * Load result configuration data from xml file
    * @param xml_data xml data parsed by reading an xml file
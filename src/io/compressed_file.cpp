@@ -0,0 +1,429 @@
+/**
+ * Fast map matching.
+ *
+ * Implementation of the gzip file streams
+ */
+
+#include "io/compressed_file.hpp"
+#include "util/debug.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <errno.h>
+#include <unistd.h>
+
+#include <boost/format.hpp>
+
+namespace FMM {
+namespace IO {
+
+namespace {
+
+const std::string GZIP_EXTENSION = ".gz";
+const std::string STANDARD_STREAM = "-";
+// Blocks written to the standard output are kept small so that the
+// results are passed down a pipe soon after they are matched.
+const std::size_t STANDARD_OUTPUT_BLOCK_SIZE = 1 << 16;
+
+} // namespace
+
+bool is_gzip_file(const std::string &filename) {
+  return filename.size() > GZIP_EXTENSION.size() &&
+    filename.compare(filename.size() - GZIP_EXTENSION.size(),
+                     GZIP_EXTENSION.size(), GZIP_EXTENSION) == 0;
+}
+
+bool is_standard_stream(const std::string &filename) {
+  return filename == STANDARD_STREAM;
+}
+
+std::string strip_gzip_extension(const std::string &filename) {
+  if (!is_gzip_file(filename)) return filename;
+  return filename.substr(0, filename.size() - GZIP_EXTENSION.size());
+}
+
+GzipOutputBuffer::GzipOutputBuffer(const std::string &filename, int level,
+                                   std::size_t block_size) :
+  filename_(filename), block_size_(block_size > 0 ? block_size : 1) {
+  std::string mode = "wb" + std::to_string(level);
+  file_ = gzopen(filename.c_str(), mode.c_str());
+  if (file_ == nullptr) {
+    SPDLOG_CRITICAL("Create gzip file {} fail", filename);
+    return;
+  }
+  start();
+}
+
+GzipOutputBuffer::GzipOutputBuffer(int fd, std::size_t block_size) :
+  filename_("/dev/fd/" + std::to_string(fd)), block_size_(block_size > 0 ? block_size : 1),
+  flush_blocks_(true) {
+  int dup_fd = dup(fd);
+  // Transparent mode, the data is written without gzip header
+  file_ = dup_fd < 0 ? nullptr : gzdopen(dup_fd, "wT");
+  if (file_ == nullptr) {
+    if (dup_fd >= 0) ::close(dup_fd);
+    SPDLOG_CRITICAL("Open file descriptor {} fail", fd);
+    return;
+  }
+  start();
+}
+
+void GzipOutputBuffer::start() {
+  gzbuffer(file_, 1 << 17);
+  block_.resize(block_size_);
+  setp(block_.data(), block_.data() + block_.size());
+  thread_ = std::thread(&GzipOutputBuffer::compress_blocks, this);
+}
+
+GzipOutputBuffer::~GzipOutputBuffer() {
+  try {
+    close();
+  } catch (const std::exception &e) {
+    SPDLOG_CRITICAL("Close gzip file fail: {}", e.what());
+  }
+}
+
+bool GzipOutputBuffer::is_open() const {
+  return file_ != nullptr;
+}
+
+void GzipOutputBuffer::close() {
+  if (file_ == nullptr) return;
+  // The thread is stopped and the file closed before an error is thrown,
+  // so that a failed write never leaves the thread running.
+  pass_block();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closing_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+  int status = gzclose(file_);
+  file_ = nullptr;
+  setp(nullptr, nullptr);
+  if (failed_ || status != Z_OK) {
+    std::string message = (boost::format("Write gzip file %1% fail") % filename_).str();
+    SPDLOG_CRITICAL(message);
+    throw std::runtime_error(message);
+  }
+}
+
+GzipOutputBuffer::int_type GzipOutputBuffer::overflow(int_type ch) {
+  if (file_ == nullptr) return traits_type::eof();
+  submit_block();
+  if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(ch);
+    pbump(1);
+  }
+  return traits_type::not_eof(ch);
+}
+
+int GzipOutputBuffer::sync() {
+  if (file_ == nullptr) return -1;
+  submit_block();
+  return 0;
+}
+
+void GzipOutputBuffer::submit_block() {
+  pass_block();
+  check_error();
+}
+
+void GzipOutputBuffer::pass_block() {
+  std::size_t size = pptr() - pbase();
+  if (size > 0) {
+    block_.resize(size);
+    std::unique_lock<std::mutex> lock(mutex_);
+    // Wait for the background thread if it falls behind
+    cv_.wait(lock, [this] {
+      return pending_blocks_.size() < MAX_PENDING_BLOCKS || failed_;
+    });
+    pending_blocks_.push_back(std::move(block_));
+    lock.unlock();
+    cv_.notify_all();
+    block_ = std::vector<char>(block_size_);
+    setp(block_.data(), block_.data() + block_.size());
+  }
+}
+
+void GzipOutputBuffer::check_error() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (failed_) {
+    std::string message = (boost::format("Write gzip file %1% fail") % filename_).str();
+    SPDLOG_CRITICAL(message);
+    throw std::runtime_error(message);
+  }
+}
+
+void GzipOutputBuffer::compress_blocks() {
+  while (true) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] {
+      return !pending_blocks_.empty() || closing_;
+    });
+    if (pending_blocks_.empty()) break;
+    std::vector<char> block = std::move(pending_blocks_.front());
+    pending_blocks_.pop_front();
+    bool failed = failed_;
+    lock.unlock();
+    cv_.notify_all();
+    if (!failed && (gzwrite(file_, block.data(), block.size()) !=
+        static_cast<int>(block.size()) ||
+        (flush_blocks_ && gzflush(file_, Z_SYNC_FLUSH) != Z_OK))) {
+      lock.lock();
+      failed_ = true;
+      lock.unlock();
+      cv_.notify_all();
+    }
+  }
+}
+
+GzipInputBuffer::GzipInputBuffer(const std::string &filename,
+                                 std::size_t block_size) :
+  filename_(filename), block_size_(block_size > 0 ? block_size : 1) {
+  file_ = gzopen(filename.c_str(), "rb");
+  if (file_ == nullptr) {
+    SPDLOG_CRITICAL("Open gzip file {} fail", filename);
+    return;
+  }
+  start();
+}
+
+GzipInputBuffer::GzipInputBuffer(int fd, std::size_t block_size) :
+  filename_("/dev/fd/" + std::to_string(fd)), block_size_(block_size > 0 ? block_size : 1) {
+  fd_ = dup(fd);
+  if (fd_ < 0) {
+    SPDLOG_CRITICAL("Open file descriptor {} fail", fd);
+    return;
+  }
+  start();
+}
+
+void GzipInputBuffer::start() {
+  if (file_ != nullptr) gzbuffer(file_, 1 << 17);
+  setg(nullptr, nullptr, nullptr);
+  thread_ = std::thread(&GzipInputBuffer::decompress_blocks, this);
+}
+
+GzipInputBuffer::~GzipInputBuffer() {
+  if (!is_open()) return;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+  if (file_ != nullptr) {
+    gzclose(file_);
+  } else {
+    ::close(fd_);
+  }
+}
+
+bool GzipInputBuffer::is_open() const {
+  return file_ != nullptr || fd_ >= 0;
+}
+
+GzipInputBuffer::int_type GzipInputBuffer::underflow() {
+  if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+  if (!is_open()) return traits_type::eof();
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this] {
+    return !ready_blocks_.empty() || finished_;
+  });
+  if (ready_blocks_.empty()) {
+    if (failed_) {
+      std::string message = (boost::format("Read gzip file %1% fail") % filename_).str();
+      SPDLOG_CRITICAL(message);
+      throw std::runtime_error(message);
+    }
+    return traits_type::eof();
+  }
+  block_ = std::move(ready_blocks_.front());
+  ready_blocks_.pop_front();
+  lock.unlock();
+  cv_.notify_all();
+  setg(block_.data(), block_.data(), block_.data() + block_.size());
+  return traits_type::to_int_type(*gptr());
+}
+
+bool GzipInputBuffer::push_block(std::vector<char> block) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this] {
+    return ready_blocks_.size() < MAX_READY_BLOCKS || stopping_;
+  });
+  if (stopping_) return false;
+  ready_blocks_.push_back(std::move(block));
+  lock.unlock();
+  cv_.notify_all();
+  return true;
+}
+
+void GzipInputBuffer::finish(bool failed) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    failed_ = failed;
+    finished_ = true;
+  }
+  cv_.notify_all();
+}
+
+void GzipInputBuffer::decompress_blocks() {
+  if (file_ == nullptr) {
+    inflate_blocks();
+    return;
+  }
+  while (true) {
+    std::vector<char> block(block_size_);
+    int size = gzread(file_, block.data(), block.size());
+    if (size <= 0) {
+      finish(size < 0);
+      break;
+    }
+    block.resize(size);
+    if (!push_block(std::move(block))) break;
+  }
+}
+
+void GzipInputBuffer::inflate_blocks() {
+  // gzread waits until a whole block is read, which holds back a slow
+  // stream, so the data is read and inflated as it arrives.
+  std::vector<char> input(std::min<std::size_t>(block_size_, 1 << 16));
+  // Read the first two bytes to detect the gzip header
+  std::size_t size = 0;
+  while (size < 2) {
+    ssize_t count = ::read(fd_, input.data() + size, input.size() - size);
+    if (count < 0 && errno == EINTR) continue;
+    if (count < 0) {
+      finish(true);
+      return;
+    }
+    if (count == 0) break;
+    size += count;
+  }
+  bool compressed = size >= 2 &&
+    static_cast<unsigned char>(input[0]) == 0x1f &&
+    static_cast<unsigned char>(input[1]) == 0x8b;
+  z_stream stream = z_stream();
+  // 16 + MAX_WBITS decodes a gzip stream
+  if (compressed && inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK) {
+    finish(true);
+    return;
+  }
+  bool failed = false;
+  bool stream_end = !compressed;
+  bool stopping = false;
+  while (size > 0 && !failed && !stopping) {
+    if (!compressed) {
+      stopping = !push_block(
+        std::vector<char>(input.begin(), input.begin() + size));
+    } else {
+      stream.next_in = reinterpret_cast<Bytef *>(input.data());
+      stream.avail_in = size;
+      // A full block may leave output in the stream without more input
+      bool full = true;
+      while ((stream.avail_in > 0 || full) && !failed && !stopping) {
+        if (stream_end) {
+          if (stream.avail_in == 0) break;
+          // Another gzip member concatenated to the file
+          inflateReset(&stream);
+          stream_end = false;
+        }
+        std::vector<char> block(block_size_);
+        stream.next_out = reinterpret_cast<Bytef *>(block.data());
+        stream.avail_out = block.size();
+        int status = inflate(&stream, Z_NO_FLUSH);
+        if (status == Z_STREAM_END) {
+          stream_end = true;
+        } else if (status != Z_OK && status != Z_BUF_ERROR) {
+          failed = true;
+        }
+        full = stream.avail_out == 0;
+        block.resize(block.size() - stream.avail_out);
+        if (!block.empty()) stopping = !push_block(std::move(block));
+      }
+    }
+    size = 0;
+    while (!failed && !stopping) {
+      ssize_t count = ::read(fd_, input.data(), input.size());
+      if (count < 0 && errno == EINTR) continue;
+      failed = count < 0;
+      if (count > 0) size = count;
+      break;
+    }
+  }
+  if (compressed) inflateEnd(&stream);
+  if (!stopping) finish(failed || !stream_end);
+}
+
+OutputFileStream::OutputFileStream(const std::string &filename) :
+  std::ostream(nullptr) {
+  if (is_standard_stream(filename)) {
+    gzip_buf_.reset(
+      new GzipOutputBuffer(STDOUT_FILENO, STANDARD_OUTPUT_BLOCK_SIZE));
+    rdbuf(gzip_buf_.get());
+    if (!gzip_buf_->is_open()) setstate(std::ios::failbit);
+    exceptions(std::ios::badbit);
+  } else if (is_gzip_file(filename)) {
+    gzip_buf_.reset(new GzipOutputBuffer(filename));
+    rdbuf(gzip_buf_.get());
+    if (!gzip_buf_->is_open()) setstate(std::ios::failbit);
+    // Errors of the background thread are thrown from the buffer
+    exceptions(std::ios::badbit);
+  } else {
+    rdbuf(&file_buf_);
+    if (!file_buf_.open(filename, std::ios::out)) {
+      setstate(std::ios::failbit);
+    }
+  }
+}
+
+bool OutputFileStream::is_open() const {
+  return gzip_buf_ ? gzip_buf_->is_open() : file_buf_.is_open();
+}
+
+void OutputFileStream::close() {
+  if (gzip_buf_) {
+    gzip_buf_->close();
+  } else if (!file_buf_.close()) {
+    setstate(std::ios::failbit);
+  }
+}
+
+InputFileStream::InputFileStream(const std::string &filename) :
+  std::istream(nullptr) {
+  if (is_standard_stream(filename)) {
+    gzip_buf_.reset(new GzipInputBuffer(STDIN_FILENO, 1 << 22));
+    rdbuf(gzip_buf_.get());
+    if (!gzip_buf_->is_open()) setstate(std::ios::failbit);
+    exceptions(std::ios::badbit);
+  } else if (is_gzip_file(filename)) {
+    gzip_buf_.reset(new GzipInputBuffer(filename));
+    rdbuf(gzip_buf_.get());
+    if (!gzip_buf_->is_open()) setstate(std::ios::failbit);
+    exceptions(std::ios::badbit);
+  } else {
+    rdbuf(&file_buf_);
+    if (!file_buf_.open(filename, std::ios::in)) {
+      setstate(std::ios::failbit);
+    }
+  }
+}
+
+bool InputFileStream::is_open() const {
+  return gzip_buf_ ? gzip_buf_->is_open() : file_buf_.is_open();
+}
+
+void InputFileStream::close() {
+  if (gzip_buf_) {
+    exceptions(std::ios::goodbit);
+    rdbuf(nullptr);
+    gzip_buf_.reset();
+  } else {
+    file_buf_.close();
+  }
+}
+
+} // IO
+} // FMM
@@ -0,0 +1,230 @@
+/**
+ * Fast map matching.
+ *
+ * File streams that compress or decompress gzip files on a background
+ * thread, selected by the .gz extension of the file name. The file name -
+ * stands for the standard input or output.
+ */
+
+#ifndef FMM_COMPRESSED_FILE_HPP
+#define FMM_COMPRESSED_FILE_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <zlib.h>
+
+namespace FMM {
+namespace IO {
+
+/**
+ * Check if a file is gzip compressed from its extension
+ * @param  filename file name
+ * @return true if the file name ends with .gz
+ */
+bool is_gzip_file(const std::string &filename);
+
+/**
+ * Check if a file name stands for the standard input or output
+ * @param  filename file name
+ * @return true if the file name is -
+ */
+bool is_standard_stream(const std::string &filename);
+
+/**
+ * Remove the .gz extension of a file name, which is used to find the
+ * format of the file compressed.
+ * @param  filename file name
+ * @return file name without .gz, unchanged if it is not a gzip file
+ */
+std::string strip_gzip_extension(const std::string &filename);
+
+/**
+ * Stream buffer writing a gzip file. The data is collected into large
+ * blocks, which are compressed and written by a background thread so that
+ * the thread writing the data is not blocked by the compression.
+ */
+class GzipOutputBuffer : public std::streambuf {
+ public:
+  /**
+   * Constructor
+   * @param filename   file name
+   * @param level      compression level from 1 to 9
+   * @param block_size number of bytes passed to the background thread at
+   * a time
+   */
+  explicit GzipOutputBuffer(const std::string &filename, int level = 6,
+                            std::size_t block_size = 1 << 22);
+  /**
+   * Constructor writing the data without compression to a file
+   * descriptor, such as a pipe. Each block is flushed to the descriptor
+   * once written, so that the reader receives the data block by block.
+   * @param fd         file descriptor, which is duplicated
+   * @param block_size number of bytes passed to the background thread at
+   * a time
+   */
+  explicit GzipOutputBuffer(int fd, std::size_t block_size);
+  /**
+   * Destructor, the file is closed if it is not closed yet.
+   */
+  ~GzipOutputBuffer();
+  /**
+   * Check if the file is opened
+   */
+  bool is_open() const;
+  /**
+   * Compress the data left and close the file, std::runtime_error is
+   * thrown if the data cannot be written.
+   */
+  void close();
+ protected:
+  int_type overflow(int_type ch) override;
+  int sync() override;
+ private:
+  void start();
+  // Pass the current block to the background thread and throw the
+  // error of a previous block
+  void submit_block();
+  // Pass the current block to the background thread
+  void pass_block();
+  void compress_blocks();
+  void check_error();
+  // Number of blocks waiting for compression at most
+  static const std::size_t MAX_PENDING_BLOCKS = 4;
+  gzFile file_ = nullptr;
+  std::string filename_;
+  std::size_t block_size_;
+  std::vector<char> block_;
+  std::deque<std::vector<char>> pending_blocks_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool flush_blocks_ = false;
+  bool closing_ = false;
+  bool failed_ = false;
+  std::thread thread_;
+};
+
+/**
+ * Stream buffer reading a gzip file. The blocks of the file are
+ * decompressed ahead by a background thread. A file not compressed is
+ * read as it is.
+ */
+class GzipInputBuffer : public std::streambuf {
+ public:
+  /**
+   * Constructor
+   * @param filename   file name
+   * @param block_size number of bytes decompressed at a time
+   */
+  explicit GzipInputBuffer(const std::string &filename,
+                           std::size_t block_size = 1 << 22);
+  /**
+   * Constructor reading from a file descriptor, such as a pipe. The data
+   * is decompressed if it is gzip compressed. The data received is passed
+   * on as soon as it is read, without waiting for a whole block.
+   * @param fd         file descriptor, which is duplicated
+   * @param block_size number of bytes decompressed at a time at most
+   */
+  GzipInputBuffer(int fd, std::size_t block_size);
+  /**
+   * Destructor, the background thread is stopped and the file is closed.
+   */
+  ~GzipInputBuffer();
+  /**
+   * Check if the file is opened
+   */
+  bool is_open() const;
+ protected:
+  int_type underflow() override;
+ private:
+  void start();
+  void decompress_blocks();
+  // Read the file descriptor and inflate the data incrementally
+  void inflate_blocks();
+  // Queue a block for the reading thread, return false if stopping
+  bool push_block(std::vector<char> block);
+  // Mark the end of the data
+  void finish(bool failed);
+  // Number of blocks decompressed ahead at most
+  static const std::size_t MAX_READY_BLOCKS = 2;
+  gzFile file_ = nullptr;
+  int fd_ = -1;
+  std::string filename_;
+  std::size_t block_size_;
+  std::vector<char> block_;
+  std::deque<std::vector<char>> ready_blocks_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stopping_ = false;
+  bool finished_ = false;
+  bool failed_ = false;
+  std::thread thread_;
+};
+
+/**
+ * Output file stream, the file is compressed with gzip if its name ends
+ * with .gz. Errors of compression are thrown as std::runtime_error.
+ *
+ * With the file name -, the data is written to the standard output and
+ * flushed at every flush of the stream.
+ */
+class OutputFileStream : public std::ostream {
+ public:
+  /**
+   * Open a file for writing, the failbit is set if it cannot be created.
+   * @param filename file name
+   */
+  explicit OutputFileStream(const std::string &filename);
+  /**
+   * Check if the file is opened
+   */
+  bool is_open() const;
+  /**
+   * Flush the data and close the file
+   */
+  void close();
+ private:
+  std::filebuf file_buf_;
+  std::unique_ptr<GzipOutputBuffer> gzip_buf_;
+};
+
+/**
+ * Input file stream, the file is decompressed if its name ends with .gz.
+ * Errors of decompression are thrown as std::runtime_error.
+ *
+ * With the file name -, the data is read from the standard input, which
+ * is decompressed if it is gzip compressed. It cannot be rewound.
+ */
+class InputFileStream : public std::istream {
+ public:
+  /**
+   * Open a file for reading, the failbit is set if it cannot be opened.
+   * @param filename file name
+   */
+  explicit InputFileStream(const std::string &filename);
+  /**
+   * Check if the file is opened
+   */
+  bool is_open() const;
+  /**
+   * Close the file
+   */
+  void close();
+ private:
+  std::filebuf file_buf_;
+  std::unique_ptr<GzipInputBuffer> gzip_buf_;
+};
+
+} // IO
+} // FMM
+
+#endif //FMM_COMPRESSED_FILE_HPP
@@ -8,9 +8,17 @@
 #include "util/debug.hpp"
 #include "util/util.hpp"
 #include "config/gps_config.hpp"
+#include "io/text_parser.hpp"
+#include "io/trajectory_file.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
 #include <iostream>
 #include <stdexcept>
 #include <string>
+#include <omp.h>
+#include <unistd.h>
 
 #include <boost/format.hpp>
 
@@ -87,7 +95,9 @@ bool GDALTrajectoryReader::has_next_trajectory() {
 }
 
 bool GDALTrajectoryReader::has_timestamp() {
-  return timestamp_idx > 0;
+  // A feature holds a single value in the timestamp field, which is not
+  // read into the timestamps of the points
+  return false;
 }
 
 Trajectory GDALTrajectoryReader::read_next_trajectory() {
@@ -202,6 +212,446 @@ void CSVTrajectoryReader::close() {
   ifs.close();
 }
 
+namespace {
+
+// Split the header line of a mapped CSV file into column names and
+// return the start of the first row.
+const char *read_header(const char *begin, const char *end, char delim,
+                        std::vector<std::string> *names) {
+  const char *line_end;
+  const char *body = next_line(begin, end, &line_end);
+  std::stringstream check1(std::string(begin, line_end));
+  std::string intermediate;
+  while (safe_get_line(check1, intermediate, delim)) {
+    names->push_back(intermediate);
+  }
+  return body;
+}
+
+int find_column(const std::vector<std::string> &names,
+                const std::string &name) {
+  for (int i = 0; i < names.size(); ++i) {
+    if (names[i] == name) return i;
+  }
+  return -1;
+}
+
+[[noreturn]] void throw_invalid_value(const char *first, const char *last) {
+  std::string message = (boost::format("Invalid value %1% in GPS file") %
+    std::string(first, last)).str();
+  SPDLOG_CRITICAL(message);
+  throw std::runtime_error(message);
+}
+
+} // namespace
+
+MmapCSVTrajectoryReader::MmapCSVTrajectoryReader(
+  const std::string &e_filename, const std::string &id_name,
+  const std::string &geom_name, const std::string &timestamp_name) :
+  file_(e_filename) {
+  std::vector<std::string> names;
+  body_ = read_header(file_.begin(), file_.end(), delim, &names);
+  id_idx = find_column(names, id_name);
+  geom_idx = find_column(names, geom_name);
+  timestamp_idx = find_column(names, timestamp_name);
+  if (id_idx < 0 || geom_idx < 0) {
+    std::string message = (boost::format("Id %1% or Geometry column %2% not found") % id_name % geom_name).str();
+    SPDLOG_CRITICAL(message);
+    throw std::runtime_error(message);
+  }
+  if (timestamp_idx < 0) {
+    SPDLOG_WARN("Timestamp column {} not found", timestamp_name);
+  }
+  SPDLOG_INFO("Id index {} Geometry index {} Timstamp index {}",
+              id_idx, geom_idx, timestamp_idx);
+  cursor_ = body_;
+}
+
+Trajectory MmapCSVTrajectoryReader::read_next_trajectory() {
+  const char *line_end;
+  const char *field = cursor_;
+  cursor_ = next_line(cursor_, file_.end(), &line_end);
+  int trid = 0;
+  FMM::CORE::LineString geom;
+  std::vector<double> timestamps;
+  int index = 0;
+  while (field != line_end) {
+    const char *field_end = static_cast<const char *>(
+      std::memchr(field, delim, line_end - field));
+    if (field_end == nullptr) field_end = line_end;
+    if (index == id_idx) {
+      if (parse_int(field, field_end, &trid) == nullptr) {
+        throw_invalid_value(field, field_end);
+      }
+    }
+    if (index == geom_idx) {
+      parse_linestring(field, field_end, &geom);
+    }
+    if (index == timestamp_idx) {
+      parse_timestamps(field, field_end, &timestamps);
+    }
+    if (field_end == line_end) break;
+    field = field_end + 1;
+    ++index;
+  }
+  return Trajectory{trid, geom, timestamps};
+}
+
+bool MmapCSVTrajectoryReader::has_next_trajectory() {
+  return cursor_ != file_.end();
+}
+
+bool MmapCSVTrajectoryReader::has_timestamp() {
+  return timestamp_idx > 0;
+}
+
+void MmapCSVTrajectoryReader::reset_cursor() {
+  cursor_ = body_;
+}
+
+void MmapCSVTrajectoryReader::close() {
+  file_.close();
+  cursor_ = body_ = file_.end();
+}
+
+MmapCSVPointReader::MmapCSVPointReader(
+  const std::string &e_filename, const std::string &id_name,
+  const std::string &x_name, const std::string &y_name,
+  const std::string &time_name, std::size_t chunk_size, int num_threads) :
+  file_(e_filename), chunk_size_(chunk_size > 0 ? chunk_size : 1),
+  num_threads_(num_threads > 0 ? num_threads : omp_get_max_threads()) {
+  std::vector<std::string> names;
+  body_ = read_header(file_.begin(), file_.end(), delim, &names);
+  id_idx = find_column(names, id_name);
+  x_idx = find_column(names, x_name);
+  y_idx = find_column(names, y_name);
+  timestamp_idx = find_column(names, time_name);
+  if (id_idx < 0 || x_idx < 0 || y_idx < 0) {
+    std::string message = (boost::format("Id %1%, X %2% or Y %3% column not found") % id_name % x_name % y_name).str();
+    SPDLOG_CRITICAL(message);
+    throw std::runtime_error(message);
+  }
+  if (timestamp_idx < 0) {
+    SPDLOG_WARN("Time stamp {} not found, will be estimated ", time_name);
+  }
+  SPDLOG_INFO("Id index {} x index {} y index {} time index {}",
+              id_idx, x_idx, y_idx, timestamp_idx);
+  cursor_ = body_;
+}
+
+bool MmapCSVPointReader::read_row(const char *line, const char *line_end,
+                                  int *id, double *x, double *y,
+                                  double *timestamp) const {
+  return parse_point_row(line, line_end, delim, id_idx, x_idx, y_idx,
+                         timestamp_idx, id, x, y, timestamp);
+}
+
+const char *MmapCSVPointReader::align_chunk(const char *pos) const {
+  const char *end = file_.end();
+  if (pos >= end) return end;
+  const char *line_end;
+  if (pos[-1] != '\n') {
+    pos = next_line(pos, end, &line_end);
+  }
+  // Skip the rows of the trajectory the first row belongs to
+  int first_id = 0;
+  bool found = false;
+  while (pos != end) {
+    const char *next = next_line(pos, end, &line_end);
+    int id = 0;
+    double x, y, timestamp;
+    if (read_row(pos, line_end, &id, &x, &y, &timestamp)) {
+      if (found && id != first_id) break;
+      first_id = id;
+      found = true;
+    }
+    pos = next;
+  }
+  return pos;
+}
+
+void MmapCSVPointReader::parse_chunk(
+  const char *first, const char *last,
+  std::vector<Trajectory> *trajectories) const {
+  FMM::CORE::LineString geom;
+  std::vector<double> timestamps;
+  int trid = 0;
+  const char *line = first;
+  while (line != last) {
+    const char *line_end;
+    const char *next = next_line(line, last, &line_end);
+    int id = 0;
+    double x = 0, y = 0, timestamp = 0;
+    if (read_row(line, line_end, &id, &x, &y, &timestamp)) {
+      if (id != trid && geom.get_num_points() > 0) {
+        trajectories->push_back(Trajectory{trid, geom, timestamps});
+        geom.clear();
+        timestamps.clear();
+      }
+      trid = id;
+      geom.add_point(x, y);
+      if (timestamp_idx > 0)
+        timestamps.push_back(timestamp);
+    }
+    line = next;
+  }
+  if (geom.get_num_points() > 0) {
+    trajectories->push_back(Trajectory{trid, geom, timestamps});
+  }
+}
+
+void MmapCSVPointReader::read_batch() {
+  int num_chunks = num_threads_;
+  std::vector<const char *> bounds(num_chunks + 1, cursor_);
+  for (int i = 1; i <= num_chunks; ++i) {
+    std::size_t left = file_.end() - bounds[i - 1];
+    bounds[i] = align_chunk(bounds[i - 1] + std::min(chunk_size_, left));
+  }
+  std::vector<std::vector<Trajectory>> chunks(num_chunks);
+  std::vector<std::exception_ptr> errors(num_chunks);
+  #pragma omp parallel for schedule(dynamic, 1) num_threads(num_threads_)
+  for (int i = 0; i < num_chunks; ++i) {
+    try {
+      parse_chunk(bounds[i], bounds[i + 1], &chunks[i]);
+    } catch (...) {
+      errors[i] = std::current_exception();
+    }
+  }
+  for (int i = 0; i < num_chunks; ++i) {
+    if (errors[i]) std::rethrow_exception(errors[i]);
+  }
+  for (std::vector<Trajectory> &chunk : chunks) {
+    for (Trajectory &trajectory : chunk) {
+      trajectories_.push_back(std::move(trajectory));
+    }
+  }
+  cursor_ = bounds[num_chunks];
+}
+
+Trajectory MmapCSVPointReader::read_next_trajectory() {
+  if (!has_next_trajectory()) {
+    std::string message = "No trajectory left in GPS file";
+    SPDLOG_CRITICAL(message);
+    throw std::runtime_error(message);
+  }
+  Trajectory trajectory = std::move(trajectories_.front());
+  trajectories_.pop_front();
+  return trajectory;
+}
+
+bool MmapCSVPointReader::has_next_trajectory() {
+  while (trajectories_.empty() && cursor_ != file_.end()) {
+    read_batch();
+  }
+  return !trajectories_.empty();
+}
+
+bool MmapCSVPointReader::has_timestamp() {
+  return timestamp_idx > 0;
+}
+
+void MmapCSVPointReader::reset_cursor() {
+  trajectories_.clear();
+  cursor_ = body_;
+}
+
+void MmapCSVPointReader::close() {
+  file_.close();
+  trajectories_.clear();
+  cursor_ = body_ = file_.end();
+}
+
+SortedCSVPointReader::SortedCSVPointReader(
+  const std::string &e_filename, const std::string &id_name,
+  const std::string &x_name, const std::string &y_name,
+  const std::string &time_name, std::size_t memory_limit,
+  const std::string &spill_dir) : spill_dir_(spill_dir) {
+  if (spill_dir_.empty()) {
+    const char *tmpdir = std::getenv("TMPDIR");
+    spill_dir_ = tmpdir != nullptr ? tmpdir : "/tmp";
+  }
+  MappedFile file(e_filename);
+  std::vector<std::string> names;
+  const char *line = read_header(file.begin(), file.end(), ';', &names);
+  int id_idx = find_column(names, id_name);
+  int x_idx = find_column(names, x_name);
+  int y_idx = find_column(names, y_name);
+  timestamp_idx = find_column(names, time_name);
+  if (id_idx < 0 || x_idx < 0 || y_idx < 0) {
+    std::string message = (boost::format("Id %1%, X %2% or Y %3% column not found") % id_name % x_name % y_name).str();
+    SPDLOG_CRITICAL(message);
+    throw std::runtime_error(message);
+  }
+  if (timestamp_idx < 0) {
+    SPDLOG_WARN("Time stamp {} not found, will be estimated ", time_name);
+  }
+  SPDLOG_INFO("Id index {} x index {} y index {} time index {}",
+              id_idx, x_idx, y_idx, timestamp_idx);
+  std::size_t max_records =
+    std::max<std::size_t>(memory_limit / sizeof(PointRecord), 1);
+  auto begin_time = UTIL::get_current_time();
+  std::vector<PointRecord> records;
+  // Allocated once, the buffer is reused after each run is spilled
+  records.reserve(max_records);
+  long long seq = 0;
+  while (line != file.end()) {
+    const char *line_end;
+    const char *next = next_line(line, file.end(), &line_end);
+    PointRecord record{0, 0, seq, 0, 0};
+    if (parse_point_row(line, line_end, ';', id_idx, x_idx, y_idx,
+                        timestamp_idx, &record.id, &record.x, &record.y,
+                        &record.timestamp)) {
+      records.push_back(record);
+      ++seq;
+      if (records.size() >= max_records) spill(&records);
+    }
+    line = next;
+  }
+  if (num_spilled_runs_ > 0) {
+    if (!records.empty()) spill(&records);
+    std::vector<PointRecord>().swap(records);
+  } else {
+    std::sort(records.begin(), records.end());
+    Run run;
+    run.buffer = std::move(records);
+    runs_.push_back(std::move(run));
+  }
+  buffer_records_ = std::max<std::size_t>(max_records / runs_.size(), 1);
+  for (int i = 0; i < runs_.size(); ++i) {
+    PointRecord record;
+    if (next_record(&runs_[i], &record)) {
+      heap_.push_back(std::make_pair(record, i));
+    }
+  }
+  std::make_heap(heap_.begin(), heap_.end(), heap_order);
+  double duration = UTIL::get_duration(begin_time, UTIL::get_current_time());
+  SPDLOG_INFO("Read {} points in {:.3f} s, {:.0f} points/s", seq,
+              duration, duration > 0 ? seq / duration : 0);
+  SPDLOG_INFO("Spilled {} runs of {} bytes in total", num_spilled_runs_,
+              spilled_bytes_);
+}
+
+SortedCSVPointReader::~SortedCSVPointReader() {
+  close();
+}
+
+bool SortedCSVPointReader::heap_order(
+  const std::pair<PointRecord, int> &a,
+  const std::pair<PointRecord, int> &b) {
+  return b.first < a.first;
+}
+
+void SortedCSVPointReader::spill(std::vector<PointRecord> *records) {
+  std::sort(records->begin(), records->end());
+  std::string path = spill_dir_ + "/fmm_points_XXXXXX";
+  std::vector<char> name(path.begin(), path.end());
+  name.push_back('\0');
+  int fd = mkstemp(name.data());
+  FILE *file = fd < 0 ? nullptr : fdopen(fd, "w+b");
+  if (file == nullptr) {
+    if (fd >= 0) ::close(fd);
+    std::string message = (boost::format("Create run file in %1% fail") %
+      spill_dir_).str();
+    SPDLOG_CRITICAL(message);
+    throw std::runtime_error(message);
+  }
+  // The file is removed once it is closed
+  unlink(name.data());
+  Run run;
+  run.file = file;
+  runs_.push_back(std::move(run));
+  if (std::fwrite(records->data(), sizeof(PointRecord), records->size(),
+                  file) != records->size()) {
+    std::string message = (boost::format("Write run file in %1% fail") %
+      spill_dir_).str();
+    SPDLOG_CRITICAL(message);
+    throw std::runtime_error(message);
+  }
+  std::rewind(file);
+  spilled_bytes_ += records->size() * sizeof(PointRecord);
+  ++num_spilled_runs_;
+  SPDLOG_DEBUG("Spill run {} of {} points", num_spilled_runs_,
+               records->size());
+  records->clear();
+}
+
+bool SortedCSVPointReader::next_record(Run *run, PointRecord *record) {
+  if (run->pos == run->buffer.size()) {
+    if (run->file == nullptr) return false;
+    run->buffer.resize(buffer_records_);
+    run->buffer.resize(std::fread(run->buffer.data(), sizeof(PointRecord),
+                                  buffer_records_, run->file));
+    run->pos = 0;
+    if (run->buffer.empty()) return false;
+  }
+  *record = run->buffer[run->pos++];
+  return true;
+}
+
+bool SortedCSVPointReader::pop_record(PointRecord *record) {
+  if (heap_.empty()) return false;
+  std::pop_heap(heap_.begin(), heap_.end(), heap_order);
+  *record = heap_.back().first;
+  int i = heap_.back().second;
+  heap_.pop_back();
+  PointRecord next;
+  if (next_record(&runs_[i], &next)) {
+    heap_.push_back(std::make_pair(next, i));
+    std::push_heap(heap_.begin(), heap_.end(), heap_order);
+  }
+  return true;
+}
+
+Trajectory SortedCSVPointReader::read_next_trajectory() {
+  if (!has_next_trajectory()) {
+    std::string message = "No trajectory left in GPS file";
+    SPDLOG_CRITICAL(message);
+    throw std::runtime_error(message);
+  }
+  PointRecord record = pending_;
+  has_pending_ = false;
+  int trid = record.id;
+  FMM::CORE::LineString geom;
+  std::vector<double> timestamps;
+  do {
+    if (record.id != trid) {
+      pending_ = record;
+      has_pending_ = true;
+      break;
+    }
+    geom.add_point(record.x, record.y);
+    if (has_timestamp())
+      timestamps.push_back(record.timestamp);
+  } while (pop_record(&record));
+  return Trajectory{trid, geom, timestamps};
+}
+
+bool SortedCSVPointReader::has_next_trajectory() {
+  if (!has_pending_) has_pending_ = pop_record(&pending_);
+  return has_pending_;
+}
+
+bool SortedCSVPointReader::has_timestamp() {
+  return timestamp_idx > 0;
+}
+
+void SortedCSVPointReader::close() {
+  for (Run &run : runs_) {
+    if (run.file != nullptr) std::fclose(run.file);
+  }
+  runs_.clear();
+  heap_.clear();
+  has_pending_ = false;
+}
+
+int SortedCSVPointReader::get_num_runs() const {
+  return num_spilled_runs_;
+}
+
+long long SortedCSVPointReader::get_spilled_bytes() const {
+  return spilled_bytes_;
+}
+
 CSVPointReader::CSVPointReader(const std::string &e_filename,
                                const std::string &id_name,
                                const std::string &x_name,
@@ -281,13 +731,13 @@ Trajectory CSVPointReader::read_next_trajectory() {
         id = std::stoi(intermediate);
       }
       if (index == x_idx) {
-        x = std::stof(intermediate);
+        x = std::stod(intermediate);
       }
       if (index == y_idx) {
-        y = std::stof(intermediate);
+        y = std::stod(intermediate);
       }
       if (index == timestamp_idx) {
-        timestamp = std::stof(intermediate);
+        timestamp = std::stod(intermediate);
       }
       ++index;
     }
@@ -337,10 +787,27 @@ GPSReader::GPSReader(const FMM::CONFIG::GPSConfig &config) {
     SPDLOG_INFO("GPS data in trajectory shapefile format");
     reader = std::make_shared<GDALTrajectoryReader>
                (config.file, config.id,config.timestamp);
+  } else if (mode == 1 && config.mmap) {
+    SPDLOG_INFO("GPS data in trajectory CSV format, memory mapped");
+    reader = std::make_shared<MmapCSVTrajectoryReader>
+               (config.file, config.id, config.geom, config.timestamp);
   } else if (mode == 1) {
     SPDLOG_INFO("GPS data in trajectory CSV format");
     reader = std::make_shared<CSVTrajectoryReader>
                (config.file, config.id, config.geom, config.timestamp);
+  } else if (mode == 3) {
+    SPDLOG_INFO("GPS data in binary trajectory format");
+    reader = std::make_shared<BinaryTrajectoryReader>(config.file);
+  } else if (mode == 2 && config.unsorted) {
+    SPDLOG_INFO("GPS data in unsorted point CSV format");
+    reader = std::make_shared<SortedCSVPointReader>
+               (config.file, config.id, config.x, config.y, config.timestamp,
+                std::size_t(config.sort_memory) << 20);
+  } else if (mode == 2 && config.mmap) {
+    SPDLOG_INFO("GPS data in point CSV format, memory mapped");
+    reader = std::make_shared<MmapCSVPointReader>
+               (config.file, config.id, config.x, config.y, config.timestamp,
+                std::size_t(1) << 22, config.parse_threads);
   } else if (mode == 2) {
     SPDLOG_INFO("GPS data in point CSV format");
     reader = std::make_shared<CSVPointReader>
@@ -12,7 +12,11 @@
 
 #include "core/gps.hpp"
 #include "config/gps_config.hpp"
+#include "io/mapped_file.hpp"
+#include "io/compressed_file.hpp"
 
+#include <cstdio>
+#include <deque>
 #include <iostream>
 #include <fstream>
 #include <string>
@@ -81,6 +85,10 @@ public:
                        const std::string &timestamp_name);
   FMM::CORE::Trajectory read_next_trajectory() override;
   bool has_next_trajectory() override;
+  /**
+   * Check if the trajectories read contain timestamps
+   * @return false as the timestamps are not read from the file
+   */
   bool has_timestamp() override;
   void close() override;
   /**
@@ -108,6 +116,9 @@ private:
  * search of shortest path queries. If it is not specified, it would be
  * estimated from the maximum speed.
  *
+ * The file name - reads the trajectories from the standard input, in
+ * which case the cursor cannot be reset.
+ *
  * Example:
  *    id;geom;timestamp
  *    1;LineString(1 0,1 1);1,1
@@ -157,13 +168,69 @@ public:
    */
   static std::vector<double> string2time(const std::string &str);
 private:
-  std::fstream ifs;
+  InputFileStream ifs;
   int id_idx = -1;
   int geom_idx = -1;
   int timestamp_idx = -1; // Index of the id column in shapefile
   char delim = ';';
 }; // TrajectoryCSVReader
 
+/**
+ * Trajectory Reader class for CSV trajectory file, which is memory mapped
+ * and parsed in place.
+ *
+ * The format is the same as CSVTrajectoryReader. The fields of a row are
+ * tokenized without being copied, and the linestring and timestamps are
+ * decoded by the functions in text_parser.hpp instead of string streams.
+ */
+class MmapCSVTrajectoryReader : public ITrajectoryReader {
+public:
+  /**
+   * Constructor of MmapCSVTrajectoryReader
+   * @param e_filename input file name.
+   * @param id_name ID column name
+   * @param geom_name Geometry column name
+   * @param timestamp_name Timestamp column name. If the timestamp column
+   * is not found, an empty timestamp vector will be returned for
+   * every trajectory.
+   */
+  MmapCSVTrajectoryReader(const std::string &e_filename,
+                          const std::string &id_name,
+                          const std::string &geom_name,
+                          const std::string &timestamp_name = "timestamp");
+  /**
+   * Reset cursor of the reader
+   */
+  void reset_cursor();
+  /**
+   * Read the next trajectory in the file.
+   * @return A trajectory object
+   */
+  FMM::CORE::Trajectory read_next_trajectory() override;
+  /**
+   * Check if the file still contains trajectory not read
+   * @return true if there is still any trajectory not read
+   */
+  bool has_next_trajectory() override;
+  /**
+   * Check if the file contains timestamp information
+   * @return true if it contains timestamp
+   */
+  bool has_timestamp() override;
+  /**
+   * Close the reader object, the file is unmapped.
+   */
+  void close() override;
+private:
+  MappedFile file_;
+  const char *cursor_ = nullptr; // Start of the next row
+  const char *body_ = nullptr; // Start of the first row after the header
+  int id_idx = -1;
+  int geom_idx = -1;
+  int timestamp_idx = -1;
+  char delim = ';';
+}; // MmapCSVTrajectoryReader
+
 /**
  * Trajectory Reader class for CSV point file.
  *
@@ -173,6 +240,9 @@ private:
  * id;timestamp in ascending order as trajectory will be extracted by
  * comparing id and timestamp information.
  *
+ * The file name - reads the points from the standard input, in which case
+ * the cursor cannot be reset.
+ *
  * Example:
  *    id;x;y;timestamp
  *    1;1;1;1
@@ -220,7 +290,7 @@ public:
   void close() override;
 private:
   std::string prev_line = "";
-  std::fstream ifs;
+  InputFileStream ifs;
   int id_idx = -1;
   int x_idx = -1;
   int y_idx = -1;
@@ -228,6 +298,215 @@ private:
   char delim = ';';
 }; // CSVTemporalTrajectoryReader
 
+/**
+ * Trajectory Reader class for CSV point file, which is memory mapped and
+ * parsed by multiple threads.
+ *
+ * The format is the same as CSVPointReader. The file is read in batches,
+ * each batch is split into one chunk of bytes per parsing thread. The end of
+ * a chunk is moved forward to the first row whose id differs from the row
+ * before it, so that a trajectory is never split between two chunks. The
+ * chunks are parsed in parallel and the trajectories are returned in the
+ * order of the file.
+ */
+class MmapCSVPointReader : public ITrajectoryReader {
+public:
+  /**
+   * Constructor of MmapCSVPointReader
+   * @param e_filename file name
+   * @param id_name id column name
+   * @param x_name x column name
+   * @param y_name y column name
+   * @param time_name timestamp name. If the timestamp column is not found,
+   * an empty timestamp vector will be returned for every trajectory.
+   * @param chunk_size number of bytes parsed by a thread in a batch
+   * @param num_threads number of threads parsing a batch, 0 for the
+   * maximum number of OpenMP threads. When the reader feeds a matching
+   * pipeline, the parse team runs next to the matching workers.
+   */
+  MmapCSVPointReader(
+    const std::string &e_filename,
+    const std::string &id_name,
+    const std::string &x_name,
+    const std::string &y_name,
+    const std::string &time_name,
+    std::size_t chunk_size = 1 << 22,
+    int num_threads = 0);
+  /**
+   * Read the next trajectory in the file.
+   * @return A trajectory object
+   */
+  FMM::CORE::Trajectory read_next_trajectory() override;
+  /**
+   * Check if the file still contains trajectory not read
+   * @return true if there is still any trajectory not read
+   */
+  bool has_next_trajectory() override;
+  /**
+   * Reset cursor of the reader
+   */
+  void reset_cursor();
+  /**
+   * Check if the file contains timestamp information
+   * @return true if it contains timestamp
+   */
+  bool has_timestamp() override;
+  /**
+   * Close the reader object, the file is unmapped.
+   */
+  void close() override;
+private:
+  /**
+   * Parse a row, std::runtime_error is thrown if a value is invalid
+   * @return false if the row is empty
+   */
+  bool read_row(const char *line, const char *line_end, int *id,
+                double *x, double *y, double *timestamp) const;
+  /**
+   * Find the first row at or after a position whose id differs from the
+   * id of the row before it.
+   */
+  const char *align_chunk(const char *pos) const;
+  /**
+   * Parse the rows in [first,last) into trajectories
+   */
+  void parse_chunk(const char *first, const char *last,
+                   std::vector<FMM::CORE::Trajectory> *trajectories) const;
+  /**
+   * Parse the next batch of chunks in parallel
+   */
+  void read_batch();
+  MappedFile file_;
+  std::size_t chunk_size_;
+  int num_threads_; // Threads parsing a batch, one chunk each
+  const char *cursor_ = nullptr; // Start of the next batch
+  const char *body_ = nullptr; // Start of the first row after the header
+  std::deque<FMM::CORE::Trajectory> trajectories_; // Parsed, not read
+  int id_idx = -1;
+  int x_idx = -1;
+  int y_idx = -1;
+  int timestamp_idx = -1;
+  char delim = ';';
+}; // MmapCSVPointReader
+
+/**
+ * Trajectory Reader class for CSV point file whose rows are not sorted,
+ * such as points of many vehicles interleaved by time.
+ *
+ * The format is the same as CSVPointReader. The points are grouped by id
+ * and ordered by timestamp with an external merge sort. The file is read
+ * into a buffer of bounded size, which is sorted and spilled to a
+ * temporary run file whenever it is full. The runs are then merged on
+ * the fly while the trajectories are read, in ascending order of id.
+ * Points with the same id and timestamp keep the order of the file.
+ */
+class SortedCSVPointReader : public ITrajectoryReader {
+public:
+  /**
+   * Constructor of SortedCSVPointReader, the whole file is read and the
+   * sorted runs are created.
+   * @param e_filename file name
+   * @param id_name id column name
+   * @param x_name x column name
+   * @param y_name y column name
+   * @param time_name timestamp name. If the timestamp column is not found,
+   * an empty timestamp vector will be returned for every trajectory and
+   * the points of a trajectory keep the order of the file.
+   * @param memory_limit maximum number of bytes of points held in memory
+   * @param spill_dir folder of the temporary run files, TMPDIR or /tmp
+   * is used if it is empty.
+   */
+  SortedCSVPointReader(
+    const std::string &e_filename,
+    const std::string &id_name,
+    const std::string &x_name,
+    const std::string &y_name,
+    const std::string &time_name,
+    std::size_t memory_limit = std::size_t(1) << 30,
+    const std::string &spill_dir = "");
+  ~SortedCSVPointReader();
+  /**
+   * Read the next trajectory in the file.
+   * @return A trajectory object
+   */
+  FMM::CORE::Trajectory read_next_trajectory() override;
+  /**
+   * Check if the file still contains trajectory not read
+   * @return true if there is still any trajectory not read
+   */
+  bool has_next_trajectory() override;
+  /**
+   * Check if the file contains timestamp information
+   * @return true if it contains timestamp
+   */
+  bool has_timestamp() override;
+  /**
+   * Close the reader object, the run files are removed.
+   */
+  void close() override;
+  /**
+   * Get the number of runs spilled to disk, 0 if the points fit in memory
+   */
+  int get_num_runs() const;
+  /**
+   * Get the number of bytes spilled to disk
+   */
+  long long get_spilled_bytes() const;
+private:
+  /**
+   * A point with the keys it is sorted by
+   */
+  struct PointRecord {
+    int id;
+    double timestamp;
+    long long seq; /**< position of the point in the file */
+    double x;
+    double y;
+    bool operator<(const PointRecord &rhs) const {
+      if (id != rhs.id) return id < rhs.id;
+      if (timestamp != rhs.timestamp) return timestamp < rhs.timestamp;
+      return seq < rhs.seq;
+    };
+  };
+  /**
+   * A sorted run, stored in a temporary file or in memory
+   */
+  struct Run {
+    FILE *file = nullptr; /**< run file, nullptr if it is in memory */
+    std::vector<PointRecord> buffer; /**< records read from the run */
+    std::size_t pos = 0; /**< position of the next record in buffer */
+  };
+  /**
+   * Sort the records and write them to a new run file
+   */
+  void spill(std::vector<PointRecord> *records);
+  /**
+   * Get the next record of a run
+   * @return false if the run is exhausted
+   */
+  bool next_record(Run *run, PointRecord *record);
+  /**
+   * Get the next record in the merged order
+   * @return false if all the records are read
+   */
+  bool pop_record(PointRecord *record);
+  /**
+   * Order of the heap, the smallest record is at the top
+   */
+  static bool heap_order(const std::pair<PointRecord, int> &a,
+                         const std::pair<PointRecord, int> &b);
+  std::string spill_dir_;
+  std::size_t buffer_records_; // Records read from a run at a time
+  std::vector<Run> runs_;
+  // Heap of the head record of each run, the smallest first
+  std::vector<std::pair<PointRecord, int>> heap_;
+  bool has_pending_ = false; // A record is read but not returned
+  PointRecord pending_;
+  long long spilled_bytes_ = 0;
+  int num_spilled_runs_ = 0;
+  int timestamp_idx = -1;
+}; // SortedCSVPointReader
+
 /**
  * %GPSReader class, a wrapper makes it easier to read data from
  * a file by specifying GPSConfig as input.
@@ -254,6 +533,13 @@ public:
   inline bool has_next_trajectory() {
     return reader->has_next_trajectory();
   };
+  /**
+   * Check if the file contains timestamp information
+   * @return true if it contains timestamp
+   */
+  inline bool has_timestamp() {
+    return reader->has_timestamp();
+  };
   /**
    * Read next N trajectories from the file. If there are k trajectories left
    * k<N, then only k trajectories will be returned.
@@ -0,0 +1,49 @@
+#include "io/mapped_file.hpp"
+#include "util/debug.hpp"
+
+#include <stdexcept>
+
+#include <boost/format.hpp>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace FMM::IO;
+
+MappedFile::MappedFile(const std::string &filename) {
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    if (fd >= 0) ::close(fd);
+    std::string message = (boost::format("Open file %1% fail") % filename).str();
+    SPDLOG_CRITICAL(message);
+    throw std::runtime_error(message);
+  }
+  size_ = st.st_size;
+  if (size_ > 0) {
+    void *data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      ::close(fd);
+      std::string message = (boost::format("Map file %1% fail") % filename).str();
+      SPDLOG_CRITICAL(message);
+      throw std::runtime_error(message);
+    }
+    madvise(data, size_, MADV_SEQUENTIAL);
+    data_ = static_cast<const char *>(data);
+  }
+  // The mapping is kept after the file descriptor is closed
+  ::close(fd);
+}
+
+MappedFile::~MappedFile() {
+  close();
+}
+
+void MappedFile::close() {
+  if (data_ != nullptr) {
+    munmap(const_cast<char *>(data_), size_);
+  }
+  data_ = nullptr;
+  size_ = 0;
+}
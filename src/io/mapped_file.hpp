@@ -0,0 +1,53 @@
+/**
+ * Fast map matching.
+ *
+ * Read only memory mapping of a file
+ */
+
+#ifndef FMM_MAPPED_FILE_HPP
+#define FMM_MAPPED_FILE_HPP
+
+#include <string>
+
+namespace FMM {
+namespace IO {
+
+/**
+ * A file mapped into memory for reading. The mapping is released when
+ * the object is closed or destroyed.
+ */
+class MappedFile {
+ public:
+  /**
+   * Map a file, std::runtime_error is thrown if it fails.
+   * @param filename file name
+   */
+  explicit MappedFile(const std::string &filename);
+  ~MappedFile();
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  /**
+   * Get the start of the content
+   */
+  inline const char *begin() const {return data_;};
+  /**
+   * Get the end of the content
+   */
+  inline const char *end() const {return data_ + size_;};
+  /**
+   * Get the size of the file in bytes
+   */
+  inline std::size_t size() const {return size_;};
+  /**
+   * Unmap the file, the content is empty afterwards
+   */
+  void close();
+ private:
+  const char *data_ = nullptr;
+  std::size_t size_ = 0;
+};
+
+} // IO
+} // FMM
+
+#endif //FMM_MAPPED_FILE_HPP
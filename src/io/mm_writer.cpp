@@ -8,23 +8,93 @@
  */
 
 #include "io/mm_writer.hpp"
+#include "io/result_file.hpp"
 #include "util/util.hpp"
 #include "util/debug.hpp"
 #include "config/result_config.hpp"
 #include <omp.h>
 
-#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
 namespace FMM {
 
 namespace IO {
 
+namespace {
+
+// Significant digits used when the precision is not configured, which
+// were the defaults of std::ostream and of the WKT writer. The WKT writer
+// left its precision on the stream, so the values written after a
+// geometry have the precision of the geometry.
+const int DEFAULT_VALUE_PRECISION = 6;
+const int DEFAULT_GEOMETRY_PRECISION = 12;
+// From this precision, the shortest digits reading back to the same
+// value are written
+const int ROUND_TRIP_PRECISION = 17;
+
+void append_text(fmt::memory_buffer &buf, const char *text) {
+  buf.append(text, text + std::strlen(text));
+}
+
+void append_int(fmt::memory_buffer &buf, long long value) {
+  fmt::format_int digits(value);
+  buf.append(digits.data(), digits.data() + digits.size());
+}
+
+template<typename Iterator>
+void append_ints(fmt::memory_buffer &buf, Iterator first, Iterator last) {
+  for (Iterator it = first; it != last; ++it) {
+    if (it != first) buf.push_back(',');
+    append_int(buf, *it);
+  }
+}
+
+// Write a double as printf %g, which is the format of std::ostream
+void append_double(fmt::memory_buffer &buf, double value, int precision) {
+  char digits[32];
+  int n;
+  if (precision >= ROUND_TRIP_PRECISION) {
+    // 15 digits are enough for most values, 17 for all of them
+    for (int p = 15; ; ++p) {
+      n = std::snprintf(digits, sizeof(digits), "%.*g", p, value);
+      if (p >= ROUND_TRIP_PRECISION ||
+          std::strtod(digits, nullptr) == value) break;
+    }
+  } else {
+    n = std::snprintf(digits, sizeof(digits), "%.*g", precision, value);
+  }
+  buf.append(digits, digits + n);
+}
+
+// Write a linestring in WKT
+void append_linestring(fmt::memory_buffer &buf,
+                       const FMM::CORE::LineString &geom, int precision) {
+  append_text(buf, "LINESTRING(");
+  int n = geom.get_num_points();
+  for (int i = 0; i < n; ++i) {
+    if (i > 0) buf.push_back(',');
+    append_double(buf, geom.get_x(i), precision);
+    buf.push_back(' ');
+    append_double(buf, geom.get_y(i), precision);
+  }
+  buf.push_back(')');
+}
+
+} // namespace
+
 CSVMatchResultWriter::CSVMatchResultWriter(
     const std::string &result_file, const CONFIG::OutputConfig &config_arg) :
     m_fstream(result_file), config_(config_arg) {
+  buffer_.reserve(BUFFER_SIZE);
   write_header();
 }
 
+CSVMatchResultWriter::~CSVMatchResultWriter() {
+  flush();
+}
+
 void CSVMatchResultWriter::write_header() {
   std::string header = "id";
   if (config_.write_opath) header += ";opath";
@@ -46,141 +116,163 @@ void CSVMatchResultWriter::write_header() {
 void CSVMatchResultWriter::write_result(
     const FMM::CORE::Trajectory &traj,
     const FMM::MM::MatchResult &result) {
-  std::stringstream buf;
-  buf << result.id;
+  std::string text;
+  format_result(traj, result, &text);
+  // Ensure that fstream is called corrected in OpenMP
+  #pragma omp critical
+  write_text(text);
+}
+
+void CSVMatchResultWriter::write_text(const std::string &text) {
+  buffer_ += text;
+  if (buffer_.size() >= BUFFER_SIZE) {
+    flush();
+  }
+}
+
+void CSVMatchResultWriter::flush() {
+  m_fstream.write(buffer_.data(), buffer_.size());
+  m_fstream.flush();
+  buffer_.clear();
+}
+
+void CSVMatchResultWriter::format_result(
+    const FMM::CORE::Trajectory &traj,
+    const FMM::MM::MatchResult &result, std::string *text) const {
+  // The buffer is reused by the rows formatted in the same thread
+  static thread_local fmt::memory_buffer buf;
+  buf.clear();
+  int value_precision = config_.precision > 0 ?
+    config_.precision : DEFAULT_VALUE_PRECISION;
+  int geometry_precision = config_.precision > 0 ?
+    config_.precision : DEFAULT_GEOMETRY_PRECISION;
+  const FMM::MM::MatchedCandidatePath &path = result.opt_candidate_path;
+  int N = path.size();
+  append_int(buf, result.id);
   if (config_.write_opath) {
-    buf << ";" << result.opath;
+    buf.push_back(';');
+    append_ints(buf, result.opath.begin(), result.opath.end());
   }
   if (config_.write_error) {
-    buf << ";";
-    if (!result.opt_candidate_path.empty()) {
-      int N = result.opt_candidate_path.size();
-      for (int i = 0; i < N - 1; ++i) {
-        buf << result.opt_candidate_path[i].c.dist << ",";
-      }
-      buf << result.opt_candidate_path[N - 1].c.dist;
+    buf.push_back(';');
+    for (int i = 0; i < N; ++i) {
+      if (i > 0) buf.push_back(',');
+      append_double(buf, path[i].c.dist, value_precision);
     }
   }
   if (config_.write_offset) {
-    buf << ";";
-    if (!result.opt_candidate_path.empty()) {
-      int N = result.opt_candidate_path.size();
-      for (int i = 0; i < N - 1; ++i) {
-        buf << result.opt_candidate_path[i].c.offset << ",";
-      }
-      buf << result.opt_candidate_path[N - 1].c.offset;
+    buf.push_back(';');
+    for (int i = 0; i < N; ++i) {
+      if (i > 0) buf.push_back(',');
+      append_double(buf, path[i].c.offset, value_precision);
     }
   }
   if (config_.write_spdist) {
-    buf << ";";
-    if (!result.opt_candidate_path.empty()) {
-      int N = result.opt_candidate_path.size();
-      for (int i = 1; i < N; ++i) {
-        buf << result.opt_candidate_path[i].sp_dist
-            << (i==N-1?"":",");
-      }
+    buf.push_back(';');
+    for (int i = 1; i < N; ++i) {
+      if (i > 1) buf.push_back(',');
+      append_double(buf, path[i].sp_dist, value_precision);
     }
   }
   if (config_.write_pgeom) {
-    buf << ";";
-    if (!result.opt_candidate_path.empty()) {
-      int N = result.opt_candidate_path.size();
-      FMM::CORE::LineString pline;
+    buf.push_back(';');
+    if (N > 0) {
+      append_text(buf, "LINESTRING(");
       for (int i = 0; i < N; ++i) {
-        const FMM::CORE::Point &point = result.opt_candidate_path[i].c.point;
-        pline.add_point(point);
+        if (i > 0) buf.push_back(',');
+        append_double(buf, boost::geometry::get<0>(path[i].c.point),
+                      geometry_precision);
+        buf.push_back(' ');
+        append_double(buf, boost::geometry::get<1>(path[i].c.point),
+                      geometry_precision);
       }
-      buf << pline;
+      buf.push_back(')');
+      value_precision = geometry_precision;
     }
   }
   // Write fields related with cpath
   if (config_.write_cpath) {
-    buf << ";" << result.cpath;
+    buf.push_back(';');
+    append_ints(buf, result.cpath.begin(), result.cpath.end());
   }
   if (config_.write_tpath) {
-    buf << ";";
+    buf.push_back(';');
     if (!result.cpath.empty()) {
       // Iterate through consecutive indexes and write the traversed path
       int J = result.indices.size();
       for (int j = 0; j < J - 1; ++j) {
-        int a = result.indices[j];
-        int b = result.indices[j + 1];
-        for (int i = a; i < b; ++i) {
-          buf << result.cpath[i];
-          buf << ",";
-        }
-        buf << result.cpath[b];
-        if (j < J - 2) {
-          // Last element should not have a bar
-          buf << "|";
+        if (j > 0) {
+          buf.push_back('|');
         }
+        append_ints(buf, result.cpath.begin() + result.indices[j],
+                    result.cpath.begin() + result.indices[j + 1] + 1);
       }
     }
   }
   if (config_.write_mgeom) {
-    buf << ";" << result.mgeom;
+    buf.push_back(';');
+    append_linestring(buf, result.mgeom, geometry_precision);
+    value_precision = geometry_precision;
   }
   if (config_.write_ep) {
-    buf << ";";
-    if (!result.opt_candidate_path.empty()) {
-      int N = result.opt_candidate_path.size();
-      for (int i = 0; i < N - 1; ++i) {
-        buf << result.opt_candidate_path[i].ep << ",";
-      }
-      buf << result.opt_candidate_path[N - 1].ep;
+    buf.push_back(';');
+    for (int i = 0; i < N; ++i) {
+      if (i > 0) buf.push_back(',');
+      append_double(buf, path[i].ep, value_precision);
     }
   }
   if (config_.write_tp) {
-    buf << ";";
-    if (!result.opt_candidate_path.empty()) {
-      int N = result.opt_candidate_path.size();
-      for (int i = 0; i < N - 1; ++i) {
-        buf << result.opt_candidate_path[i].tp << ",";
-      }
-      buf << result.opt_candidate_path[N - 1].tp;
+    buf.push_back(';');
+    for (int i = 0; i < N; ++i) {
+      if (i > 0) buf.push_back(',');
+      append_double(buf, path[i].tp, value_precision);
     }
   }
   if (config_.write_length) {
-    buf << ";";
-    if (!result.opt_candidate_path.empty()) {
-      int N = result.opt_candidate_path.size();
-      SPDLOG_TRACE("Write length for {} edges",N);
-      for (int i = 0; i < N - 1; ++i) {
-        // SPDLOG_TRACE("Write length {}",i);
-        buf << result.opt_candidate_path[i].c.edge->length << ",";
-      }
-      // SPDLOG_TRACE("Write length {}",N-1);
-      buf << result.opt_candidate_path[N - 1].c.edge->length;
+    buf.push_back(';');
+    SPDLOG_TRACE("Write length for {} edges",N);
+    for (int i = 0; i < N; ++i) {
+      if (i > 0) buf.push_back(',');
+      append_double(buf, path[i].c.edge->length, value_precision);
     }
   }
   if (config_.write_duration) {
-    buf << ";";
-    if (!traj.timestamps.empty()) {
-      int N = traj.timestamps.size();
-      SPDLOG_TRACE("Write duration for {} points",N);
-      for (int i = 1; i < N; ++i) {
-        // SPDLOG_TRACE("Write length {}",i);
-        buf << traj.timestamps[i] - traj.timestamps[i-1]
-            << (i==N-1?"":",");
-      }
+    buf.push_back(';');
+    int T = traj.timestamps.size();
+    SPDLOG_TRACE("Write duration for {} points",T);
+    for (int i = 1; i < T; ++i) {
+      if (i > 1) buf.push_back(',');
+      append_double(buf, traj.timestamps[i] - traj.timestamps[i-1],
+                    value_precision);
     }
   }
   if (config_.write_speed) {
-    buf << ";";
-    if (!result.opt_candidate_path.empty() && !traj.timestamps.empty()) {
-      int N = traj.timestamps.size();
-      for (int i = 1; i < N; ++i) {
+    buf.push_back(';');
+    if (N > 0) {
+      int T = traj.timestamps.size();
+      for (int i = 1; i < T; ++i) {
+        if (i > 1) buf.push_back(',');
         double duration = traj.timestamps[i] - traj.timestamps[i-1];
-        buf << (duration>0?(result.opt_candidate_path[i].sp_dist/duration):0)
-            << (i==N-1?"":",");
+        append_double(buf, duration > 0 ? path[i].sp_dist / duration : 0,
+                      value_precision);
       }
     }
   }
-  buf << '\n';
-  // Ensure that fstream is called corrected in OpenMP
-  #pragma omp critical
-  m_fstream << buf.rdbuf();
+  buf.push_back('\n');
+  text->append(buf.data(), buf.size());
 }
 
+ResultWriter::ResultWriter(const FMM::CONFIG::ResultConfig &config) {
+  if (config.get_result_format() == 1) {
+    SPDLOG_INFO("Write result in binary format");
+    writer = std::make_shared<BinaryMatchResultWriter>(
+      config.file, config.output_config);
+  } else {
+    SPDLOG_INFO("Write result in CSV format");
+    writer = std::make_shared<CSVMatchResultWriter>(
+      config.file, config.output_config);
+  }
+};
+
 } //IO
 } //MM
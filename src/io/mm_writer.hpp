@@ -17,9 +17,11 @@
 #include "util/debug.hpp"
 #include "network/network.hpp"
 #include "config/result_config.hpp"
+#include "io/compressed_file.hpp"
 
 #include <iostream>
 #include <fstream>
+#include <memory>
 #include <omp.h>
 
 namespace FMM {
@@ -31,6 +33,7 @@ namespace IO {
  */
 class MatchResultWriter {
 public:
+  virtual ~MatchResultWriter() = default;
   /**
    * Write the match result to a file
    * @param result the match result of a trajectory
@@ -38,10 +41,34 @@ public:
   virtual void write_result(
     const FMM::CORE::Trajectory &traj,
     const FMM::MM::MatchResult &result) = 0;
+  /**
+   * Format a match result into a string, which can be called
+   * concurrently as nothing is written.
+   * @param traj Input trajectory
+   * @param result Map match result
+   * @param text the formatted result is appended to it
+   */
+  virtual void format_result(const FMM::CORE::Trajectory &traj,
+                             const FMM::MM::MatchResult &result,
+                             std::string *text) const = 0;
+  /**
+   * Write a string formatted by format_result. It is not thread safe and
+   * should be called by a single thread.
+   */
+  virtual void write_text(const std::string &text) = 0;
+  /**
+   * Flush the buffered data to the file
+   */
+  virtual void flush() = 0;
 };
 
 /**
  * A writer class for writing matche result to a CSV file.
+ *
+ * A result can be formatted into a string by any thread with format_result
+ * and the strings are appended by a single thread with write_text, which
+ * are stored in a buffer and written to the file in large blocks.
+ * The file is compressed with gzip if its name ends with .gz.
  */
 class CSVMatchResultWriter : public MatchResultWriter {
 public:
@@ -57,6 +84,10 @@ public:
    */
   CSVMatchResultWriter(const std::string &result_file,
                        const CONFIG::OutputConfig &config_arg);
+  /**
+   * Destructor, the buffered text is flushed to the file.
+   */
+  ~CSVMatchResultWriter();
   /**
    * Write a header line for the fields exported
    */
@@ -68,11 +99,79 @@ public:
    */
   void write_result(const FMM::CORE::Trajectory &traj,
                     const FMM::MM::MatchResult &result);
+  /**
+   * Format a match result into a line of text, which can be called
+   * concurrently as nothing is written.
+   * @param traj Input trajectory
+   * @param result Map match result
+   * @param text the line is appended to it
+   */
+  void format_result(const FMM::CORE::Trajectory &traj,
+                     const FMM::MM::MatchResult &result,
+                     std::string *text) const;
+  /**
+   * Write a text formatted by format_result. It is not thread safe and
+   * should be called by a single thread.
+   * @param text formatted text
+   */
+  void write_text(const std::string &text);
+  /**
+   * Flush the buffered text to the file
+   */
+  void flush();
 private:
-  std::ofstream m_fstream;
+  // Size of the buffer written to the file at a time
+  static constexpr std::size_t BUFFER_SIZE = 1 << 20;
+  OutputFileStream m_fstream;
   const CONFIG::OutputConfig &config_;
+  std::string buffer_;
 }; // CSVMatchResultWriter
 
+/**
+ * %ResultWriter class, a wrapper makes it easier to write results to
+ * a file by specifying ResultConfig as input.
+ */
+class ResultWriter {
+public:
+  /**
+   * Constructor
+   * @param config configuration of the result, the file format will be
+   * determined from it automatically.
+   */
+  ResultWriter(const FMM::CONFIG::ResultConfig &config);
+  /**
+   * Write match result
+   * @param traj Input trajectory
+   * @param result Map match result
+   */
+  inline void write_result(const FMM::CORE::Trajectory &traj,
+                           const FMM::MM::MatchResult &result) {
+    writer->write_result(traj, result);
+  };
+  /**
+   * Format a match result, which can be called concurrently.
+   */
+  inline void format_result(const FMM::CORE::Trajectory &traj,
+                            const FMM::MM::MatchResult &result,
+                            std::string *text) const {
+    writer->format_result(traj, result, text);
+  };
+  /**
+   * Write a string formatted by format_result by a single thread.
+   */
+  inline void write_text(const std::string &text) {
+    writer->write_text(text);
+  };
+  /**
+   * Flush the buffered results to the file
+   */
+  inline void flush() {
+    writer->flush();
+  };
+private:
+  std::shared_ptr<MatchResultWriter> writer;
+}; // ResultWriter
+
 };     //IO
 } //FMM
 #endif // FMM_MM_WRITER_HPP
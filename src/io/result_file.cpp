@@ -0,0 +1,393 @@
+/**
+ * Fast map matching.
+ *
+ * Implementation of the binary match result file
+ */
+
+#include "io/result_file.hpp"
+#include "util/debug.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+#include <boost/format.hpp>
+
+using namespace FMM;
+using namespace FMM::CORE;
+using namespace FMM::MM;
+using namespace FMM::IO;
+
+namespace {
+
+const char RESULT_FILE_MAGIC[8] = {'F','M','M','R','E','S','\0','\0'};
+const uint32_t RESULT_FILE_VERSION = 1;
+
+[[noreturn]] void throw_corrupted(const std::string &reason) {
+  std::string message = "Corrupted result file: " + reason;
+  SPDLOG_CRITICAL(message);
+  throw std::runtime_error(message);
+}
+
+template<typename T>
+void append_value(std::string *text, T value) {
+  text->append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+// Append the length of an array and the values converted to T
+template<typename T, typename Container>
+void append_array(std::string *text, const Container &values) {
+  append_value<uint32_t>(text, values.size());
+  for (const auto &value : values) {
+    append_value<T>(text, static_cast<T>(value));
+  }
+}
+
+// Append a linestring as an array of x,y pairs
+void append_linestring(std::string *text, const LineString &geom) {
+  int n = geom.get_num_points();
+  append_value<uint32_t>(text, 2 * n);
+  for (int i = 0; i < n; ++i) {
+    append_value<double>(text, geom.get_x(i));
+    append_value<double>(text, geom.get_y(i));
+  }
+}
+
+// Read an array written by append_array, return the position after it
+template<typename T>
+const char *read_array(const char *pos, const char *end,
+                       std::vector<T> *values) {
+  uint32_t n;
+  if (end - pos < std::ptrdiff_t(sizeof(n))) {
+    throw_corrupted("array out of range");
+  }
+  std::memcpy(&n, pos, sizeof(n));
+  pos += sizeof(n);
+  if (std::size_t(end - pos) / sizeof(T) < n) {
+    throw_corrupted("array out of range");
+  }
+  values->resize(n);
+  if (n > 0) std::memcpy(&(*values)[0], pos, n * sizeof(T));
+  return pos + n * sizeof(T);
+}
+
+} // namespace
+
+uint32_t FMM::IO::get_result_fields(const CONFIG::OutputConfig &config) {
+  uint32_t fields = 0;
+  if (config.write_opath) fields |= RESULT_FIELD_OPATH;
+  if (config.write_error) fields |= RESULT_FIELD_ERROR;
+  if (config.write_offset) fields |= RESULT_FIELD_OFFSET;
+  if (config.write_spdist) fields |= RESULT_FIELD_SPDIST;
+  if (config.write_pgeom) fields |= RESULT_FIELD_PGEOM;
+  if (config.write_cpath) fields |= RESULT_FIELD_CPATH;
+  if (config.write_tpath) fields |= RESULT_FIELD_TPATH;
+  if (config.write_mgeom) fields |= RESULT_FIELD_MGEOM;
+  if (config.write_ep) fields |= RESULT_FIELD_EP;
+  if (config.write_tp) fields |= RESULT_FIELD_TP;
+  if (config.write_length) fields |= RESULT_FIELD_LENGTH;
+  if (config.write_duration) fields |= RESULT_FIELD_DURATION;
+  if (config.write_speed) fields |= RESULT_FIELD_SPEED;
+  return fields;
+}
+
+BinaryMatchResultWriter::BinaryMatchResultWriter(
+  const std::string &result_file, const CONFIG::OutputConfig &config_arg,
+  int block_size) :
+  ofs_(result_file, std::ios::binary), fields_(get_result_fields(config_arg)),
+  block_size_(block_size > 0 ? block_size : 1) {
+  if (!ofs_) {
+    std::string message = (boost::format("Create result file %1% fail") % result_file).str();
+    SPDLOG_CRITICAL(message);
+    throw std::runtime_error(message);
+  }
+  buffer_.reserve(BUFFER_SIZE);
+  // The header is written again when the file is closed
+  ResultFileHeader header{};
+  ofs_.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  offset_ = sizeof(header);
+}
+
+BinaryMatchResultWriter::~BinaryMatchResultWriter() {
+  close();
+}
+
+void BinaryMatchResultWriter::write_result(const Trajectory &traj,
+                                           const MatchResult &result) {
+  std::string text;
+  format_result(traj, result, &text);
+  #pragma omp critical
+  write_text(text);
+}
+
+void FMM::IO::format_result_record(const Trajectory &traj,
+                                  const MatchResult &result, uint32_t fields,
+                                  std::string *text) {
+  std::size_t start = text->size();
+  // The size is set after the record is formatted
+  append_value<uint32_t>(text, 0);
+  append_value<int32_t>(text, result.id);
+  const MatchedCandidatePath &path = result.opt_candidate_path;
+  int N = path.size();
+  std::vector<float> values;
+  if (fields & RESULT_FIELD_OPATH) {
+    append_array<int64_t>(text, result.opath);
+  }
+  if (fields & RESULT_FIELD_ERROR) {
+    values.clear();
+    for (int i = 0; i < N; ++i) values.push_back(path[i].c.dist);
+    append_array<float>(text, values);
+  }
+  if (fields & RESULT_FIELD_OFFSET) {
+    values.clear();
+    for (int i = 0; i < N; ++i) values.push_back(path[i].c.offset);
+    append_array<float>(text, values);
+  }
+  if (fields & RESULT_FIELD_SPDIST) {
+    values.clear();
+    for (int i = 1; i < N; ++i) values.push_back(path[i].sp_dist);
+    append_array<float>(text, values);
+  }
+  if (fields & RESULT_FIELD_PGEOM) {
+    LineString pline;
+    for (int i = 0; i < N; ++i) pline.add_point(path[i].c.point);
+    append_linestring(text, pline);
+  }
+  if (fields & RESULT_FIELD_CPATH) {
+    append_array<int64_t>(text, result.cpath);
+  }
+  if (fields & RESULT_FIELD_TPATH) {
+    if (result.cpath.empty()) {
+      append_value<uint32_t>(text, 0);
+    } else {
+      append_array<int32_t>(text, result.indices);
+    }
+  }
+  if (fields & RESULT_FIELD_MGEOM) {
+    append_linestring(text, result.mgeom);
+  }
+  if (fields & RESULT_FIELD_EP) {
+    values.clear();
+    for (int i = 0; i < N; ++i) values.push_back(path[i].ep);
+    append_array<float>(text, values);
+  }
+  if (fields & RESULT_FIELD_TP) {
+    values.clear();
+    for (int i = 0; i < N; ++i) values.push_back(path[i].tp);
+    append_array<float>(text, values);
+  }
+  if (fields & RESULT_FIELD_LENGTH) {
+    values.clear();
+    for (int i = 0; i < N; ++i) values.push_back(path[i].c.edge->length);
+    append_array<float>(text, values);
+  }
+  if (fields & RESULT_FIELD_DURATION) {
+    values.clear();
+    for (std::size_t i = 1; i < traj.timestamps.size(); ++i) {
+      values.push_back(traj.timestamps[i] - traj.timestamps[i - 1]);
+    }
+    append_array<float>(text, values);
+  }
+  if (fields & RESULT_FIELD_SPEED) {
+    values.clear();
+    if (N > 0) {
+      for (std::size_t i = 1; i < traj.timestamps.size() &&
+           i < std::size_t(N); ++i) {
+        double duration = traj.timestamps[i] - traj.timestamps[i - 1];
+        values.push_back(duration > 0 ? path[i].sp_dist / duration : 0);
+      }
+    }
+    append_array<float>(text, values);
+  }
+  uint32_t size = text->size() - start - sizeof(uint32_t);
+  std::memcpy(&(*text)[start], &size, sizeof(size));
+}
+
+void BinaryMatchResultWriter::format_result(
+  const Trajectory &traj, const MatchResult &result,
+  std::string *text) const {
+  format_result_record(traj, result, fields_, text);
+}
+
+void BinaryMatchResultWriter::write_text(const std::string &text) {
+  if (num_results_ % block_size_ == 0) {
+    blocks_.push_back(ResultBlock{offset_, num_results_});
+  }
+  buffer_ += text;
+  offset_ += text.size();
+  ++num_results_;
+  if (buffer_.size() >= BUFFER_SIZE) {
+    flush();
+  }
+}
+
+void BinaryMatchResultWriter::flush() {
+  ofs_.write(buffer_.data(), buffer_.size());
+  buffer_.clear();
+}
+
+void BinaryMatchResultWriter::close() {
+  if (!ofs_.is_open()) return;
+  flush();
+  ResultFileHeader header{};
+  std::memcpy(header.magic, RESULT_FILE_MAGIC, sizeof(header.magic));
+  header.version = RESULT_FILE_VERSION;
+  header.fields = fields_;
+  header.num_results = num_results_;
+  header.num_blocks = blocks_.size();
+  header.index_offset = offset_;
+  ofs_.write(reinterpret_cast<const char *>(blocks_.data()),
+             blocks_.size() * sizeof(ResultBlock));
+  ofs_.seekp(0);
+  ofs_.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  ofs_.close();
+  SPDLOG_INFO("Write {} results in {} blocks", num_results_, blocks_.size());
+}
+
+BinaryMatchResultReader::BinaryMatchResultReader(const std::string &filename)
+  : file_(filename) {
+  if (file_.size() < sizeof(ResultFileHeader)) {
+    throw_corrupted("file too small");
+  }
+  std::memcpy(&header_, file_.begin(), sizeof(header_));
+  if (std::memcmp(header_.magic, RESULT_FILE_MAGIC,
+                  sizeof(header_.magic)) != 0) {
+    throw_corrupted("magic not matched");
+  }
+  if (header_.version != RESULT_FILE_VERSION) {
+    throw_corrupted("version " + std::to_string(header_.version) +
+                    " not supported");
+  }
+  if (header_.index_offset < sizeof(header_) ||
+      header_.index_offset > file_.size() ||
+      (file_.size() - header_.index_offset) / sizeof(ResultBlock) <
+      header_.num_blocks) {
+    throw_corrupted("block index out of range");
+  }
+  // The records are not aligned, so the blocks are copied before use
+  blocks_ = file_.begin() + header_.index_offset;
+  for (uint64_t i = 0; i < header_.num_blocks; ++i) {
+    ResultBlock block = get_block(i);
+    if (block.offset < sizeof(header_) ||
+        block.offset > header_.index_offset ||
+        block.first_result > header_.num_results) {
+      throw_corrupted("block " + std::to_string(i) + " out of range");
+    }
+  }
+  records_end_ = file_.begin() + header_.index_offset;
+  cursor_ = file_.begin() + sizeof(header_);
+  SPDLOG_INFO("Binary result file {} results {} blocks {}",
+              filename, header_.num_results, header_.num_blocks);
+}
+
+ResultBlock BinaryMatchResultReader::get_block(uint64_t block) const {
+  ResultBlock result;
+  std::memcpy(&result, blocks_ + block * sizeof(ResultBlock),
+              sizeof(ResultBlock));
+  return result;
+}
+
+const char *FMM::IO::read_result_record(const char *pos,
+                                       const char *records_end,
+                                       uint32_t fields,
+                                       ResultRecord *record) {
+  uint32_t size;
+  int32_t id;
+  if (pos > records_end ||
+      records_end - pos < std::ptrdiff_t(sizeof(size) + sizeof(id))) {
+    throw_corrupted("record out of range");
+  }
+  std::memcpy(&size, pos, sizeof(size));
+  pos += sizeof(size);
+  if (std::size_t(records_end - pos) < size || size < sizeof(id)) {
+    throw_corrupted("record out of range");
+  }
+  const char *end = pos + size;
+  std::memcpy(&id, pos, sizeof(id));
+  pos += sizeof(id);
+  *record = ResultRecord();
+  record->id = id;
+  if (fields & RESULT_FIELD_OPATH)
+    pos = read_array(pos, end, &record->opath);
+  if (fields & RESULT_FIELD_ERROR)
+    pos = read_array(pos, end, &record->error);
+  if (fields & RESULT_FIELD_OFFSET)
+    pos = read_array(pos, end, &record->offset);
+  if (fields & RESULT_FIELD_SPDIST)
+    pos = read_array(pos, end, &record->spdist);
+  if (fields & RESULT_FIELD_PGEOM)
+    pos = read_array(pos, end, &record->pgeom);
+  if (fields & RESULT_FIELD_CPATH)
+    pos = read_array(pos, end, &record->cpath);
+  if (fields & RESULT_FIELD_TPATH)
+    pos = read_array(pos, end, &record->indices);
+  if (fields & RESULT_FIELD_MGEOM)
+    pos = read_array(pos, end, &record->mgeom);
+  if (fields & RESULT_FIELD_EP)
+    pos = read_array(pos, end, &record->ep);
+  if (fields & RESULT_FIELD_TP)
+    pos = read_array(pos, end, &record->tp);
+  if (fields & RESULT_FIELD_LENGTH)
+    pos = read_array(pos, end, &record->length);
+  if (fields & RESULT_FIELD_DURATION)
+    pos = read_array(pos, end, &record->duration);
+  if (fields & RESULT_FIELD_SPEED)
+    pos = read_array(pos, end, &record->speed);
+  return end;
+}
+
+const char *BinaryMatchResultReader::read_record(
+  const char *pos, ResultRecord *record) const {
+  return read_result_record(pos, records_end_, header_.fields, record);
+}
+
+uint32_t BinaryMatchResultReader::get_fields() const {
+  return header_.fields;
+}
+
+long long BinaryMatchResultReader::get_num_results() const {
+  return header_.num_results;
+}
+
+uint64_t BinaryMatchResultReader::get_num_blocks() const {
+  return header_.num_blocks;
+}
+
+bool BinaryMatchResultReader::has_next_result() const {
+  return cursor_ < records_end_;
+}
+
+ResultRecord BinaryMatchResultReader::read_next_result() {
+  ResultRecord record;
+  cursor_ = read_record(cursor_, &record);
+  return record;
+}
+
+std::vector<ResultRecord> BinaryMatchResultReader::read_all_results() {
+  std::vector<ResultRecord> records;
+  while (has_next_result()) {
+    records.push_back(read_next_result());
+  }
+  return records;
+}
+
+void BinaryMatchResultReader::seek_block(uint64_t block) {
+  if (block >= header_.num_blocks) {
+    throw std::out_of_range("Block index out of range");
+  }
+  cursor_ = file_.begin() + get_block(block).offset;
+}
+
+void BinaryMatchResultReader::read_block(
+  uint64_t block, std::vector<ResultRecord> *records) const {
+  if (block >= header_.num_blocks) {
+    throw std::out_of_range("Block index out of range");
+  }
+  uint64_t first = get_block(block).first_result;
+  uint64_t last = block + 1 < header_.num_blocks ?
+    get_block(block + 1).first_result : header_.num_results;
+  const char *pos = file_.begin() + get_block(block).offset;
+  for (uint64_t i = first; i < last; ++i) {
+    records->emplace_back();
+    pos = read_record(pos, &records->back());
+  }
+}
@@ -0,0 +1,233 @@
+/**
+ * Fast map matching.
+ *
+ * Binary match result file, which stores the fields of the match results
+ * as arrays of numbers so that they are loaded without text parsing.
+ */
+
+#ifndef FMM_RESULT_FILE_HPP
+#define FMM_RESULT_FILE_HPP
+
+#include "io/mm_writer.hpp"
+#include "io/mapped_file.hpp"
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace FMM {
+namespace IO {
+
+/**
+ * Bit of each field in the header of a binary result file. The fields of
+ * a record are stored in the order of the bits.
+ */
+enum ResultField : uint32_t {
+  RESULT_FIELD_OPATH = 1 << 0, /**< int64 array of edge id */
+  RESULT_FIELD_ERROR = 1 << 1, /**< float array */
+  RESULT_FIELD_OFFSET = 1 << 2, /**< float array */
+  RESULT_FIELD_SPDIST = 1 << 3, /**< float array, from the second point */
+  RESULT_FIELD_PGEOM = 1 << 4, /**< double array of x,y pairs */
+  RESULT_FIELD_CPATH = 1 << 5, /**< int64 array of edge id */
+  RESULT_FIELD_TPATH = 1 << 6, /**< int32 array of the index of each
+                                    opath edge in cpath */
+  RESULT_FIELD_MGEOM = 1 << 7, /**< double array of x,y pairs */
+  RESULT_FIELD_EP = 1 << 8, /**< float array */
+  RESULT_FIELD_TP = 1 << 9, /**< float array */
+  RESULT_FIELD_LENGTH = 1 << 10, /**< float array */
+  RESULT_FIELD_DURATION = 1 << 11, /**< float array, from the second point */
+  RESULT_FIELD_SPEED = 1 << 12 /**< float array, from the second point */
+};
+
+/**
+ * Header at the start of a binary result file.
+ *
+ * The file is made of the header, the records grouped into blocks and the
+ * block index at the end. A record is its size in bytes (uint32, the size
+ * field excluded), the trajectory id (int32) and the arrays of the fields
+ * in the header, each stored as its length (uint32) followed by the
+ * values. All the numbers are in native byte order.
+ */
+struct ResultFileHeader {
+  char magic[8]; /**< FMMRES followed by two null characters */
+  uint32_t version; /**< version of the format */
+  uint32_t fields; /**< bits of the fields stored, see ResultField */
+  uint64_t num_results; /**< number of records */
+  uint64_t num_blocks; /**< number of blocks */
+  uint64_t index_offset; /**< offset of the block index */
+};
+
+/**
+ * Entry of the block index
+ */
+struct ResultBlock {
+  uint64_t offset; /**< offset of the first record in the block */
+  uint64_t first_result; /**< index of the first record */
+};
+
+/**
+ * A match result loaded from a binary result file, the fields not stored
+ * are empty.
+ */
+struct ResultRecord {
+  int id; /**< id of the trajectory */
+  std::vector<int64_t> opath; /**< edge matched to each point */
+  std::vector<float> error; /**< distance from each point to the edge */
+  std::vector<float> offset; /**< offset of each matched point */
+  std::vector<float> spdist; /**< path distance from the previous point */
+  std::vector<double> pgeom; /**< x,y of the matched points */
+  std::vector<int64_t> cpath; /**< edges of the complete path */
+  std::vector<int32_t> indices; /**< index of opath edge in cpath, the path
+                                     traversed between point j and j+1 is
+                                     cpath[indices[j]] to cpath[indices[j+1]]
+                                     */
+  std::vector<double> mgeom; /**< x,y of the matched path */
+  std::vector<float> ep; /**< emission probability */
+  std::vector<float> tp; /**< transition probability */
+  std::vector<float> length; /**< length of the matched edges */
+  std::vector<float> duration; /**< time from the previous point */
+  std::vector<float> speed; /**< speed from the previous point */
+};
+
+/**
+ * Get the fields of a binary result record from an output configuration
+ * @param  config output configuration
+ * @return bits of the fields, see ResultField
+ */
+uint32_t get_result_fields(const CONFIG::OutputConfig &config);
+
+/**
+ * Format a match result into a record of a binary result file, which is
+ * also used to send results over a binary protocol.
+ * @param traj   input trajectory
+ * @param result match result
+ * @param fields bits of the fields stored, see ResultField
+ * @param text   the record is appended to it
+ */
+void format_result_record(const FMM::CORE::Trajectory &traj,
+                          const FMM::MM::MatchResult &result,
+                          uint32_t fields, std::string *text);
+
+/**
+ * Read a record formatted by format_result_record, std::runtime_error is
+ * thrown if the record is corrupted.
+ * @param  pos         position of the record
+ * @param  records_end end of the data holding the record
+ * @param  fields      bits of the fields stored, see ResultField
+ * @param  record      set to the record read
+ * @return position of the next record
+ */
+const char *read_result_record(const char *pos, const char *records_end,
+                               uint32_t fields, ResultRecord *record);
+
+/**
+ * A writer class for writing match result to a binary result file.
+ *
+ * As CSVMatchResultWriter, a result can be formatted into a record by any
+ * thread and the records are written by a single thread.
+ */
+class BinaryMatchResultWriter : public MatchResultWriter {
+ public:
+  /**
+   * Constructor, std::runtime_error is thrown if the file cannot be
+   * created.
+   * @param result_file the filename to write result
+   * @param config_arg the fields that will be exported
+   * @param block_size number of records in a block
+   */
+  BinaryMatchResultWriter(const std::string &result_file,
+                          const CONFIG::OutputConfig &config_arg,
+                          int block_size = 1024);
+  /**
+   * Destructor, the file is closed if it is not closed yet.
+   */
+  ~BinaryMatchResultWriter();
+  void write_result(const FMM::CORE::Trajectory &traj,
+                    const FMM::MM::MatchResult &result) override;
+  void format_result(const FMM::CORE::Trajectory &traj,
+                     const FMM::MM::MatchResult &result,
+                     std::string *text) const override;
+  /**
+   * Write a record formatted by format_result, one record at a call so
+   * that the records are counted into blocks.
+   */
+  void write_text(const std::string &text) override;
+  void flush() override;
+  /**
+   * Write the block index and the header, and close the file
+   */
+  void close();
+ private:
+  static constexpr std::size_t BUFFER_SIZE = 1 << 20;
+  std::ofstream ofs_;
+  uint32_t fields_;
+  int block_size_;
+  uint64_t offset_ = 0;
+  uint64_t num_results_ = 0;
+  std::vector<ResultBlock> blocks_;
+  std::string buffer_;
+};
+
+/**
+ * Reader of a binary result file, which is memory mapped.
+ */
+class BinaryMatchResultReader {
+ public:
+  /**
+   * Constructor, std::runtime_error is thrown if the file is not a valid
+   * binary result file.
+   * @param filename file name
+   */
+  explicit BinaryMatchResultReader(const std::string &filename);
+  /**
+   * Get the fields stored, see ResultField
+   */
+  uint32_t get_fields() const;
+  /**
+   * Get the number of records
+   */
+  long long get_num_results() const;
+  /**
+   * Get the number of blocks
+   */
+  uint64_t get_num_blocks() const;
+  /**
+   * Check if there is still any record not read
+   */
+  bool has_next_result() const;
+  /**
+   * Read the next record
+   */
+  ResultRecord read_next_result();
+  /**
+   * Move the cursor to the first record of a block, std::out_of_range is
+   * thrown if the block does not exist
+   */
+  void seek_block(uint64_t block);
+  /**
+   * Read all the records of a block. It does not move the cursor and can
+   * be called concurrently.
+   * @param block index of the block
+   * @param records the records are appended to it
+   */
+  void read_block(uint64_t block,
+                  std::vector<ResultRecord> *records) const;
+  /**
+   * Read all the records left
+   */
+  std::vector<ResultRecord> read_all_results();
+ private:
+  const char *read_record(const char *pos, ResultRecord *record) const;
+  ResultBlock get_block(uint64_t block) const;
+  MappedFile file_;
+  ResultFileHeader header_;
+  const char *blocks_ = nullptr;
+  const char *cursor_ = nullptr;
+  const char *records_end_ = nullptr;
+};
+
+} // IO
+} // FMM
+
+#endif //FMM_RESULT_FILE_HPP
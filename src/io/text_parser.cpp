@@ -0,0 +1,117 @@
+/**
+ * Fast map matching.
+ *
+ * Implementation of the text parsing functions
+ */
+
+#include "io/text_parser.hpp"
+#include "util/debug.hpp"
+
+#include <cctype>
+#include <stdexcept>
+
+namespace FMM {
+namespace IO {
+
+namespace {
+
+// Match a keyword ignoring the case, return the position after it
+const char *match_keyword(const char *first, const char *last,
+                          const char *keyword) {
+  const char *p = first;
+  for (; *keyword != '\0'; ++keyword, ++p) {
+    if (p == last ||
+        std::toupper(static_cast<unsigned char>(*p)) != *keyword) {
+      return nullptr;
+    }
+  }
+  return p;
+}
+
+// Parse the text in place, return false if it is not understood
+bool parse_linestring_fast(const char *first, const char *last,
+                           CORE::LineString *geom) {
+  const char *p = skip_spaces(first, last);
+  p = match_keyword(p, last, "LINESTRING");
+  if (p == nullptr) return false;
+  p = skip_spaces(p, last);
+  const char *empty = match_keyword(p, last, "EMPTY");
+  if (empty != nullptr) {
+    return skip_spaces(empty, last) == last;
+  }
+  if (p == last || *p != '(') return false;
+  ++p;
+  while (true) {
+    double x, y;
+    p = parse_double(p, last, &x);
+    if (p == nullptr || p == last || (*p != ' ' && *p != '\t')) return false;
+    p = parse_double(p, last, &y);
+    if (p == nullptr) return false;
+    geom->add_point(x, y);
+    p = skip_spaces(p, last);
+    if (p == last) return false;
+    if (*p == ')') break;
+    if (*p != ',') return false;
+    ++p;
+  }
+  return skip_spaces(p + 1, last) == last;
+}
+
+} // namespace
+
+void parse_linestring(const char *first, const char *last,
+                      CORE::LineString *geom) {
+  if (!parse_linestring_fast(first, last, geom)) {
+    geom->clear();
+    boost::geometry::read_wkt(std::string(first, last),
+                              geom->get_geometry());
+  }
+}
+
+void parse_timestamps(const char *first, const char *last,
+                      std::vector<double> *values) {
+  const char *p = first;
+  double v;
+  while ((p = parse_double(p, last, &v)) != nullptr) {
+    values->push_back(v);
+    p = skip_spaces(p, last);
+    if (p == last || *p != ',') break;
+    ++p;
+  }
+}
+
+bool parse_point_row(const char *line, const char *line_end, char delim,
+                     int id_idx, int x_idx, int y_idx, int timestamp_idx,
+                     int *id, double *x, double *y, double *timestamp) {
+  if (line == line_end) return false;
+  const char *field = line;
+  int index = 0;
+  while (true) {
+    const char *field_end = static_cast<const char *>(
+      std::memchr(field, delim, line_end - field));
+    if (field_end == nullptr) field_end = line_end;
+    const char *parsed = field;
+    if (index == id_idx) {
+      parsed = parse_int(field, field_end, id);
+    } else if (index == x_idx) {
+      parsed = parse_double(field, field_end, x);
+    } else if (index == y_idx) {
+      parsed = parse_double(field, field_end, y);
+    } else if (index == timestamp_idx) {
+      parsed = parse_double(field, field_end, timestamp);
+    }
+    if (parsed == nullptr) {
+      std::string message = "Invalid value " +
+        std::string(field, field_end) + " in GPS file";
+      SPDLOG_CRITICAL(message);
+      throw std::runtime_error(message);
+    }
+    if (field_end == line_end) break;
+    field = field_end + 1;
+    ++index;
+  }
+  return true;
+}
+
+} // IO
+} // FMM
@@ -0,0 +1,192 @@
+/**
+ * Fast map matching.
+ *
+ * Functions parsing numbers, WKT linestrings and timestamps in place from
+ * a range of characters, which is not required to be null terminated.
+ */
+
+#ifndef FMM_TEXT_PARSER_HPP
+#define FMM_TEXT_PARSER_HPP
+
+#include "core/geometry.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace FMM {
+namespace IO {
+
+/**
+ * Skip the spaces and tabs at the start of a range
+ * @return position of the first other character
+ */
+inline const char *skip_spaces(const char *first, const char *last) {
+  while (first != last && (*first == ' ' || *first == '\t')) ++first;
+  return first;
+}
+
+/**
+ * Parse a decimal integer, optionally signed.
+ * @param  first start of the range
+ * @param  last  end of the range
+ * @param  value set to the value parsed
+ * @return position after the integer, nullptr if no integer is found or
+ * it is out of the range of int
+ */
+inline const char *parse_int(const char *first, const char *last,
+                             int *value) {
+  const char *p = skip_spaces(first, last);
+  bool negative = false;
+  if (p != last && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    ++p;
+  }
+  const char *digits = p;
+  const long long limit = negative ?
+    -static_cast<long long>(std::numeric_limits<int>::min()) :
+    std::numeric_limits<int>::max();
+  long long v = 0;
+  while (p != last && *p >= '0' && *p <= '9') {
+    v = v * 10 + (*p - '0');
+    if (v > limit) return nullptr;
+    ++p;
+  }
+  if (p == digits) return nullptr;
+  *value = static_cast<int>(negative ? -v : v);
+  return p;
+}
+
+/**
+ * Parse a floating point number in decimal notation with an optional
+ * exponent, leading spaces are skipped.
+ *
+ * A number with at most 19 significant digits whose mantissa and power of
+ * ten are both exactly representable is computed with a single rounding,
+ * which gives the same value as strtod. Other numbers are passed to strtod.
+ *
+ * @param  first start of the range
+ * @param  last  end of the range
+ * @param  value set to the value parsed
+ * @return position after the number, nullptr if no number is found
+ */
+inline const char *parse_double(const char *first, const char *last,
+                                double *value) {
+  static const double powers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  const char *start = skip_spaces(first, last);
+  const char *p = start;
+  bool negative = false;
+  if (p != last && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    ++p;
+  }
+  uint64_t mantissa = 0;
+  int significant = 0;
+  int exponent = 0;
+  bool has_digits = false;
+  while (p != last && *p >= '0' && *p <= '9') {
+    if (mantissa > 0 || *p != '0') {
+      mantissa = mantissa * 10 + (*p - '0');
+      ++significant;
+    }
+    has_digits = true;
+    ++p;
+  }
+  if (p != last && *p == '.') {
+    ++p;
+    while (p != last && *p >= '0' && *p <= '9') {
+      if (mantissa > 0 || *p != '0') {
+        mantissa = mantissa * 10 + (*p - '0');
+        ++significant;
+      }
+      --exponent;
+      has_digits = true;
+      ++p;
+    }
+  }
+  if (!has_digits) return nullptr;
+  if (p != last && (*p == 'e' || *p == 'E')) {
+    const char *q = p + 1;
+    bool exp_negative = false;
+    if (q != last && (*q == '-' || *q == '+')) {
+      exp_negative = *q == '-';
+      ++q;
+    }
+    if (q != last && *q >= '0' && *q <= '9') {
+      int e = 0;
+      while (q != last && *q >= '0' && *q <= '9') {
+        if (e < 100000) e = e * 10 + (*q - '0');
+        ++q;
+      }
+      exponent += exp_negative ? -e : e;
+      p = q;
+    }
+  }
+  if (significant <= 19 && mantissa <= (uint64_t(1) << 53) &&
+      exponent >= -22 && exponent <= 22) {
+    double v = static_cast<double>(mantissa);
+    v = exponent < 0 ? v / powers[-exponent] : v * powers[exponent];
+    *value = negative ? -v : v;
+  } else {
+    std::string token(start, p);
+    *value = std::strtod(token.c_str(), nullptr);
+  }
+  return p;
+}
+
+/**
+ * Find the end of the line starting at line and the start of the next one
+ * @param  line start of the line
+ * @param  last end of the text
+ * @param  line_end set to the end of the line, excluding \r\n or \n
+ * @return start of the next line, last if it is the last line
+ */
+inline const char *next_line(const char *line, const char *last,
+                             const char **line_end) {
+  const char *p = static_cast<const char *>(
+    std::memchr(line, '\n', last - line));
+  const char *next = p == nullptr ? last : p + 1;
+  if (p == nullptr) p = last;
+  if (p > line && p[-1] == '\r') --p;
+  *line_end = p;
+  return next;
+}
+
+/**
+ * Parse a WKT linestring, such as LINESTRING(0 0,1 1). Text that is not
+ * a two dimensional linestring is passed to boost::geometry::read_wkt.
+ * @param first start of the text
+ * @param last  end of the text
+ * @param geom  linestring to store the points, which should be empty
+ */
+void parse_linestring(const char *first, const char *last,
+                      CORE::LineString *geom);
+
+/**
+ * Parse a list of double values separated by ,
+ * @param first start of the text
+ * @param last  end of the text
+ * @param values the values are appended to it
+ */
+void parse_timestamps(const char *first, const char *last,
+                      std::vector<double> *values);
+
+/**
+ * Parse a row of a CSV point file. The columns not found are given a
+ * negative index and their values are unchanged.
+ * std::runtime_error is thrown if a value is invalid.
+ * @return false if the row is empty
+ */
+bool parse_point_row(const char *line, const char *line_end, char delim,
+                     int id_idx, int x_idx, int y_idx, int timestamp_idx,
+                     int *id, double *x, double *y, double *timestamp);
+
+} // IO
+} // FMM
+
+#endif //FMM_TEXT_PARSER_HPP
@@ -0,0 +1,230 @@
+#include "io/trajectory_file.hpp"
+#include "util/debug.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+#include <boost/format.hpp>
+
+using namespace FMM;
+using namespace FMM::CORE;
+using namespace FMM::IO;
+
+namespace {
+
+const char TRAJECTORY_FILE_MAGIC[8] = {'F','M','M','T','R','A','J','\0'};
+const uint32_t TRAJECTORY_FILE_VERSION = 1;
+const uint32_t TRAJECTORY_FILE_TIMESTAMP = 1;
+
+[[noreturn]] void throw_corrupted(const std::string &reason) {
+  std::string message = "Corrupted trajectory file: " + reason;
+  SPDLOG_CRITICAL(message);
+  throw std::runtime_error(message);
+}
+
+} // namespace
+
+TrajectoryFileWriter::TrajectoryFileWriter(
+  const std::string &filename, bool write_timestamp, int block_size) :
+  ofs_(filename, std::ios::binary), write_timestamp_(write_timestamp),
+  block_size_(block_size > 0 ? block_size : 1) {
+  if (!ofs_) {
+    std::string message = (boost::format("Create trajectory file %1% fail") % filename).str();
+    SPDLOG_CRITICAL(message);
+    throw std::runtime_error(message);
+  }
+  // The header is written again when the file is closed
+  TrajectoryFileHeader header{};
+  ofs_.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  offset_ = sizeof(header);
+}
+
+TrajectoryFileWriter::~TrajectoryFileWriter() {
+  close();
+}
+
+void TrajectoryFileWriter::write(const Trajectory &trajectory) {
+  uint32_t n = trajectory.geom.get_num_points();
+  if (write_timestamp_ && trajectory.timestamps.size() != n) {
+    std::string message = (boost::format("Trajectory %1% has %2% points but %3% timestamps") % trajectory.id % n % trajectory.timestamps.size()).str();
+    SPDLOG_CRITICAL(message);
+    throw std::runtime_error(message);
+  }
+  if (num_trajectories_ % block_size_ == 0) {
+    blocks_.push_back(TrajectoryBlock{offset_, num_trajectories_});
+  }
+  int32_t id = trajectory.id;
+  values_.resize(write_timestamp_ ? 3 * n : 2 * n);
+  for (uint32_t i = 0; i < n; ++i) {
+    values_[i] = trajectory.geom.get_x(i);
+    values_[n + i] = trajectory.geom.get_y(i);
+  }
+  if (write_timestamp_) {
+    std::copy(trajectory.timestamps.begin(), trajectory.timestamps.end(),
+              values_.begin() + 2 * n);
+  }
+  ofs_.write(reinterpret_cast<const char *>(&id), sizeof(id));
+  ofs_.write(reinterpret_cast<const char *>(&n), sizeof(n));
+  ofs_.write(reinterpret_cast<const char *>(values_.data()),
+             values_.size() * sizeof(double));
+  offset_ += sizeof(id) + sizeof(n) + values_.size() * sizeof(double);
+  ++num_trajectories_;
+}
+
+void TrajectoryFileWriter::close() {
+  if (!ofs_.is_open()) return;
+  TrajectoryFileHeader header{};
+  std::memcpy(header.magic, TRAJECTORY_FILE_MAGIC, sizeof(header.magic));
+  header.version = TRAJECTORY_FILE_VERSION;
+  header.flags = write_timestamp_ ? TRAJECTORY_FILE_TIMESTAMP : 0;
+  header.num_trajectories = num_trajectories_;
+  header.num_blocks = blocks_.size();
+  header.index_offset = offset_;
+  ofs_.write(reinterpret_cast<const char *>(blocks_.data()),
+             blocks_.size() * sizeof(TrajectoryBlock));
+  ofs_.seekp(0);
+  ofs_.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  ofs_.close();
+  SPDLOG_INFO("Write {} trajectories in {} blocks", num_trajectories_,
+              blocks_.size());
+}
+
+BinaryTrajectoryReader::BinaryTrajectoryReader(const std::string &filename)
+  : file_(filename) {
+  if (file_.size() < sizeof(TrajectoryFileHeader)) {
+    throw_corrupted("file too small");
+  }
+  std::memcpy(&header_, file_.begin(), sizeof(header_));
+  if (std::memcmp(header_.magic, TRAJECTORY_FILE_MAGIC,
+                  sizeof(header_.magic)) != 0) {
+    throw_corrupted("magic not matched");
+  }
+  if (header_.version != TRAJECTORY_FILE_VERSION) {
+    throw_corrupted("version " + std::to_string(header_.version) +
+                    " not supported");
+  }
+  if (header_.index_offset < sizeof(header_) ||
+      header_.index_offset > file_.size() ||
+      (file_.size() - header_.index_offset) / sizeof(TrajectoryBlock) <
+      header_.num_blocks) {
+    throw_corrupted("block index out of range");
+  }
+  blocks_ = reinterpret_cast<const TrajectoryBlock *>(
+    file_.begin() + header_.index_offset);
+  for (uint64_t i = 0; i < header_.num_blocks; ++i) {
+    if (blocks_[i].offset < sizeof(header_) ||
+        blocks_[i].offset > header_.index_offset ||
+        blocks_[i].offset % sizeof(double) != 0 ||
+        blocks_[i].first_trajectory > header_.num_trajectories) {
+      throw_corrupted("block " + std::to_string(i) + " out of range");
+    }
+  }
+  records_end_ = file_.begin() + header_.index_offset;
+  cursor_ = file_.begin() + sizeof(header_);
+  SPDLOG_INFO("Binary trajectory file {} trajectories {} blocks {}",
+              filename, header_.num_trajectories, header_.num_blocks);
+}
+
+const char *BinaryTrajectoryReader::read_record(
+  const char *pos, Trajectory *trajectory) const {
+  int32_t id;
+  uint32_t n;
+  if (pos > records_end_ ||
+      records_end_ - pos < std::ptrdiff_t(sizeof(id) + sizeof(n))) {
+    throw_corrupted("record out of range");
+  }
+  std::memcpy(&id, pos, sizeof(id));
+  std::memcpy(&n, pos + sizeof(id), sizeof(n));
+  pos += sizeof(id) + sizeof(n);
+  std::size_t num_values = has_timestamp_flag() ? 3 * std::size_t(n)
+                                                 : 2 * std::size_t(n);
+  if ((records_end_ - pos) / sizeof(double) < num_values) {
+    throw_corrupted("record out of range");
+  }
+  // The records are aligned to 8 bytes, the values are read in place
+  const double *xs = reinterpret_cast<const double *>(pos);
+  const double *ys = xs + n;
+  trajectory->id = id;
+  trajectory->geom.clear();
+  trajectory->geom.get_geometry().reserve(n);
+  for (uint32_t i = 0; i < n; ++i) {
+    trajectory->geom.add_point(xs[i], ys[i]);
+  }
+  if (has_timestamp_flag()) {
+    trajectory->timestamps.assign(ys + n, ys + 2 * n);
+  } else {
+    trajectory->timestamps.clear();
+  }
+  return pos + num_values * sizeof(double);
+}
+
+Trajectory BinaryTrajectoryReader::read_next_trajectory() {
+  Trajectory trajectory;
+  cursor_ = read_record(cursor_, &trajectory);
+  return trajectory;
+}
+
+bool BinaryTrajectoryReader::has_next_trajectory() {
+  return cursor_ < records_end_;
+}
+
+bool BinaryTrajectoryReader::has_timestamp() {
+  return has_timestamp_flag();
+}
+
+bool BinaryTrajectoryReader::has_timestamp_flag() const {
+  return (header_.flags & TRAJECTORY_FILE_TIMESTAMP) != 0;
+}
+
+void BinaryTrajectoryReader::close() {
+  file_.close();
+  blocks_ = nullptr;
+  cursor_ = records_end_ = nullptr;
+}
+
+void BinaryTrajectoryReader::reset_cursor() {
+  cursor_ = file_.begin() + sizeof(header_);
+}
+
+long long BinaryTrajectoryReader::get_num_trajectories() const {
+  return header_.num_trajectories;
+}
+
+uint64_t BinaryTrajectoryReader::get_num_blocks() const {
+  return header_.num_blocks;
+}
+
+void BinaryTrajectoryReader::seek_block(uint64_t block) {
+  if (block >= header_.num_blocks) {
+    throw std::out_of_range("Block index out of range");
+  }
+  cursor_ = file_.begin() + blocks_[block].offset;
+}
+
+void BinaryTrajectoryReader::read_block(
+  uint64_t block, std::vector<Trajectory> *trajectories) const {
+  if (block >= header_.num_blocks) {
+    throw std::out_of_range("Block index out of range");
+  }
+  uint64_t first = blocks_[block].first_trajectory;
+  uint64_t last = block + 1 < header_.num_blocks ?
+    blocks_[block + 1].first_trajectory : header_.num_trajectories;
+  const char *pos = file_.begin() + blocks_[block].offset;
+  for (uint64_t i = first; i < last; ++i) {
+    trajectories->emplace_back();
+    pos = read_record(pos, &trajectories->back());
+  }
+}
+
+long long FMM::IO::convert_to_trajectory_file(
+  const CONFIG::GPSConfig &config, const std::string &filename) {
+  GPSReader reader(config);
+  TrajectoryFileWriter writer(filename, reader.has_timestamp());
+  long long num_trajectories = 0;
+  while (reader.has_next_trajectory()) {
+    writer.write(reader.read_next_trajectory());
+    ++num_trajectories;
+  }
+  writer.close();
+  return num_trajectories;
+}
@@ -0,0 +1,172 @@
+/**
+ * Fast map matching.
+ *
+ * Binary trajectory file, which stores the coordinates of trajectories as
+ * doubles so that they are read without any parsing.
+ */
+
+#ifndef FMM_TRAJECTORY_FILE_HPP
+#define FMM_TRAJECTORY_FILE_HPP
+
+#include "io/gps_reader.hpp"
+#include "io/mapped_file.hpp"
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace FMM {
+namespace IO {
+
+/**
+ * Header at the start of a binary trajectory file.
+ *
+ * The file is made of the header, the trajectory records grouped into
+ * blocks and the block index at the end. A trajectory record is the id
+ * (int32), the number of points n (uint32), followed by n x values, n y
+ * values and n timestamps if the file has timestamps, all stored as
+ * doubles. Every field is in native byte order and aligned to 8 bytes.
+ * The block index stores the offset and the first trajectory of each
+ * block, so that the blocks can be read at random or in parallel.
+ */
+struct TrajectoryFileHeader {
+  char magic[8]; /**< FMMTRAJ followed by a null character */
+  uint32_t version; /**< version of the format */
+  uint32_t flags; /**< bit 0 is set if the file has timestamps */
+  uint64_t num_trajectories; /**< number of trajectories */
+  uint64_t num_blocks; /**< number of blocks */
+  uint64_t index_offset; /**< offset of the block index */
+};
+
+/**
+ * Entry of the block index
+ */
+struct TrajectoryBlock {
+  uint64_t offset; /**< offset of the first record in the block */
+  uint64_t first_trajectory; /**< index of the first trajectory */
+};
+
+/**
+ * Writer of a binary trajectory file
+ */
+class TrajectoryFileWriter {
+ public:
+  /**
+   * Constructor, std::runtime_error is thrown if the file cannot be
+   * created.
+   * @param filename   file name
+   * @param write_timestamp if true, timestamps are written
+   * @param block_size number of trajectories in a block
+   */
+  TrajectoryFileWriter(const std::string &filename, bool write_timestamp,
+                       int block_size = 1024);
+  /**
+   * Destructor, the file is closed if it is not closed yet.
+   */
+  ~TrajectoryFileWriter();
+  /**
+   * Write a trajectory, std::runtime_error is thrown if timestamps are
+   * written and the trajectory has not one timestamp per point.
+   */
+  void write(const CORE::Trajectory &trajectory);
+  /**
+   * Write the block index and the header, and close the file
+   */
+  void close();
+ private:
+  std::ofstream ofs_;
+  bool write_timestamp_;
+  int block_size_;
+  uint64_t offset_ = 0;
+  uint64_t num_trajectories_ = 0;
+  std::vector<TrajectoryBlock> blocks_;
+  std::vector<double> values_;
+};
+
+/**
+ * Trajectory Reader class for binary trajectory file, which is memory
+ * mapped and read in place.
+ */
+class BinaryTrajectoryReader : public ITrajectoryReader {
+ public:
+  /**
+   * Constructor, std::runtime_error is thrown if the file is not a valid
+   * binary trajectory file.
+   * @param filename file name
+   */
+  explicit BinaryTrajectoryReader(const std::string &filename);
+  /**
+   * Read the next trajectory in the file.
+   * @return A trajectory object
+   */
+  FMM::CORE::Trajectory read_next_trajectory() override;
+  /**
+   * Check if the file still contains trajectory not read
+   * @return true if there is still any trajectory not read
+   */
+  bool has_next_trajectory() override;
+  /**
+   * Check if the file contains timestamp information
+   * @return true if it contains timestamp
+   */
+  bool has_timestamp() override;
+  /**
+   * Close the reader object, the file is unmapped.
+   */
+  void close() override;
+  /**
+   * Reset cursor of the reader
+   */
+  void reset_cursor();
+  /**
+   * Get the number of trajectories in the file
+   */
+  long long get_num_trajectories() const;
+  /**
+   * Get the number of blocks in the file
+   */
+  uint64_t get_num_blocks() const;
+  /**
+   * Move the cursor to the first trajectory of a block, std::out_of_range
+   * is thrown if the block does not exist
+   */
+  void seek_block(uint64_t block);
+  /**
+   * Read all the trajectories of a block. It does not move the cursor
+   * and can be called concurrently.
+   * @param block index of the block
+   * @param trajectories the trajectories are appended to it
+   */
+  void read_block(uint64_t block,
+                  std::vector<FMM::CORE::Trajectory> *trajectories) const;
+ private:
+  /**
+   * Read the record at a position
+   * @param  pos position of the record
+   * @param  trajectory set to the trajectory read
+   * @return position of the next record
+   */
+  const char *read_record(const char *pos,
+                          FMM::CORE::Trajectory *trajectory) const;
+  bool has_timestamp_flag() const;
+  MappedFile file_;
+  TrajectoryFileHeader header_;
+  const TrajectoryBlock *blocks_ = nullptr;
+  const char *cursor_ = nullptr;
+  const char *records_end_ = nullptr;
+};
+
+/**
+ * Convert a GPS file readable by GPSReader into a binary trajectory file.
+ * @param  config   configuration of the GPS file
+ * @param  filename binary trajectory file to write
+ * @return number of trajectories converted
+ */
+long long convert_to_trajectory_file(const CONFIG::GPSConfig &config,
+                                     const std::string &filename);
+
+} // IO
+} // FMM
+
+#endif //FMM_TRAJECTORY_FILE_HPP
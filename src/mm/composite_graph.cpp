@@ -1,6 +1,11 @@
 #include "mm/composite_graph.hpp"
 #include "util/debug.hpp"
 
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <boost/format.hpp>
+
 using namespace FMM;
 using namespace FMM::CORE;
 using namespace FMM::NETWORK;
@@ -11,6 +16,19 @@ DummyGraph::DummyGraph(){}
 DummyGraph::DummyGraph(const Traj_Candidates &traj_candidates,
   double reverse_tolerance){
   if (traj_candidates.empty()) return;
+  dummy_start = std::numeric_limits<NodeIndex>::max();
+  dummy_end = 0;
+  for (const Point_Candidates &pcs : traj_candidates) {
+    for (const Candidate &c : pcs) {
+      dummy_start = std::min(dummy_start, c.index);
+      dummy_end = std::max(dummy_end, c.index + 1);
+    }
+  }
+  if (dummy_end <= dummy_start) {
+    dummy_start = dummy_end = 0;
+    return;
+  }
+  dummy_points.resize(dummy_end - dummy_start);
   int N = traj_candidates.size();
   std::unordered_map<EdgeIndex,const Candidate*> ca;
   std::unordered_map<EdgeIndex,const Candidate*> cb;
@@ -20,6 +38,7 @@ DummyGraph::DummyGraph(const Traj_Candidates &traj_candidates,
     const Point_Candidates &pcs = traj_candidates[i];
     for (const Candidate &c:pcs) {
       NodeIndex n = c.index;
+      dummy_points[n - dummy_start] = c.point;
       add_edge(c.edge->source, n, c.edge->index, c.offset);
       add_edge(n,c.edge->target, c.edge->index, c.edge->length - c.offset);
       cur_cmap->insert(std::make_pair(c.edge->index,&c));
@@ -40,22 +59,67 @@ DummyGraph::DummyGraph(const Traj_Candidates &traj_candidates,
     cur_cmap = temp;
     cur_cmap->clear();
   }
+  // Group the edges by source, keeping the order they are added
+  auto source_less = [](const DummyEdge &a, const DummyEdge &b) {
+    return a.source < b.source;
+  };
+  std::stable_sort(network_edges.begin(), network_edges.end(), source_less);
+  std::stable_sort(dummy_edges.begin(), dummy_edges.end(), source_less);
+  dummy_offsets.assign(dummy_end - dummy_start + 1, 0);
+  for (const DummyEdge &e : dummy_edges) {
+    ++dummy_offsets[e.source - dummy_start + 1];
+  }
+  for (int i = 1; i < dummy_offsets.size(); ++i) {
+    dummy_offsets[i] += dummy_offsets[i - 1];
+  }
+  external_index_vec.reserve(2 * get_num_edges());
+  for (const std::vector<DummyEdge> *edges : {&network_edges, &dummy_edges}) {
+    for (const DummyEdge &e : *edges) {
+      external_index_vec.push_back(e.source);
+      external_index_vec.push_back(e.target);
+    }
+  }
+  std::sort(external_index_vec.begin(), external_index_vec.end());
+  external_index_vec.erase(
+    std::unique(external_index_vec.begin(), external_index_vec.end()),
+    external_index_vec.end());
 }
 
 Graph_T *DummyGraph::get_graph_ptr(){
+  get_boost_graph();
   return &g;
 }
 
 const Graph_T &DummyGraph::get_boost_graph() const {
+  if (!graph_built) {
+    g = Graph_T(external_index_vec.size());
+    for (const std::vector<DummyEdge> *edges :
+         {&network_edges, &dummy_edges}) {
+      for (const DummyEdge &de : *edges) {
+        EdgeDescriptor e;
+        bool inserted;
+        boost::tie(e, inserted) = boost::add_edge(
+          get_internal_index(de.source), get_internal_index(de.target), g);
+        g[e].index = de.index;
+        g[e].length = de.cost;
+      }
+    }
+    graph_built = true;
+  }
   return g;
 }
 
 int DummyGraph::get_num_vertices() const {
-  return boost::num_vertices(g);
+  return external_index_vec.size();
+}
+
+int DummyGraph::get_num_edges() const {
+  return network_edges.size() + dummy_edges.size();
 }
 
-bool DummyGraph::containNodeIndex(NodeIndex external_index) const {
-  return internal_index_map.find(external_index)!=internal_index_map.end();
+bool DummyGraph::containNodeIndex(NodeIndex index) const {
+  return std::binary_search(external_index_vec.begin(),
+                            external_index_vec.end(), index);
 }
 
 NodeIndex DummyGraph::get_external_index(DummyIndex inner_index) const {
@@ -63,66 +127,66 @@ NodeIndex DummyGraph::get_external_index(DummyIndex inner_index) const {
 }
 
 DummyIndex DummyGraph::get_internal_index(NodeIndex external_index) const {
-  return internal_index_map.at(external_index);
+  auto iter = std::lower_bound(external_index_vec.begin(),
+                               external_index_vec.end(), external_index);
+  if (iter == external_index_vec.end() || *iter != external_index) {
+    throw std::out_of_range(
+      (boost::format("Node %1% not found in dummy graph")
+       % external_index).str());
+  }
+  return iter - external_index_vec.begin();
+}
+
+void DummyGraph::print_node_index_map() const {
+  std::cout<<"Inner index map\n";
+  for (DummyIndex i = 0; i < external_index_vec.size(); ++i) {
+    std::cout << "{" << external_index_vec[i] << ": " << i << "}\n";
+  }
+}
+
+void DummyGraph::out_edges(NodeIndex u, const DummyEdge **begin,
+                           const DummyEdge **end) const {
+  if (u >= dummy_start && u < dummy_end) {
+    *begin = dummy_edges.data() + dummy_offsets[u - dummy_start];
+    *end = dummy_edges.data() + dummy_offsets[u - dummy_start + 1];
+  } else {
+    auto range = std::equal_range(
+      network_edges.begin(), network_edges.end(),
+      DummyEdge{u, 0, 0, 0},
+      [](const DummyEdge &a, const DummyEdge &b) {
+      return a.source < b.source;
+    });
+    *begin = network_edges.data() + (range.first - network_edges.begin());
+    *end = network_edges.data() + (range.second - network_edges.begin());
+  }
 }
 
 int DummyGraph::get_edge_index(NodeIndex source,NodeIndex target,double cost)
 const {
   SPDLOG_TRACE("Dummy graph get edge index {} {} cost {}",source,target,cost);
-  EdgeDescriptor e;
-  OutEdgeIterator out_i, out_end;
-  NodeIndex source_idx = get_internal_index(source);
-  NodeIndex target_idx = get_internal_index(target);
-  for (boost::tie(out_i, out_end) = boost::out_edges(source_idx,g);
-       out_i != out_end; ++out_i) {
-    e = *out_i;
-    SPDLOG_TRACE("Target index {} {} id {} e length {} {}",
-                 target_idx, boost::target(e,g),
-                 g[e].index,
-                 g[e].length,
-                 std::abs(g[e].length - cost));
-    if (target_idx == boost::target(e,g) &&
-        (std::abs(g[e].length - cost) <= DOUBLE_MIN)) {
-      return g[e].index;
+  const DummyEdge *begin, *end;
+  out_edges(source, &begin, &end);
+  for (const DummyEdge *e = begin; e != end; ++e) {
+    if (e->target == target && (std::abs(e->cost - cost) <= DOUBLE_MIN)) {
+      return e->index;
     }
   }
   return -1;
 }
 
-void DummyGraph::print_node_index_map() const {
-  std::cout<<"Inner index map\n";
-  for (auto const& pair:internal_index_map) {
-    std::cout << "{" << pair.first << ": " << pair.second << "}\n";
-  }
+const Point &DummyGraph::get_dummy_point(NodeIndex u) const {
+  return dummy_points[u - dummy_start];
 }
 
 void DummyGraph::add_edge(NodeIndex source, NodeIndex target,
                           EdgeIndex edge_index, double cost) {
   // SPDLOG_TRACE("  Add edge {} {} e {} cost {}",
   //               source,target,edge_index,cost);
-  auto search1 = internal_index_map.find(source);
-  auto search2 = internal_index_map.find(target);
-  DummyIndex source_idx, target_idx;
-  if (search1!=internal_index_map.end()) {
-    source_idx = search1->second;
+  if (source >= dummy_start && source < dummy_end) {
+    dummy_edges.push_back(DummyEdge{source, target, edge_index, cost});
   } else {
-    source_idx = external_index_vec.size();
-    external_index_vec.push_back(source);
-    internal_index_map.insert({source,source_idx});
+    network_edges.push_back(DummyEdge{source, target, edge_index, cost});
   }
-  if (search2!=internal_index_map.end()) {
-    target_idx = search2->second;
-  } else {
-    target_idx = external_index_vec.size();
-    external_index_vec.push_back(target);
-    internal_index_map.insert({target,target_idx});
-  }
-  EdgeDescriptor e;
-  bool inserted;
-  boost::tie(e, inserted) = boost::add_edge(source_idx,target_idx,g);
-  // id is the FID read, id_attr is the external property in SHP
-  g[e].index = edge_index;
-  g[e].length = cost;
 }
 
 CompositeGraph::CompositeGraph(const NetworkGraph &g,const DummyGraph &dg) :
@@ -148,34 +212,31 @@ const {
   return g_.get_edge_id(get_edge_index(u,v,cost));
 }
 
-std::vector<CompEdgeProperty> CompositeGraph::out_edges(NodeIndex u) const {
-  std::vector<CompEdgeProperty> out_edges;
-  OutEdgeIterator out_i, out_end;
-  EdgeDescriptor e;
-  if (dg_.containNodeIndex(u)) {
-    const Graph_T &dg = dg_.get_boost_graph();
-    NodeIndex u_internal = dg_.get_internal_index(u);
-    for (boost::tie(out_i, out_end) = boost::out_edges(u_internal,dg);
-         out_i != out_end; ++out_i) {
-      e = *out_i;
-      NodeIndex v_internal = boost::target(e, dg);
-      NodeIndex v = dg_.get_external_index(v_internal);
-      out_edges.push_back(CompEdgeProperty{v,dg[e].length});
-    }
-  }
+CompOutEdgeRange CompositeGraph::out_edges(NodeIndex u) const {
+  const DummyEdge *dummy_begin, *dummy_end;
+  dg_.out_edges(u, &dummy_begin, &dummy_end);
   if (u < num_vertices) {
     const Graph_T &g = g_.get_boost_graph();
-    for (boost::tie(out_i, out_end)=boost::out_edges(u,g);
-         out_i != out_end; ++out_i) {
-      e = *out_i;
-      NodeIndex v = boost::target(e, g);
-      // Export a pair of (v,cost)
-      out_edges.push_back(CompEdgeProperty{v,g[e].length});
-    }
+    OutEdgeIterator out_i, out_end;
+    boost::tie(out_i, out_end) = boost::out_edges(u, g);
+    return CompOutEdgeRange{
+      CompOutEdgeIterator(dummy_begin, dummy_end, &g, out_i, out_end),
+      CompOutEdgeIterator(dummy_end, dummy_end, &g, out_end, out_end)};
   }
-  return out_edges;
+  return CompOutEdgeRange{
+    CompOutEdgeIterator(dummy_begin, dummy_end, nullptr,
+                        OutEdgeIterator(), OutEdgeIterator()),
+    CompOutEdgeIterator(dummy_end, dummy_end, nullptr,
+                        OutEdgeIterator(), OutEdgeIterator())};
 }
 
 bool CompositeGraph::check_dummy_node(NodeIndex u) const {
   return u>=num_vertices;
 }
+
+const Point &CompositeGraph::get_node_point(NodeIndex u) const {
+  if (u >= num_vertices) {
+    return dg_.get_dummy_point(u);
+  }
+  return g_.get_vertex_point(u);
+}
@@ -22,11 +22,25 @@ namespace MM {
  */
 typedef unsigned int DummyIndex;
 
+/**
+ * An edge connecting a dummy node in the dummy graph
+ */
+struct DummyEdge {
+  NETWORK::NodeIndex source; /**< Source node index */
+  NETWORK::NodeIndex target; /**< Target node index */
+  NETWORK::EdgeIndex index; /**< Index of the network edge it lies on */
+  double cost; /**< Cost of the edge */
+};
+
 /**
  * A graph containing dummy nodes and edges used in map matching.
  * It connects candidate node (dummy node) matched to GPS observations
  * with the nodes in the original road network. The connected edges
  * are dummy edges.
+ *
+ * The edges are stored in two flat arrays sorted by source node, one for
+ * edges leaving a network node and the other for edges leaving a dummy
+ * node, so that the out edges of a node are a contiguous range.
  */
 class DummyGraph {
  public:
@@ -44,23 +58,31 @@ class DummyGraph {
    */
   DummyGraph(const Traj_Candidates &traj_candidates,
              double reverse_tolerance=0);
-
   /**
    * Get the inner graph data
+   *
+   * The boost graph is built from the dummy edges on the first call,
+   * modifying it has no effect on the edges used in map matching.
+   *
    * @return A pointer to the inner boost graph.
    */
   NETWORK::Graph_T *get_graph_ptr();
-
   /**
    * Get a const reference to the inner graph data
-   * @return A pointer to the inner boost graph.
+   *
+   * The boost graph is built from the dummy edges on the first call.
+   *
+   * @return A reference to the inner boost graph.
    */
   const NETWORK::Graph_T &get_boost_graph() const;
-
   /**
    * Get the number of vertices in the dummy graph
    */
   int get_num_vertices() const;
+  /**
+   * Get the number of edges in the dummy graph
+   */
+  int get_num_edges() const;
   /**
    * Check if a node is contained in the dummy graph
    *
@@ -68,11 +90,10 @@ class DummyGraph {
    * dummy node representing a candidate or (b) it is the end
    * node of a matched candidate edge.
    *
-   * @param  external_index The NodeIndex of a node
+   * @param  index The NodeIndex of a node
    * @return true if a node is contained
    */
-  bool containNodeIndex(NETWORK::NodeIndex external_index) const;
-
+  bool containNodeIndex(NETWORK::NodeIndex index) const;
   /**
    * Get the NodeIndex of a node according to the inner index of the
    * dummy graph
@@ -80,17 +101,29 @@ class DummyGraph {
    * @return a node index of the node in the original network graph
    */
   NETWORK::NodeIndex get_external_index(DummyIndex inner_index) const;
-
   /**
    * Get the internal index of a node in dummy graph
+   *
+   * Inner indices follow the ascending order of the node indices.
    * If the node is not contained in the dummy graph, an exception will be
    * thrown. Call the containNodeIndex before invoking this function.
    *
    * @param  external_index The node index in original network graph
    * @return  a internal index
-   *
    */
   DummyIndex get_internal_index(NETWORK::NodeIndex external_index) const;
+  /**
+   * Print the mapping from dummy index to node index
+   */
+  void print_node_index_map() const;
+  /**
+   * Get the dummy edges leaving a node
+   * @param u    node index
+   * @param begin set to the first edge
+   * @param end   set to the position after the last edge
+   */
+  void out_edges(NETWORK::NodeIndex u, const DummyEdge **begin,
+                 const DummyEdge **end) const;
   /**
    * Get the edge index in the original network graph.
    * @param  source source NodeIndex in the original network graph
@@ -102,9 +135,12 @@ class DummyGraph {
   int get_edge_index(NETWORK::NodeIndex source,
                      NETWORK::NodeIndex target, double cost) const;
   /**
-   * Print the mapping from dummy index to node index
+   * Get the point of a dummy node, which is the matched point of the
+   * candidate.
+   * @param  u dummy node index
+   * @return point of the candidate
    */
-  void print_node_index_map() const;
+  const CORE::Point &get_dummy_point(NETWORK::NodeIndex u) const;
  protected:
   /**
    * Add an edge to the dummy graph
@@ -118,9 +154,22 @@ class DummyGraph {
                 NETWORK::EdgeIndex edge_index, double cost);
  private:
   static constexpr double DOUBLE_MIN = 1e-6;
-  NETWORK::Graph_T g;
+  // Candidate nodes fall in [dummy_start, dummy_end)
+  NETWORK::NodeIndex dummy_start = 0;
+  NETWORK::NodeIndex dummy_end = 0;
+  // Edges leaving a network node, sorted by source
+  std::vector<DummyEdge> network_edges;
+  // Edges leaving a dummy node, grouped by source
+  std::vector<DummyEdge> dummy_edges;
+  // Offsets of the edges of dummy node dummy_start+i in dummy_edges
+  std::vector<unsigned int> dummy_offsets;
+  // Sorted node indices of the dummy graph, position is the inner index
   std::vector<NETWORK::NodeIndex> external_index_vec;
-  std::unordered_map<NETWORK::NodeIndex, DummyIndex> internal_index_map;
+  // Boost graph over the inner indices, built on demand
+  mutable NETWORK::Graph_T g;
+  mutable bool graph_built = false;
+  // Matched point of dummy node dummy_start+i
+  std::vector<CORE::Point> dummy_points;
 };
 
 /**
@@ -131,6 +180,70 @@ struct CompEdgeProperty {
   double cost; /**< Cost of an edge */
 };
 
+/**
+ * Iterator over the out edges of a node in the composite graph.
+ *
+ * The dummy edges are visited first and then the edges of the network
+ * graph, both are read in place without copying.
+ */
+class CompOutEdgeIterator {
+ public:
+  /**
+   * Constructor of an iterator
+   * @param dummy_i   current dummy edge
+   * @param dummy_end end of the dummy edges
+   * @param g         network graph, nullptr if the node is a dummy node
+   * @param base_i    current network edge
+   * @param base_end  end of the network edges
+   */
+  CompOutEdgeIterator(const DummyEdge *dummy_i, const DummyEdge *dummy_end,
+                      const NETWORK::Graph_T *g,
+                      NETWORK::OutEdgeIterator base_i,
+                      NETWORK::OutEdgeIterator base_end) :
+    dummy_i_(dummy_i), dummy_end_(dummy_end), g_(g),
+    base_i_(base_i), base_end_(base_end) {
+  };
+  inline CompEdgeProperty operator*() const {
+    if (dummy_i_ != dummy_end_) {
+      return CompEdgeProperty{dummy_i_->target, dummy_i_->cost};
+    }
+    return CompEdgeProperty{
+      static_cast<NETWORK::NodeIndex>(boost::target(*base_i_, *g_)),
+                            (*g_)[*base_i_].length};
+  };
+  inline CompOutEdgeIterator &operator++() {
+    if (dummy_i_ != dummy_end_) {
+      ++dummy_i_;
+    } else {
+      ++base_i_;
+    }
+    return *this;
+  };
+  inline bool operator==(const CompOutEdgeIterator &rhs) const {
+    return dummy_i_ == rhs.dummy_i_ &&
+      (g_ == nullptr || base_i_ == rhs.base_i_);
+  };
+  inline bool operator!=(const CompOutEdgeIterator &rhs) const {
+    return !(*this == rhs);
+  };
+ private:
+  const DummyEdge *dummy_i_;
+  const DummyEdge *dummy_end_;
+  const NETWORK::Graph_T *g_;
+  NETWORK::OutEdgeIterator base_i_;
+  NETWORK::OutEdgeIterator base_end_;
+};
+
+/**
+ * Range of the out edges of a node in the composite graph
+ */
+struct CompOutEdgeRange {
+  CompOutEdgeIterator first; /**< iterator to the first edge */
+  CompOutEdgeIterator second; /**< iterator past the last edge */
+  inline CompOutEdgeIterator begin() const {return first;};
+  inline CompOutEdgeIterator end() const {return second;};
+};
+
 /**
  * Composite Graph as a wrapper of network graph and dummy graph.
  */
@@ -160,14 +273,20 @@ class CompositeGraph {
   NETWORK::EdgeID get_edge_id(NETWORK::NodeIndex u,
                      NETWORK::NodeIndex v, double cost) const;
   /**
-   * Get out edges leaving a node u in the composite graph
+   * Get out edges leaving a node u in the composite graph. No memory is
+   * allocated, the range is valid as long as the graphs are alive.
    */
-  std::vector<CompEdgeProperty> out_edges(NETWORK::NodeIndex u) const;
+  CompOutEdgeRange out_edges(NETWORK::NodeIndex u) const;
   /**
    * Check if a node u is dummy node, namely representing
    * a candidate point
    */
   bool check_dummy_node(NETWORK::NodeIndex u) const;
+  /**
+   * Get the point of a node u, which is the vertex point of a network
+   * node or the matched point of a dummy node.
+   */
+  const CORE::Point &get_node_point(NETWORK::NodeIndex u) const;
  private:
   const NETWORK::NetworkGraph &g_;
   const DummyGraph &dg_;
@@ -8,6 +8,10 @@
 #include "util/debug.hpp"
 #include "io/gps_reader.hpp"
 #include "io/mm_writer.hpp"
+#include "mm/mm_pipeline.hpp"
+
+#include <chrono>
+#include <stdexcept>
 
 
 using namespace FMM;
@@ -18,15 +22,22 @@ using namespace FMM::MM;
 
 FastMapMatchConfig::FastMapMatchConfig(int k_arg, double r_arg,
                                        double gps_error,
-                                       double reverse_tolerance) :
+                                       double reverse_tolerance,
+                                       int beam_width,
+                                       double prune_margin,
+                                       double fallback_factor) :
   k(k_arg), radius(r_arg), gps_error(gps_error),
-  reverse_tolerance(reverse_tolerance) {
+  reverse_tolerance(reverse_tolerance),
+  beam_width(beam_width), prune_margin(prune_margin),
+  fallback_factor(fallback_factor) {
 };
 
 void FastMapMatchConfig::print() const {
   SPDLOG_INFO("FMMAlgorithmConfig");
   SPDLOG_INFO("k {} radius {} gps_error {} reverse_tolerance {}",
     k, radius, gps_error, reverse_tolerance);
+  SPDLOG_INFO("beam_width {} prune_margin {}", beam_width, prune_margin);
+  SPDLOG_INFO("fallback_factor {}", fallback_factor);
 };
 
 FastMapMatchConfig FastMapMatchConfig::load_from_xml(
@@ -36,7 +47,12 @@ FastMapMatchConfig FastMapMatchConfig::load_from_xml(
   double gps_error = xml_data.get("config.parameters.gps_error", 50.0);
   double reverse_tolerance =
     xml_data.get("config.parameters.reverse_tolerance", 0.0);
-  return FastMapMatchConfig{k, radius, gps_error, reverse_tolerance};
+  int beam_width = xml_data.get("config.parameters.beam_width", 0);
+  double prune_margin = xml_data.get("config.parameters.prune_margin", 0.0);
+  double fallback_factor =
+    xml_data.get("config.parameters.fallback_factor", 0.0);
+  return FastMapMatchConfig{k, radius, gps_error, reverse_tolerance,
+                            beam_width, prune_margin, fallback_factor};
 };
 
 FastMapMatchConfig FastMapMatchConfig::load_from_arg(
@@ -45,7 +61,11 @@ FastMapMatchConfig FastMapMatchConfig::load_from_arg(
   double radius = arg_data["radius"].as<double>();
   double gps_error = arg_data["error"].as<double>();
   double reverse_tolerance = arg_data["reverse_tolerance"].as<double>();
-  return FastMapMatchConfig{k, radius, gps_error, reverse_tolerance};
+  int beam_width = arg_data["beam_width"].as<int>();
+  double prune_margin = arg_data["prune_margin"].as<double>();
+  double fallback_factor = arg_data["fallback_factor"].as<double>();
+  return FastMapMatchConfig{k, radius, gps_error, reverse_tolerance,
+                            beam_width, prune_margin, fallback_factor};
 };
 
 void FastMapMatchConfig::register_arg(cxxopts::Options &options){
@@ -57,7 +77,13 @@ void FastMapMatchConfig::register_arg(cxxopts::Options &options){
     ("reverse_tolerance","Ratio of reverse movement allowed",
       cxxopts::value<double>()->default_value("0.0"))
     ("e,error","GPS error",
-    cxxopts::value<double>()->default_value("50.0"));
+    cxxopts::value<double>()->default_value("50.0"))
+    ("beam_width","Maximum candidates expanded per point",
+      cxxopts::value<int>()->default_value("0"))
+    ("prune_margin","Log probability margin to prune candidates",
+      cxxopts::value<double>()->default_value("0.0"))
+    ("fallback_factor","Bound factor of graph search beyond UBODT",
+      cxxopts::value<double>()->default_value("0.0"));
 }
 
 void FastMapMatchConfig::register_help(std::ostringstream &oss){
@@ -68,14 +94,25 @@ void FastMapMatchConfig::register_help(std::ostringstream &oss){
     "(network data unit) (50)\n";
   oss<<"--reverse_tolerance (optional) <double>: proportion "
       "of reverse movement allowed on an edge\n";
+  oss<<"--beam_width (optional) <int>: maximum number of candidates "
+      "of a point expanded to the next point, 0 for no limit (0)\n";
+  oss<<"--prune_margin (optional) <double>: candidates with log "
+      "probability lower than the best one by this margin are not "
+      "expanded, 0 for no limit (0)\n";
+  oss<<"--fallback_factor (optional) <double>: transitions not found "
+      "in UBODT are searched in the network within this factor "
+      "multiplied with the Euclidean distance, 0 to disable (0)\n";
 };
 
 bool FastMapMatchConfig::validate() const {
   if (gps_error <= 0 || radius <= 0 || k <= 0 || reverse_tolerance <0
-    || reverse_tolerance>1 ) {
+    || reverse_tolerance>1 || beam_width < 0 || prune_margin < 0
+    || fallback_factor < 0) {
     SPDLOG_CRITICAL(
-      "Invalid mm parameter k {} r {} gps error {} reverse_tolerance {}",
-                    k, radius, gps_error,reverse_tolerance);
+      "Invalid mm parameter k {} r {} gps error {} reverse_tolerance {} "
+      "beam_width {} prune_margin {} fallback_factor {}",
+                    k, radius, gps_error,reverse_tolerance,
+                    beam_width, prune_margin, fallback_factor);
     return false;
   }
   return true;
@@ -93,7 +130,9 @@ MatchResult FastMapMatch::match_traj(const Trajectory &traj,
   TransitionGraph tg(tc, config.gps_error);
   SPDLOG_DEBUG("Update cost in transition graph");
   // The network will be used internally to update transition graph
-  update_tg(&tg, traj, config.reverse_tolerance);
+  UBODTFallback fallback(graph_);
+  update_tg(&tg, traj, config,
+            config.fallback_factor > 0 ? &fallback : nullptr);
   SPDLOG_DEBUG("Optimal path inference");
   TGOpath tg_opath = tg.backtrack();
   SPDLOG_DEBUG("Optimal path size {}", tg_opath.size());
@@ -113,14 +152,31 @@ MatchResult FastMapMatch::match_traj(const Trajectory &traj,
   });
   std::vector<int> indices;
   const std::vector<Edge> &edges = network_.get_edges();
-  C_Path cpath = ubodt_->construct_complete_path(traj.id, tg_opath, edges,
-                                                 &indices,
-                                                 config.reverse_tolerance);
+  // Paths of the transitions found by the fallback search
+  std::vector<std::vector<EdgeIndex>> fallback_paths;
+  if (fallback.get_num_searches() > 0) {
+    for (int i = 0; i + 1 < tg_opath.size(); ++i) {
+      const Candidate *a = tg_opath[i]->c;
+      const Candidate *b = tg_opath[i + 1]->c;
+      if (need_ubodt_query(a, b, config.reverse_tolerance) &&
+          ubodt_->look_up(a->edge->target, b->edge->source) == nullptr) {
+        fallback_paths.push_back(
+          fallback.get_path(a->edge->target, b->edge->source));
+      } else {
+        fallback_paths.push_back({});
+      }
+    }
+  }
+  C_Path cpath = ubodt_->construct_complete_path(
+    traj.id, tg_opath, edges, &indices, config.reverse_tolerance,
+    fallback_paths.empty() ? nullptr : &fallback_paths);
   SPDLOG_DEBUG("Opath is {}", opath);
   SPDLOG_DEBUG("Indices is {}", indices);
   SPDLOG_DEBUG("Complete path is {}", cpath);
   LineString mgeom = network_.complete_path_to_geometry(
     traj.geom, cpath);
+  ubodt_->flush_cache_stats();
+  fallback_searches_ += fallback.get_num_searches();
   return MatchResult{
     traj.id, matched_candidate_path, opath, cpath, indices, mgeom};
 }
@@ -156,6 +212,28 @@ PyMatchResult FastMapMatch::match_wkt(
   return output;
 };
 
+PyBatchMatchResult FastMapMatch::match_batch(
+  const std::vector<int> &ids, const std::vector<double> &xs,
+  const std::vector<double> &ys, const std::vector<double> &timestamps,
+  const FastMapMatchConfig &config) {
+  std::vector<Trajectory> trajectories = group_trajectories(
+    ids, xs, ys, timestamps);
+  std::vector<MatchResult> results(trajectories.size());
+  std::string error;
+  #pragma omp parallel for schedule(dynamic)
+  for (int i = 0; i < trajectories.size(); ++i) {
+    // An exception cannot leave the parallel region
+    try {
+      results[i] = match_traj(trajectories[i], config);
+    } catch (const std::exception &e) {
+      #pragma omp critical
+      error = e.what();
+    }
+  }
+  if (!error.empty()) throw std::runtime_error(error);
+  return collect_batch_results(trajectories, results);
+};
+
 std::string FastMapMatch::match_gps_file(
   const FMM::CONFIG::GPSConfig &gps_config,
   const FMM::CONFIG::ResultConfig &result_config,
@@ -190,36 +268,41 @@ std::string FastMapMatch::match_gps_file(
   int step_size = 1000;
   auto begin_time = UTIL::get_current_time();
   FMM::IO::GPSReader reader(gps_config);
-  FMM::IO::CSVMatchResultWriter writer(result_config.file,
-                                       result_config.output_config);
+  FMM::IO::ResultWriter writer(result_config);
+  // Progress is kept out of the results written to the standard output
+  std::ostream &progress_stream =
+    result_config.is_standard_output() ? std::cerr : std::cout;
   if (use_omp){
-    int buffer_trajectories_size = 100000;
-    while (reader.has_next_trajectory()) {
-      std::vector<Trajectory> trajectories =
-        reader.read_next_N_trajectories(buffer_trajectories_size);
-      int trajectories_fetched = trajectories.size();
-      #pragma omp parallel for
-      for (int i = 0; i < trajectories_fetched; ++i) {
-        Trajectory &trajectory = trajectories[i];
-        int points_in_tr = trajectory.geom.get_num_points();
-        MM::MatchResult result = match_traj(
-            trajectory, fmm_config);
-        writer.write_result(trajectory,result);
-        #pragma omp critical
-        if (!result.cpath.empty()) {
-          points_matched += points_in_tr;
-          traj_matched+=1;
-        }
-        total_points += points_in_tr;
-        total_trajs += 1;
-        ++progress;
-        if (progress % step_size == 0) {
-          std::stringstream buf;
-          buf << "Progress " << progress << '\n';
-          std::cout << buf.rdbuf();
-        }
-      }
+    // The results written to the standard output are passed on once
+    // the workers run out of results
+    MatchPipeline<MatchResult>::FlushFunction flush;
+    if (result_config.is_standard_output()) {
+      flush = [&writer] { writer.flush(); };
     }
+    MatchPipeline<MatchResult> pipeline(0, 1000, 1000,
+      result_config.ordered);
+    pipeline.run(&reader, [&](const Trajectory &trajectory) {
+      return match_traj(trajectory, fmm_config);
+    }, [&](const Trajectory &trajectory, const MatchResult &result,
+           std::string *text) {
+      writer.format_result(trajectory, result, text);
+    }, [&](const Trajectory &trajectory, const MatchResult &result,
+           const std::string &text) {
+      int points_in_tr = trajectory.geom.get_num_points();
+      writer.write_text(text);
+      if (!result.cpath.empty()) {
+        points_matched += points_in_tr;
+        traj_matched+=1;
+      }
+      total_points += points_in_tr;
+      total_trajs += 1;
+      ++progress;
+      if (progress % step_size == 0) {
+        std::stringstream buf;
+        buf << "Progress " << progress << '\n';
+        progress_stream << buf.rdbuf();
+      }
+    }, flush);
   } else {
     while (reader.has_next_trajectory()) {
       if (progress % step_size == 0) {
@@ -248,11 +331,49 @@ std::string FastMapMatch::match_gps_file(
      << traj_matched <<"\n";
   oss<<"Map match percentage " << points_matched / (double) total_points <<"\n";
   oss<<"Map match speed " << points_matched / duration << " points/s \n";
+  if (fmm_config.beam_width > 0 || fmm_config.prune_margin > 0) {
+    oss<<"Transitions pruned " << get_pruned_transitions() <<"\n";
+  }
+  if (fmm_config.fallback_factor > 0) {
+    oss<<"Fallback searches " << get_fallback_searches() <<"\n";
+  }
+  UBODTCacheStats cache_stats = ubodt_->get_cache_stats();
+  oss<<"UBODT cache hits " << cache_stats.hits << " misses "
+     << cache_stats.misses << "\n";
+  oss<<"UBODT path cache hits " << cache_stats.path_hits << " misses "
+     << cache_stats.path_misses << "\n";
   return oss.str();
 };
 
+long long FastMapMatch::get_pruned_transitions() const {
+  return pruned_transitions_;
+}
+
+long long FastMapMatch::get_fallback_searches() const {
+  return fallback_searches_;
+}
+
 double FastMapMatch::get_sp_dist(
   const Candidate *ca, const Candidate *cb, double reverse_tolerance) {
+  Record *r = nullptr;
+  if (need_ubodt_query(ca, cb, reverse_tolerance)) {
+    r = ubodt_->look_up_cached(ca->edge->target, cb->edge->source);
+  }
+  return get_sp_dist(ca, cb, reverse_tolerance, r);
+}
+
+bool FastMapMatch::need_ubodt_query(
+  const Candidate *ca, const Candidate *cb, double reverse_tolerance) {
+  if (ca->edge->id == cb->edge->id && (ca->offset <= cb->offset ||
+      ca->offset - cb->offset < ca->edge->length * reverse_tolerance)) {
+    return false;
+  }
+  return ca->edge->target != cb->edge->source;
+}
+
+double FastMapMatch::get_sp_dist(
+  const Candidate *ca, const Candidate *cb, double reverse_tolerance,
+  const Record *r) {
   double sp_dist = 0;
   if (ca->edge->id == cb->edge->id && ca->offset <= cb->offset) {
     sp_dist = cb->offset - ca->offset;
@@ -264,7 +385,6 @@ double FastMapMatch::get_sp_dist(
     // Transition on the same OD nodes
     sp_dist = ca->edge->length - ca->offset + cb->offset;
   } else {
-    Record *r = ubodt_->look_up(ca->edge->target, cb->edge->source);
     // No sp path exist from O to D.
     if (r == nullptr) return std::numeric_limits<double>::infinity();
     // calculate original SP distance
@@ -275,16 +395,31 @@ double FastMapMatch::get_sp_dist(
 
 void FastMapMatch::update_tg(
   TransitionGraph *tg,
-  const Trajectory &traj, double reverse_tolerance) {
+  const Trajectory &traj, const FastMapMatchConfig &config,
+  UBODTFallback *fallback) {
   SPDLOG_DEBUG("Update transition graph");
   std::vector<TGLayer> &layers = tg->get_layers();
   std::vector<double> eu_dists = ALGORITHM::cal_eu_dist(traj.geom);
   int N = layers.size();
+  long long pruned = 0;
+  // The clock is read only if the time of each layer is logged
+  bool timed = spdlog::default_logger_raw()->should_log(spdlog::level::debug);
   for (int i = 0; i < N - 1; ++i) {
     SPDLOG_DEBUG("Update layer {} ", i);
     bool connected = false;
+    double prune_threshold = TransitionGraph::calc_prune_threshold(
+      layers[i], config.beam_width, config.prune_margin);
+    std::chrono::steady_clock::time_point layer_begin;
+    if (timed) layer_begin = std::chrono::steady_clock::now();
     update_layer(i, &(layers[i]), &(layers[i + 1]),
-                 eu_dists[i], reverse_tolerance, &connected);
+                 eu_dists[i], config.reverse_tolerance, prune_threshold,
+                 &connected, &pruned, fallback,
+                 config.fallback_factor * eu_dists[i]);
+    if (timed) {
+      SPDLOG_DEBUG("Update layer {} takes {} us", i,
+        std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - layer_begin).count());
+    }
     if (!connected){
       SPDLOG_WARN("Traj {} unmatched as point {} and {} not connected",
         traj.id, i, i+1);
@@ -292,6 +427,8 @@ void FastMapMatch::update_tg(
       break;
     }
   }
+  SPDLOG_DEBUG("Transitions pruned {}", pruned);
+  pruned_transitions_ += pruned;
   SPDLOG_DEBUG("Update transition graph done");
 }
 
@@ -300,15 +437,48 @@ void FastMapMatch::update_layer(int level,
                                 TGLayer *lb_ptr,
                                 double eu_dist,
                                 double reverse_tolerance,
-                                bool *connected) {
+                                double prune_threshold,
+                                bool *connected,
+                                long long *pruned,
+                                UBODTFallback *fallback,
+                                double fallback_delta) {
   // SPDLOG_TRACE("Update layer");
   TGLayer &lb = *lb_ptr;
   bool layer_connected = false;
+  // A pair not in UBODT is longer than its delta
+  if (fallback_delta <= ubodt_->get_delta()) fallback = nullptr;
+  // Query all the OD pairs between the two layers in a batch
+  std::vector<std::pair<NodeIndex,NodeIndex>> od_pairs;
   for (auto iter_a = la_ptr->begin(); iter_a != la_ptr->end(); ++iter_a) {
-    NodeIndex source = iter_a->c->index;
+    if (iter_a->cumu_prob < prune_threshold) continue;
     for (auto iter_b = lb_ptr->begin(); iter_b != lb_ptr->end(); ++iter_b) {
+      if (need_ubodt_query(iter_a->c, iter_b->c, reverse_tolerance)) {
+        od_pairs.push_back({iter_a->c->edge->target,
+                            iter_b->c->edge->source});
+      }
+    }
+  }
+  std::vector<Record *> records = ubodt_->look_up_batch(od_pairs);
+  auto record_iter = records.begin();
+  for (auto iter_a = la_ptr->begin(); iter_a != la_ptr->end(); ++iter_a) {
+    if (iter_a->cumu_prob < prune_threshold) {
+      if (pruned != nullptr) *pruned += lb.size();
+      continue;
+    }
+    for (auto iter_b = lb_ptr->begin(); iter_b != lb_ptr->end(); ++iter_b) {
+      const Record *r = nullptr;
+      if (need_ubodt_query(iter_a->c, iter_b->c, reverse_tolerance)) {
+        r = *(record_iter++);
+      }
       double sp_dist = get_sp_dist(iter_a->c, iter_b->c,
-        reverse_tolerance);
+        reverse_tolerance, r);
+      if (std::isinf(sp_dist) && fallback != nullptr) {
+        double cost = fallback->get_cost(iter_a->c->edge->target,
+                                         iter_b->c->edge->source,
+                                         fallback_delta);
+        sp_dist = cost + iter_a->c->edge->length - iter_a->c->offset +
+          iter_b->c->offset;
+      }
       double tp = TransitionGraph::calc_tp(sp_dist, eu_dist);
       double temp = iter_a->cumu_prob + log(tp) + log(iter_b->ep);
       SPDLOG_TRACE("L {} f {} t {} sp {} dist {} tp {} ep {} fcp {} tcp {}",
@@ -331,3 +501,45 @@ void FastMapMatch::update_layer(int level,
   }
   // SPDLOG_TRACE("Update layer done");
 }
+
+FastMapMatchSession::FastMapMatchSession(FastMapMatch &model,
+                                         const FastMapMatchConfig &config,
+                                         int max_lag) :
+  model_(model), config_(config), tg_(config.gps_error, max_lag) {
+};
+
+OnlineMatchPath FastMapMatchSession::push_point(double x, double y) {
+  int point_index = point_index_++;
+  LineString geom;
+  geom.add_point(x, y);
+  Traj_Candidates tc = model_.network_.search_tr_cs_knn(
+    geom, config_.k, config_.radius);
+  if (tc.empty()) {
+    SPDLOG_DEBUG("Candidate not found for point {}", point_index);
+    return tg_.flush();
+  }
+  double eu_dist = std::sqrt((x - prev_x_) * (x - prev_x_) +
+                             (y - prev_y_) * (y - prev_y_));
+  prev_x_ = x;
+  prev_y_ = y;
+  TGLayer *lb = tg_.add_layer(point_index, tc[0]);
+  int N = tg_.get_num_layers();
+  if (N < 2) return {};
+  TGLayer *la = tg_.get_layer(N - 2);
+  long long pruned = 0;
+  double prune_threshold = TransitionGraph::calc_prune_threshold(
+    *la, config_.beam_width, config_.prune_margin);
+  UBODTFallback fallback(model_.graph_);
+  model_.update_layer(point_index - 1, la, lb, eu_dist,
+                      config_.reverse_tolerance, prune_threshold,
+                      nullptr, &pruned,
+                      config_.fallback_factor > 0 ? &fallback : nullptr,
+                      config_.fallback_factor * eu_dist);
+  model_.pruned_transitions_ += pruned;
+  model_.fallback_searches_ += fallback.get_num_searches();
+  return tg_.decode();
+};
+
+OnlineMatchPath FastMapMatchSession::flush() {
+  return tg_.flush();
+};
@@ -14,10 +14,12 @@
 #include "network/network_graph.hpp"
 #include "mm/transition_graph.hpp"
 #include "mm/fmm/ubodt.hpp"
+#include "mm/fmm/ubodt_fallback.hpp"
 #include "python/pyfmm.hpp"
 #include "config/gps_config.hpp"
 #include "config/result_config.hpp"
 
+#include <atomic>
 #include <string>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/xml_parser.hpp>
@@ -36,14 +38,29 @@ struct FastMapMatchConfig{
    * @param r_arg the search radius, in map unit, which is the same as
    * GPS data and network data.
    * @param gps_error the gps error, in map unit
+   * @param reverse_tolerance the ratio of reverse movement allowed
+   * @param beam_width the maximum number of candidates of a point expanded
+   * to the next point, 0 means no limit
+   * @param prune_margin candidates whose log probability is lower than the
+   * best candidate of a point by more than this value are not expanded,
+   * 0 means no limit
+   * @param fallback_factor a transition not found in UBODT is searched in
+   * the network graph within this factor multiplied with the Euclidean
+   * distance between the two points, 0 means no fallback
    *
    */
   FastMapMatchConfig(int k_arg = 8, double r_arg = 300, double gps_error = 50,
-    double reverse_tolerance = 0.0);
+    double reverse_tolerance = 0.0, int beam_width = 0,
+    double prune_margin = 0.0, double fallback_factor = 0.0);
   int k; /**< Number of candidates */
   double radius; /**< Search radius*/
   double gps_error; /**< GPS error */
   double reverse_tolerance;
+  int beam_width; /**< Beam width of Viterbi search, 0 to disable */
+  double prune_margin; /**< Log probability margin of Viterbi search,
+                            0 to disable */
+  double fallback_factor; /**< Factor of the bound of graph search for
+                               transitions not in UBODT, 0 to disable */
   /**
    * Check if the configuration is valid or not
    * @return true if valid
@@ -77,12 +94,15 @@ struct FastMapMatchConfig{
   static void register_help(std::ostringstream &oss);
 };
 
+class FastMapMatchSession;
+
 /**
  * Fast map matching algorithm/model.
  *
  *
  */
 class FastMapMatch {
+  friend class FastMapMatchSession;
  public:
   /**
    * Constructor of Fast map matching model
@@ -111,6 +131,20 @@ class FastMapMatch {
    */
   PYTHON::PyMatchResult match_wkt(
       const std::string &wkt,const FastMapMatchConfig &config);
+  /**
+   * Match a batch of trajectories in parallel, consecutive points with the
+   * same id form a trajectory as in the GPS point file.
+   * @param ids id of each point
+   * @param xs x of each point
+   * @param ys y of each point
+   * @param timestamps timestamp of each point, empty if not available
+   * @param config Map matching configuration
+   * @return Map matching result in columnar format used in Python API
+   */
+  PYTHON::PyBatchMatchResult match_batch(
+    const std::vector<int> &ids, const std::vector<double> &xs,
+    const std::vector<double> &ys, const std::vector<double> &timestamps,
+    const FastMapMatchConfig &config);
   /**
    * Match GPS data stored in a file
    * @param  gps_config    [description]
@@ -125,6 +159,16 @@ class FastMapMatch {
     const FastMapMatchConfig &config,
     bool use_omp = true
   );
+  /**
+   * Get the number of transitions skipped by beam pruning since the
+   * model is created.
+   */
+  long long get_pruned_transitions() const;
+  /**
+   * Get the number of graph searches run for transitions not found in
+   * UBODT since the model is created.
+   */
+  long long get_fallback_searches() const;
  protected:
   /**
    * Get shortest path distance between two candidates
@@ -135,31 +179,109 @@ class FastMapMatch {
   double get_sp_dist(const Candidate *ca,
                      const Candidate *cb,
                      double reverse_tolerance);
+  /**
+   * Get shortest path distance between two candidates with the row
+   * of UBODT already queried
+   * @param  ca from candidate
+   * @param  cb to candidate
+   * @param  r  the row from ca's target to cb's source, only used when
+   * need_ubodt_query returns true
+   * @return  shortest path value
+   */
+  double get_sp_dist(const Candidate *ca,
+                     const Candidate *cb,
+                     double reverse_tolerance,
+                     const Record *r);
+  /**
+   * Check if the shortest path distance between two candidates needs
+   * to be queried from UBODT
+   */
+  static bool need_ubodt_query(const Candidate *ca,
+                               const Candidate *cb,
+                               double reverse_tolerance);
   /**
    * Update probabilities in a transition graph
    * @param tg transition graph
    * @param traj raw trajectory
    * @param config map match configuration
+   * @param fallback used for transitions not found in UBODT if it is not
+   * nullptr
    */
   void update_tg(TransitionGraph *tg,
                  const CORE::Trajectory &traj,
-                 double reverse_tolerance = 0);
+                 const FastMapMatchConfig &config,
+                 UBODTFallback *fallback = nullptr);
   /**
    * Update probabilities between two layers a and b in the transition graph
    * @param level   the index of layer a
    * @param la_ptr  layer a
    * @param lb_ptr  layer b next to a
    * @param eu_dist Euclidean distance between two observed point
+   * @param prune_threshold nodes in layer a with a lower accumulative
+   * probability are not expanded
    * @param connected the variable is set to false if the layer is not connected
    * with the next layer
+   * @param pruned the number of transitions skipped is added to it
+   * @param fallback used for transitions not found in UBODT if it is not
+   * nullptr
+   * @param fallback_delta upper bound of the fallback search, which is
+   * skipped if it is not larger than the delta of UBODT
    */
   void update_layer(int level, TGLayer *la_ptr, TGLayer *lb_ptr,
                     double eu_dist, double reverse_tolerance,
-                    bool *connected);
+                    double prune_threshold,
+                    bool *connected, long long *pruned = nullptr,
+                    UBODTFallback *fallback = nullptr,
+                    double fallback_delta = 0);
  private:
   const NETWORK::Network &network_;
   const NETWORK::NetworkGraph &graph_;
   std::shared_ptr<UBODT> ubodt_;
+  // Counters updated by the threads matching with the same model
+  std::atomic<long long> pruned_transitions_{0};
+  std::atomic<long long> fallback_searches_{0};
+};
+
+/**
+ * Online session of fast map matching.
+ *
+ * Points of a trajectory are pushed one at a time and only the
+ * transitions from the previous point are evaluated, candidates are
+ * returned once they are finalized by the fixed-lag Viterbi decoder.
+ * A session is not thread safe, use one session per trajectory.
+ */
+class FastMapMatchSession {
+ public:
+  /**
+   * Constructor of an online session
+   * @param model   Fast map matching model
+   * @param config  Map matching configuration
+   * @param max_lag Maximum number of points left undecided, a decision is
+   * forced on the earliest point when it is exceeded.
+   */
+  FastMapMatchSession(FastMapMatch &model,
+                      const FastMapMatchConfig &config,
+                      int max_lag = 10);
+  /**
+   * Push a point to the session
+   * @param x x coordinate of the point
+   * @param y y coordinate of the point
+   * @return candidates finalized by the point, which can be empty
+   */
+  OnlineMatchPath push_point(double x, double y);
+  /**
+   * Finalize all the points pushed, which is called at the end of the
+   * trajectory.
+   * @return candidates finalized
+   */
+  OnlineMatchPath flush();
+ private:
+  FastMapMatch &model_;
+  FastMapMatchConfig config_;
+  OnlineTransitionGraph tg_;
+  int point_index_ = 0;
+  double prev_x_ = 0;
+  double prev_y_ = 0;
 };
 }
 }
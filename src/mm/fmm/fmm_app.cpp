@@ -5,6 +5,7 @@
 #include "mm/fmm/fmm_app.hpp"
 #include "io/gps_reader.hpp"
 #include "io/mm_writer.hpp"
+#include "mm/mm_pipeline.hpp"
 #include <omp.h>
 
 using namespace FMM;
@@ -16,8 +17,10 @@ void FMMApp::run() {
   FastMapMatch mm_model(network_, ng_, ubodt_);
   const FastMapMatchConfig &fmm_config = config_.fmm_config;
   IO::GPSReader reader(config_.gps_config);
-  IO::CSVMatchResultWriter writer(config_.result_config.file,
-                                  config_.result_config.output_config);
+  IO::ResultWriter writer(config_.result_config);
+  // Progress is kept out of the results written to the standard output
+  std::ostream &progress_stream =
+    config_.result_config.is_standard_output() ? std::cerr : std::cout;
   // Start map matching
   int progress = 0;
   int points_matched = 0;
@@ -29,31 +32,34 @@ void FMMApp::run() {
   SPDLOG_INFO("Start to match trajectories");
   if (config_.use_omp){
     SPDLOG_INFO("Run map matching parallelly");
-    int buffer_trajectories_size = 100000;
-    while (reader.has_next_trajectory()) {
-      std::vector<Trajectory> trajectories =
-        reader.read_next_N_trajectories(buffer_trajectories_size);
-      int trajectories_fetched = trajectories.size();
-      #pragma omp parallel for
-      for (int i = 0; i < trajectories_fetched; ++i) {
-        Trajectory &trajectory = trajectories[i];
-        int points_in_tr = trajectory.geom.get_num_points();
-        MM::MatchResult result = mm_model.match_traj(
-            trajectory, fmm_config);
-        writer.write_result(trajectory,result);
-        #pragma omp critical
-        if (!result.cpath.empty()) {
-          points_matched += points_in_tr;
-        }
-        total_points += points_in_tr;
-        ++progress;
-        if (progress % step_size == 0) {
-          std::stringstream buf;
-          buf << "Progress " << progress << '\n';
-          std::cout << buf.rdbuf();
-        }
-      }
+    // The results written to the standard output are passed on once
+    // the workers run out of results
+    MM::MatchPipeline<MM::MatchResult>::FlushFunction flush;
+    if (config_.result_config.is_standard_output()) {
+      flush = [&writer] { writer.flush(); };
     }
+    MM::MatchPipeline<MM::MatchResult> pipeline(0, 1000, 1000,
+      config_.result_config.ordered);
+    pipeline.run(&reader, [&](const Trajectory &trajectory) {
+      return mm_model.match_traj(trajectory, fmm_config);
+    }, [&](const Trajectory &trajectory, const MM::MatchResult &result,
+           std::string *text) {
+      writer.format_result(trajectory, result, text);
+    }, [&](const Trajectory &trajectory, const MM::MatchResult &result,
+           const std::string &text) {
+      int points_in_tr = trajectory.geom.get_num_points();
+      writer.write_text(text);
+      if (!result.cpath.empty()) {
+        points_matched += points_in_tr;
+      }
+      total_points += points_in_tr;
+      ++progress;
+      if (progress % step_size == 0) {
+        std::stringstream buf;
+        buf << "Progress " << progress << '\n';
+        progress_stream << buf.rdbuf();
+      }
+    }, flush);
   } else {
     SPDLOG_INFO("Run map matching in single thread");
     while (reader.has_next_trajectory()) {
@@ -84,5 +90,16 @@ void FMMApp::run() {
   SPDLOG_INFO("Point match speed: {}", points_matched / time_spent);
   SPDLOG_INFO("Point match speed (excluding input): {}",
               points_matched / time_spent_exclude_input);
+  if (fmm_config.beam_width > 0 || fmm_config.prune_margin > 0) {
+    SPDLOG_INFO("Transitions pruned: {}", mm_model.get_pruned_transitions());
+  }
+  if (fmm_config.fallback_factor > 0) {
+    SPDLOG_INFO("Fallback searches: {}", mm_model.get_fallback_searches());
+  }
+  UBODTCacheStats cache_stats = ubodt_->get_cache_stats();
+  SPDLOG_INFO("UBODT cache hits: {} misses: {}",
+              cache_stats.hits, cache_stats.misses);
+  SPDLOG_INFO("UBODT path cache hits: {} misses: {}",
+              cache_stats.path_hits, cache_stats.path_misses);
   SPDLOG_INFO("Time takes {}", time_spent);
 };
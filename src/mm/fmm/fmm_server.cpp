@@ -0,0 +1,666 @@
+/**
+ * Fast map matching.
+ *
+ * Implementation of fmm_server
+ */
+
+#include "mm/fmm/fmm_server.hpp"
+#include "io/result_file.hpp"
+#include "util/debug.hpp"
+#include "util/util.hpp"
+
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include <boost/format.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <omp.h>
+
+using namespace FMM;
+using namespace FMM::CORE;
+using namespace FMM::MM;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Requests larger than these are rejected
+const std::size_t MAX_HEADER_SIZE = 1 << 16;
+const std::size_t MAX_BODY_SIZE = 1 << 28;
+const int LISTEN_BACKLOG = 128;
+// Number of trajectories waiting for the workers at most
+const std::size_t TASK_QUEUE_CAPACITY = 1 << 14;
+
+bool is_tcp_address(const std::string &address) {
+  return address.find('/') == std::string::npos &&
+    address.find(':') != std::string::npos;
+}
+
+// Open a socket listening at host:port or a Unix socket path
+int listen_at(const std::string &address) {
+  int fd = -1;
+  if (is_tcp_address(address)) {
+    std::size_t pos = address.rfind(':');
+    std::string host = address.substr(0, pos);
+    std::string port = address.substr(pos + 1);
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo *info = nullptr;
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(),
+                    &hints, &info) == 0) {
+      for (addrinfo *p = info; p != nullptr && fd < 0; p = p->ai_next) {
+        fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+        if (fd < 0) continue;
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(fd, p->ai_addr, p->ai_addrlen) != 0) {
+          close(fd);
+          fd = -1;
+        }
+      }
+      freeaddrinfo(info);
+    }
+  } else {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (address.size() < sizeof(addr.sun_path)) {
+      std::memcpy(addr.sun_path, address.c_str(), address.size());
+      // Remove the socket left by a previous server
+      struct stat st;
+      if (stat(address.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(address.c_str());
+      }
+      fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (fd >= 0 && bind(fd, reinterpret_cast<sockaddr *>(&addr),
+                          sizeof(addr)) != 0) {
+        close(fd);
+        fd = -1;
+      }
+    }
+  }
+  if (fd < 0 || listen(fd, LISTEN_BACKLOG) != 0) {
+    std::string message = (boost::format("Listen at %1% fail: %2%") % address % std::strerror(errno)).str();
+    if (fd >= 0) close(fd);
+    SPDLOG_CRITICAL(message);
+    throw std::runtime_error(message);
+  }
+  return fd;
+}
+
+// Receive data appended to a buffer, false if the connection is closed
+bool receive(int fd, std::string *buffer) {
+  char data[1 << 16];
+  while (true) {
+    ssize_t n = recv(fd, data, sizeof(data), 0);
+    if (n > 0) {
+      buffer->append(data, n);
+      return true;
+    }
+    if (n < 0 && errno == EINTR) continue;
+    return false;
+  }
+}
+
+// Receive until the buffer holds at least size bytes
+bool receive_until(int fd, std::string *buffer, std::size_t size) {
+  while (buffer->size() < size) {
+    if (!receive(fd, buffer)) return false;
+  }
+  return true;
+}
+
+bool send_all(int fd, const std::string &data) {
+  const char *pos = data.data();
+  std::size_t size = data.size();
+  while (size > 0) {
+    ssize_t n = send(fd, pos, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    pos += n;
+    size -= n;
+  }
+  return true;
+}
+
+std::string to_lower(std::string text) {
+  for (char &c : text) c = std::tolower(static_cast<unsigned char>(c));
+  return text;
+}
+
+void append_json_string(fmt::memory_buffer &buf, const std::string &text) {
+  buf.push_back('"');
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      buf.push_back('\\');
+      buf.push_back(c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      fmt::format_to(buf, "\\u{:04x}", static_cast<int>(c));
+    } else {
+      buf.push_back(c);
+    }
+  }
+  buf.push_back('"');
+}
+
+template<typename Container>
+void append_json_array(fmt::memory_buffer &buf, const Container &values) {
+  buf.push_back('[');
+  bool first = true;
+  for (const auto &value : values) {
+    if (!first) buf.push_back(',');
+    fmt::format_to(buf, "{}", value);
+    first = false;
+  }
+  buf.push_back(']');
+}
+
+std::string json_error(const std::string &message) {
+  fmt::memory_buffer buf;
+  fmt::format_to(buf, "{{\"error\":");
+  append_json_string(buf, message);
+  buf.push_back('}');
+  return fmt::to_string(buf);
+}
+
+std::string http_response(int status, const std::string &body,
+                          bool keep_alive) {
+  const char *reason = "OK";
+  if (status == 400) reason = "Bad Request";
+  else if (status == 404) reason = "Not Found";
+  else if (status == 413) reason = "Payload Too Large";
+  return (boost::format("HTTP/1.1 %1% %2%\r\n"
+                        "Content-Type: application/json\r\n"
+                        "Content-Length: %3%\r\n"
+                        "Connection: %4%\r\n\r\n")
+          % status % reason % body.size()
+          % (keep_alive ? "keep-alive" : "close")).str() + body;
+}
+
+template<typename T>
+void append_value(std::string *text, T value) {
+  text->append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+// Read a value of a binary request, which is not aligned
+template<typename T>
+T read_value(const char **pos, const char *end) {
+  if (std::size_t(end - *pos) < sizeof(T)) {
+    throw std::runtime_error("Binary request out of range");
+  }
+  T value;
+  std::memcpy(&value, *pos, sizeof(T));
+  *pos += sizeof(T);
+  return value;
+}
+
+double elapsed_ms(const Clock::time_point &begin,
+                  const Clock::time_point &end) {
+  return std::chrono::duration<double, std::milli>(end - begin).count();
+}
+
+uint32_t to_microseconds(double ms) {
+  return static_cast<uint32_t>(ms * 1000);
+}
+
+} // namespace
+
+const uint32_t FMMServer::BINARY_RESULT_FIELDS =
+  IO::RESULT_FIELD_OPATH | IO::RESULT_FIELD_CPATH |
+  IO::RESULT_FIELD_TPATH | IO::RESULT_FIELD_MGEOM;
+
+/**
+ * Trajectories of a request, which is completed when all of them are
+ * matched by the workers.
+ */
+struct FMMServer::MatchRequest {
+  const std::vector<Trajectory> *trajectories;
+  const FastMapMatchConfig *config;
+  std::vector<MatchResult> results;
+  std::vector<std::string> *errors;
+  std::size_t remaining;
+  bool started = false;
+  Clock::time_point start_time;
+  double match_ms = 0;
+  std::string error;
+  std::mutex mutex;
+  std::condition_variable done;
+};
+
+FMMServer::FMMServer(const FMMServerConfig &config) :
+  config_(config),
+  network_(config_.network_config),
+  ng_(network_),
+  ubodt_(UBODT::read_ubodt_file(config_.ubodt_file)),
+  model_(network_, ng_, ubodt_),
+  tasks_(TASK_QUEUE_CAPACITY) {
+  if (pipe(stop_pipe_) != 0 || pipe(wake_pipe_) != 0) {
+    std::string message = "Create stop pipe fail";
+    SPDLOG_CRITICAL(message);
+    throw std::runtime_error(message);
+  }
+  // The connections closed are not blocked by a full wake pipe
+  for (int fd : wake_pipe_) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  }
+  int num_workers =
+    config_.threads > 0 ? config_.threads : omp_get_max_threads();
+  for (int i = 0; i < num_workers; ++i) {
+    workers_.emplace_back(&FMMServer::work, this);
+  }
+  SPDLOG_INFO("Start {} worker threads", num_workers);
+}
+
+FMMServer::~FMMServer() {
+  tasks_.close();
+  for (std::thread &worker : workers_) {
+    worker.join();
+  }
+  close(stop_pipe_[0]);
+  close(stop_pipe_[1]);
+  close(wake_pipe_[0]);
+  close(wake_pipe_[1]);
+}
+
+void FMMServer::stop() {
+  char c = 0;
+  // Only async-signal-safe calls are made here
+  ssize_t n = write(stop_pipe_[1], &c, 1);
+  (void) n;
+}
+
+void FMMServer::run() {
+  std::vector<pollfd> fds;
+  std::vector<bool> is_http;
+  fds.push_back(pollfd{stop_pipe_[0], POLLIN, 0});
+  is_http.push_back(false);
+  fds.push_back(pollfd{wake_pipe_[0], POLLIN, 0});
+  is_http.push_back(false);
+  if (!config_.http_address.empty()) {
+    fds.push_back(pollfd{listen_at(config_.http_address), POLLIN, 0});
+    is_http.push_back(true);
+    SPDLOG_INFO("Serve HTTP/JSON protocol at {}", config_.http_address);
+  }
+  if (!config_.binary_address.empty()) {
+    fds.push_back(pollfd{listen_at(config_.binary_address), POLLIN, 0});
+    is_http.push_back(false);
+    SPDLOG_INFO("Serve binary protocol at {}", config_.binary_address);
+  }
+  std::size_t max_connections = config_.max_connections;
+  auto accepting = [&]() {
+    std::lock_guard<std::mutex> lock(connections_mutex_);
+    return connections_.size() < max_connections;
+  };
+  while (true) {
+    // The listeners are not polled while the connections are full, a
+    // connection closed writes to the wake pipe to poll them again.
+    short events = accepting() ? POLLIN : 0;
+    for (std::size_t i = 2; i < fds.size(); ++i) {
+      fds[i].events = events;
+    }
+    if (poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR) continue;
+      SPDLOG_CRITICAL("Poll fail: {}", std::strerror(errno));
+      break;
+    }
+    if (fds[0].revents != 0) break;
+    if (fds[1].revents != 0) {
+      char data[64];
+      while (read(wake_pipe_[0], data, sizeof(data)) > 0) {}
+    }
+    for (std::size_t i = 2; i < fds.size(); ++i) {
+      if (!(fds[i].revents & POLLIN) || !accepting()) continue;
+      int fd = accept(fds[i].fd, nullptr, nullptr);
+      if (fd < 0) continue;
+      {
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        connections_.insert(fd);
+      }
+      std::thread(&FMMServer::serve_connection, this, fd, is_http[i])
+        .detach();
+    }
+  }
+  SPDLOG_INFO("Stop serving");
+  char c;
+  while (read(stop_pipe_[0], &c, 1) != 1 && errno == EINTR) {}
+  for (std::size_t i = 2; i < fds.size(); ++i) {
+    close(fds[i].fd);
+  }
+  for (const std::string &address :
+       {config_.http_address, config_.binary_address}) {
+    if (!address.empty() && !is_tcp_address(address)) {
+      unlink(address.c_str());
+    }
+  }
+  // Wake up the connections waiting for requests
+  std::unique_lock<std::mutex> lock(connections_mutex_);
+  for (int fd : connections_) {
+    shutdown(fd, SHUT_RDWR);
+  }
+  connections_done_.wait(lock, [this] { return connections_.empty(); });
+}
+
+void FMMServer::serve_connection(int fd, bool http) {
+  try {
+    if (http) {
+      serve_http(fd);
+    } else {
+      serve_binary(fd);
+    }
+  } catch (const std::exception &e) {
+    SPDLOG_WARN("Connection closed: {}", e.what());
+  }
+  std::lock_guard<std::mutex> lock(connections_mutex_);
+  close(fd);
+  connections_.erase(fd);
+  connections_done_.notify_all();
+  char c = 0;
+  ssize_t n = write(wake_pipe_[1], &c, 1);
+  (void) n;
+}
+
+void FMMServer::serve_http(int fd) {
+  std::string buffer;
+  while (true) {
+    std::size_t header_end;
+    while ((header_end = buffer.find("\r\n\r\n")) == std::string::npos) {
+      if (buffer.size() > MAX_HEADER_SIZE || !receive(fd, &buffer)) return;
+    }
+    std::istringstream header(buffer.substr(0, header_end));
+    std::string method, path, version, line;
+    header >> method >> path >> version;
+    std::getline(header, line);
+    std::size_t content_length = 0;
+    bool keep_alive = version == "HTTP/1.1";
+    while (std::getline(header, line)) {
+      std::size_t colon = line.find(':');
+      if (colon == std::string::npos) continue;
+      std::string name = to_lower(line.substr(0, colon));
+      std::string value = line.substr(colon + 1);
+      value.erase(0, value.find_first_not_of(" \t"));
+      value.erase(value.find_last_not_of(" \t\r") + 1);
+      if (name == "content-length") {
+        content_length = std::strtoull(value.c_str(), nullptr, 10);
+      } else if (name == "connection") {
+        keep_alive = to_lower(value) == "keep-alive";
+      }
+    }
+    if (content_length > MAX_BODY_SIZE) {
+      send_all(fd, http_response(413, json_error("Request too large"),
+                                 false));
+      return;
+    }
+    std::size_t body_start = header_end + 4;
+    if (!receive_until(fd, &buffer, body_start + content_length)) return;
+    std::string body = buffer.substr(body_start, content_length);
+    buffer.erase(0, body_start + content_length);
+    int status = 200;
+    std::string response;
+    if (method == "POST" && path == "/match") {
+      try {
+        response = handle_json(body);
+      } catch (const std::exception &e) {
+        SPDLOG_WARN("Invalid request: {}", e.what());
+        status = 400;
+        response = json_error(e.what());
+      }
+    } else if (method == "GET" && path == "/stats") {
+      response = get_stats();
+    } else {
+      status = 404;
+      response = json_error("Not found");
+    }
+    if (!send_all(fd, http_response(status, response, keep_alive)) ||
+        !keep_alive) {
+      return;
+    }
+  }
+}
+
+void FMMServer::serve_binary(int fd) {
+  std::string buffer;
+  while (true) {
+    if (!receive_until(fd, &buffer, sizeof(uint32_t))) return;
+    uint32_t size;
+    std::memcpy(&size, buffer.data(), sizeof(size));
+    std::string response;
+    if (size > MAX_BODY_SIZE) {
+      append_value<int32_t>(&response, 1);
+      response += "Request too large";
+    } else {
+      if (!receive_until(fd, &buffer, sizeof(size) + size)) return;
+      std::string payload = buffer.substr(sizeof(size), size);
+      buffer.erase(0, sizeof(size) + size);
+      try {
+        response = handle_binary(payload);
+      } catch (const std::exception &e) {
+        SPDLOG_WARN("Invalid request: {}", e.what());
+        response.clear();
+        append_value<int32_t>(&response, 1);
+        response += e.what();
+      }
+    }
+    std::string frame;
+    append_value<uint32_t>(&frame, response.size());
+    if (!send_all(fd, frame + response) || size > MAX_BODY_SIZE) return;
+  }
+}
+
+std::string FMMServer::handle_json(const std::string &body) {
+  boost::property_tree::ptree tree;
+  std::istringstream iss(body);
+  boost::property_tree::read_json(iss, tree);
+  FastMapMatchConfig config = config_.fmm_config;
+  config.k = tree.get("k", config.k);
+  config.radius = tree.get("radius", config.radius);
+  config.gps_error = tree.get("gps_error", config.gps_error);
+  config.reverse_tolerance =
+    tree.get("reverse_tolerance", config.reverse_tolerance);
+  if (!config.validate()) {
+    throw std::runtime_error("Invalid map matching parameters");
+  }
+  std::vector<Trajectory> trajectories;
+  std::vector<std::string> errors;
+  auto add_trajectory = [&](const boost::property_tree::ptree &node) {
+    int id = node.get("id", static_cast<int>(trajectories.size()));
+    std::string wkt = node.get<std::string>("wkt");
+    // An invalid geometry only fails its own trajectory
+    try {
+      trajectories.push_back(Trajectory(id, wkt2linestring(wkt)));
+      errors.push_back("");
+    } catch (const std::exception &e) {
+      trajectories.push_back(Trajectory(id, LineString()));
+      errors.push_back(
+        (boost::format("Invalid wkt: %1%") % e.what()).str());
+    }
+  };
+  auto children = tree.get_child_optional("trajectories");
+  if (children) {
+    for (const auto &child : *children) {
+      add_trajectory(child.second);
+    }
+  } else {
+    add_trajectory(tree);
+  }
+  RequestMetrics metrics;
+  std::vector<MatchResult> results =
+    match(trajectories, config, &errors, &metrics);
+  fmt::memory_buffer buf;
+  fmt::format_to(buf, "{{\"results\":[");
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    const MatchResult &result = results[i];
+    if (i > 0) buf.push_back(',');
+    if (!errors[i].empty()) {
+      fmt::format_to(buf, "{{\"id\":{},\"error\":", trajectories[i].id);
+      append_json_string(buf, errors[i]);
+      buf.push_back('}');
+      continue;
+    }
+    fmt::format_to(buf, "{{\"id\":{},\"opath\":", result.id);
+    append_json_array(buf, result.opath);
+    fmt::format_to(buf, ",\"cpath\":");
+    append_json_array(buf, result.cpath);
+    fmt::format_to(buf, ",\"indices\":");
+    append_json_array(buf, result.indices);
+    fmt::format_to(buf, ",\"mgeom\":");
+    append_json_string(buf, result.mgeom.export_wkt(12));
+    buf.push_back('}');
+  }
+  fmt::format_to(buf, "],\"queue_ms\":{:.3f},\"match_ms\":{:.3f},"
+                 "\"total_ms\":{:.3f}}}",
+                 metrics.queue_ms, metrics.match_ms, metrics.total_ms);
+  return fmt::to_string(buf);
+}
+
+std::string FMMServer::handle_binary(const std::string &payload) {
+  const char *pos = payload.data();
+  const char *end = pos + payload.size();
+  uint32_t count = read_value<uint32_t>(&pos, end);
+  std::vector<Trajectory> trajectories;
+  for (uint32_t i = 0; i < count; ++i) {
+    int32_t id = read_value<int32_t>(&pos, end);
+    uint32_t n = read_value<uint32_t>(&pos, end);
+    if (std::size_t(end - pos) / (2 * sizeof(double)) < n) {
+      throw std::runtime_error("Binary request out of range");
+    }
+    const char *ys = pos + n * sizeof(double);
+    LineString geom;
+    for (uint32_t j = 0; j < n; ++j) {
+      double x, y;
+      std::memcpy(&x, pos + j * sizeof(double), sizeof(double));
+      std::memcpy(&y, ys + j * sizeof(double), sizeof(double));
+      geom.add_point(x, y);
+    }
+    pos = ys + n * sizeof(double);
+    trajectories.push_back(Trajectory(id, geom));
+  }
+  RequestMetrics metrics;
+  std::vector<std::string> errors(trajectories.size());
+  std::vector<MatchResult> results =
+    match(trajectories, config_.fmm_config, &errors, &metrics);
+  std::string response;
+  append_value<int32_t>(&response, 0);
+  append_value<uint32_t>(&response, results.size());
+  append_value<uint32_t>(&response, to_microseconds(metrics.queue_ms));
+  append_value<uint32_t>(&response, to_microseconds(metrics.match_ms));
+  append_value<uint32_t>(&response, to_microseconds(metrics.total_ms));
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    IO::format_result_record(trajectories[i], results[i],
+                             BINARY_RESULT_FIELDS, &response);
+  }
+  uint32_t num_failed = 0;
+  for (const std::string &error : errors) {
+    if (!error.empty()) ++num_failed;
+  }
+  append_value<uint32_t>(&response, num_failed);
+  for (std::size_t i = 0; i < errors.size(); ++i) {
+    if (errors[i].empty()) continue;
+    append_value<uint32_t>(&response, i);
+    append_value<uint32_t>(&response, errors[i].size());
+    response += errors[i];
+  }
+  return response;
+}
+
+std::string FMMServer::get_stats() {
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  return fmt::format("{{\"requests\":{},\"trajectories\":{},"
+                     "\"mean_latency_ms\":{:.3f},\"max_latency_ms\":{:.3f}}}",
+                     num_requests_, num_trajectories_,
+                     num_requests_ > 0 ? total_latency_ms_ / num_requests_
+                                       : 0.0,
+                     max_latency_ms_);
+}
+
+std::vector<MatchResult> FMMServer::match(
+  const std::vector<Trajectory> &trajectories,
+  const FastMapMatchConfig &config, std::vector<std::string> *errors,
+  RequestMetrics *metrics) {
+  Clock::time_point begin_time = Clock::now();
+  MatchRequest request;
+  request.trajectories = &trajectories;
+  request.config = &config;
+  request.results.resize(trajectories.size());
+  request.errors = errors;
+  std::size_t num_tasks = 0;
+  for (std::size_t i = 0; i < trajectories.size(); ++i) {
+    if ((*errors)[i].empty()) {
+      ++num_tasks;
+    } else {
+      request.results[i].id = trajectories[i].id;
+    }
+  }
+  request.remaining = num_tasks;
+  std::size_t queued = 0;
+  for (std::size_t i = 0; i < trajectories.size(); ++i) {
+    if (!(*errors)[i].empty()) continue;
+    if (!tasks_.push(Task{&request, static_cast<int>(i)})) {
+      std::lock_guard<std::mutex> lock(request.mutex);
+      request.remaining -= num_tasks - queued;
+      request.error = "Server stopped";
+      break;
+    }
+    ++queued;
+  }
+  std::unique_lock<std::mutex> lock(request.mutex);
+  request.done.wait(lock, [&request] { return request.remaining == 0; });
+  Clock::time_point end_time = Clock::now();
+  if (!request.error.empty()) {
+    throw std::runtime_error(request.error);
+  }
+  metrics->queue_ms =
+    request.started ? elapsed_ms(begin_time, request.start_time) : 0;
+  metrics->match_ms = request.match_ms;
+  metrics->total_ms = elapsed_ms(begin_time, end_time);
+  {
+    std::lock_guard<std::mutex> stats_lock(stats_mutex_);
+    ++num_requests_;
+    num_trajectories_ += trajectories.size();
+    total_latency_ms_ += metrics->total_ms;
+    max_latency_ms_ = std::max(max_latency_ms_, metrics->total_ms);
+  }
+  return std::move(request.results);
+}
+
+void FMMServer::work() {
+  Task task;
+  while (tasks_.pop(&task)) {
+    MatchRequest *request = task.request;
+    Clock::time_point begin_time = Clock::now();
+    {
+      std::lock_guard<std::mutex> lock(request->mutex);
+      if (!request->started) {
+        request->started = true;
+        request->start_time = begin_time;
+      }
+    }
+    const Trajectory &trajectory = (*request->trajectories)[task.index];
+    MatchResult result;
+    std::string error;
+    try {
+      result = model_.match_traj(trajectory, *request->config);
+    } catch (const std::exception &e) {
+      // Only the trajectory is failed, not the whole request
+      result.id = trajectory.id;
+      error = e.what();
+    }
+    double duration = elapsed_ms(begin_time, Clock::now());
+    std::lock_guard<std::mutex> lock(request->mutex);
+    request->results[task.index] = std::move(result);
+    request->match_ms += duration;
+    if (!error.empty()) (*request->errors)[task.index] = error;
+    if (--request->remaining == 0) request->done.notify_all();
+  }
+}
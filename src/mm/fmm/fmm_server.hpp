@@ -0,0 +1,170 @@
+/**
+ * Fast map matching.
+ *
+ * fmm_server command line program, which keeps the network, the graph and
+ * the UBODT in memory and matches the trajectories sent by clients.
+ *
+ * Each protocol is served at a TCP address host:port or a Unix socket
+ * path. The trajectories of the requests from all the connections are
+ * queued to a single pool of worker threads. At most max_connections
+ * connections are served at the same time, the others wait in the listen
+ * backlog until one of them is closed.
+ *
+ * HTTP/JSON protocol
+ *
+ *   POST /match with a body
+ *     {"trajectories":[{"id":1,"wkt":"LINESTRING(0 0,1 1)"}],
+ *      "k":8,"radius":300,"gps_error":50}
+ *   where the parameters are optional and default to those of the server,
+ *   a single trajectory {"id":1,"wkt":"LINESTRING(0 0,1 1)"} is also
+ *   accepted. The response is
+ *     {"results":[{"id":1,"opath":[..],"cpath":[..],"indices":[..],
+ *      "mgeom":"LINESTRING(..)"}],"queue_ms":..,"match_ms":..,
+ *      "total_ms":..}
+ *   where a trajectory failing to be parsed or matched is returned as
+ *   {"id":1,"error":".."} without failing the other ones.
+ *
+ *   GET /stats returns the number of requests and trajectories matched
+ *   and the latency of the requests.
+ *
+ * Binary protocol
+ *
+ *   A request or a response is the size of the payload (uint32) followed
+ *   by the payload, all numbers in native byte order.
+ *
+ *   Request payload: the number of trajectories (uint32) and for each
+ *   trajectory, its id (int32), the number of points n (uint32), n x
+ *   values and n y values (double), as a binary trajectory file without
+ *   timestamps.
+ *
+ *   Response payload: the status (int32) and, for a failed request, the
+ *   error message. For a successful request with status 0, the number of
+ *   results (uint32), the queue, match and total time in microseconds
+ *   (uint32) and the results, stored as the records of a binary result
+ *   file with the fields opath, cpath, tpath and mgeom, followed by the
+ *   number of failed trajectories (uint32) and for each of them, its
+ *   index in the request (uint32), the size of the error message (uint32)
+ *   and the message. The record of a failed trajectory is empty.
+ */
+
+#ifndef FMM_FMM_SERVER_HPP_
+#define FMM_FMM_SERVER_HPP_
+
+#include "mm/fmm/fmm_server_config.hpp"
+#include "mm/fmm/fmm_algorithm.hpp"
+#include "mm/mm_pipeline.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace FMM{
+namespace MM{
+
+/**
+ * Time spent by a request of the server, in milliseconds
+ */
+struct RequestMetrics {
+  double queue_ms = 0; /**< time before the first trajectory is matched */
+  double match_ms = 0; /**< time of the workers matching the
+                            trajectories */
+  double total_ms = 0; /**< time until all the trajectories are matched */
+};
+
+/**
+ * Class of fmm_server command line program
+ */
+class FMMServer {
+ public:
+  /**
+   * Create FMMServer from configuration data, the worker threads are
+   * started.
+   * @param config Configuration of the server defining network, graph,
+   * UBODT and the addresses served.
+   */
+  FMMServer(const FMMServerConfig &config);
+  /**
+   * Destructor, the worker threads are stopped.
+   */
+  ~FMMServer();
+  /**
+   * Serve the requests until stop is called, std::runtime_error is thrown
+   * if an address cannot be served.
+   */
+  void run();
+  /**
+   * Stop serving, which can be called from a signal handler.
+   */
+  void stop();
+  /**
+   * Match the trajectories of a JSON request
+   * @param  body JSON request
+   * @return JSON response
+   */
+  std::string handle_json(const std::string &body);
+  /**
+   * Match the trajectories of a binary request
+   * @param  payload payload of the request
+   * @return payload of the response
+   */
+  std::string handle_binary(const std::string &payload);
+  /**
+   * Get the statistics of the requests served as JSON
+   */
+  std::string get_stats();
+  /**
+   * Fields of the results of the binary protocol, see IO::ResultField
+   */
+  static const uint32_t BINARY_RESULT_FIELDS;
+ private:
+  struct MatchRequest;
+  // A trajectory of a request matched by a worker
+  struct Task {
+    MatchRequest *request;
+    int index;
+  };
+  /**
+   * Match trajectories by the worker threads, std::runtime_error is thrown
+   * if the server is stopped.
+   * @param trajectories trajectories to match
+   * @param config map matching configuration
+   * @param errors error of each trajectory, which is empty if it is
+   * matched. The trajectories with an error given are not matched.
+   * @param metrics time spent by the request
+   * @return results of the trajectories, the ones failed are empty
+   */
+  std::vector<MatchResult> match(
+    const std::vector<CORE::Trajectory> &trajectories,
+    const FastMapMatchConfig &config, std::vector<std::string> *errors,
+    RequestMetrics *metrics);
+  void work();
+  void serve_connection(int fd, bool http);
+  void serve_http(int fd);
+  void serve_binary(int fd);
+  const FMMServerConfig &config_;
+  NETWORK::Network network_;
+  NETWORK::NetworkGraph ng_;
+  std::shared_ptr<UBODT> ubodt_;
+  FastMapMatch model_;
+  BoundedQueue<Task> tasks_;
+  std::vector<std::thread> workers_;
+  int stop_pipe_[2] = {-1, -1};
+  // Written when a connection is closed, to accept the next one
+  int wake_pipe_[2] = {-1, -1};
+  // Connections served, which are shut down when the server stops
+  std::set<int> connections_;
+  std::mutex connections_mutex_;
+  std::condition_variable connections_done_;
+  std::mutex stats_mutex_;
+  long long num_requests_ = 0;
+  long long num_trajectories_ = 0;
+  double total_latency_ms_ = 0;
+  double max_latency_ms_ = 0;
+};
+}
+}
+
+#endif //FMM_FMM_SERVER_HPP_
@@ -0,0 +1,145 @@
+#include "mm/fmm/fmm_server_config.hpp"
+#include "util/debug.hpp"
+#include "util/util.hpp"
+
+using namespace FMM;
+using namespace FMM::CONFIG;
+using namespace FMM::MM;
+
+FMMServerConfig::FMMServerConfig(int argc, char **argv){
+  spdlog::set_pattern("[%^%l%$][%s:%-3#] %v");
+  if (argc==2) {
+    std::string configfile(argv[1]);
+    if (UTIL::check_file_extension(configfile,"xml,XML"))
+      load_xml(configfile);
+    else {
+      load_arg(argc,argv);
+    }
+  } else {
+    load_arg(argc,argv);
+  }
+  spdlog::set_level((spdlog::level::level_enum) log_level);
+  if (!help_specified)
+    print();
+};
+
+void FMMServerConfig::load_xml(const std::string &file){
+  SPDLOG_INFO("Start with reading fmm_server configuration {}",file);
+  boost::property_tree::ptree tree;
+  boost::property_tree::read_xml(file, tree);
+  network_config = NetworkConfig::load_from_xml(tree);
+  fmm_config = FastMapMatchConfig::load_from_xml(tree);
+  ubodt_file = tree.get<std::string>("config.input.ubodt.file");
+  http_address = tree.get("config.server.http", "");
+  binary_address = tree.get("config.server.binary", "");
+  threads = tree.get("config.server.threads", 0);
+  max_connections = tree.get("config.server.max_connections", 256);
+  log_level = tree.get("config.other.log_level",2);
+  SPDLOG_INFO("Finish with reading fmm_server xml configuration");
+};
+
+void FMMServerConfig::load_arg(int argc, char **argv){
+  SPDLOG_INFO("Start reading fmm_server configuration from arguments");
+  cxxopts::Options options("fmm_server_config",
+                           "Configuration parser of fmm_server");
+  NetworkConfig::register_arg(options);
+  FastMapMatchConfig::register_arg(options);
+  options.add_options()
+    ("ubodt","Ubodt file name",
+    cxxopts::value<std::string>()->default_value(""))
+    ("http","Address of HTTP/JSON protocol",
+    cxxopts::value<std::string>()->default_value(""))
+    ("binary","Address of binary protocol",
+    cxxopts::value<std::string>()->default_value(""))
+    ("threads","Number of worker threads",
+    cxxopts::value<int>()->default_value("0"))
+    ("max_connections","Number of connections served at the same time",
+    cxxopts::value<int>()->default_value("256"))
+    ("l,log_level","Log level",cxxopts::value<int>()->default_value("2"))
+    ("h,help","Help information");
+  if (argc==1) {
+    help_specified = true;
+    return;
+  }
+  auto result = options.parse(argc, argv);
+  network_config = NetworkConfig::load_from_arg(result);
+  fmm_config = FastMapMatchConfig::load_from_arg(result);
+  ubodt_file = result["ubodt"].as<std::string>();
+  http_address = result["http"].as<std::string>();
+  binary_address = result["binary"].as<std::string>();
+  threads = result["threads"].as<int>();
+  max_connections = result["max_connections"].as<int>();
+  log_level = result["log_level"].as<int>();
+  if (result.count("help")>0) {
+    help_specified = true;
+  }
+  SPDLOG_INFO("Finish with reading fmm_server arg configuration");
+};
+
+void FMMServerConfig::print_help(){
+  std::ostringstream oss;
+  oss<<"fmm_server argument lists:\n";
+  oss<<"--ubodt (required) <string>: Ubodt file name\n";
+  NetworkConfig::register_help(oss);
+  FastMapMatchConfig::register_help(oss);
+  oss<<"--http (optional) <string>: address of HTTP/JSON protocol,\n";
+  oss<<"  host:port or a Unix socket path\n";
+  oss<<"--binary (optional) <string>: address of binary protocol,\n";
+  oss<<"  host:port or a Unix socket path\n";
+  oss<<"--threads (optional) <int>: number of worker threads,\n";
+  oss<<"  0 for the number of cores (0)\n";
+  oss<<"--max_connections (optional) <int>: number of connections\n";
+  oss<<"  served at the same time (256)\n";
+  oss<<"-l/--log_level (optional) <int>: log level (2)\n";
+  oss<<"-h/--help:print help information\n";
+  oss<<"For xml configuration, check example folder\n";
+  std::cout<<oss.str();
+};
+
+void FMMServerConfig::print() const {
+  SPDLOG_INFO("----   Print configuration    ----");
+  network_config.print();
+  fmm_config.print();
+  SPDLOG_INFO("UBODT file {}",ubodt_file);
+  SPDLOG_INFO("HTTP address {}",http_address);
+  SPDLOG_INFO("Binary address {}",binary_address);
+  SPDLOG_INFO("Threads {}",threads);
+  SPDLOG_INFO("Max connections {}",max_connections);
+  SPDLOG_INFO("Log level {}",UTIL::LOG_LEVESLS[log_level]);
+  SPDLOG_INFO("---- Print configuration done ----");
+};
+
+bool FMMServerConfig::validate() const
+{
+  SPDLOG_DEBUG("Validating configuration");
+  if (log_level<0 || log_level>UTIL::LOG_LEVESLS.size()) {
+    SPDLOG_CRITICAL("Invalid log_level {}, which should be 0 - 6",log_level);
+    SPDLOG_CRITICAL("0-trace,1-debug,2-info,3-warn,4-err,5-critical,6-off");
+    return false;
+  }
+  if (!network_config.validate()) {
+    return false;
+  }
+  if (!fmm_config.validate()) {
+    return false;
+  }
+  if (!UTIL::file_exists(ubodt_file)) {
+    SPDLOG_CRITICAL("UBODT file not exists {}", ubodt_file);
+    return false;
+  }
+  if (http_address.empty() && binary_address.empty()) {
+    SPDLOG_CRITICAL("Neither HTTP nor binary address is specified");
+    return false;
+  }
+  if (threads < 0) {
+    SPDLOG_CRITICAL("Number of threads {} should not be negative", threads);
+    return false;
+  }
+  if (max_connections <= 0) {
+    SPDLOG_CRITICAL("Number of connections {} should be positive",
+                    max_connections);
+    return false;
+  }
+  SPDLOG_DEBUG("Validating done");
+  return true;
+};
@@ -0,0 +1,76 @@
+/**
+ * Fast map matching.
+ *
+ * fmm_server command line program configuration
+ */
+
+#ifndef FMM_FMM_SERVER_CONFIG_HPP_
+#define FMM_FMM_SERVER_CONFIG_HPP_
+
+#include "config/network_config.hpp"
+#include "mm/fmm/fmm_algorithm.hpp"
+
+namespace FMM{
+namespace MM{
+/**
+ * Configuration class of fmm_server command line program
+ */
+class FMMServerConfig
+{
+ public:
+  /**
+   * Constructor of the configuration from command line arguments.
+   * The argument data are fetched from the main function directly.
+   *
+   * @param argc number of arguments
+   * @param argv raw argument data
+   */
+  FMMServerConfig(int argc, char **argv);
+  /**
+   * Load configuration from an XML file
+   * @param file xml file name
+   */
+  void load_xml(const std::string &file);
+  /**
+   * Load configuration from arguments. The argument data
+   * are fetched from the main function directly.
+   * @param argc number of arguments
+   * @param argv raw argument data
+   */
+  void load_arg(int argc, char **argv);
+  /**
+   * Validate the configuration
+   * @return true if valid
+   */
+  bool validate() const;
+  /**
+   * Print configuration data
+   */
+  void print() const;
+  /**
+   * Print help information
+   */
+  static void print_help();
+  CONFIG::NetworkConfig network_config;/**< Network data configuraiton */
+  FastMapMatchConfig fmm_config; /**< Default map matching configuraiton,
+                                      which can be changed by a request */
+  std::string ubodt_file; /**< UBODT file name */
+  std::string http_address; /**< Address of the HTTP/JSON protocol,
+                                 host:port or a Unix socket path,
+                                 empty to disable */
+  std::string binary_address; /**< Address of the binary protocol,
+                                   host:port or a Unix socket path,
+                                   empty to disable */
+  int threads = 0; /**< Number of worker threads, 0 for the maximum
+                        number of OpenMP threads */
+  int max_connections = 256; /**< Number of connections served at the
+                                  same time, the others wait in the
+                                  listen backlog */
+  bool help_specified = false;  /**< Help is specified or not */
+  int log_level = 2;  /**< log level, 0-trace,1-debug,2-info,
+                          3-warn,4-err,5-critical,6-off */
+}; // FMMServerConfig
+}
+}
+
+#endif //FMM_FMM_SERVER_CONFIG_HPP_
@@ -4,7 +4,10 @@
 
 #include "mm/fmm/ubodt.hpp"
 #include "util/util.hpp"
+#include "io/compressed_file.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <stdexcept>
 
@@ -18,8 +21,74 @@ using namespace FMM;
 using namespace FMM::CORE;
 using namespace FMM::NETWORK;
 using namespace FMM::MM;
+
+// Prefetch an address into cache, a prefetch never faults even on nullptr
+#if defined(__GNUC__)
+#define UBODT_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define UBODT_PREFETCH(addr)
+#endif
+
+// Source of unique ids of UBODT objects, an address can be reused after
+// a table is released so it cannot identify the owner of a cache.
+static std::atomic<long long> ubodt_count(0);
+
+/**
+ * Statistics of the lookup caches of a table summed over all threads
+ */
+struct UBODT::CacheCounters {
+  std::atomic<long long> hits{0};
+  std::atomic<long long> misses{0};
+  std::atomic<long long> path_hits{0};
+  std::atomic<long long> path_misses{0};
+};
+
+/**
+ * Lookup cache of a thread, both tables are direct-mapped.
+ */
+struct UBODT::ThreadCache {
+  struct RecordEntry {
+    NodeIndex source;
+    NodeIndex target;
+    bool valid;
+    Record *r;
+  };
+  struct PathEntry {
+    NodeIndex source;
+    NodeIndex target;
+    bool valid;
+    std::vector<EdgeIndex> edges;
+  };
+  long long owner_id = -1;
+  long long owner_rows = -1;
+  std::shared_ptr<CacheCounters> counters;
+  std::vector<RecordEntry> records;
+  std::vector<PathEntry> paths;
+  long long hits = 0;
+  long long misses = 0;
+  long long path_hits = 0;
+  long long path_misses = 0;
+  static unsigned int slot(NodeIndex source, NodeIndex target) {
+    return (source * 2654435761u) ^ target;
+  }
+  // Add the pending statistics to the counters of the owner
+  void flush() {
+    if (counters) {
+      counters->hits += hits;
+      counters->misses += misses;
+      counters->path_hits += path_hits;
+      counters->path_misses += path_misses;
+    }
+    hits = 0;
+    misses = 0;
+    path_hits = 0;
+    path_misses = 0;
+  }
+};
+
 UBODT::UBODT(int buckets_arg, int multiplier_arg) :
-    buckets(buckets_arg), multiplier(multiplier_arg) {
+    buckets(buckets_arg), multiplier(multiplier_arg),
+    cache_owner_id(ubodt_count++), cache_counters(new CacheCounters()) {
   SPDLOG_TRACE("Intialization UBODT with buckets {} multiplier {}",
                buckets, multiplier);
   hashtable = (Record **) malloc(sizeof(Record *) * buckets);
@@ -59,25 +128,147 @@ Record *UBODT::look_up(NodeIndex source, NodeIndex target) const {
   return r;
 }
 
-std::vector<EdgeIndex> UBODT::look_sp_path(NodeIndex source,
-                                           NodeIndex target) const {
-  std::vector<EdgeIndex> edges;
-  if (source == target) { return edges; }
+UBODT::ThreadCache &UBODT::get_thread_cache() const {
+  static thread_local ThreadCache cache;
+  if (cache.owner_id != cache_owner_id || cache.owner_rows != num_rows) {
+    cache.flush();
+    cache.owner_id = cache_owner_id;
+    cache.owner_rows = num_rows;
+    cache.counters = cache_counters;
+    cache.records.assign(CACHE_SIZE,
+                         ThreadCache::RecordEntry{0, 0, false, nullptr});
+    cache.paths.assign(PATH_CACHE_SIZE,
+                       ThreadCache::PathEntry{0, 0, false, {}});
+  }
+  return cache;
+}
+
+Record *UBODT::look_up_cached(NodeIndex source, NodeIndex target) const {
+  ThreadCache &cache = get_thread_cache();
+  ThreadCache::RecordEntry &entry = cache.records[
+    ThreadCache::slot(source, target) & (CACHE_SIZE - 1)];
+  if (entry.valid && entry.source == source && entry.target == target) {
+    ++cache.hits;
+    return entry.r;
+  }
+  ++cache.misses;
+  entry = ThreadCache::RecordEntry{source, target, true,
+                                   look_up(source, target)};
+  return entry.r;
+}
+
+std::vector<Record *> UBODT::look_up_batch(
+  const std::vector<std::pair<NodeIndex,NodeIndex>> &od_pairs) const {
+  std::vector<std::pair<NodeIndex,NodeIndex>> unique_pairs(od_pairs);
+  std::sort(unique_pairs.begin(), unique_pairs.end());
+  unique_pairs.erase(std::unique(unique_pairs.begin(), unique_pairs.end()),
+                     unique_pairs.end());
+  int N = unique_pairs.size();
+  ThreadCache &cache = get_thread_cache();
+  std::vector<Record *> unique_records(N);
+  std::vector<int> missed;
+  for (int i = 0; i < N; ++i) {
+    const ThreadCache::RecordEntry &entry = cache.records[ThreadCache::slot(
+      unique_pairs[i].first, unique_pairs[i].second) & (CACHE_SIZE - 1)];
+    if (entry.valid && entry.source == unique_pairs[i].first &&
+        entry.target == unique_pairs[i].second) {
+      unique_records[i] = entry.r;
+    } else {
+      missed.push_back(i);
+    }
+  }
+  cache.hits += N - missed.size();
+  cache.misses += missed.size();
+  int M = missed.size();
+  std::vector<unsigned int> buckets_idx(M);
+  for (int j = 0; j < M; ++j) {
+    const auto &od = unique_pairs[missed[j]];
+    buckets_idx[j] = cal_bucket_index(od.first, od.second);
+    UBODT_PREFETCH(&hashtable[buckets_idx[j]]);
+  }
+  for (int j = 0; j < M; ++j) {
+    unique_records[missed[j]] = hashtable[buckets_idx[j]];
+    UBODT_PREFETCH(unique_records[missed[j]]);
+  }
+  for (int j = 0; j < M; ++j) {
+    const auto &od = unique_pairs[missed[j]];
+    Record *r = unique_records[missed[j]];
+    while (r != nullptr && (r->source != od.first ||
+                            r->target != od.second)) {
+      r = r->next;
+    }
+    unique_records[missed[j]] = r;
+    cache.records[ThreadCache::slot(od.first, od.second) & (CACHE_SIZE - 1)]
+      = ThreadCache::RecordEntry{od.first, od.second, true, r};
+  }
+  std::vector<Record *> records(od_pairs.size());
+  for (int i = 0; i < od_pairs.size(); ++i) {
+    auto iter = std::lower_bound(unique_pairs.begin(), unique_pairs.end(),
+                                 od_pairs[i]);
+    records[i] = unique_records[iter - unique_pairs.begin()];
+  }
+  return records;
+}
+
+const std::vector<EdgeIndex> &UBODT::look_sp_path(NodeIndex source,
+                                                  NodeIndex target) const {
+  static const std::vector<EdgeIndex> empty_path;
+  if (source == target) { return empty_path; }
+  ThreadCache &cache = get_thread_cache();
+  ThreadCache::PathEntry &entry = cache.paths[
+    ThreadCache::slot(source, target) & (PATH_CACHE_SIZE - 1)];
+  if (entry.valid && entry.source == source && entry.target == target) {
+    ++cache.path_hits;
+    return entry.edges;
+  }
+  ++cache.path_misses;
+  // The path is unpacked into the slot, reusing its memory
+  std::vector<EdgeIndex> &edges = entry.edges;
+  edges.clear();
+  entry.source = source;
+  entry.target = target;
+  entry.valid = true;
   Record *r = look_up(source, target);
   // No transition exist from source to target
-  if (r == nullptr) { return edges; }
-  while (r->first_n != target) {
-    edges.push_back(r->next_e);
-    r = look_up(r->first_n, target);
+  if (r != nullptr) {
+    // Unpack backward along the predecessor links
+    Record *p = r;
+    while (p != nullptr && (p->prev_r != nullptr || p->prev_n == source)) {
+      edges.push_back(p->last_e);
+      p = p->prev_r;
+    }
+    if (p == nullptr) {
+      std::reverse(edges.begin(), edges.end());
+    } else {
+      // A link is missing, fall back to querying the next node
+      edges.clear();
+      while (r->first_n != target) {
+        edges.push_back(r->next_e);
+        r = look_up(r->first_n, target);
+      }
+      edges.push_back(r->next_e);
+    }
   }
-  edges.push_back(r->next_e);
   return edges;
 }
 
+UBODTCacheStats UBODT::get_cache_stats() const {
+  flush_cache_stats();
+  return UBODTCacheStats{cache_counters->hits, cache_counters->misses,
+                         cache_counters->path_hits,
+                         cache_counters->path_misses};
+}
+
+void UBODT::flush_cache_stats() const {
+  get_thread_cache().flush();
+}
+
 C_Path UBODT::construct_complete_path(int traj_id, const TGOpath &path,
                                       const std::vector<Edge> &edges,
                                       std::vector<int> *indices,
-                                      double reverse_tolerance) const {
+                                      double reverse_tolerance,
+                                      const std::vector<std::vector<EdgeIndex>>
+                                      *fallback_paths) const {
   C_Path cpath;
   if (!indices->empty()) indices->clear();
   if (path.empty()) return cpath;
@@ -93,7 +284,12 @@ C_Path UBODT::construct_complete_path(int traj_id, const TGOpath &path,
     if ((a->edge->id != b->edge->id) || (a->offset - b->offset >
         a->edge->length * reverse_tolerance)) {
       // segs stores edge index
-      auto segs = look_sp_path(a->edge->target, b->edge->source);
+      const std::vector<EdgeIndex> *segs_ptr =
+        &look_sp_path(a->edge->target, b->edge->source);
+      if (segs_ptr->empty() && fallback_paths != nullptr) {
+        segs_ptr = &(*fallback_paths)[i];
+      }
+      const std::vector<EdgeIndex> &segs = *segs_ptr;
       // No transition exist in UBODT
       if (segs.empty() && a->edge->target != b->edge->source) {
         SPDLOG_DEBUG("Edges not found connecting a b");
@@ -137,6 +333,31 @@ unsigned int UBODT::cal_bucket_index(NodeIndex source, NodeIndex target) const {
 }
 
 
+void UBODT::link_predecessors() {
+  SPDLOG_INFO("Link UBODT records to predecessors");
+  auto begin_time = UTIL::get_current_time();
+  long long unlinked = 0;
+  for (int i = 0; i < buckets; ++i) {
+    for (Record *r = hashtable[i]; r != nullptr; r = r->next) {
+      r->prev_r = nullptr;
+      r->last_e = r->next_e;
+      if (r->prev_n == r->source) continue;
+      Record *last = look_up(r->prev_n, r->target);
+      Record *prev = look_up(r->source, r->prev_n);
+      // The last edge is only known if prev_n is adjacent to target
+      if (last == nullptr || prev == nullptr || last->first_n != r->target) {
+        ++unlinked;
+        continue;
+      }
+      r->prev_r = prev;
+      r->last_e = last->next_e;
+    }
+  }
+  auto end_time = UTIL::get_current_time();
+  SPDLOG_INFO("Link UBODT records in {} seconds, records unlinked {}",
+              UTIL::get_duration(begin_time, end_time), unlinked);
+}
+
 void UBODT::insert(Record *r) {
   //int h = (r->source*multiplier+r->target)%buckets ;
   int h = cal_bucket_index(r->source, r->target);
@@ -150,9 +371,15 @@ long UBODT::estimate_ubodt_rows(const std::string &filename) {
   struct stat stat_buf;
   long rc = stat(filename.c_str(), &stat_buf);
   if (rc == 0) {
-    int file_bytes = stat_buf.st_size;
+    long file_bytes = stat_buf.st_size;
     SPDLOG_TRACE("UBODT file size is {} bytes", file_bytes);
-    std::string fn_extension = filename.substr(filename.find_last_of(".") + 1);
+    if (IO::is_gzip_file(filename)) {
+      // Assume a typical compression ratio of gzip
+      file_bytes *= 5;
+    }
+    std::string plain_filename = IO::strip_gzip_extension(filename);
+    std::string fn_extension = plain_filename.substr(
+      plain_filename.find_last_of(".") + 1);
     std::transform(fn_extension.begin(),
                    fn_extension.end(),
                    fn_extension.begin(),
@@ -188,9 +415,10 @@ std::shared_ptr<UBODT> UBODT::read_ubodt_file(const std::string &filename,
     int multiplier) {
   std::shared_ptr<UBODT> ubodt = nullptr;
   auto start_time = UTIL::get_current_time();
-  if (UTIL::check_file_extension(filename,"bin")){
+  std::string plain_filename = IO::strip_gzip_extension(filename);
+  if (UTIL::check_file_extension(plain_filename,"bin")){
     ubodt = read_ubodt_binary(filename,multiplier);
-  } else if (UTIL::check_file_extension(filename,"csv,txt")) {
+  } else if (UTIL::check_file_extension(plain_filename,"csv,txt")) {
     ubodt = read_ubodt_csv(filename,multiplier);
   } else {
     std::string message = (boost::format("File format not supported: %1%") % filename).str();
@@ -211,13 +439,33 @@ std::shared_ptr<UBODT> UBODT::read_ubodt_csv(const std::string &filename,
   SPDLOG_TRACE("Estimated buckets {}", buckets);
   int progress_step = 1000000;
   std::shared_ptr<UBODT> table = std::make_shared<UBODT>(buckets, multiplier);
-  FILE *stream = fopen(filename.c_str(), "r");
+  // A plain file is read with fgets, which is faster than std::istream
+  bool compressed = IO::is_gzip_file(filename);
+  std::unique_ptr<IO::InputFileStream> compressed_stream;
+  FILE *stream = nullptr;
+  if (compressed) {
+    compressed_stream.reset(new IO::InputFileStream(filename));
+  } else {
+    stream = fopen(filename.c_str(), "r");
+  }
+  if (compressed ? !compressed_stream->is_open() : stream == nullptr) {
+    std::string message = (boost::format("UBODT file %1% cannot be opened") % filename).str();
+    SPDLOG_CRITICAL(message);
+    throw std::runtime_error(message);
+  }
+  auto read_line = [&](char *line) -> bool {
+    if (compressed) {
+      return static_cast<bool>(
+        compressed_stream->getline(line, BUFFER_LINE));
+    }
+    return fgets(line, BUFFER_LINE, stream) != nullptr;
+  };
   long NUM_ROWS = 0;
   char line[BUFFER_LINE];
-  if (fgets(line, BUFFER_LINE, stream)) {
+  if (read_line(line)) {
     SPDLOG_TRACE("Header line skipped.");
   }
-  while (fgets(line, BUFFER_LINE, stream)) {
+  while (read_line(line)) {
     ++NUM_ROWS;
     Record *r = (Record *) malloc(sizeof(Record));
     /* Parse line into a Record */
@@ -231,16 +479,19 @@ std::shared_ptr<UBODT> UBODT::read_ubodt_csv(const std::string &filename,
         &r->cost
     );
     r->next = nullptr;
+    r->prev_r = nullptr;
+    r->last_e = r->next_e;
     table->insert(r);
     if (NUM_ROWS % progress_step == 0) {
       SPDLOG_INFO("Read rows {}", NUM_ROWS);
     }
   }
-  fclose(stream);
+  if (stream != nullptr) fclose(stream);
   double lf = NUM_ROWS / (double) buckets;
   SPDLOG_TRACE("Estimated load factor #elements/#tablebuckets {}", lf);
   if (lf > 10) { SPDLOG_WARN("Load factor is too large."); }
   SPDLOG_INFO("Finish reading UBODT with rows {}", NUM_ROWS);
+  table->link_predecessors();
   return table;
 }
 
@@ -253,13 +504,10 @@ std::shared_ptr<UBODT> UBODT::read_ubodt_binary(const std::string &filename,
   int buckets = find_prime_number(rows / LOAD_FACTOR);
   std::shared_ptr<UBODT> table = std::make_shared<UBODT>(buckets, multiplier);
   long NUM_ROWS = 0;
-  std::ifstream ifs(filename.c_str());
-  // Check byte offset
-  std::streampos archiveOffset = ifs.tellg();
-  std::streampos streamEnd = ifs.seekg(0, std::ios_base::end).tellg();
-  ifs.seekg(archiveOffset);
+  // A compressed file cannot be seeked, so the end is found by peek
+  IO::InputFileStream ifs(filename);
   boost::archive::binary_iarchive ia(ifs);
-  while (ifs.tellg() < streamEnd) {
+  while (ifs.peek() != std::char_traits<char>::eof()) {
     ++NUM_ROWS;
     Record *r = (Record *) malloc(sizeof(Record));
     ia >> r->source;
@@ -269,17 +517,19 @@ std::shared_ptr<UBODT> UBODT::read_ubodt_binary(const std::string &filename,
     ia >> r->next_e;
     ia >> r->cost;
     r->next = nullptr;
+    r->prev_r = nullptr;
+    r->last_e = r->next_e;
     table->insert(r);
     if (NUM_ROWS % progress_step == 0) {
       SPDLOG_INFO("Read rows {}", NUM_ROWS);
     }
   }
-  ifs.close();
   double lf = NUM_ROWS / (double) buckets;
   SPDLOG_TRACE("Estimated load factor #elements/#tablebuckets {}", lf);
   if (lf > 10) {
     SPDLOG_WARN("Load factor is too large.");
   }
   SPDLOG_INFO("Finish reading UBODT with rows {}", NUM_ROWS);
+  table->link_predecessors();
   return table;
 }
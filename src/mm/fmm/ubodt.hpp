@@ -14,11 +14,16 @@
 #include "mm/transition_graph.hpp"
 #include "util/debug.hpp"
 
+#include <memory>
+
 namespace FMM {
 namespace MM {
 
 /**
- * %Record type of the upper bounded origin destination table
+ * %Record type of the upper bounded origin destination table.
+ *
+ * The predecessor link prev_r and last_e take 8 bytes per record, 48
+ * bytes instead of 40, as last_e fills the padding after next_e.
  */
 struct Record {
   NETWORK::NodeIndex source; /**< source node*/
@@ -26,8 +31,23 @@ struct Record {
   NETWORK::NodeIndex first_n; /**< next node visited from source to target */
   NETWORK::NodeIndex prev_n; /**< last node visited before target */
   NETWORK::EdgeIndex next_e; /**< next edge visited from source to target */
+  NETWORK::EdgeIndex last_e; /**< last edge visited before target, derived
+                                  after the table is loaded */
   double cost; /**< distance from source to target */
   Record *next; /**< the next record stored in hashtable */
+  Record *prev_r; /**< the record from source to prev_n, derived after
+                       the table is loaded. It is nullptr if target is
+                       adjacent to source or the link is not found. */
+};
+
+/**
+ * Statistics of the lookup cache in front of UBODT
+ */
+struct UBODTCacheStats {
+  long long hits; /**< rows found in the cache */
+  long long misses; /**< rows queried from the hash table */
+  long long path_hits; /**< shortest paths found in the cache */
+  long long path_misses; /**< shortest paths unpacked from the hash table */
 };
 
 /**
@@ -54,15 +74,48 @@ class UBODT {
    */
   Record *look_up(NETWORK::NodeIndex source, NETWORK::NodeIndex target) const;
 
+  /**
+   * Look up a row through the lookup cache of the calling thread.
+   *
+   * Each thread keeps a small direct-mapped cache of recent OD pairs,
+   * including the pairs not found, so that the node pairs repeated in
+   * consecutive layers and trajectories do not go to the hash table.
+   *
+   * @param  source source node
+   * @param  target target node
+   * @return  A row in the ubodt if the od pair is found, otherwise nullptr
+   * is returned.
+   */
+  Record *look_up_cached(NETWORK::NodeIndex source,
+                         NETWORK::NodeIndex target) const;
+  /**
+   * Look up the rows of a batch of OD pairs.
+   *
+   * Duplicated pairs are queried only once and the lookup cache of the
+   * calling thread is checked first. The buckets of the remaining pairs
+   * are prefetched before the chains are traversed, so that the cache
+   * misses of independent pairs overlap with each other.
+   *
+   * @param  od_pairs a vector of (source, target) pairs
+   * @return A vector of rows aligned with od_pairs, nullptr is stored for
+   * a pair not found.
+   */
+  std::vector<Record *> look_up_batch(
+    const std::vector<std::pair<NETWORK::NodeIndex,NETWORK::NodeIndex>>
+    &od_pairs) const;
   /**
    * Look up a shortest path (SP) containing edges from source to target.
-   * In case that SP is not found, empty is returned.
+   * In case that SP is not found, empty is returned. Recent paths are
+   * kept in the lookup cache of the calling thread. The path is unpacked
+   * following the predecessor links if they are available.
    * @param  source source node
    * @param  target target node
-   * @return  a shortest path connecting source to target
+   * @return  a shortest path connecting source to target, stored in the
+   * lookup cache of the calling thread. The reference is valid until the
+   * next lookup of the thread.
    */
-  std::vector<NETWORK::EdgeIndex> look_sp_path(NETWORK::NodeIndex source,
-      NETWORK::NodeIndex target) const;
+  const std::vector<NETWORK::EdgeIndex> &look_sp_path(
+      NETWORK::NodeIndex source, NETWORK::NodeIndex target) const;
 
   /**
    * Construct the complete path (a vector of edge ID) from an optimal path
@@ -71,15 +124,20 @@ class UBODT {
    * @param path an optimal path
    * @param edges a vector of edges
    * @param indices the index of each optimal edge in the complete path
+   * @param fallback_paths the paths between path[i] and path[i+1] found
+   * outside of UBODT, used when a pair is not found in UBODT
    * @return a complete path (topologically connected).
    * If there is a large gap in the optimal
    * path implying complete path cannot be found in UBDOT,
    * an empty path is returned
    */
-  C_Path construct_complete_path(int traj_id, const TGOpath &path,
-                                 const std::vector<NETWORK::Edge> &edges,
-                                 std::vector<int> *indices,
-                                 double reverse_tolerance) const;
+  C_Path construct_complete_path(
+    int traj_id, const TGOpath &path,
+    const std::vector<NETWORK::Edge> &edges,
+    std::vector<int> *indices,
+    double reverse_tolerance,
+    const std::vector<std::vector<NETWORK::EdgeIndex>> *fallback_paths =
+    nullptr) const;
   /**
    * Get the upperbound of the UBODT
    * @return upperbound value
@@ -94,6 +152,28 @@ class UBODT {
   unsigned int cal_bucket_index(NETWORK::NodeIndex source,
       NETWORK::NodeIndex target) const;
 
+  /**
+   * Get the statistics of the lookup cache summed over all threads.
+   * The pending statistics of the calling thread are included.
+   */
+  UBODTCacheStats get_cache_stats() const;
+  /**
+   * Add the pending statistics of the lookup cache of the calling thread
+   * to the totals returned by get_cache_stats.
+   */
+  void flush_cache_stats() const;
+  /**
+   * Link each record to the record of its predecessor node, so that a
+   * shortest path can be unpacked from the target to the source by
+   * following pointers instead of querying the hash table per edge.
+   * A record is linked only if the record from its predecessor node to
+   * the target is a single edge, otherwise, e.g., a path of equal cost
+   * with more edges is stored there, it is left unlinked and its path
+   * is unpacked by querying the next node.
+   * It is called after a table is read from a file, and should be called
+   * again if records are inserted afterwards.
+   */
+  void link_predecessors();
   /**
    *  Insert a record into the hash table
    * @param r a record to be inserted
@@ -106,7 +186,8 @@ class UBODT {
 
   /**
    * Read UBODT from a file.
-   * The format will be infered from the file extension.
+   * The format will be infered from the file extension, a file ending
+   * with .gz is decompressed, such as ubodt.txt.gz.
    * @param  filename   input file name
    * @param  multiplier A value used for inserting rows to the UBODT
    * @return  A shared pointer to the UBODT data.
@@ -147,12 +228,28 @@ class UBODT {
                                               a bucket. */
   static const int BUFFER_LINE = 1024; /**< Number of characters to store in
                                             a line */
+  static const int CACHE_SIZE = 4096; /**< Number of rows in the lookup
+                                           cache of a thread, power of 2 */
+  static const int PATH_CACHE_SIZE = 1024; /**< Number of paths in the lookup
+                                           cache of a thread, power of 2 */
  private:
   const long long multiplier;   // multiplier to get a unique ID
   const int buckets;   // number of buckets
   long long num_rows=0;   // multiplier to get a unique ID
   double delta = 0.0;
   Record **hashtable;
+  struct ThreadCache;
+  struct CacheCounters;
+  /**
+   * Get the lookup cache of the calling thread, which is reset if it
+   * is created for another table or the table has changed since then.
+   * The pending statistics are added to the table the cache was created
+   * for before it is reset.
+   */
+  ThreadCache &get_thread_cache() const;
+  const long long cache_owner_id; // unique id to identify thread caches
+  // Shared with the thread caches, which can outlive the table
+  std::shared_ptr<CacheCounters> cache_counters;
 };
 }
 }
@@ -0,0 +1,47 @@
+#include "mm/fmm/ubodt_fallback.hpp"
+#include "util/debug.hpp"
+
+#include <limits>
+
+using namespace FMM;
+using namespace FMM::NETWORK;
+using namespace FMM::MM;
+
+UBODTFallback::UBODTFallback(const NetworkGraph &graph) : graph_(graph) {
+}
+
+double UBODTFallback::get_cost(NodeIndex source, NodeIndex target,
+                               double delta) {
+  auto iter = trees_.find(source);
+  if (iter == trees_.end() || iter->second.delta < delta) {
+    // Search again as a target beyond the cached bound may be reached
+    SearchTree &tree = trees_[source];
+    tree.delta = delta;
+    tree.pmap.clear();
+    tree.dmap.clear();
+    graph_.single_source_upperbound_dijkstra(source, delta,
+                                             &tree.pmap, &tree.dmap);
+    ++num_searches_;
+    SPDLOG_TRACE("Fallback search from {} delta {} visits {} nodes",
+                 source, delta, tree.dmap.size());
+    iter = trees_.find(source);
+  }
+  const DistanceMap &dmap = iter->second.dmap;
+  auto target_iter = dmap.find(target);
+  if (target_iter == dmap.end() || target_iter->second > delta) {
+    return std::numeric_limits<double>::infinity();
+  }
+  return target_iter->second;
+}
+
+std::vector<EdgeIndex> UBODTFallback::get_path(NodeIndex source,
+                                               NodeIndex target) const {
+  auto iter = trees_.find(source);
+  if (iter == trees_.end()) return {};
+  return graph_.back_track(source, target, iter->second.pmap,
+                           iter->second.dmap);
+}
+
+long long UBODTFallback::get_num_searches() const {
+  return num_searches_;
+}
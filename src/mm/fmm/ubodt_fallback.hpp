@@ -0,0 +1,69 @@
+/**
+ * Fast map matching.
+ *
+ * Bounded graph search used for the OD pairs not covered by UBODT
+ */
+
+#ifndef FMM_UBODT_FALLBACK_H_
+#define FMM_UBODT_FALLBACK_H_
+
+#include "network/network_graph.hpp"
+
+#include <unordered_map>
+
+namespace FMM {
+namespace MM {
+
+/**
+ * Fallback of UBODT for the transitions longer than its upper bound.
+ *
+ * A bounded Dijkstra search is run in the network graph from the source
+ * node of a missing OD pair. The search tree is cached by source node,
+ * so that the other targets of the same source and the complete path
+ * are served without searching again. An object is meant to be used
+ * for a single trajectory and is not thread safe.
+ */
+class UBODTFallback {
+ public:
+  /**
+   * Constructor
+   * @param graph network graph
+   */
+  explicit UBODTFallback(const NETWORK::NetworkGraph &graph);
+  /**
+   * Get the shortest path distance from source to target
+   * @param  source source node
+   * @param  target target node
+   * @param  delta  upper bound of the search
+   * @return the distance, infinity if target is not reached within delta
+   */
+  double get_cost(NETWORK::NodeIndex source, NETWORK::NodeIndex target,
+                  double delta);
+  /**
+   * Get the shortest path from source to target found by get_cost
+   * @return a vector of edge index, empty if the path is not found
+   */
+  std::vector<NETWORK::EdgeIndex> get_path(NETWORK::NodeIndex source,
+                                           NETWORK::NodeIndex target) const;
+  /**
+   * Get the number of graph searches run
+   */
+  long long get_num_searches() const;
+ private:
+  /**
+   * Search tree of a source node
+   */
+  struct SearchTree {
+    double delta; /**< upper bound of the search */
+    NETWORK::PredecessorMap pmap; /**< predecessor map */
+    NETWORK::DistanceMap dmap; /**< distance map */
+  };
+  const NETWORK::NetworkGraph &graph_;
+  std::unordered_map<NETWORK::NodeIndex, SearchTree> trees_;
+  long long num_searches_ = 0;
+};
+
+}
+}
+
+#endif //FMM_UBODT_FALLBACK_H_
@@ -4,6 +4,7 @@
 
 #include "mm/fmm/ubodt_gen_algorithm.hpp"
 #include "mm/fmm/ubodt.hpp"
+#include "io/compressed_file.hpp"
 #include "util/debug.hpp"
 #include <omp.h>
 
@@ -38,7 +39,7 @@ void UBODTGenAlgorithm::precompute_ubodt_single_thead(
   int num_vertices = ng_.get_num_vertices();
   int step_size = num_vertices / 10;
   if (step_size < 10) step_size = 10;
-  std::ofstream myfile(filename);
+  IO::OutputFileStream myfile(filename);
   SPDLOG_INFO("Start to generate UBODT with delta {}", delta);
   SPDLOG_INFO("Output format {}", (binary ? "binary" : "csv"));
   if (binary) {
@@ -72,7 +73,7 @@ void UBODTGenAlgorithm::precompute_ubodt_omp(
   int num_vertices = ng_.get_num_vertices();
   int step_size = num_vertices / 10;
   if (step_size < 10) step_size = 10;
-  std::ofstream myfile(filename);
+  IO::OutputFileStream myfile(filename);
   SPDLOG_INFO("Start to generate UBODT with delta {}", delta);
   SPDLOG_INFO("Output format {}", (binary ? "binary" : "csv"));
   if (binary) {
@@ -145,7 +146,9 @@ void UBODTGenAlgorithm::write_result_csv(
            successor,
            prev_node,
            edge_index,
+           edge_index,
            dmap[cur_node],
+           nullptr,
            nullptr});
     }
   }
@@ -194,7 +197,9 @@ void UBODTGenAlgorithm::write_result_binary(boost::archive::binary_oarchive &str
            successor,
            prev_node,
            edge_index,
+           edge_index,
            dmap[cur_node],
+           nullptr,
            nullptr});
     }
   }
@@ -1,6 +1,7 @@
 #include "mm/fmm/ubodt_gen_app_config.hpp"
 #include "util/util.hpp"
 #include "util/debug.hpp"
+#include "io/compressed_file.hpp"
 
 using namespace FMM;
 using namespace FMM::CORE;
@@ -85,7 +86,8 @@ void UBODTGenAppConfig::print_help() {
   oss << "ubodt_gen argument lists:\n";
   NetworkConfig::register_help(oss);
   oss << "--delta (optional) <double>: upperbound (3000.0)\n";
-  oss << "-o/--output (required) <string>: Output file name\n";
+  oss << "-o/--output (required) <string>: Output file name,\n";
+  oss << "  compressed with gzip if it ends with .gz\n";
   oss << "-l/--log_level (optional) <int>: log level (2)\n";
   oss << "--use_omp: use OpenMP or not\n";
   oss << "-h/--help: help information\n";
@@ -120,7 +122,8 @@ bool UBODTGenAppConfig::validate() const {
 }
 
 bool UBODTGenAppConfig::is_binary_output() const {
-  if (UTIL::check_file_extension(result_file,"bin")) {
+  if (UTIL::check_file_extension(
+        IO::strip_gzip_extension(result_file),"bin")) {
     return true;
   }
   return false;
@@ -6,6 +6,7 @@
 #include "h3_util.hpp"
 #include "h3mm_writer.hpp"
 #include "io/gps_reader.hpp"
+#include "mm/mm_pipeline.hpp"
 
 namespace FMM {
 namespace MM {
@@ -172,29 +173,34 @@ public:
     UTIL::TimePoint begin_time = UTIL::get_current_time();
     FMM::IO::GPSReader reader(gps_config);
     H3MatchResultWriter writer(output_config);
+    // Progress is kept out of the results written to the standard output
+    std::ostream &progress_stream =
+      FMM::IO::is_standard_stream(output_config.file) ? std::cerr : std::cout;
     if (use_omp) {
-      int buffer_trajectories_size = 100000;
-      while (reader.has_next_trajectory()) {
-        std::vector<FMM::CORE::Trajectory> trajectories =
-          reader.read_next_N_trajectories(buffer_trajectories_size);
-        int trajectories_fetched = trajectories.size();
-        #pragma omp parallel for
-        for (int i = 0; i < trajectories_fetched; ++i) {
-          FMM::CORE::Trajectory &trajectory = trajectories[i];
-          int points_in_tr = trajectory.geom.get_num_points();
-          auto result = match_traj(
-            trajectory, config);
-          writer.write_result(trajectory,result);
-          #pragma omp critical
-          total_points += points_in_tr;
-          ++progress;
-          if (progress % step_size == 0) {
-            std::stringstream buf;
-            buf << "Progress " << progress << '\n';
-            std::cout << buf.rdbuf();
-          }
-        }
+      // The results written to the standard output are passed on once
+      // the workers run out of results
+      MatchPipeline<H3MatchResult>::FlushFunction flush;
+      if (FMM::IO::is_standard_stream(output_config.file)) {
+        flush = [&writer] { writer.flush(); };
       }
+      MatchPipeline<H3MatchResult> pipeline;
+      pipeline.run(&reader, [&](const FMM::CORE::Trajectory &trajectory) {
+        return match_traj(trajectory, config);
+      }, [&](const FMM::CORE::Trajectory &trajectory,
+             const H3MatchResult &result, std::string *text) {
+        writer.format_result(trajectory, result, text);
+      }, [&](const FMM::CORE::Trajectory &trajectory,
+             const H3MatchResult &result, const std::string &text) {
+        int points_in_tr = trajectory.geom.get_num_points();
+        writer.write_text(text);
+        total_points += points_in_tr;
+        ++progress;
+        if (progress % step_size == 0) {
+          std::stringstream buf;
+          buf << "Progress " << progress << '\n';
+          progress_stream << buf.rdbuf();
+        }
+      }, flush);
     } else {
       while (reader.has_next_trajectory()) {
         if (progress % step_size == 0) {
@@ -3,6 +3,7 @@
 
 #include "io/gps_reader.hpp"
 #include "config/gps_config.hpp"
+#include "config/result_config.hpp"
 #include "h3mm.hpp"
 #include "cxxopts/cxxopts.hpp"
 #include "util/util.hpp"
@@ -26,6 +27,9 @@ public:
    *
    */
   H3MMAppConfig(int argc, char **argv){
+    // Keep the log out of the results written to the standard output
+    if (FMM::CONFIG::ResultConfig::is_standard_output(argc, argv))
+      FMM::UTIL::log_to_stderr();
     spdlog::set_pattern("[%^%l%$][%s:%-3#] %v");
     if (argc==2) {
       std::string configfile(argv[1]);
@@ -3,6 +3,7 @@
 #include "h3_type.hpp"
 #include "h3_util.hpp"
 #include "util/util.hpp"
+#include "io/compressed_file.hpp"
 
 namespace FMM {
 namespace MM {
@@ -15,7 +16,8 @@ struct H3MatchResultConfig {
   H3MatchResultConfig(const std::string &filename, bool write_geom_arg) :
     file(filename),write_geom(write_geom_arg){
   };
-  std::string file;   /**< Output file to write the result */
+  std::string file;   /**< Output file to write the result, - for the
+                           standard output */
   bool write_geom;
   /**
    * Check the validation of the configuration
@@ -26,6 +28,7 @@ struct H3MatchResultConfig {
       SPDLOG_CRITICAL("Output file not specified");
       return false;
     }
+    if (FMM::IO::is_standard_stream(file)) return true;
     if (FMM::UTIL::file_exists(file))
     {
       SPDLOG_WARN("Overwrite existing result file {}",file);
@@ -79,7 +82,8 @@ struct H3MatchResultConfig {
    * Register help information to a string stream
    */
   static void register_help(std::ostringstream &oss){
-    oss<<"-o,--output (required) <string>: Output file name\n";
+    oss<<"-o,--output (required) <string>: Output file name, "
+      "- for the standard output\n";
     oss<<"--write_geom: if specified, write geometry output\n";
   };
 };
@@ -113,14 +117,40 @@ public:
    */
   void write_result(const FMM::CORE::Trajectory &traj,
                     const FMM::MM::H3MatchResult &result){
+    std::string text;
+    format_result(traj, result, &text);
+    #pragma omp critical
+    write_text(text);
+  };
+  /**
+   * Format a match result into a line of text, which can be called
+   * concurrently.
+   * @param traj Input trajectory
+   * @param result Map match result
+   * @param text the line is appended to it
+   */
+  void format_result(const FMM::CORE::Trajectory &traj,
+                     const FMM::MM::H3MatchResult &result,
+                     std::string *text) const {
     std::ostringstream buf;
     buf << traj.id;
     buf << ";" << result.hexs;
     if (config_.write_geom)
       buf << ";" << hexs2wkt(result.hexs, 12);
     buf << "\n";
-    #pragma omp critical
-    m_fstream << buf.str();
+    *text += buf.str();
+  };
+  /**
+   * Write a text formatted by format_result, called by a single thread.
+   */
+  void write_text(const std::string &text){
+    m_fstream << text;
+  };
+  /**
+   * Flush the text written to the file
+   */
+  void flush(){
+    m_fstream.flush();
   };
 private:
   void write_header(){
@@ -131,7 +161,7 @@ private:
     m_fstream<<"\n";
   };
   H3MatchResultConfig config_;
-  std::ofstream m_fstream;
+  FMM::IO::OutputFileStream m_fstream;
 };     // CSVMatchResultWriter
 }
 }
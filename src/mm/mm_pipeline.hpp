@@ -0,0 +1,416 @@
+/**
+ * Fast map matching.
+ *
+ * Pipeline of reading, map matching and writing trajectories, which are
+ * run concurrently and connected by bounded queues.
+ */
+
+#ifndef FMM_MM_PIPELINE_HPP
+#define FMM_MM_PIPELINE_HPP
+
+#include "core/gps.hpp"
+#include "io/gps_reader.hpp"
+#include "util/debug.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <omp.h>
+
+namespace FMM {
+namespace MM {
+
+/**
+ * A queue with a bounded capacity shared by producer and consumer
+ * threads. A push blocks while the queue is full and a pop blocks while
+ * it is empty, until the queue is closed.
+ */
+template <typename T>
+class BoundedQueue {
+ public:
+  /**
+   * Constructor
+   * @param capacity maximum number of items stored
+   */
+  explicit BoundedQueue(std::size_t capacity) :
+    capacity_(capacity > 0 ? capacity : 1) {
+  };
+  /**
+   * Push an item to the queue
+   * @return false if the queue is closed and the item is dropped
+   */
+  bool push(T item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock, [this] {
+      return closed_ || items_.size() < capacity_;
+    });
+    if (closed_) return false;
+    items_.push_back(std::move(item));
+    not_empty_.notify_one();
+    return true;
+  };
+  /**
+   * Pop an item from the queue
+   * @param item set to the item popped
+   * @return false if the queue is closed and empty
+   */
+  bool pop(T *item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this] {
+      return closed_ || !items_.empty();
+    });
+    if (items_.empty()) return false;
+    *item = std::move(items_.front());
+    items_.pop_front();
+    not_full_.notify_one();
+    return true;
+  };
+  /**
+   * Check if the queue holds no item
+   */
+  bool empty() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return items_.empty();
+  };
+  /**
+   * Close the queue, the items left can still be popped.
+   */
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_empty_.notify_all();
+    not_full_.notify_all();
+  };
+ private:
+  std::size_t capacity_;
+  std::deque<T> items_;
+  bool closed_ = false;
+  std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+};
+
+/**
+ * Estimate the cost of matching a trajectory, which is the number of
+ * points weighted by the size of its bounding box relative to the
+ * length of the trajectory. A trajectory spread over a large area
+ * searches more of the network than one moving back and forth.
+ */
+inline double estimate_match_cost(const CORE::Trajectory &traj) {
+  const CORE::LineString &geom = traj.geom;
+  int N = geom.get_num_points();
+  if (N < 2) return N;
+  double min_x = geom.get_x(0), max_x = min_x;
+  double min_y = geom.get_y(0), max_y = min_y;
+  for (int i = 1; i < N; ++i) {
+    min_x = std::min(min_x, geom.get_x(i));
+    max_x = std::max(max_x, geom.get_x(i));
+    min_y = std::min(min_y, geom.get_y(i));
+    max_y = std::max(max_y, geom.get_y(i));
+  }
+  double length = geom.get_length();
+  if (length <= 0) return N;
+  double diagonal = std::sqrt((max_x - min_x) * (max_x - min_x) +
+                              (max_y - min_y) * (max_y - min_y));
+  return N * (1 + diagonal / length);
+}
+
+/**
+ * Order a window of trajectories from the most expensive one to the
+ * cheapest one and group them into chunks. A chunk is closed once its
+ * total cost reaches chunk_cost, the last chunk may be cheaper.
+ * @param  costs      estimated cost of each trajectory in the window
+ * @param  chunk_cost minimum total cost of a chunk
+ * @return the indices of the trajectories in each chunk
+ */
+inline std::vector<std::vector<int>> make_match_chunks(
+  const std::vector<double> &costs, double chunk_cost) {
+  std::vector<int> order(costs.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&costs](int a, int b) {
+    return costs[a] > costs[b];
+  });
+  std::vector<std::vector<int>> chunks;
+  std::vector<int> chunk;
+  double cost = 0;
+  for (int i : order) {
+    chunk.push_back(i);
+    cost += costs[i];
+    if (cost >= chunk_cost) {
+      chunks.push_back(std::move(chunk));
+      chunk.clear();
+      cost = 0;
+    }
+  }
+  if (!chunk.empty()) chunks.push_back(std::move(chunk));
+  return chunks;
+}
+
+/**
+ * Pipeline to match the trajectories of a GPS file.
+ *
+ * A reader thread pushes trajectories to a bounded input queue, a pool of
+ * worker threads matches them and pushes the results to a bounded output
+ * queue, which is consumed by the calling thread. The workers never wait
+ * for a whole batch to be read or matched, and the number of trajectories
+ * held in memory is bounded by the capacity of the queues.
+ *
+ * Trajectories are read in windows and the trajectories of a window are
+ * queued from the most expensive one to the cheapest one, so that a long
+ * trajectory does not start last and leave the other workers idle. The
+ * cheap trajectories are grouped into chunks to reduce the queue traffic.
+ * Each worker pulls the next chunk once it is free. A window is closed
+ * before it is full once the workers run out of work, so that a slow
+ * stream such as the standard input is not held back to fill it.
+ *
+ * A result can be formatted into text by the worker matching it, so that
+ * the writing thread only appends the text to the output. The results are
+ * written in the order they are finished, or in the order the trajectories
+ * are read if the order is preserved, in which case a result finished
+ * early is held until all the results before it are written. The reader
+ * then stays at most a window ahead of the results written, so that a
+ * slow trajectory does not leave all the results after it held. A flush
+ * function can be set to pass the results written on once the writing
+ * thread catches up with the workers, such as to a standard output read
+ * by another program.
+ */
+template <typename Result>
+class MatchPipeline {
+ public:
+  /**
+   * Function matching a trajectory, called concurrently by the workers
+   */
+  typedef std::function<Result(const CORE::Trajectory &)> MatchFunction;
+  /**
+   * Function formatting a result into text, called concurrently by the
+   * workers
+   */
+  typedef std::function<void(const CORE::Trajectory &, const Result &,
+                             std::string *)> FormatFunction;
+  /**
+   * Function writing a result with the text formatted, called by a
+   * single thread
+   */
+  typedef std::function<void(const CORE::Trajectory &, const Result &,
+                             const std::string &)> WriteFunction;
+  /**
+   * Function flushing the results written, called by the writing thread
+   */
+  typedef std::function<void()> FlushFunction;
+  /**
+   * Constructor
+   * @param num_workers number of worker threads, the maximum number of
+   * OpenMP threads is used if it is not positive.
+   * @param window_size maximum number of trajectories ordered by cost at
+   * a time, which is also the capacity of the output queue and the number
+   * of results held at most if the order is preserved
+   * @param chunk_cost trajectories are grouped into a chunk until the
+   * total estimated cost reaches this value
+   * @param preserve_order if true, the results are written in the order
+   * the trajectories are read
+   */
+  explicit MatchPipeline(int num_workers = 0, int window_size = 1000,
+                         double chunk_cost = 1000,
+                         bool preserve_order = false) :
+    num_workers_(num_workers > 0 ? num_workers : omp_get_max_threads()),
+    window_size_(window_size > 0 ? window_size : 1),
+    chunk_cost_(chunk_cost), preserve_order_(preserve_order) {
+  };
+  /**
+   * Get the time in seconds each worker spent in matching during the last
+   * run
+   */
+  const std::vector<double> &get_busy_times() const {
+    return busy_times_;
+  };
+  /**
+   * Run the pipeline until all the trajectories are read and written.
+   * An exception thrown by any stage stops the pipeline and is rethrown.
+   * @param reader reader of the trajectories, such as a GPSReader, which
+   * provides has_next_trajectory and read_next_trajectory
+   * @param match  function to match a trajectory
+   * @param format function to format a result, the text passed to write
+   * is empty if it is not set
+   * @param write  function to write a result
+   * @param flush  function called once no more result is ready to be
+   * written, if it is set
+   */
+  template <typename Reader>
+  void run(Reader *reader, const MatchFunction &match,
+           const FormatFunction &format, const WriteFunction &write,
+           const FlushFunction &flush = FlushFunction()) {
+    // A trajectory with its sequence number in the input
+    struct Task {
+      long long seq;
+      CORE::Trajectory trajectory;
+    };
+    struct Output {
+      long long seq;
+      CORE::Trajectory trajectory;
+      Result result;
+      std::string text;
+    };
+    typedef std::vector<Task> Chunk;
+    BoundedQueue<Chunk> input_queue(2 * num_workers_);
+    BoundedQueue<Output> output_queue(window_size_);
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    // Sequence number of the next result to write in order
+    long long next_seq = 0;
+    bool stopped = false;
+    std::mutex order_mutex;
+    std::condition_variable order_cv;
+    auto fail = [&](std::exception_ptr e) {
+      {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error) error = e;
+      }
+      {
+        std::lock_guard<std::mutex> lock(order_mutex);
+        stopped = true;
+      }
+      order_cv.notify_all();
+      input_queue.close();
+      output_queue.close();
+    };
+    // A trajectory is read only if its result can be held in order
+    auto in_window = [&](long long seq) {
+      return !preserve_order_ ||
+        seq - next_seq < static_cast<long long>(window_size_);
+    };
+    SPDLOG_DEBUG("Start pipeline with {} workers", num_workers_);
+    auto begin_time = std::chrono::steady_clock::now();
+    std::thread reader_thread([&] {
+      try {
+        bool open = true;
+        long long seq = 0;
+        while (open) {
+          {
+            std::unique_lock<std::mutex> lock(order_mutex);
+            order_cv.wait(lock, [&] { return stopped || in_window(seq); });
+            if (stopped) break;
+          }
+          if (!reader->has_next_trajectory()) break;
+          std::vector<Task> window;
+          std::vector<double> costs;
+          while (window.size() < window_size_ &&
+                 reader->has_next_trajectory()) {
+            window.push_back(Task{seq++, reader->read_next_trajectory()});
+            costs.push_back(estimate_match_cost(window.back().trajectory));
+            // The next read may block, flush if the workers are idle
+            if (input_queue.empty()) break;
+            if (preserve_order_) {
+              std::lock_guard<std::mutex> lock(order_mutex);
+              if (!in_window(seq)) break;
+            }
+          }
+          for (const std::vector<int> &indices :
+               make_match_chunks(costs, chunk_cost_)) {
+            Chunk chunk;
+            for (int j : indices) {
+              chunk.push_back(std::move(window[j]));
+            }
+            if (!(open = input_queue.push(std::move(chunk)))) break;
+          }
+        }
+      } catch (...) {
+        fail(std::current_exception());
+      }
+      input_queue.close();
+    });
+    std::vector<std::thread> workers;
+    std::mutex workers_mutex;
+    int workers_running = num_workers_;
+    busy_times_.assign(num_workers_, 0);
+    for (int i = 0; i < num_workers_; ++i) {
+      workers.emplace_back([&, i] {
+        try {
+          Chunk chunk;
+          bool open = true;
+          while (open && input_queue.pop(&chunk)) {
+            for (Task &task : chunk) {
+              auto match_begin = std::chrono::steady_clock::now();
+              Output output{task.seq, std::move(task.trajectory),
+                            Result(), std::string()};
+              output.result = match(output.trajectory);
+              if (format) {
+                format(output.trajectory, output.result, &output.text);
+              }
+              busy_times_[i] += std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - match_begin).count();
+              if (!(open = output_queue.push(std::move(output)))) {
+                break;
+              }
+            }
+          }
+        } catch (...) {
+          fail(std::current_exception());
+        }
+        // The last worker finished closes the output queue
+        std::lock_guard<std::mutex> lock(workers_mutex);
+        if (--workers_running == 0) output_queue.close();
+      });
+    }
+    try {
+      Output output;
+      // Results finished before the ones preceding them in the input
+      std::map<long long, Output> pending;
+      while (output_queue.pop(&output)) {
+        if (!preserve_order_) {
+          write(output.trajectory, output.result, output.text);
+        } else {
+          long long seq = output.seq;
+          pending.insert(std::make_pair(seq, std::move(output)));
+          auto iter = pending.begin();
+          bool written = false;
+          while (iter != pending.end() && iter->first == next_seq) {
+            write(iter->second.trajectory, iter->second.result,
+                  iter->second.text);
+            iter = pending.erase(iter);
+            std::lock_guard<std::mutex> lock(order_mutex);
+            ++next_seq;
+            written = true;
+          }
+          if (written) order_cv.notify_all();
+        }
+        if (flush && output_queue.empty()) flush();
+      }
+    } catch (...) {
+      fail(std::current_exception());
+    }
+    reader_thread.join();
+    for (std::thread &worker : workers) {
+      worker.join();
+    }
+    double duration = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - begin_time).count();
+    SPDLOG_INFO("Workers {} busy min {:.3f} s mean {:.3f} s max {:.3f} s "
+                "of {:.3f} s", num_workers_,
+                *std::min_element(busy_times_.begin(), busy_times_.end()),
+                std::accumulate(busy_times_.begin(), busy_times_.end(),
+                                0.0) / num_workers_,
+                *std::max_element(busy_times_.begin(), busy_times_.end()),
+                duration);
+    if (error) std::rethrow_exception(error);
+  };
+ private:
+  int num_workers_;
+  std::size_t window_size_;
+  double chunk_cost_;
+  bool preserve_order_;
+  std::vector<double> busy_times_;
+};
+
+}
+}
+#endif //FMM_MM_PIPELINE_HPP
@@ -63,6 +63,19 @@ struct MatchedCandidate {
  */
 typedef std::vector<MatchedCandidate> MatchedCandidatePath;
 
+/**
+ * A candidate finalized by an online map matching session
+ */
+struct OnlineMatch {
+  int point_index; /**< index of the point in the order it is pushed */
+  MatchedCandidate mc; /**< Candidate matched to the point */
+};
+
+/**
+ * A vector of finalized candidates returned by an online session
+ */
+typedef std::vector<OnlineMatch> OnlineMatchPath;
+
 /**
  * Map matched result representation
  */
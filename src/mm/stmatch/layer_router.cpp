@@ -0,0 +1,192 @@
+#include "mm/stmatch/layer_router.hpp"
+#include "util/debug.hpp"
+
+#include <algorithm>
+#include <limits>
+
+using namespace FMM;
+using namespace FMM::CORE;
+using namespace FMM::NETWORK;
+using namespace FMM::MM;
+
+double LayerRoutes::get_distance(int i, int j) const {
+  return distances_[i * targets_.size() + j];
+}
+
+std::vector<EdgeIndex> LayerRoutes::get_path(int i, int j) const {
+  std::vector<EdgeIndex> path;
+  const Meeting &m = meetings_[i * targets_.size() + j];
+  if (m.edge == -2 ||
+      distances_[i * targets_.size() + j] ==
+      std::numeric_limits<double>::max()) {
+    return path;
+  }
+  if (m.edge >= 0) {
+    // Forward part from the source to the meeting edge
+    const std::unordered_map<NodeIndex, EdgeIndex> &forward =
+      forward_edges_[i];
+    NodeIndex start = sources_[i]->edge->target;
+    NodeIndex u = graph_->get_edge((EdgeIndex) m.edge).source;
+    path.push_back(m.edge);
+    while (u != start) {
+      EdgeIndex e = forward.at(u);
+      path.push_back(e);
+      u = graph_->get_edge(e).source;
+    }
+    std::reverse(path.begin(), path.end());
+  }
+  // Backward part from the meeting node to the target
+  const std::unordered_map<NodeIndex, EdgeIndex> &backward =
+    backward_edges_[j];
+  NodeIndex end = targets_[j]->edge->source;
+  NodeIndex v = m.node;
+  while (v != end) {
+    EdgeIndex e = backward.at(v);
+    path.push_back(e);
+    v = graph_->get_edge(e).target;
+  }
+  return path;
+}
+
+LayerRouter::LayerRouter(const NetworkGraph &graph) : graph_(graph) {
+  const Graph_T &g = graph_.get_boost_graph();
+  unsigned int num_vertices = graph_.get_num_vertices();
+  in_offsets_.assign(num_vertices + 1, 0);
+  boost::graph_traits<Graph_T>::edge_iterator it, end;
+  for (boost::tie(it, end) = boost::edges(g); it != end; ++it) {
+    ++in_offsets_[boost::target(*it, g) + 1];
+  }
+  for (unsigned int i = 1; i <= num_vertices; ++i) {
+    in_offsets_[i] += in_offsets_[i - 1];
+  }
+  in_edges_.resize(in_offsets_[num_vertices]);
+  std::vector<unsigned int> positions(in_offsets_.begin(),
+                                      in_offsets_.end() - 1);
+  for (boost::tie(it, end) = boost::edges(g); it != end; ++it) {
+    NodeIndex v = boost::target(*it, g);
+    in_edges_[positions[v]++] =
+      InEdge{(NodeIndex) boost::source(*it, g), g[*it].index, g[*it].length};
+  }
+}
+
+LayerRoutes LayerRouter::search(const std::vector<const Candidate *> &sources,
+                                const std::vector<const Candidate *> &targets,
+                                double delta,
+                                double reverse_tolerance) const {
+  int NS = sources.size();
+  int NT = targets.size();
+  LayerRoutes routes;
+  routes.graph_ = &graph_;
+  routes.sources_ = sources;
+  routes.targets_ = targets;
+  routes.distances_.assign(NS * NT, std::numeric_limits<double>::max());
+  routes.meetings_.assign(NS * NT, LayerRoutes::Meeting{0, -2});
+  routes.forward_edges_.resize(NS);
+  routes.backward_edges_.resize(NT);
+  double radius = delta / 2;
+  std::unordered_map<NodeIndex, std::vector<BucketEntry>> buckets;
+  // Backward search from each target
+  for (int j = 0; j < NT; ++j) {
+    const Candidate *b = targets[j];
+    if (b->offset > delta) continue;
+    std::unordered_map<NodeIndex, EdgeIndex> &succ = routes.backward_edges_[j];
+    DistanceMap dmap;
+    Heap Q;
+    NodeIndex start = b->edge->source;
+    Q.push(start, b->offset);
+    dmap.insert({start, b->offset});
+    // The start node always enters the bucket so that a forward search
+    // settling it can reach the target.
+    buckets[start].push_back(BucketEntry{j, b->offset});
+    while (!Q.empty()) {
+      HeapNode node = Q.top();
+      Q.pop();
+      if (node.value > radius) break;
+      NodeIndex v = node.index;
+      if (v != start) {
+        buckets[v].push_back(BucketEntry{j, node.value});
+      }
+      for (unsigned int k = in_offsets_[v]; k < in_offsets_[v + 1]; ++k) {
+        const InEdge &e = in_edges_[k];
+        double temp_dist = node.value + e.length;
+        auto u_iter = dmap.find(e.source);
+        if (u_iter != dmap.end()) {
+          if (u_iter->second - temp_dist > 1e-6) {
+            u_iter->second = temp_dist;
+            succ[e.source] = e.index;
+            Q.decrease_key(e.source, temp_dist);
+          }
+        } else if (temp_dist <= radius) {
+          Q.push(e.source, temp_dist);
+          dmap.insert({e.source, temp_dist});
+          succ[e.source] = e.index;
+        }
+      }
+    }
+  }
+  const Graph_T &g = graph_.get_boost_graph();
+  // Forward search from each source
+  for (int i = 0; i < NS; ++i) {
+    const Candidate *a = sources[i];
+    double *distances = &routes.distances_[i * NT];
+    LayerRoutes::Meeting *meetings = &routes.meetings_[i * NT];
+    // Candidates on the same edge are connected directly
+    for (int j = 0; j < NT; ++j) {
+      const Candidate *b = targets[j];
+      if (a->edge->index != b->edge->index) continue;
+      if (a->offset <= b->offset) {
+        distances[j] = b->offset - a->offset;
+      } else if (a->offset - b->offset <
+                 a->edge->length * reverse_tolerance) {
+        distances[j] = 0;
+      }
+    }
+    auto scan_bucket = [&](NodeIndex v, double dist, int edge) {
+      auto iter = buckets.find(v);
+      if (iter == buckets.end()) return;
+      for (const BucketEntry &entry : iter->second) {
+        double total = dist + entry.dist;
+        if (total <= delta && total < distances[entry.target]) {
+          distances[entry.target] = total;
+          meetings[entry.target] = LayerRoutes::Meeting{v, edge};
+        }
+      }
+    };
+    NodeIndex start = a->edge->target;
+    double start_dist = a->edge->length - a->offset;
+    if (start_dist > delta) continue;
+    scan_bucket(start, start_dist, -1);
+    std::unordered_map<NodeIndex, EdgeIndex> &pred = routes.forward_edges_[i];
+    DistanceMap dmap;
+    Heap Q;
+    Q.push(start, start_dist);
+    dmap.insert({start, start_dist});
+    OutEdgeIterator out_i, out_end;
+    while (!Q.empty()) {
+      HeapNode node = Q.top();
+      Q.pop();
+      if (node.value > radius) break;
+      NodeIndex u = node.index;
+      for (boost::tie(out_i, out_end) = boost::out_edges(u, g);
+           out_i != out_end; ++out_i) {
+        NodeIndex v = boost::target(*out_i, g);
+        double temp_dist = node.value + g[*out_i].length;
+        EdgeIndex e = g[*out_i].index;
+        scan_bucket(v, temp_dist, e);
+        auto v_iter = dmap.find(v);
+        if (v_iter != dmap.end()) {
+          if (v_iter->second - temp_dist > 1e-6) {
+            v_iter->second = temp_dist;
+            pred[v] = e;
+            Q.decrease_key(v, temp_dist);
+          }
+        } else if (temp_dist <= radius) {
+          Q.push(v, temp_dist);
+          dmap.insert({v, temp_dist});
+          pred[v] = e;
+        }
+      }
+    }
+  }
+  return routes;
+}
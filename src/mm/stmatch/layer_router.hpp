@@ -0,0 +1,114 @@
+/**
+ * Fast map matching.
+ *
+ * Many-to-many bounded shortest path search between two layers of
+ * candidates, used in stmatch.
+ */
+
+#ifndef FMM_LAYER_ROUTER_HPP
+#define FMM_LAYER_ROUTER_HPP
+
+#include "network/network_graph.hpp"
+#include "mm/mm_type.hpp"
+
+#include <unordered_map>
+
+namespace FMM {
+namespace MM {
+
+class LayerRouter;
+
+/**
+ * Result of a many-to-many search between two layers of candidates.
+ */
+class LayerRoutes {
+  friend class LayerRouter;
+ public:
+  /**
+   * Get the shortest path distance from source i to target j
+   * @return the distance, std::numeric_limits<double>::max() if the
+   * target is not reached within the upper bound
+   */
+  double get_distance(int i, int j) const;
+  /**
+   * Get the network edges traversed from source i to target j, the edges
+   * of the two candidates are excluded.
+   * @return a vector of edge index, empty if the target is not reached
+   * or the two candidates are directly connected on the same edge.
+   */
+  std::vector<NETWORK::EdgeIndex> get_path(int i, int j) const;
+ private:
+  /**
+   * The position where the forward search of a source meets the backward
+   * search of a target.
+   */
+  struct Meeting {
+    NETWORK::NodeIndex node; /**< node reached in the backward search */
+    int edge; /**< edge relaxed in the forward search to reach node,
+                   -1 if node is the start of the forward search and
+                   -2 if the candidates are on the same edge */
+  };
+  const NETWORK::NetworkGraph *graph_;
+  std::vector<const Candidate *> sources_;
+  std::vector<const Candidate *> targets_;
+  std::vector<double> distances_;
+  std::vector<Meeting> meetings_;
+  // Edge visited before a node in the forward search of each source
+  std::vector<std::unordered_map<NETWORK::NodeIndex, NETWORK::EdgeIndex>>
+    forward_edges_;
+  // Edge visited after a node in the backward search of each target
+  std::vector<std::unordered_map<NETWORK::NodeIndex, NETWORK::EdgeIndex>>
+    backward_edges_;
+};
+
+/**
+ * Bucket based many-to-many bounded shortest path search.
+ *
+ * A backward search with radius delta/2 is run from each target and the
+ * nodes settled are stored in buckets. A forward search with radius
+ * delta/2 is then run from each source, and the buckets are scanned on
+ * every edge relaxed, so that all the distances within delta between the
+ * two layers are found without repeating the overlapping searches.
+ */
+class LayerRouter {
+ public:
+  /**
+   * Constructor, the reverse adjacency of the graph is built.
+   * @param graph network graph
+   */
+  explicit LayerRouter(const NETWORK::NetworkGraph &graph);
+  /**
+   * Search the shortest paths from sources to targets
+   * @param  sources  source candidates
+   * @param  targets  target candidates
+   * @param  delta    upper bound of the distance
+   * @param  reverse_tolerance the ratio of reverse movement allowed
+   * @return the routes found
+   */
+  LayerRoutes search(const std::vector<const Candidate *> &sources,
+                     const std::vector<const Candidate *> &targets,
+                     double delta, double reverse_tolerance) const;
+ private:
+  /**
+   * An edge entering a node
+   */
+  struct InEdge {
+    NETWORK::NodeIndex source; /**< source node of the edge */
+    NETWORK::EdgeIndex index; /**< index of the edge */
+    double length; /**< length of the edge */
+  };
+  /**
+   * A target reached by the backward search from a node
+   */
+  struct BucketEntry {
+    int target; /**< index of the target */
+    double dist; /**< distance from the node to the target */
+  };
+  const NETWORK::NetworkGraph &graph_;
+  std::vector<unsigned int> in_offsets_;
+  std::vector<InEdge> in_edges_;
+};
+
+}
+}
+#endif //FMM_LAYER_ROUTER_HPP
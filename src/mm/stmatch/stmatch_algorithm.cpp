@@ -4,8 +4,11 @@
 #include "util/util.hpp"
 #include "io/gps_reader.hpp"
 #include "io/mm_writer.hpp"
+#include "mm/mm_pipeline.hpp"
 
 #include <limits>
+#include <stdexcept>
+#include <boost/format.hpp>
 
 using namespace FMM;
 using namespace FMM::CORE;
@@ -15,10 +18,15 @@ using namespace FMM::PYTHON;
 
 STMATCHConfig::STMATCHConfig(
   int k_arg, double r_arg, double gps_error_arg,
-  double vmax_arg, double factor_arg, double reverse_tolerance_arg):
+  double vmax_arg, double factor_arg, double reverse_tolerance_arg,
+  int beam_width_arg, double prune_margin_arg, bool many_to_many_arg,
+  bool astar_arg, int cache_size_arg):
   k(k_arg), radius(r_arg), gps_error(gps_error_arg),
   vmax(vmax_arg), factor(factor_arg),
-  reverse_tolerance(reverse_tolerance_arg) {
+  reverse_tolerance(reverse_tolerance_arg),
+  beam_width(beam_width_arg), prune_margin(prune_margin_arg),
+  many_to_many(many_to_many_arg), astar(astar_arg),
+  cache_size(cache_size_arg) {
 };
 
 void STMATCHConfig::print() const {
@@ -26,6 +34,9 @@ void STMATCHConfig::print() const {
   SPDLOG_INFO("k {} radius {} gps_error {} vmax {} factor {}",
               k, radius, gps_error, vmax, factor);
   SPDLOG_INFO("reverse_tolerance {}",reverse_tolerance);
+  SPDLOG_INFO("beam_width {} prune_margin {}", beam_width, prune_margin);
+  SPDLOG_INFO("many_to_many {} astar {} cache_size {}",
+              many_to_many, astar, cache_size);
 };
 
 STMATCHConfig STMATCHConfig::load_from_xml(
@@ -37,7 +48,15 @@ STMATCHConfig STMATCHConfig::load_from_xml(
   double factor = xml_data.get("config.parameters.factor", 1.5);
   double reverse_tolerance =
     xml_data.get("config.parameters.reverse_tolerance", 0.0);
-  return STMATCHConfig{k, radius, gps_error, vmax, factor,reverse_tolerance};
+  int beam_width = xml_data.get("config.parameters.beam_width", 0);
+  double prune_margin = xml_data.get("config.parameters.prune_margin", 0.0);
+  bool many_to_many =
+    !(!xml_data.get_child_optional("config.parameters.many_to_many"));
+  bool astar = !(!xml_data.get_child_optional("config.parameters.astar"));
+  int cache_size = xml_data.get("config.parameters.cache_size", 0);
+  return STMATCHConfig{k, radius, gps_error, vmax, factor,reverse_tolerance,
+                       beam_width, prune_margin, many_to_many, astar,
+                       cache_size};
 };
 
 STMATCHConfig STMATCHConfig::load_from_arg(
@@ -48,7 +67,14 @@ STMATCHConfig STMATCHConfig::load_from_arg(
   double vmax = arg_data["vmax"].as<double>();
   double factor = arg_data["factor"].as<double>();
   double reverse_tolerance = arg_data["reverse_tolerance"].as<double>();
-  return STMATCHConfig{k, radius, gps_error, vmax, factor, reverse_tolerance};
+  int beam_width = arg_data["beam_width"].as<int>();
+  double prune_margin = arg_data["prune_margin"].as<double>();
+  bool many_to_many = arg_data.count("many_to_many") > 0;
+  bool astar = arg_data.count("astar") > 0;
+  int cache_size = arg_data["cache_size"].as<int>();
+  return STMATCHConfig{k, radius, gps_error, vmax, factor, reverse_tolerance,
+                       beam_width, prune_margin, many_to_many, astar,
+                       cache_size};
 };
 
 void STMATCHConfig::register_arg(cxxopts::Options &options){
@@ -64,7 +90,15 @@ void STMATCHConfig::register_arg(cxxopts::Options &options){
     ("factor","Scale factor",
     cxxopts::value<double>()->default_value("1.5"))
     ("reverse_tolerance","Ratio of reverse movement allowed",
-      cxxopts::value<double>()->default_value("0.0"));
+      cxxopts::value<double>()->default_value("0.0"))
+    ("beam_width","Maximum candidates expanded per point",
+      cxxopts::value<int>()->default_value("0"))
+    ("prune_margin","Log probability margin to prune candidates",
+      cxxopts::value<double>()->default_value("0.0"))
+    ("many_to_many","Many-to-many search between layers")
+    ("astar","A* search directed to the candidates")
+    ("cache_size","Capacity of the transition cache",
+      cxxopts::value<int>()->default_value("0"));
 }
 
 void STMATCHConfig::register_help(std::ostringstream &oss){
@@ -78,14 +112,33 @@ void STMATCHConfig::register_help(std::ostringstream &oss){
     " Maximum speed (unit: network_data_unit/s) (30)\n";
   oss<<"--reverse_tolerance (optional) <double>: proportion "
       "of reverse movement allowed on an edge\n";
+  oss<<"--beam_width (optional) <int>: maximum number of candidates "
+      "of a point expanded to the next point, 0 for no limit (0)\n";
+  oss<<"--prune_margin (optional) <double>: candidates with log "
+      "probability lower than the best one by this margin are not "
+      "expanded, 0 for no limit (0)\n";
+  oss<<"--many_to_many (optional): search the distances between two "
+      "points in a single many-to-many search\n";
+  oss<<"--astar (optional): direct the search from a candidate to the "
+      "candidates of the next point by Euclidean distance, not "
+      "supported with --many_to_many\n";
+  oss<<"--cache_size (optional) <int>: maximum number of shortest "
+      "paths cached across trajectories, 0 to disable (0)\n";
 };
 
 bool STMATCHConfig::validate() const {
   if (gps_error <= 0 || radius <= 0 || k <= 0 || vmax <= 0 || factor <= 0
-      || reverse_tolerance<0) {
+      || reverse_tolerance<0 || beam_width < 0 || prune_margin < 0
+      || cache_size < 0) {
     SPDLOG_CRITICAL("Invalid mm parameter k {} r {} gps error {} "
-        "vmax {} f {} reverse_tolerance {}",
-                    k, radius, gps_error, vmax, factor, reverse_tolerance);
+        "vmax {} f {} reverse_tolerance {} beam_width {} prune_margin {} "
+        "cache_size {}",
+                    k, radius, gps_error, vmax, factor, reverse_tolerance,
+                    beam_width, prune_margin, cache_size);
+    return false;
+  }
+  if (many_to_many && astar) {
+    SPDLOG_CRITICAL("astar is not supported with many_to_many");
     return false;
   }
   return true;
@@ -122,6 +175,28 @@ PyMatchResult STMATCH::match_wkt(
   return output;
 };
 
+PyBatchMatchResult STMATCH::match_batch(
+  const std::vector<int> &ids, const std::vector<double> &xs,
+  const std::vector<double> &ys, const std::vector<double> &timestamps,
+  const STMATCHConfig &config) {
+  std::vector<Trajectory> trajectories = group_trajectories(
+    ids, xs, ys, timestamps);
+  std::vector<MatchResult> results(trajectories.size());
+  std::string error;
+  #pragma omp parallel for schedule(dynamic)
+  for (int i = 0; i < trajectories.size(); ++i) {
+    // An exception cannot leave the parallel region
+    try {
+      results[i] = match_traj(trajectories[i], config);
+    } catch (const std::exception &e) {
+      #pragma omp critical
+      error = e.what();
+    }
+  }
+  if (!error.empty()) throw std::runtime_error(error);
+  return collect_batch_results(trajectories, results);
+};
+
 // Procedure of HMM based map matching algorithm.
 MatchResult STMATCH::match_traj(const Trajectory &traj,
                                 const STMATCHConfig &config) {
@@ -139,9 +214,17 @@ MatchResult STMATCH::match_traj(const Trajectory &traj,
   TransitionGraph tg(tc, config.gps_error);
   SPDLOG_DEBUG("Update cost in transition graph");
   // The network will be used internally to update transition graph
-  update_tg(&tg, cg, traj, config);
+  std::vector<TGLayerPaths> layer_paths;
+  update_tg(&tg, cg, traj, config, &layer_paths);
   SPDLOG_DEBUG("Optimal path inference");
   TGOpath tg_opath = tg.backtrack();
+  // Paths of the winning transitions along the optimal path
+  std::vector<const std::vector<EdgeIndex> *> transition_paths;
+  std::vector<TGLayer> &layers = tg.get_layers();
+  for (int i = 1; i < tg_opath.size(); ++i) {
+    int j = tg_opath[i] - layers[i].data();
+    transition_paths.push_back(&layer_paths[i][j]);
+  }
   SPDLOG_DEBUG("Optimal path size {}", tg_opath.size());
   MatchedCandidatePath matched_candidate_path(tg_opath.size());
   std::transform(tg_opath.begin(), tg_opath.end(),
@@ -158,7 +241,8 @@ MatchResult STMATCH::match_traj(const Trajectory &traj,
     return a->c->edge->id;
   });
   std::vector<int> indices;
-  C_Path cpath = build_cpath(tg_opath, &indices, config.reverse_tolerance);
+  C_Path cpath = build_cpath(tg_opath, &indices, config.reverse_tolerance,
+                             &transition_paths);
   SPDLOG_DEBUG("Opath is {}", opath);
   SPDLOG_DEBUG("Indices is {}", indices);
   SPDLOG_DEBUG("Complete path is {}", cpath);
@@ -188,6 +272,14 @@ std::string STMATCH::match_gps_file(
   if (!stmatch_config.validate()) {
     oss<<"stmatch_config invalid\n";
     validate = false;
+  } else if (stmatch_config.cache_size > 0 && !stmatch_config.many_to_many) {
+    // The cache is shared by the model, check its size before matching
+    try {
+      get_transition_cache(stmatch_config.cache_size);
+    } catch (const std::invalid_argument &e) {
+      oss<<e.what()<<"\n";
+      validate = false;
+    }
   }
   if (!validate) {
     oss<<"match_gps_file canceled\n";
@@ -200,34 +292,39 @@ std::string STMATCH::match_gps_file(
   int step_size = 1000;
   auto begin_time = UTIL::get_current_time();
   FMM::IO::GPSReader reader(gps_config);
-  FMM::IO::CSVMatchResultWriter writer(result_config.file,
-                                       result_config.output_config);
+  FMM::IO::ResultWriter writer(result_config);
+  // Progress is kept out of the results written to the standard output
+  std::ostream &progress_stream =
+    result_config.is_standard_output() ? std::cerr : std::cout;
   if (use_omp) {
-    int buffer_trajectories_size = 100000;
-    while (reader.has_next_trajectory()) {
-      std::vector<Trajectory> trajectories =
-        reader.read_next_N_trajectories(buffer_trajectories_size);
-      int trajectories_fetched = trajectories.size();
-      #pragma omp parallel for
-      for (int i = 0; i < trajectories_fetched; ++i) {
-        Trajectory &trajectory = trajectories[i];
-        int points_in_tr = trajectory.geom.get_num_points();
-        MM::MatchResult result = match_traj(
-          trajectory, stmatch_config);
-        writer.write_result(trajectory,result);
-        #pragma omp critical
-        if (!result.cpath.empty()) {
-          points_matched += points_in_tr;
-        }
-        total_points += points_in_tr;
-        ++progress;
-        if (progress % step_size == 0) {
-          std::stringstream buf;
-          buf << "Progress " << progress << '\n';
-          std::cout << buf.rdbuf();
-        }
-      }
+    // The results written to the standard output are passed on once
+    // the workers run out of results
+    MatchPipeline<MatchResult>::FlushFunction flush;
+    if (result_config.is_standard_output()) {
+      flush = [&writer] { writer.flush(); };
     }
+    MatchPipeline<MatchResult> pipeline(0, 1000, 1000,
+      result_config.ordered);
+    pipeline.run(&reader, [&](const Trajectory &trajectory) {
+      return match_traj(trajectory, stmatch_config);
+    }, [&](const Trajectory &trajectory, const MatchResult &result,
+           std::string *text) {
+      writer.format_result(trajectory, result, text);
+    }, [&](const Trajectory &trajectory, const MatchResult &result,
+           const std::string &text) {
+      int points_in_tr = trajectory.geom.get_num_points();
+      writer.write_text(text);
+      if (!result.cpath.empty()) {
+        points_matched += points_in_tr;
+      }
+      total_points += points_in_tr;
+      ++progress;
+      if (progress % step_size == 0) {
+        std::stringstream buf;
+        buf << "Progress " << progress << '\n';
+        progress_stream << buf.rdbuf();
+      }
+    }, flush);
   } else {
     while (reader.has_next_trajectory()) {
       if (progress % step_size == 0) {
@@ -251,17 +348,69 @@ std::string STMATCH::match_gps_file(
   oss<<"Time takes " << duration << " seconds\n";
   oss<<"Total points " << total_points << " matched "<< points_matched <<"\n";
   oss<<"Map match speed " << points_matched / duration << " points/s \n";
+  if (stmatch_config.beam_width > 0 || stmatch_config.prune_margin > 0) {
+    oss<<"Transitions pruned " << get_pruned_transitions() <<"\n";
+  }
+  oss<<"Nodes settled " << get_settled_nodes() <<"\n";
+  if (stmatch_config.cache_size > 0) {
+    TransitionCacheStats cache_stats = get_cache_stats();
+    oss<<"Transition cache hits " << cache_stats.hits << " misses "
+       << cache_stats.misses << " evictions " << cache_stats.evictions
+       << "\n";
+  }
   return oss.str();
 };
 
+long long STMATCH::get_pruned_transitions() const {
+  return pruned_transitions_;
+}
+
+long long STMATCH::get_settled_nodes() const {
+  return settled_nodes_;
+}
+
+TransitionCacheStats STMATCH::get_cache_stats() const {
+  if (cache_ == nullptr) return TransitionCacheStats{0, 0, 0, 0};
+  return cache_->get_stats();
+}
+
+const LayerRouter &STMATCH::get_layer_router() {
+  std::call_once(router_once_, [this]() {
+    SPDLOG_DEBUG("Create many-to-many layer router");
+    router_.reset(new LayerRouter(graph_));
+  });
+  return *router_;
+}
+
+TransitionCache *STMATCH::get_transition_cache(int capacity) {
+  std::call_once(cache_once_, [this, capacity]() {
+    SPDLOG_DEBUG("Create transition cache of capacity {}", capacity);
+    cache_.reset(new TransitionCache(capacity));
+  });
+  if (cache_->get_capacity() != static_cast<std::size_t>(capacity)) {
+    throw std::invalid_argument(
+      (boost::format("Transition cache of capacity %1% is created, "
+                     "cache_size %2% is not supported by the model")
+       % cache_->get_capacity() % capacity).str());
+  }
+  return cache_.get();
+}
+
 void STMATCH::update_tg(TransitionGraph *tg,
                         const CompositeGraph &cg,
                         const Trajectory &traj,
-                        const STMATCHConfig &config) {
+                        const STMATCHConfig &config,
+                        std::vector<TGLayerPaths> *paths) {
   SPDLOG_DEBUG("Update transition graph");
   std::vector<TGLayer> &layers = tg->get_layers();
   std::vector<double> eu_dists = ALGORITHM::cal_eu_dist(traj.geom);
   int N = layers.size();
+  if (paths != nullptr) {
+    paths->clear();
+    paths->resize(N);
+  }
+  long long pruned = 0;
+  long long settled = 0;
   for (int i = 0; i < N - 1; ++i) {
     // Routing from current_layer to next_layer
     double delta = 0;
@@ -271,29 +420,109 @@ void STMATCH::update_tg(TransitionGraph *tg,
       double duration = traj.timestamps[i + 1] - traj.timestamps[i];
       delta = config.factor * config.vmax * duration;
     }
+    double prune_threshold = TransitionGraph::calc_prune_threshold(
+      layers[i], config.beam_width, config.prune_margin);
     update_layer(i, &(layers[i]), &(layers[i + 1]),
-                 cg, eu_dists[i], delta);
+                 cg, eu_dists[i], delta, prune_threshold, &pruned,
+                 paths == nullptr ? nullptr : &((*paths)[i + 1]),
+                 &config, &settled);
   }
+  SPDLOG_DEBUG("Transitions pruned {}", pruned);
+  pruned_transitions_ += pruned;
+  settled_nodes_ += settled;
   SPDLOG_DEBUG("Update transition graph done");
 }
 
 void STMATCH::update_layer(int level, TGLayer *la_ptr, TGLayer *lb_ptr,
                            const CompositeGraph &cg,
                            double eu_dist,
-                           double delta) {
+                           double delta,
+                           double prune_threshold,
+                           long long *pruned,
+                           TGLayerPaths *lb_paths,
+                           const STMATCHConfig *config,
+                           long long *settled) {
   SPDLOG_DEBUG("Update layer {} starts", level);
   TGLayer &lb = *lb_ptr;
-  for (auto iter_a = la_ptr->begin(); iter_a != la_ptr->end(); ++iter_a) {
-    NodeIndex source = iter_a->c->index;
-    // SPDLOG_TRACE("  Calculate distance from source {}", source);
-    // single source upper bound routing
-    std::vector<NodeIndex> targets(lb.size());
-    std::transform(lb.begin(), lb.end(), targets.begin(),
+  if (lb_paths != nullptr) {
+    lb_paths->assign(lb.size(), std::vector<EdgeIndex>());
+  }
+  bool many_to_many = config != nullptr && config->many_to_many;
+  bool astar = config != nullptr && config->astar;
+  TransitionCache *cache = nullptr;
+  if (config != nullptr && config->cache_size > 0 && !many_to_many) {
+    cache = get_transition_cache(config->cache_size);
+  }
+  long long layer_settled = 0;
+  std::vector<NodeIndex> targets(lb.size());
+  std::transform(lb.begin(), lb.end(), targets.begin(),
+                 [](TGNode &a) {
+    return a.c->index;
+  });
+  // Distances from all the expanded nodes of layer a are found at once
+  LayerRoutes routes;
+  std::vector<int> route_index(la_ptr->size(), -1);
+  if (many_to_many) {
+    std::vector<const Candidate *> sources;
+    for (int k = 0; k < la_ptr->size(); ++k) {
+      if ((*la_ptr)[k].cumu_prob >= prune_threshold) {
+        route_index[k] = sources.size();
+        sources.push_back((*la_ptr)[k].c);
+      }
+    }
+    std::vector<const Candidate *> target_candidates(lb.size());
+    std::transform(lb.begin(), lb.end(), target_candidates.begin(),
                    [](TGNode &a) {
-      return a.c->index;
+      return a.c;
     });
-    std::vector<double> distances = shortest_path_upperbound(
-      level, cg, source, targets, delta);
+    routes = get_layer_router().search(sources, target_candidates, delta,
+                            config->reverse_tolerance);
+  }
+  // The search of a node of layer a is kept if it wins a node of layer b,
+  // the paths are extracted once after all the transitions are compared.
+  struct SourceSearch {
+    PredecessorMap pmap;
+    DistanceMap dmap;
+    std::vector<std::vector<EdgeIndex>> cached_paths;
+    bool cached = false;
+  };
+  std::vector<SourceSearch> searches(
+    lb_paths != nullptr ? la_ptr->size() : 0);
+  std::vector<int> winners(lb.size(), -1);
+  for (auto iter_a = la_ptr->begin(); iter_a != la_ptr->end(); ++iter_a) {
+    if (iter_a->cumu_prob < prune_threshold) {
+      if (pruned != nullptr) *pruned += lb.size();
+      continue;
+    }
+    NodeIndex source = iter_a->c->index;
+    int ka = std::distance(la_ptr->begin(), iter_a);
+    int ia = route_index[ka];
+    PredecessorMap pmap;
+    DistanceMap dmap;
+    std::vector<double> distances(lb.size());
+    // Paths of the transitions found in the cache
+    std::vector<std::vector<EdgeIndex>> cached_paths;
+    bool cached = false;
+    if (many_to_many) {
+      for (int i = 0; i < lb.size(); ++i) {
+        distances[i] = routes.get_distance(ia, i);
+      }
+    } else if (cache != nullptr && find_cached_transitions(
+        iter_a->c, lb, delta, config->reverse_tolerance, cache,
+        &distances, &cached_paths)) {
+      cached = true;
+    } else {
+      // single source upper bound routing
+      distances = shortest_path_upperbound(
+        level, cg, source, targets, delta, &pmap, &dmap, astar,
+        &layer_settled);
+      if (cache != nullptr) {
+        insert_cached_transitions(cg, iter_a->c, lb, delta,
+                                  config->reverse_tolerance, distances,
+                                  pmap, dmap, cache);
+      }
+    }
+    bool won = false;
     for (auto iter_b = lb_ptr->begin(); iter_b != lb_ptr->end(); ++iter_b) {
       int i = std::distance(lb_ptr->begin(),iter_b);
       double tp = TransitionGraph::calc_tp(distances[i], eu_dist);
@@ -307,32 +536,92 @@ void STMATCH::update_layer(int level, TGLayer *la_ptr, TGLayer *lb_ptr,
         iter_b->prev = &(*iter_a);
         iter_b->sp_dist = distances[i];
         iter_b->tp = tp;
+        winners[i] = ka;
+        won = true;
+      }
+    }
+    if (lb_paths != nullptr && won && !many_to_many) {
+      SourceSearch &search = searches[ka];
+      search.pmap = std::move(pmap);
+      search.dmap = std::move(dmap);
+      search.cached_paths = std::move(cached_paths);
+      search.cached = cached;
+    }
+  }
+  if (lb_paths != nullptr) {
+    for (int i = 0; i < lb.size(); ++i) {
+      int ka = winners[i];
+      if (ka < 0) continue;
+      if (many_to_many) {
+        (*lb_paths)[i] = routes.get_path(route_index[ka], i);
+        continue;
+      }
+      SourceSearch &search = searches[ka];
+      if (search.cached) {
+        (*lb_paths)[i] = std::move(search.cached_paths[i]);
+      } else if (search.dmap.find(targets[i]) != search.dmap.end()) {
+        (*lb_paths)[i] = extract_path(cg, (*la_ptr)[ka].c->index,
+                                      targets[i], search.pmap, search.dmap);
       }
     }
   }
+  SPDLOG_DEBUG("Layer {} nodes settled {}", level, layer_settled);
+  if (settled != nullptr) *settled += layer_settled;
   SPDLOG_DEBUG("Update layer done");
 }
 
 std::vector<double> STMATCH::shortest_path_upperbound(
   int level, const CompositeGraph &cg, NodeIndex source,
-  const std::vector<NodeIndex> &targets, double delta) {
+  const std::vector<NodeIndex> &targets, double delta,
+  PredecessorMap *pmap_ptr, DistanceMap *dmap_ptr,
+  bool astar, long long *settled) {
   // SPDLOG_TRACE("Upperbound shortest path source {}", source);
   // SPDLOG_TRACE("Upperbound shortest path targets {}", targets);
   std::unordered_set<NodeIndex> unreached_targets;
   for (auto &node:targets) {
     unreached_targets.insert(node);
   }
-  DistanceMap dmap;
-  PredecessorMap pmap;
+  // Lower bound of the distance from a node to the nearest target, which
+  // is the Euclidean distance to the bounding box of the targets. The
+  // distance to a box never exceeds the length of an edge between two
+  // nodes, so the bound is consistent and a node settled is never visited
+  // again.
+  double min_x = std::numeric_limits<double>::max();
+  double min_y = std::numeric_limits<double>::max();
+  double max_x = -std::numeric_limits<double>::max();
+  double max_y = -std::numeric_limits<double>::max();
+  if (astar) {
+    for (auto &node:targets) {
+      const Point &t = cg.get_node_point(node);
+      min_x = std::min(min_x, boost::geometry::get<0>(t));
+      min_y = std::min(min_y, boost::geometry::get<1>(t));
+      max_x = std::max(max_x, boost::geometry::get<0>(t));
+      max_y = std::max(max_y, boost::geometry::get<1>(t));
+    }
+  }
+  auto heuristic = [&](NodeIndex u) {
+    if (!astar || targets.empty()) return 0.0;
+    const Point &p = cg.get_node_point(u);
+    double x = boost::geometry::get<0>(p);
+    double y = boost::geometry::get<1>(p);
+    double dx = std::max(std::max(min_x - x, x - max_x), 0.0);
+    double dy = std::max(std::max(min_y - y, y - max_y), 0.0);
+    return std::sqrt(dx * dx + dy * dy);
+  };
+  DistanceMap &dmap = *dmap_ptr;
+  PredecessorMap &pmap = *pmap_ptr;
   Heap Q;
-  Q.push(source, 0);
+  // The key of a node in the heap is its distance plus the lower bound
+  Q.push(source, heuristic(source));
   pmap.insert({source, source});
   dmap.insert({source, 0});
   double temp_dist = 0;
-  // Dijkstra search
+  long long num_settled = 0;
+  // Dijkstra search, or A* search if a lower bound is given
   while (!Q.empty() && !unreached_targets.empty()) {
     HeapNode node = Q.top();
     Q.pop();
+    ++num_settled;
     // SPDLOG_TRACE("  Node u {} dist {}", node.index, node.value);
     NodeIndex u = node.index;
     auto iter = unreached_targets.find(u);
@@ -342,11 +631,10 @@ std::vector<double> STMATCH::shortest_path_upperbound(
       unreached_targets.erase(iter);
     }
     if (node.value > delta) break;
-    std::vector<CompEdgeProperty> out_edges = cg.out_edges(u);
-    for (auto node_iter = out_edges.begin(); node_iter != out_edges.end();
-         ++node_iter) {
-      NodeIndex v = node_iter->v;
-      temp_dist = node.value + node_iter->cost;
+    double u_dist = dmap[u];
+    for (const CompEdgeProperty &out_edge : cg.out_edges(u)) {
+      NodeIndex v = out_edge.v;
+      temp_dist = u_dist + out_edge.cost;
       // SPDLOG_TRACE("  Examine node v {} temp dist {}", v, temp_dist);
       auto v_iter = dmap.find(v);
       if (v_iter != dmap.end()) {
@@ -357,14 +645,15 @@ std::vector<double> STMATCH::shortest_path_upperbound(
           //              v, temp_dist, v_iter->second);
           pmap[v] = u;
           dmap[v] = temp_dist;
-          Q.decrease_key(v, temp_dist);
+          Q.decrease_key(v, temp_dist + heuristic(v));
         }
       } else {
         // dmap does not contain v
-        if (temp_dist <= delta) {
+        double bound = temp_dist + heuristic(v);
+        if (bound <= delta) {
           // SPDLOG_TRACE("    Insert key {} {} into pmap and dmap",
           //              v, temp_dist);
-          Q.push(v, temp_dist);
+          Q.push(v, bound);
           pmap.insert({v, u});
           dmap.insert({v, temp_dist});
         }
@@ -381,12 +670,104 @@ std::vector<double> STMATCH::shortest_path_upperbound(
       distances.push_back(std::numeric_limits<double>::max());
     }
   }
+  if (settled != nullptr) *settled += num_settled;
   // SPDLOG_TRACE("  Distance value {}", distances);
   return distances;
 }
 
+bool STMATCH::is_direct_transition(const Candidate *a, const Candidate *b,
+                                   double reverse_tolerance, double *dist) {
+  if (a->edge->index != b->edge->index) return false;
+  if (a->offset <= b->offset) {
+    *dist = b->offset - a->offset;
+    return true;
+  }
+  if (a->offset - b->offset < a->edge->length * reverse_tolerance) {
+    *dist = 0;
+    return true;
+  }
+  return false;
+}
+
+bool STMATCH::find_cached_transitions(
+  const Candidate *a, const TGLayer &lb, double delta,
+  double reverse_tolerance, TransitionCache *cache,
+  std::vector<double> *distances, std::vector<std::vector<EdgeIndex>> *paths) {
+  distances->assign(lb.size(), std::numeric_limits<double>::max());
+  paths->assign(lb.size(), std::vector<EdgeIndex>());
+  // A transition leaves a through the target of its edge and enters b
+  // through the source of its edge, unless they are on the same edge.
+  double head = a->edge->length - a->offset;
+  for (int i = 0; i < lb.size(); ++i) {
+    const Candidate *b = lb[i].c;
+    double dist = 0;
+    if (!is_direct_transition(a, b, reverse_tolerance, &dist)) {
+      double bound = delta - head - b->offset;
+      if (bound < 0) continue;
+      double cost = 0;
+      if (a->edge->target != b->edge->source &&
+          !cache->find(a->edge->target, b->edge->source, bound, &cost,
+                       &((*paths)[i]))) {
+        return false;
+      }
+      dist = head + cost + b->offset;
+    }
+    if (dist <= delta) (*distances)[i] = dist;
+  }
+  return true;
+}
+
+void STMATCH::insert_cached_transitions(
+  const CompositeGraph &cg, const Candidate *a, const TGLayer &lb,
+  double delta, double reverse_tolerance,
+  const std::vector<double> &distances,
+  const PredecessorMap &pmap, const DistanceMap &dmap,
+  TransitionCache *cache) {
+  double head = a->edge->length - a->offset;
+  for (int i = 0; i < lb.size(); ++i) {
+    const Candidate *b = lb[i].c;
+    double dist = 0;
+    if (is_direct_transition(a, b, reverse_tolerance, &dist) ||
+        a->edge->target == b->edge->source) {
+      continue;
+    }
+    double bound = delta - head - b->offset;
+    if (bound < 0) continue;
+    if (distances[i] != std::numeric_limits<double>::max()) {
+      cache->insert(a->edge->target, b->edge->source,
+                    distances[i] - head - b->offset, bound,
+                    extract_path(cg, a->index, b->index, pmap, dmap));
+    } else {
+      cache->insert(a->edge->target, b->edge->source,
+                    std::numeric_limits<double>::infinity(), bound, {});
+    }
+  }
+}
+
+std::vector<EdgeIndex> STMATCH::extract_path(
+  const CompositeGraph &cg, NodeIndex source, NodeIndex target,
+  const PredecessorMap &pmap, const DistanceMap &dmap) {
+  std::vector<EdgeIndex> path;
+  NodeIndex v = target;
+  while (v != source) {
+    NodeIndex u = pmap.at(v);
+    int e = cg.get_edge_index(u, v, dmap.at(v) - dmap.at(u));
+    // A network edge is split into two dummy edges by a candidate node
+    if (path.empty() || path.back() != e) {
+      path.push_back(e);
+    }
+    v = u;
+  }
+  // Remove the edges of the target and source candidates
+  if (!path.empty()) path.erase(path.begin());
+  if (!path.empty()) path.pop_back();
+  std::reverse(path.begin(), path.end());
+  return path;
+}
+
 C_Path STMATCH::build_cpath(const TGOpath &opath, std::vector<int> *indices,
-  double reverse_tolerance) {
+  double reverse_tolerance,
+  const std::vector<const std::vector<EdgeIndex> *> *paths) {
   SPDLOG_DEBUG("Build cpath from optimal candidate path");
   C_Path cpath;
   if (!indices->empty()) indices->clear();
@@ -403,8 +784,8 @@ C_Path STMATCH::build_cpath(const TGOpath &opath, std::vector<int> *indices,
     // SPDLOG_TRACE("Check a {} b {}", a->edge->id, b->edge->id);
     if ((a->edge->id != b->edge->id) ||
         (a->offset-b->offset>a->edge->length * reverse_tolerance)) {
-      auto segs = graph_.shortest_path_dijkstra(a->edge->target,
-                                                b->edge->source);
+      std::vector<EdgeIndex> segs = (paths != nullptr) ? *((*paths)[i]) :
+        graph_.shortest_path_dijkstra(a->edge->target, b->edge->source);
       // No transition found
       if (segs.empty() && a->edge->target != b->edge->source) {
         SPDLOG_TRACE("Candidate {} has disconnected edge {} to {}",
@@ -426,3 +807,62 @@ C_Path STMATCH::build_cpath(const TGOpath &opath, std::vector<int> *indices,
   SPDLOG_DEBUG("Build cpath from optimal candidate path done");
   return cpath;
 }
+
+STMATCHSession::STMATCHSession(STMATCH &model, const STMATCHConfig &config,
+                               int max_lag) :
+  model_(model), config_(config), tg_(config.gps_error, max_lag) {
+};
+
+OnlineMatchPath STMATCHSession::push_point(double x, double y,
+                                           double timestamp) {
+  int point_index = point_index_++;
+  LineString geom;
+  geom.add_point(x, y);
+  Traj_Candidates tc = model_.network_.search_tr_cs_knn(
+    geom, config_.k, config_.radius);
+  if (tc.empty()) {
+    SPDLOG_DEBUG("Candidate not found for point {}", point_index);
+    return tg_.flush();
+  }
+  // Dummy nodes of two consecutive points never overlap
+  unsigned int index_start = model_.graph_.get_num_vertices() +
+    (point_index % 2) * config_.k;
+  for (int m = 0; m < tc[0].size(); ++m) {
+    tc[0][m].index = index_start + m;
+  }
+  double eu_dist = std::sqrt((x - prev_x_) * (x - prev_x_) +
+                             (y - prev_y_) * (y - prev_y_));
+  double delta = 0;
+  if (timestamp < 0 || prev_timestamp_ < 0) {
+    delta = eu_dist * config_.factor * 4;
+  } else {
+    delta = config_.factor * config_.vmax * (timestamp - prev_timestamp_);
+  }
+  prev_x_ = x;
+  prev_y_ = y;
+  prev_timestamp_ = timestamp;
+  TGLayer *lb = tg_.add_layer(point_index, tc[0]);
+  int N = tg_.get_num_layers();
+  if (N < 2) return {};
+  TGLayer *la = tg_.get_layer(N - 2);
+  Traj_Candidates layer_candidates(2);
+  for (const TGNode &node : *la) {
+    layer_candidates[0].push_back(*(node.c));
+  }
+  layer_candidates[1] = tc[0];
+  DummyGraph dg(layer_candidates, config_.reverse_tolerance);
+  CompositeGraph cg(model_.graph_, dg);
+  long long pruned = 0;
+  long long settled = 0;
+  double prune_threshold = TransitionGraph::calc_prune_threshold(
+    *la, config_.beam_width, config_.prune_margin);
+  model_.update_layer(point_index - 1, la, lb, cg, eu_dist, delta,
+                      prune_threshold, &pruned, nullptr, &config_, &settled);
+  model_.pruned_transitions_ += pruned;
+  model_.settled_nodes_ += settled;
+  return tg_.decode();
+};
+
+OnlineMatchPath STMATCHSession::flush() {
+  return tg_.flush();
+};
@@ -13,11 +13,16 @@
 #include "network/network_graph.hpp"
 #include "mm/composite_graph.hpp"
 #include "mm/transition_graph.hpp"
+#include "mm/stmatch/layer_router.hpp"
+#include "mm/stmatch/transition_cache.hpp"
 #include "mm/mm_type.hpp"
 #include "python/pyfmm.hpp"
 #include "config/gps_config.hpp"
 #include "config/result_config.hpp"
 
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/xml_parser.hpp>
@@ -40,10 +45,27 @@ struct STMATCHConfig {
    * @param vmax_arg the maximum speed of the vehicle in map unit/second
    * @param factor_arg a factor multiplied with vmax*deltaT to constrain the
    * search in stmatch.
+   * @param reverse_tolerance_arg the ratio of reverse movement allowed
+   * @param beam_width_arg the maximum number of candidates of a point
+   * expanded to the next point, 0 means no limit
+   * @param prune_margin_arg candidates whose log probability is lower than
+   * the best candidate of a point by more than this value are not expanded,
+   * 0 means no limit
+   * @param many_to_many_arg if true, the distances between two layers are
+   * found in a single many-to-many search instead of a search from each
+   * candidate
+   * @param astar_arg if true, the search from a candidate is directed to
+   * the targets by the Euclidean distance, which is not supported with
+   * many_to_many
+   * @param cache_size_arg maximum number of shortest paths kept in the
+   * transition cache shared by all the trajectories, 0 to disable
    */
   STMATCHConfig(int k_arg = 8, double r_arg = 300, double gps_error_arg = 50,
                 double vmax_arg = 30, double factor_arg = 1.5,
-                double reverse_tolerance_arg = 0.0);
+                double reverse_tolerance_arg = 0.0,
+                int beam_width_arg = 0, double prune_margin_arg = 0.0,
+                bool many_to_many_arg = false, bool astar_arg = false,
+                int cache_size_arg = 0);
   int k; /**< number of candidates */
   double radius; /**< search radius for candidates, unit is map_unit*/
   double gps_error; /**< GPS error, unit is map_unit */
@@ -51,6 +73,15 @@ struct STMATCHConfig {
   double factor; /**< factor multiplied to vmax*deltaT to
                       limit the search of shortest path */
   double reverse_tolerance;
+  int beam_width; /**< Beam width of Viterbi search, 0 to disable */
+  double prune_margin; /**< Log probability margin of Viterbi search,
+                            0 to disable */
+  bool many_to_many; /**< Search the distances between two layers
+                          in a single many-to-many search */
+  bool astar; /**< Direct the search to the targets with the Euclidean
+                   distance as a lower bound */
+  int cache_size; /**< Capacity of the transition cache shared across
+                       trajectories, 0 to disable */
   /**
    * Check the validity of the configuration
    */
@@ -79,10 +110,20 @@ struct STMATCHConfig {
   static void register_help(std::ostringstream &oss);
 };
 
+class STMATCHSession;
+
+/**
+ * Network edges traversed by the winning transition to each node of a
+ * layer in the transition graph, the edges of the two candidates
+ * excluded.
+ */
+typedef std::vector<std::vector<NETWORK::EdgeIndex>> TGLayerPaths;
+
 /**
  * %STMATCH algorithm/model
  */
 class STMATCH {
+  friend class STMATCHSession;
 public:
   /**
    * Create a stmatch model from network and graph
@@ -98,6 +139,20 @@ public:
    */
   PYTHON::PyMatchResult match_wkt(
     const std::string &wkt,const STMATCHConfig &config);
+  /**
+   * Match a batch of trajectories in parallel, consecutive points with the
+   * same id form a trajectory as in the GPS point file.
+   * @param ids id of each point
+   * @param xs x of each point
+   * @param ys y of each point
+   * @param timestamps timestamp of each point, empty if not available
+   * @param config Map matching configuration
+   * @return Map matching result in columnar format used in Python API
+   */
+  PYTHON::PyBatchMatchResult match_batch(
+    const std::vector<int> &ids, const std::vector<double> &xs,
+    const std::vector<double> &ys, const std::vector<double> &timestamps,
+    const STMATCHConfig &config);
   /**
    * Match a trajectory to the road network
    * @param  traj   input trajector data
@@ -120,6 +175,21 @@ public:
     const STMATCHConfig &config,
     bool use_omp = true
     );
+  /**
+   * Get the number of transitions skipped by beam pruning since the
+   * model is created.
+   */
+  long long get_pruned_transitions() const;
+  /**
+   * Get the number of nodes settled in the transition searches since the
+   * model is created.
+   */
+  long long get_settled_nodes() const;
+  /**
+   * Get the statistics of the transition cache, all zero if the cache
+   * is not created.
+   */
+  TransitionCacheStats get_cache_stats() const;
 protected:
   /**
    * Update probabilities in a transition graph
@@ -127,11 +197,14 @@ protected:
    * @param cg composition graph
    * @param traj raw trajectory
    * @param config map match configuration
+   * @param paths the paths of winning transitions of each layer, which
+   * is resized to the number of layers
    */
   void update_tg(TransitionGraph *tg,
                  const CompositeGraph &cg,
                  const CORE::Trajectory &traj,
-                 const STMATCHConfig &config);
+                 const STMATCHConfig &config,
+                 std::vector<TGLayerPaths> *paths = nullptr);
   /**
    * Update probabilities between two layers a and b in the transition graph
    * @param level   the index of layer a
@@ -140,28 +213,134 @@ protected:
    * @param cg      Composition graph
    * @param eu_dist Euclidean distance between two observed point
    * @param delta   An upper bound to limit the search
+   * @param prune_threshold nodes in layer a with a lower accumulative
+   * probability are not expanded
+   * @param pruned the number of transitions skipped is added to it
+   * @param lb_paths the paths of winning transitions to layer b, which is
+   * resized to the size of layer b
+   * @param config map match configuration, which selects the search
+   * used. If it is nullptr, a Dijkstra search is run from each node of
+   * layer a.
+   * @param settled the number of nodes settled in the searches is added
+   * to it
    */
   void update_layer(int level, TGLayer *la_ptr, TGLayer *lb_ptr,
                     const CompositeGraph &cg,
                     double eu_dist,
-                    double delta);
+                    double delta,
+                    double prune_threshold,
+                    long long *pruned = nullptr,
+                    TGLayerPaths *lb_paths = nullptr,
+                    const STMATCHConfig *config = nullptr,
+                    long long *settled = nullptr);
 
   /**
    * Return distances from source to all targets and with an upper bound of
-   * delta to stop the search
+   * delta to stop the search.
+   *
+   * In the A* variant, nodes are ordered by the distance from source plus
+   * the Euclidean distance to the bounding box of the targets, and nodes
+   * whose lower bound exceeds delta are not visited.
    * @param  level   The source node's level in transiton graph, used for
    * logging.
    * @param  cg      Composition graph
    * @param  source  Source node
    * @param  targets A vector of target nodes
    * @param  delta   An upper bound value to constrain the search
+   * @param  pmap    The predecessor map of the search is stored in it
+   * @param  dmap    The distance map of the search is stored in it
+   * @param  astar   If true, the A* variant is used
+   * @param  settled The number of nodes settled is added to it
    * @return A vector of distances to the target nodes, if any target node
    * is not reached, infinity distance will be returned for that node.
    */
   std::vector<double> shortest_path_upperbound(
     int level,
     const CompositeGraph &cg, NETWORK::NodeIndex source,
-    const std::vector<NETWORK::NodeIndex> &targets, double delta);
+    const std::vector<NETWORK::NodeIndex> &targets, double delta,
+    NETWORK::PredecessorMap *pmap, NETWORK::DistanceMap *dmap,
+    bool astar = false, long long *settled = nullptr);
+  /**
+   * Extract the network edges traversed from source to target in the
+   * search tree of a bounded Dijkstra, the edges of the source and
+   * target candidates excluded.
+   * @param  cg     Composition graph
+   * @param  source Source node
+   * @param  target Target node, which must be contained in pmap
+   * @param  pmap   Predecessor map of the search
+   * @param  dmap   Distance map of the search
+   * @return A vector of edge index
+   */
+  static std::vector<NETWORK::EdgeIndex> extract_path(
+    const CompositeGraph &cg, NETWORK::NodeIndex source,
+    NETWORK::NodeIndex target, const NETWORK::PredecessorMap &pmap,
+    const NETWORK::DistanceMap &dmap);
+
+  /**
+   * Get the many-to-many router of the graph, which is created on the
+   * first call so that it is only built when many_to_many is enabled.
+   * @return the router
+   */
+  const LayerRouter &get_layer_router();
+  /**
+   * Get the transition cache shared by all the trajectories, which is
+   * created on the first call.
+   *
+   * The capacity is fixed when the cache is created. A different capacity
+   * requested later throws std::invalid_argument, as the cache is in use
+   * by the other threads.
+   *
+   * @param  capacity capacity of the cache
+   * @return the cache
+   */
+  TransitionCache *get_transition_cache(int capacity);
+  /**
+   * Get the distances from a candidate to the nodes of a layer from the
+   * transition cache
+   * @param  a         source candidate
+   * @param  lb        layer of target candidates
+   * @param  delta     upper bound of the distance
+   * @param  reverse_tolerance the ratio of reverse movement allowed
+   * @param  cache     transition cache
+   * @param  distances set to the distance to each node of lb
+   * @param  paths     set to the network edges traversed to each node
+   * of lb, the edges of the two candidates excluded
+   * @return true if all the distances are found in the cache
+   */
+  static bool find_cached_transitions(
+    const Candidate *a, const TGLayer &lb, double delta,
+    double reverse_tolerance, TransitionCache *cache,
+    std::vector<double> *distances,
+    std::vector<std::vector<NETWORK::EdgeIndex>> *paths);
+  /**
+   * Insert the result of a search from a candidate to the nodes of a
+   * layer into the transition cache
+   * @param cg        Composition graph
+   * @param a         source candidate
+   * @param lb        layer of target candidates
+   * @param delta     upper bound of the search
+   * @param reverse_tolerance the ratio of reverse movement allowed
+   * @param distances distances returned by the search
+   * @param pmap      Predecessor map of the search
+   * @param dmap      Distance map of the search
+   * @param cache     transition cache
+   */
+  static void insert_cached_transitions(
+    const CompositeGraph &cg, const Candidate *a, const TGLayer &lb,
+    double delta, double reverse_tolerance,
+    const std::vector<double> &distances,
+    const NETWORK::PredecessorMap &pmap, const NETWORK::DistanceMap &dmap,
+    TransitionCache *cache);
+  /**
+   * Check if two candidates are connected directly on the same edge
+   * @param  a    source candidate
+   * @param  b    target candidate
+   * @param  reverse_tolerance the ratio of reverse movement allowed
+   * @param  dist set to the distance of the direct transition
+   * @return true if the candidates are connected directly
+   */
+  static bool is_direct_transition(const Candidate *a, const Candidate *b,
+                                   double reverse_tolerance, double *dist);
 
   /**
    * Create a topologically connected path according to each matched
@@ -169,14 +348,71 @@ protected:
    * @param  tg_opath A sequence of optimal candidate nodes
    * @param  indices  the indices to be updated to store the index of matched
    * edge or candidate in the returned path.
+   * @param  paths    the network edges traversed between each two
+   * consecutive nodes of tg_opath, which are found in update_tg. If it is
+   * nullptr, the paths are searched again in the network graph.
    * @return A vector of edge id representing the traversed path
    */
   C_Path build_cpath(const TGOpath &tg_opath, std::vector<int> *indices,
-                     double reverse_tolerance=0);
+                     double reverse_tolerance=0,
+                     const std::vector<const std::vector<NETWORK::EdgeIndex> *>
+                     *paths = nullptr);
 private:
   const NETWORK::Network &network_;
   const NETWORK::NetworkGraph &graph_;
+  std::unique_ptr<LayerRouter> router_;
+  std::once_flag router_once_;
+  // Counters updated by the threads matching with the same model
+  std::atomic<long long> pruned_transitions_{0};
+  std::atomic<long long> settled_nodes_{0};
+  std::unique_ptr<TransitionCache> cache_;
+  std::once_flag cache_once_;
 };// STMATCH
+
+/**
+ * Online session of %STMATCH.
+ *
+ * Points of a trajectory are pushed one at a time and only the
+ * transitions from the previous point are evaluated, candidates are
+ * returned once they are finalized by the fixed-lag Viterbi decoder.
+ * A session is not thread safe, use one session per trajectory.
+ */
+class STMATCHSession {
+public:
+  /**
+   * Constructor of an online session
+   * @param model   stmatch model
+   * @param config  Map matching configuration
+   * @param max_lag Maximum number of points left undecided, a decision is
+   * forced on the earliest point when it is exceeded.
+   */
+  STMATCHSession(STMATCH &model, const STMATCHConfig &config,
+                 int max_lag = 10);
+  /**
+   * Push a point to the session
+   * @param x x coordinate of the point
+   * @param y y coordinate of the point
+   * @param timestamp timestamp of the point in seconds. If it is negative,
+   * the search is bounded by the Euclidean distance as in a trajectory
+   * without timestamps.
+   * @return candidates finalized by the point, which can be empty
+   */
+  OnlineMatchPath push_point(double x, double y, double timestamp = -1);
+  /**
+   * Finalize all the points pushed, which is called at the end of the
+   * trajectory.
+   * @return candidates finalized
+   */
+  OnlineMatchPath flush();
+private:
+  STMATCH &model_;
+  STMATCHConfig config_;
+  OnlineTransitionGraph tg_;
+  int point_index_ = 0;
+  double prev_x_ = 0;
+  double prev_y_ = 0;
+  double prev_timestamp_ = -1;
+};
 }
 } // FMM
 
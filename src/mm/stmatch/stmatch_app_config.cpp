@@ -12,6 +12,9 @@ using namespace FMM::MM;
 using namespace FMM::CONFIG;
 
 STMATCHAppConfig::STMATCHAppConfig(int argc, char **argv){
+  // Keep the log out of the results written to the standard output
+  if (ResultConfig::is_standard_output(argc, argv))
+    UTIL::log_to_stderr();
   spdlog::set_pattern("[%^%l%$][%s:%-3#] %v");
   if (argc==2) {
     std::string configfile(argv[1]);
@@ -0,0 +1,96 @@
+#include "mm/stmatch/transition_cache.hpp"
+
+#include <algorithm>
+#include <limits>
+
+using namespace FMM;
+using namespace FMM::NETWORK;
+using namespace FMM::MM;
+
+TransitionCache::TransitionCache(std::size_t capacity, int num_shards) :
+  capacity_(capacity),
+  shards_(std::max<std::size_t>(
+    std::min<std::size_t>(std::max(num_shards, 1), capacity), 1)) {
+  // The remainder of the capacity goes to the first shards
+  for (std::size_t i = 0; i < shards_.size(); ++i) {
+    shards_[i].capacity = capacity_ / shards_.size() +
+      (i < capacity_ % shards_.size() ? 1 : 0);
+  }
+}
+
+unsigned long long TransitionCache::make_key(NodeIndex source,
+                                             NodeIndex target) {
+  return ((unsigned long long) source << 32) | target;
+}
+
+TransitionCache::Shard &TransitionCache::get_shard(unsigned long long key) {
+  // Mix the bits so that the pairs of a source spread over the shards
+  unsigned long long h = key * 0x9E3779B97F4A7C15ULL;
+  return shards_[(h >> 32) % shards_.size()];
+}
+
+bool TransitionCache::find(NodeIndex source, NodeIndex target, double bound,
+                           double *cost, std::vector<EdgeIndex> *path) {
+  unsigned long long key = make_key(source, target);
+  Shard &shard = get_shard(key);
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto iter = shard.index.find(key);
+    if (iter != shard.index.end()) {
+      Entry &entry = *(iter->second);
+      if (entry.cost != std::numeric_limits<double>::infinity() ||
+          entry.bound >= bound) {
+        *cost = entry.cost;
+        if (path != nullptr) *path = entry.path;
+        // Move the entry to the front as the most recently used
+        shard.entries.splice(shard.entries.begin(), shard.entries,
+                             iter->second);
+        ++hits_;
+        return true;
+      }
+    }
+  }
+  ++misses_;
+  return false;
+}
+
+void TransitionCache::insert(NodeIndex source, NodeIndex target,
+                             double cost, double bound,
+                             const std::vector<EdgeIndex> &path) {
+  unsigned long long key = make_key(source, target);
+  Shard &shard = get_shard(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto iter = shard.index.find(key);
+  if (iter != shard.index.end()) {
+    Entry &entry = *(iter->second);
+    if (cost != std::numeric_limits<double>::infinity()) {
+      entry.cost = cost;
+      entry.path = path;
+    } else if (entry.cost == std::numeric_limits<double>::infinity()) {
+      entry.bound = std::max(entry.bound, bound);
+    }
+    shard.entries.splice(shard.entries.begin(), shard.entries,
+                         iter->second);
+    return;
+  }
+  shard.entries.push_front(Entry{key, cost, bound, path});
+  shard.index[key] = shard.entries.begin();
+  ++insertions_;
+  if (shard.entries.size() > shard.capacity) {
+    shard.index.erase(shard.entries.back().key);
+    shard.entries.pop_back();
+    ++evictions_;
+  }
+}
+
+std::size_t TransitionCache::get_capacity() const {
+  return capacity_;
+}
+
+std::size_t TransitionCache::get_size() const {
+  return insertions_ - evictions_;
+}
+
+TransitionCacheStats TransitionCache::get_stats() const {
+  return TransitionCacheStats{hits_, misses_, insertions_, evictions_};
+}
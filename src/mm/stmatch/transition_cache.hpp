@@ -0,0 +1,124 @@
+/**
+ * Fast map matching.
+ *
+ * Cache of shortest paths between network nodes shared by the
+ * trajectories matched with stmatch.
+ */
+
+#ifndef FMM_TRANSITION_CACHE_HPP
+#define FMM_TRANSITION_CACHE_HPP
+
+#include "network/type.hpp"
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace FMM {
+namespace MM {
+
+/**
+ * Statistics of the transition cache
+ */
+struct TransitionCacheStats {
+  long long hits; /**< queries answered by the cache */
+  long long misses; /**< queries not answered by the cache */
+  long long insertions; /**< entries inserted */
+  long long evictions; /**< entries evicted to keep the capacity */
+};
+
+/**
+ * A bounded and thread safe cache of shortest paths between two nodes
+ * of the network graph, shared across trajectories and threads.
+ *
+ * An entry stores the distance and the edges of the shortest path. A pair
+ * not connected within a bound is stored with an infinite distance and
+ * the bound, which answers the queries with a smaller bound. The entries
+ * are spread over shards by key, each shard is protected by its own
+ * mutex and evicts its least recently used entry when it is full. The
+ * capacity is split over the shards, so the cache never holds more than
+ * capacity entries.
+ */
+class TransitionCache {
+ public:
+  /**
+   * Constructor
+   * @param capacity   maximum number of entries
+   * @param num_shards number of shards, at most capacity
+   */
+  explicit TransitionCache(std::size_t capacity, int num_shards = 16);
+  TransitionCache(const TransitionCache &) = delete;
+  TransitionCache &operator=(const TransitionCache &) = delete;
+  /**
+   * Look up the shortest path from source to target
+   * @param  source source node
+   * @param  target target node
+   * @param  bound  upper bound of the distance queried
+   * @param  cost   set to the distance, infinity if the target is not
+   * reached within bound
+   * @param  path   set to the edges of the path if it is not nullptr
+   * @return true if the query is answered by the cache
+   */
+  bool find(NETWORK::NodeIndex source, NETWORK::NodeIndex target,
+            double bound, double *cost,
+            std::vector<NETWORK::EdgeIndex> *path = nullptr);
+  /**
+   * Insert the result of a search from source to target
+   * @param source source node
+   * @param target target node
+   * @param cost   distance, infinity if the target is not reached
+   * @param bound  upper bound of the search
+   * @param path   edges of the path
+   */
+  void insert(NETWORK::NodeIndex source, NETWORK::NodeIndex target,
+              double cost, double bound,
+              const std::vector<NETWORK::EdgeIndex> &path);
+  /**
+   * Get the maximum number of entries
+   */
+  std::size_t get_capacity() const;
+  /**
+   * Get the number of entries stored
+   */
+  std::size_t get_size() const;
+  /**
+   * Get the statistics since the cache is created
+   */
+  TransitionCacheStats get_stats() const;
+ private:
+  /**
+   * An entry of the cache
+   */
+  struct Entry {
+    unsigned long long key; /**< source and target packed */
+    double cost; /**< distance, infinity if not reached */
+    double bound; /**< bound of the search if not reached */
+    std::vector<NETWORK::EdgeIndex> path; /**< edges of the path */
+  };
+  /**
+   * A shard of the cache, the list is ordered from the most recently used
+   * entry to the least recently used one.
+   */
+  struct Shard {
+    std::mutex mutex;
+    std::size_t capacity = 0;
+    std::list<Entry> entries;
+    std::unordered_map<unsigned long long,
+                       std::list<Entry>::iterator> index;
+  };
+  static unsigned long long make_key(NETWORK::NodeIndex source,
+                                     NETWORK::NodeIndex target);
+  Shard &get_shard(unsigned long long key);
+  std::size_t capacity_;
+  std::vector<Shard> shards_;
+  std::atomic<long long> hits_{0};
+  std::atomic<long long> misses_{0};
+  std::atomic<long long> insertions_{0};
+  std::atomic<long long> evictions_{0};
+};
+
+}
+}
+#endif //FMM_TRANSITION_CACHE_HPP
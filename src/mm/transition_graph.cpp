@@ -11,6 +11,10 @@
 #include "network/type.hpp"
 #include "util/debug.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
 using namespace FMM;
 using namespace FMM::CORE;
 using namespace FMM::NETWORK;
@@ -40,6 +44,31 @@ double TransitionGraph::calc_ep(double dist,double error){
   return exp(-0.5 * a * a);
 }
 
+double TransitionGraph::calc_prune_threshold(
+  const TGLayer &layer, int beam_width, double margin){
+  double threshold = -std::numeric_limits<double>::infinity();
+  if (beam_width <= 0 && margin <= 0) return threshold;
+  std::vector<double> probs(layer.size());
+  std::transform(layer.begin(), layer.end(), probs.begin(),
+                 [](const TGNode &a) {
+    return a.cumu_prob;
+  });
+  if (probs.empty()) return threshold;
+  double best = *std::max_element(probs.begin(), probs.end());
+  if (best == -std::numeric_limits<double>::infinity()) return threshold;
+  // Unreachable nodes are always dropped once pruning is enabled
+  threshold = std::nextafter(threshold, 0.0);
+  if (margin > 0) {
+    threshold = std::max(threshold, best - margin);
+  }
+  if (beam_width > 0 && beam_width < (int) probs.size()) {
+    std::nth_element(probs.begin(), probs.begin() + beam_width - 1,
+                     probs.end(), std::greater<double>());
+    threshold = std::max(threshold, probs[beam_width - 1]);
+  }
+  return threshold;
+}
+
 // Reset the properties of a candidate set
 void TransitionGraph::reset_layer(TGLayer *layer){
   for (auto iter=layer->begin(); iter!=layer->end(); ++iter) {
@@ -113,3 +142,119 @@ void TransitionGraph::print_optimal_info(){
 std::vector<TGLayer> &TransitionGraph::get_layers(){
   return layers;
 }
+
+OnlineTransitionGraph::OnlineTransitionGraph(double gps_error, int max_lag)
+  : gps_error(gps_error), max_lag(max_lag < 1 ? 1 : max_lag) {
+}
+
+TGLayer *OnlineTransitionGraph::add_layer(
+  int point_index, const Point_Candidates &pcs){
+  layers.push_back(OnlineLayer{point_index, pcs, TGLayer()});
+  OnlineLayer &layer = layers.back();
+  for (auto iter = layer.candidates.begin(); iter!=layer.candidates.end();
+       ++iter) {
+    double ep = TransitionGraph::calc_ep(iter->dist,gps_error);
+    layer.nodes.push_back(TGNode{&(*iter),nullptr,ep,0,
+      -std::numeric_limits<double>::infinity(),0});
+  }
+  if (layers.size()==1) {
+    for (auto &node:layer.nodes) {
+      node.cumu_prob = log(node.ep);
+    }
+  }
+  return &layer.nodes;
+}
+
+TGLayer *OnlineTransitionGraph::get_layer(int i){
+  return &(layers[i].nodes);
+}
+
+int OnlineTransitionGraph::get_num_layers() const {
+  return layers.size();
+}
+
+OnlineMatchPath OnlineTransitionGraph::decode(){
+  OnlineMatchPath result;
+  int N = layers.size();
+  if (N<2) return result;
+  TGLayer &last_layer = layers.back().nodes;
+  std::vector<const TGNode*> paths;
+  for (auto &node:last_layer) {
+    if (node.cumu_prob>-std::numeric_limits<double>::infinity()) {
+      paths.push_back(&node);
+    }
+  }
+  if (paths.empty()) {
+    SPDLOG_DEBUG("Point {} not connected, finalize {} layers",
+      layers.back().point_index, N-1);
+    finalize(N-2, TransitionGraph::find_optimal_candidate(layers[N-2].nodes),
+      &result);
+    for (auto &node:layers.front().nodes) {
+      node.cumu_prob = log(node.ep);
+      node.prev = nullptr;
+    }
+    return result;
+  }
+  // Trace the surviving paths backward until they merge into one node
+  for (int i = N-1; i>=0 && !paths.empty(); --i) {
+    if (paths.size()==1) {
+      // The last layer is kept to connect with the next point
+      if (i==N-1) {
+        finalize(i-1, paths[0]->prev, &result);
+      } else {
+        finalize(i, paths[0], &result);
+      }
+      break;
+    }
+    std::vector<const TGNode*> prev_nodes;
+    for (const TGNode *node:paths) {
+      if (node->prev!=nullptr) prev_nodes.push_back(node->prev);
+    }
+    std::sort(prev_nodes.begin(), prev_nodes.end());
+    prev_nodes.erase(std::unique(prev_nodes.begin(), prev_nodes.end()),
+                     prev_nodes.end());
+    paths = prev_nodes;
+  }
+  N = layers.size();
+  if (N>max_lag) {
+    // Force a decision on the leading layers following the best node
+    const TGNode *node = TransitionGraph::find_optimal_candidate(
+      layers.back().nodes);
+    for (int i = N-1; i>N-1-max_lag; --i) {
+      node = node->prev;
+    }
+    finalize(N-1-max_lag, node, &result);
+  }
+  return result;
+}
+
+OnlineMatchPath OnlineTransitionGraph::flush(){
+  OnlineMatchPath result;
+  if (layers.empty()) return result;
+  int N = layers.size();
+  finalize(N-1, TransitionGraph::find_optimal_candidate(layers[N-1].nodes),
+    &result);
+  return result;
+}
+
+void OnlineTransitionGraph::finalize(int i, const TGNode *node,
+                                     OnlineMatchPath *result){
+  int offset = result->size();
+  // A layer whose nodes are all unreachable has no decision to report
+  if (node!=nullptr) {
+    for (int j = i; j>=0 && node!=nullptr; --j) {
+      result->push_back(OnlineMatch{layers[j].point_index,
+        MatchedCandidate{*(node->c), node->ep, node->tp, node->sp_dist}});
+      node = node->prev;
+    }
+    std::reverse(result->begin()+offset, result->end());
+  }
+  for (int j = 0; j<=i; ++j) {
+    layers.pop_front();
+  }
+  if (!layers.empty()) {
+    for (auto &front_node:layers.front().nodes) {
+      front_node.prev = nullptr;
+    }
+  }
+}
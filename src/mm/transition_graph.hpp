@@ -17,6 +17,7 @@
 #include "mm/mm_type.hpp"
 
 #include <float.h>
+#include <deque>
 
 namespace FMM
 {
@@ -82,6 +83,21 @@ public:
    */
   static double calc_ep(double dist,double error);
 
+  /**
+   * Calculate the pruning threshold of a layer in beam search.
+   *
+   * A node in the layer whose accumulative probability is lower than the
+   * threshold will not be expanded to the next layer.
+   *
+   * @param  layer      A layer whose probabilities are already updated
+   * @param  beam_width Maximum number of nodes to keep, 0 means no limit
+   * @param  margin     Maximum difference of log probability to the best
+   * node in the layer, 0 means no limit
+   * @return the threshold value, -infinity if no node should be pruned
+   */
+  static double calc_prune_threshold(const TGLayer &layer,
+                                     int beam_width, double margin);
+
   /**
    * Reset all the proability data stored in a layer of the transition graph
    * @param layer A layer in the transition graph
@@ -94,7 +110,7 @@ public:
    * @param  layer [description]
    * @return  pointer to the optimal node in the transition graph
    */
-  const TGNode *find_optimal_candidate(const TGLayer &layer);
+  static const TGNode *find_optimal_candidate(const TGLayer &layer);
   /**
    * Backtrack the transition graph to find an optimal path
    * @return An optimal path connecting the first layer with last layer and
@@ -111,6 +127,74 @@ private:
   std::vector<TGLayer> layers;
 };
 
+/**
+ * Transition graph of a fixed-lag online Viterbi decoder.
+ *
+ * Layers are appended one point at a time and kept in a bounded window.
+ * Once all the surviving paths share a common node, or the window grows
+ * longer than the maximum lag, the leading layers are decided and
+ * removed from the window.
+ */
+class OnlineTransitionGraph
+{
+public:
+  /**
+   * Constructor of online transition graph
+   * @param gps_error GPS error
+   * @param max_lag   Maximum number of layers kept undecided, at least 1
+   */
+  OnlineTransitionGraph(double gps_error, int max_lag);
+  /**
+   * Append a layer to the window.
+   *
+   * The candidates are owned by the graph, so the pointers in the nodes
+   * stay valid until the layer is removed.
+   *
+   * @param point_index index of the point the candidates belong to
+   * @param pcs         candidates of the point
+   * @return a pointer to the new layer
+   */
+  TGLayer *add_layer(int point_index, const Point_Candidates &pcs);
+  /**
+   * Get the layer at position i of the window, the first layer is the
+   * earliest undecided one.
+   */
+  TGLayer *get_layer(int i);
+  /**
+   * Get the number of layers in the window
+   */
+  int get_num_layers() const;
+  /**
+   * Decide the layers which can be finalized after the last layer is
+   * updated.
+   *
+   * If the last layer is not connected with the previous one, all the
+   * previous layers are finalized and the last layer starts a new path.
+   *
+   * @return candidates finalized, in the order of point index
+   */
+  OnlineMatchPath decode();
+  /**
+   * Finalize all the layers in the window
+   * @return candidates finalized, in the order of point index
+   */
+  OnlineMatchPath flush();
+private:
+  struct OnlineLayer {
+    int point_index;
+    Point_Candidates candidates;
+    TGLayer nodes;
+  };
+  /**
+   * Finalize the path ending at node of layer i and remove the layers
+   * from the front of the window to i.
+   */
+  void finalize(int i, const TGNode *node, OnlineMatchPath *result);
+  std::deque<OnlineLayer> layers;
+  double gps_error;
+  int max_lag;
+};
+
 }
 }
 #endif /* FMM_TRANSITION_GRAPH_HPP */
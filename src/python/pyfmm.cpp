@@ -0,0 +1,105 @@
+/**
+ * Fast map matching.
+ *
+ * Implementation of the batch API used in Python
+ */
+
+#include "python/pyfmm.hpp"
+#include "util/debug.hpp"
+
+#include <stdexcept>
+
+#include <boost/format.hpp>
+
+using namespace FMM;
+using namespace FMM::CORE;
+using namespace FMM::MM;
+
+namespace FMM {
+namespace PYTHON {
+
+std::vector<Trajectory> group_trajectories(
+  const std::vector<int> &ids, const std::vector<double> &xs,
+  const std::vector<double> &ys, const std::vector<double> &timestamps) {
+  if (xs.size() != ids.size() || ys.size() != ids.size() ||
+      (!timestamps.empty() && timestamps.size() != ids.size())) {
+    std::string message = (boost::format(
+      "Size of ids %1%, xs %2%, ys %3% and timestamps %4% not match")
+      % ids.size() % xs.size() % ys.size() % timestamps.size()).str();
+    SPDLOG_CRITICAL(message);
+    throw std::runtime_error(message);
+  }
+  std::vector<Trajectory> trajectories;
+  size_t start = 0;
+  while (start < ids.size()) {
+    size_t end = start + 1;
+    while (end < ids.size() && ids[end] == ids[start]) ++end;
+    Trajectory trajectory;
+    trajectory.id = ids[start];
+    for (size_t i = start; i < end; ++i) {
+      trajectory.geom.add_point(xs[i], ys[i]);
+    }
+    if (!timestamps.empty()) {
+      trajectory.timestamps.assign(timestamps.begin() + start,
+                                   timestamps.begin() + end);
+    }
+    trajectories.push_back(std::move(trajectory));
+    start = end;
+  }
+  return trajectories;
+}
+
+PyBatchMatchResult collect_batch_results(
+  const std::vector<Trajectory> &trajectories,
+  const std::vector<MatchResult> &results) {
+  PyBatchMatchResult output;
+  size_t num_points = 0;
+  for (const MatchResult &result : results) {
+    num_points += result.opath.size();
+  }
+  output.ids.reserve(trajectories.size());
+  output.opath.reserve(num_points);
+  output.indices.reserve(num_points);
+  output.error.reserve(num_points);
+  output.offset.reserve(num_points);
+  output.ep.reserve(num_points);
+  output.tp.reserve(num_points);
+  output.spdist.reserve(num_points);
+  output.pgeom_x.reserve(num_points);
+  output.pgeom_y.reserve(num_points);
+  output.point_offsets.push_back(0);
+  output.cpath_offsets.push_back(0);
+  output.mgeom_offsets.push_back(0);
+  for (size_t i = 0; i < trajectories.size(); ++i) {
+    const MatchResult &result = results[i];
+    output.ids.push_back(trajectories[i].id);
+    if (!result.cpath.empty()) {
+      output.opath.insert(output.opath.end(),
+                          result.opath.begin(), result.opath.end());
+      output.indices.insert(output.indices.end(),
+                            result.indices.begin(), result.indices.end());
+      for (const MatchedCandidate &mc : result.opt_candidate_path) {
+        output.error.push_back(mc.c.dist);
+        output.offset.push_back(mc.c.offset);
+        output.ep.push_back(mc.ep);
+        output.tp.push_back(mc.tp);
+        output.spdist.push_back(mc.sp_dist);
+        output.pgeom_x.push_back(boost::geometry::get<0>(mc.c.point));
+        output.pgeom_y.push_back(boost::geometry::get<1>(mc.c.point));
+      }
+      output.cpath.insert(output.cpath.end(),
+                          result.cpath.begin(), result.cpath.end());
+      for (int j = 0; j < result.mgeom.get_num_points(); ++j) {
+        output.mgeom_x.push_back(result.mgeom.get_x(j));
+        output.mgeom_y.push_back(result.mgeom.get_y(j));
+      }
+    }
+    output.point_offsets.push_back(output.opath.size());
+    output.cpath_offsets.push_back(output.cpath.size());
+    output.mgeom_offsets.push_back(output.mgeom_x.size());
+  }
+  return output;
+}
+
+} // PYTHON
+} // FMM
@@ -11,6 +11,9 @@
 #define FMM_PYFMM_HPP_
 
 #include "mm/mm_type.hpp"
+#include "core/gps.hpp"
+
+#include <vector>
 
 namespace FMM{
 /**
@@ -45,6 +48,62 @@ struct PyMatchResult {
   CORE::LineString mgeom; /**< Geometry of the matched path */
   CORE::LineString pgeom; /**< Point position matched for each GPS point */
 };
+
+/**
+ * Columnar match result of a batch of trajectories used in Python API.
+ *
+ * The values of the i-th trajectory are stored in the range
+ * [offsets[i], offsets[i+1]) of each column, where the point columns are
+ * indexed by point_offsets, cpath by cpath_offsets and mgeom_x, mgeom_y
+ * by mgeom_offsets. A trajectory not matched has empty ranges.
+ */
+struct PyBatchMatchResult {
+  std::vector<int> ids; /**< id of each trajectory */
+  std::vector<int> point_offsets; /**< offsets of the point columns */
+  MM::O_Path opath; /**< Edge ID matched for each point */
+  std::vector<int> indices; /**< index of matched edge in the cpath */
+  std::vector<double> error; /**< Error of matching each point */
+  std::vector<double> offset; /**< Matched point distance to start node of
+                                   edge */
+  std::vector<double> ep; /**< emission probability */
+  std::vector<double> tp; /**< transition proability from previous matched
+                               candidate */
+  std::vector<double> spdist; /**< shortest path distance from previous
+                                   matched candidate */
+  std::vector<double> pgeom_x; /**< x of the point position matched */
+  std::vector<double> pgeom_y; /**< y of the point position matched */
+  std::vector<int> cpath_offsets; /**< offsets of cpath */
+  MM::C_Path cpath; /**< Edge ID traversed by the matched path */
+  std::vector<int> mgeom_offsets; /**< offsets of mgeom_x and mgeom_y */
+  std::vector<double> mgeom_x; /**< x of the geometry of matched path */
+  std::vector<double> mgeom_y; /**< y of the geometry of matched path */
+};
+
+#ifndef SWIG
+/**
+ * Group the columns of GPS points into trajectories, consecutive points
+ * with the same id form a trajectory as in the GPS point file.
+ * std::runtime_error is thrown if the sizes of the columns differ.
+ * @param ids id of each point
+ * @param xs x of each point
+ * @param ys y of each point
+ * @param timestamps timestamp of each point, empty if not available
+ * @return trajectories
+ */
+std::vector<CORE::Trajectory> group_trajectories(
+  const std::vector<int> &ids, const std::vector<double> &xs,
+  const std::vector<double> &ys, const std::vector<double> &timestamps);
+
+/**
+ * Store the match results of a batch of trajectories in columns
+ * @param trajectories trajectories matched
+ * @param results match result of each trajectory
+ * @return columnar match result
+ */
+PyBatchMatchResult collect_batch_results(
+  const std::vector<CORE::Trajectory> &trajectories,
+  const std::vector<MM::MatchResult> &results);
+#endif
 }; // PYTHON
 }; // FMM
 
@@ -27,6 +27,16 @@ namespace UTIL{
 static const std::vector<std::string>
     LOG_LEVESLS {"0-trace","1-debug","2-info",
                  "3-warn","4-err","5-critical","6-off"};
+
+/**
+ * Write the log to the standard error instead of the standard output,
+ * which is used when the results are written to the standard output.
+ * It should be called before the pattern of the log is set.
+ */
+inline void log_to_stderr() {
+  spdlog::set_default_logger(std::make_shared<spdlog::logger>(
+    "", std::make_shared<spdlog::sinks::stderr_color_sink_mt>()));
+}
 }; // UTIL
 }; // FMM
 
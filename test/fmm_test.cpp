@@ -4,9 +4,33 @@
 #include "util/debug.hpp"
 #include "network/network.hpp"
 #include "mm/fmm/fmm_algorithm.hpp"
+#include "mm/fmm/ubodt_gen_algorithm.hpp"
 #include "mm/transition_graph.hpp"
+#include "mm/composite_graph.hpp"
+#include "mm/mm_pipeline.hpp"
+#include "mm/fmm/fmm_server.hpp"
 #include "core/gps.hpp"
 #include "io/gps_reader.hpp"
+#include "io/text_parser.hpp"
+#include "io/trajectory_file.hpp"
+#include "io/result_file.hpp"
+#include "io/compressed_file.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 using namespace FMM;
 using namespace FMM::IO;
@@ -33,4 +57,1065 @@ TEST_CASE( "fmm is tested", "[fmm]" ) {
     REQUIRE_THAT(result.cpath,Catch::Equals<int>({2,5,13,14,23}));
     REQUIRE(expected_mgeom==result.mgeom);
   }
+  SECTION( "online_session_test" ) {
+    const Trajectory &trajectory = trajectories[0];
+    auto ubodt = UBODT::read_ubodt_csv("../data/ubodt.txt",multiplier);
+    FastMapMatch model(network,graph,ubodt);
+    FastMapMatchConfig config{4,0.4,0.5};
+    MatchResult result = model.match_traj(trajectory,config);
+    FastMapMatchSession session(model,config,100);
+    OnlineMatchPath online_path;
+    for (int i = 0; i < trajectory.geom.get_num_points(); ++i) {
+      OnlineMatchPath finalized = session.push_point(
+        trajectory.geom.get_x(i), trajectory.geom.get_y(i));
+      online_path.insert(online_path.end(),
+                         finalized.begin(), finalized.end());
+    }
+    OnlineMatchPath finalized = session.flush();
+    online_path.insert(online_path.end(), finalized.begin(), finalized.end());
+    O_Path opath;
+    for (int i = 0; i < online_path.size(); ++i) {
+      REQUIRE(online_path[i].point_index == i);
+      opath.push_back(online_path[i].mc.c.edge->id);
+    }
+    REQUIRE_THAT(opath,Catch::Equals<FMM::NETWORK::EdgeID>(result.opath));
+  }
+  SECTION( "batch_match_test" ) {
+    auto ubodt = UBODT::read_ubodt_csv("../data/ubodt.txt",multiplier);
+    FastMapMatch model(network,graph,ubodt);
+    FastMapMatchConfig config{4,0.4,0.5};
+    std::vector<int> ids;
+    std::vector<double> xs, ys;
+    for (const Trajectory &trajectory : trajectories) {
+      for (int i = 0; i < trajectory.geom.get_num_points(); ++i) {
+        ids.push_back(trajectory.id);
+        xs.push_back(trajectory.geom.get_x(i));
+        ys.push_back(trajectory.geom.get_y(i));
+      }
+    }
+    PYTHON::PyBatchMatchResult batch = model.match_batch(
+      ids, xs, ys, std::vector<double>(), config);
+    REQUIRE(batch.ids.size() == trajectories.size());
+    REQUIRE(batch.point_offsets.back() == batch.opath.size());
+    REQUIRE(batch.pgeom_x.size() == batch.opath.size());
+    for (int i = 0; i < trajectories.size(); ++i) {
+      MatchResult result = model.match_traj(trajectories[i], config);
+      REQUIRE(batch.ids[i] == trajectories[i].id);
+      O_Path opath(batch.opath.begin() + batch.point_offsets[i],
+                   batch.opath.begin() + batch.point_offsets[i + 1]);
+      C_Path cpath(batch.cpath.begin() + batch.cpath_offsets[i],
+                   batch.cpath.begin() + batch.cpath_offsets[i + 1]);
+      REQUIRE_THAT(opath,Catch::Equals<FMM::NETWORK::EdgeID>(result.opath));
+      REQUIRE_THAT(cpath,Catch::Equals<FMM::NETWORK::EdgeID>(result.cpath));
+      REQUIRE(batch.mgeom_offsets[i + 1] - batch.mgeom_offsets[i] ==
+              result.mgeom.get_num_points());
+    }
+    xs.pop_back();
+    REQUIRE_THROWS(model.match_batch(
+      ids, xs, ys, std::vector<double>(), config));
+  }
+  SECTION( "prune_threshold_test" ) {
+    const double inf = std::numeric_limits<double>::infinity();
+    auto make_layer = [](const std::vector<double> &probs) {
+      TGLayer layer;
+      for (double prob : probs) {
+        layer.push_back(TGNode{nullptr, nullptr, 0, 0, prob, 0});
+      }
+      return layer;
+    };
+    TGLayer layer = make_layer({-1, -3, -2, -inf, -2, -5});
+    // Pruning disabled
+    REQUIRE(TransitionGraph::calc_prune_threshold(layer, 0, 0) == -inf);
+    REQUIRE(TransitionGraph::calc_prune_threshold(TGLayer(), 2, 1) == -inf);
+    // A layer without any reachable node is kept
+    REQUIRE(TransitionGraph::calc_prune_threshold(
+      make_layer({-inf, -inf}), 1, 1) == -inf);
+    // Only the unreachable nodes are dropped if the beam covers the layer
+    double threshold = TransitionGraph::calc_prune_threshold(layer, 6, 0);
+    REQUIRE(threshold > -inf);
+    REQUIRE(threshold < -5);
+    REQUIRE(TransitionGraph::calc_prune_threshold(layer, 10, 0) ==
+            threshold);
+    // The nodes tied with the last node in the beam are kept
+    REQUIRE(TransitionGraph::calc_prune_threshold(layer, 2, 0) == -2);
+    REQUIRE(TransitionGraph::calc_prune_threshold(layer, 3, 0) == -2);
+    REQUIRE(TransitionGraph::calc_prune_threshold(layer, 1, 0) == -1);
+    // Margin to the best node
+    REQUIRE(TransitionGraph::calc_prune_threshold(layer, 0, 2.5) == -3.5);
+    // The tighter of the beam and the margin is used
+    REQUIRE(TransitionGraph::calc_prune_threshold(layer, 2, 2.5) == -2);
+    REQUIRE(TransitionGraph::calc_prune_threshold(layer, 5, 0.5) == -1.5);
+  }
+  SECTION( "ubodt_fallback_test" ) {
+    const Trajectory &trajectory = trajectories[0];
+    // No transition is found in an empty UBODT
+    auto ubodt = std::make_shared<UBODT>(50, multiplier);
+    FastMapMatch model(network,graph,ubodt);
+    FastMapMatchConfig config{4,0.4,0.5};
+    MatchResult result = model.match_traj(trajectory,config);
+    REQUIRE(result.cpath.empty());
+    config.fallback_factor = 10;
+    result = model.match_traj(trajectory,config);
+    REQUIRE_THAT(result.cpath,Catch::Equals<int>({2,5,13,14,23}));
+    REQUIRE(model.get_fallback_searches() > 0);
+  }
+  SECTION( "match_pipeline_test" ) {
+    auto ubodt = UBODT::read_ubodt_csv("../data/ubodt.txt",multiplier);
+    FastMapMatch model(network,graph,ubodt);
+    FastMapMatchConfig config{4,0.4,0.5};
+    std::map<int, C_Path> expected;
+    for (const Trajectory &trajectory : trajectories) {
+      expected[trajectory.id] = model.match_traj(trajectory,config).cpath;
+    }
+    FMM::CONFIG::GPSConfig gps_config("../data/trips.csv");
+    FMM::IO::GPSReader gps_reader(gps_config);
+    MatchPipeline<MatchResult> pipeline(4, 1);
+    std::map<int, C_Path> written;
+    pipeline.run(&gps_reader, [&](const Trajectory &trajectory) {
+      return model.match_traj(trajectory,config);
+    }, nullptr, [&](const Trajectory &trajectory, const MatchResult &result,
+                    const std::string &text) {
+      REQUIRE(trajectory.id == result.id);
+      REQUIRE(text.empty());
+      written[result.id] = result.cpath;
+    });
+    REQUIRE(written == expected);
+    // Results are written in the input order with the text formatted
+    FMM::IO::GPSReader ordered_reader(gps_config);
+    MatchPipeline<MatchResult> ordered_pipeline(4, 10, 1, true);
+    std::vector<int> ids;
+    ordered_pipeline.run(&ordered_reader, [&](const Trajectory &trajectory) {
+      return model.match_traj(trajectory,config);
+    }, [&](const Trajectory &trajectory, const MatchResult &result,
+           std::string *text) {
+      *text = std::to_string(result.id);
+    }, [&](const Trajectory &trajectory, const MatchResult &result,
+           const std::string &text) {
+      REQUIRE(text == std::to_string(trajectory.id));
+      ids.push_back(trajectory.id);
+    });
+    std::vector<int> expected_ids;
+    for (const Trajectory &trajectory : trajectories) {
+      expected_ids.push_back(trajectory.id);
+    }
+    REQUIRE(ids == expected_ids);
+    // A slow first trajectory holds the results after it, the reader
+    // stays at most a window ahead of the results written
+    struct WindowReader {
+      const std::vector<Trajectory> *trajectories;
+      const std::atomic<int> *written;
+      int next = 0;
+      int max_ahead = 0;
+      bool has_next_trajectory() {
+        return next < 20;
+      };
+      Trajectory read_next_trajectory() {
+        Trajectory trajectory = (*trajectories)[next % trajectories->size()];
+        trajectory.id = next++;
+        max_ahead = std::max(max_ahead, next - written->load());
+        return trajectory;
+      };
+    };
+    std::atomic<int> num_written(0);
+    WindowReader window_reader;
+    window_reader.trajectories = &trajectories;
+    window_reader.written = &num_written;
+    MatchPipeline<MatchResult> window_pipeline(4, 4, 1, true);
+    ids.clear();
+    window_pipeline.run(&window_reader, [&](const Trajectory &trajectory) {
+      if (trajectory.id == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+      }
+      return model.match_traj(trajectory,config);
+    }, nullptr, [&](const Trajectory &trajectory, const MatchResult &result,
+                    const std::string &text) {
+      ids.push_back(trajectory.id);
+      ++num_written;
+    });
+    REQUIRE(window_reader.max_ahead <= 4);
+    REQUIRE(ids.size() == 20);
+    for (int i = 0; i < ids.size(); ++i) {
+      REQUIRE(ids[i] == i);
+    }
+  }
+  SECTION( "match_pipeline_chunk_test" ) {
+    LineString point;
+    point.add_point(1, 1);
+    REQUIRE(estimate_match_cost(Trajectory{1, point, {}}) == 1);
+    // A straight trajectory has a bounding box diagonal of its length
+    LineString straight;
+    for (int i = 0; i < 4; ++i) straight.add_point(i, i);
+    REQUIRE(estimate_match_cost(Trajectory{2, straight, {}}) == Approx(8));
+    // A trajectory moving back and forth covers a smaller area
+    LineString back_forth;
+    for (int i = 0; i < 4; ++i) back_forth.add_point(i % 2, 0);
+    REQUIRE(estimate_match_cost(Trajectory{3, back_forth, {}}) ==
+            Approx(4 * (1 + 1.0 / 3)));
+    LineString still;
+    for (int i = 0; i < 3; ++i) still.add_point(1, 1);
+    REQUIRE(estimate_match_cost(Trajectory{4, still, {}}) == 3);
+    // Ordered by cost, chunks closed once the cost reaches 4
+    std::vector<std::vector<int>> chunks = make_match_chunks(
+      {1, 5, 3, 2, 3}, 4);
+    REQUIRE(chunks.size() == 3);
+    REQUIRE(chunks[0] == std::vector<int>({1}));
+    REQUIRE(chunks[1] == std::vector<int>({2, 4}));
+    REQUIRE(chunks[2] == std::vector<int>({3, 0}));
+    REQUIRE(make_match_chunks({}, 4).empty());
+    REQUIRE(make_match_chunks({1, 1, 1}, 0).size() == 3);
+  }
+  SECTION( "match_pipeline_stream_test" ) {
+    // A stream whose next trajectory is not available until it is
+    // released, a trajectory read is matched without waiting for the
+    // window to be full.
+    struct StreamReader {
+      const std::vector<Trajectory> *trajectories;
+      int next = 0;
+      int released = 1;
+      std::mutex mutex;
+      std::condition_variable cv;
+      bool has_next_trajectory() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return next < released; });
+        return next < trajectories->size();
+      };
+      Trajectory read_next_trajectory() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return (*trajectories)[next++];
+      };
+      void release_all() {
+        std::lock_guard<std::mutex> lock(mutex);
+        released = trajectories->size() + 1;
+        cv.notify_all();
+      };
+    };
+    auto ubodt = UBODT::read_ubodt_csv("../data/ubodt.txt",multiplier);
+    FastMapMatch model(network,graph,ubodt);
+    FastMapMatchConfig config{4,0.4,0.5};
+    StreamReader stream_reader;
+    stream_reader.trajectories = &trajectories;
+    std::mutex mutex;
+    std::condition_variable written_cv;
+    std::vector<int> ids;
+    std::thread pipeline_thread([&] {
+      MatchPipeline<MatchResult> pipeline(2, 1000);
+      pipeline.run(&stream_reader, [&](const Trajectory &trajectory) {
+        return model.match_traj(trajectory,config);
+      }, nullptr, [&](const Trajectory &trajectory,
+                      const MatchResult &result, const std::string &text) {
+        std::lock_guard<std::mutex> lock(mutex);
+        ids.push_back(trajectory.id);
+        written_cv.notify_all();
+      });
+    });
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      CHECK(written_cv.wait_for(lock, std::chrono::seconds(10),
+                                [&ids] { return !ids.empty(); }));
+      CHECK(ids.size() == 1);
+    }
+    stream_reader.release_all();
+    pipeline_thread.join();
+    REQUIRE(ids.size() == trajectories.size());
+    REQUIRE(ids[0] == trajectories[0].id);
+  }
+  SECTION( "mmap_csv_reader_test" ) {
+    MmapCSVTrajectoryReader mmap_reader("../data/trips.csv","id","geom");
+    std::vector<Trajectory> mapped = mmap_reader.read_all_trajectories();
+    REQUIRE(mapped.size() == trajectories.size());
+    for (int i = 0; i < mapped.size(); ++i) {
+      REQUIRE(mapped[i].id == trajectories[i].id);
+      REQUIRE(mapped[i].geom == trajectories[i].geom);
+    }
+    mmap_reader.reset_cursor();
+    REQUIRE(mmap_reader.read_next_trajectory().id == trajectories[0].id);
+    std::string text = "LineString (1 -2.5e1, 0.125 3)";
+    LineString geom;
+    parse_linestring(text.data(), text.data() + text.size(), &geom);
+    REQUIRE(geom == wkt2linestring("LINESTRING(1 -25,0.125 3)"));
+    text = "1.5, 2,0.12345678901234567890123";
+    std::vector<double> values;
+    parse_timestamps(text.data(), text.data() + text.size(), &values);
+    REQUIRE(values.size() == 3);
+    REQUIRE(values[0] == 1.5);
+    REQUIRE(values[1] == 2);
+    REQUIRE(values[2] == std::strtod("0.12345678901234567890123", nullptr));
+    // Integers out of the range of int are rejected
+    int id = 0;
+    for (std::string valid : {"2147483647", "-2147483648", " +12;"}) {
+      REQUIRE(parse_int(valid.data(), valid.data() + valid.size(), &id) !=
+              nullptr);
+    }
+    REQUIRE(id == 12);
+    for (std::string invalid : {"2147483648", "-2147483649",
+                                "99999999999999999999999", "-", ""}) {
+      REQUIRE(parse_int(invalid.data(), invalid.data() + invalid.size(),
+                        &id) == nullptr);
+    }
+  }
+  SECTION( "mmap_csv_point_reader_test" ) {
+    std::string point_file = "mmap_points_test.csv";
+    {
+      std::ofstream ofs(point_file);
+      ofs << "id;x;y;timestamp\n" << std::setprecision(17);
+      for (const Trajectory &trajectory : trajectories) {
+        for (int i = 0; i < trajectory.geom.get_num_points(); ++i) {
+          ofs << trajectory.id << ";" << trajectory.geom.get_x(i) << ";"
+              << trajectory.geom.get_y(i) << ";" << i << "\n";
+        }
+      }
+    }
+    // A chunk size smaller than a row splits the file at every trajectory
+    for (std::size_t chunk_size : {1, 64, 1 << 22}) {
+      // Parsed by the default team, one thread and two threads
+      for (int num_threads : {0, 1, 2}) {
+        MmapCSVPointReader mmap_reader(point_file,"id","x","y","timestamp",
+                                       chunk_size, num_threads);
+        std::vector<Trajectory> mapped =
+          mmap_reader.read_all_trajectories();
+        REQUIRE(mapped.size() == trajectories.size());
+        for (int i = 0; i < mapped.size(); ++i) {
+          REQUIRE(mapped[i].id == trajectories[i].id);
+          REQUIRE(mapped[i].geom == trajectories[i].geom);
+          REQUIRE(mapped[i].timestamps.size() ==
+                  trajectories[i].geom.get_num_points());
+        }
+      }
+    }
+    FMM::CONFIG::GPSConfig gps_config(point_file);
+    gps_config.gps_point = true;
+    gps_config.mmap = true;
+    gps_config.parse_threads = 2;
+    REQUIRE(gps_config.validate());
+    GPSReader gps_reader(gps_config);
+    REQUIRE(gps_reader.read_all_trajectories().size() == trajectories.size());
+    gps_config.parse_threads = -1;
+    REQUIRE_FALSE(gps_config.validate());
+    std::remove(point_file.c_str());
+  }
+  SECTION( "sorted_csv_point_reader_test" ) {
+    std::string point_file = "unsorted_points_test.csv";
+    {
+      // Points interleaved between trajectories in descending time
+      std::ofstream ofs(point_file);
+      ofs << "id;x;y;timestamp\n" << std::setprecision(17);
+      int max_points = 0;
+      for (const Trajectory &trajectory : trajectories) {
+        max_points = std::max(max_points, trajectory.geom.get_num_points());
+      }
+      for (int i = max_points - 1; i >= 0; --i) {
+        for (const Trajectory &trajectory : trajectories) {
+          if (i >= trajectory.geom.get_num_points()) continue;
+          ofs << trajectory.id << ";" << trajectory.geom.get_x(i) << ";"
+              << trajectory.geom.get_y(i) << ";" << i << "\n";
+        }
+      }
+    }
+    std::vector<Trajectory> expected = trajectories;
+    std::sort(expected.begin(), expected.end(),
+              [](const Trajectory &a, const Trajectory &b) {
+      return a.id < b.id;
+    });
+    // A limit of a few points spills several runs
+    for (std::size_t memory_limit : {256, 1 << 20}) {
+      SortedCSVPointReader sorted_reader(point_file,"id","x","y",
+                                         "timestamp", memory_limit, ".");
+      if (memory_limit == 256) {
+        REQUIRE(sorted_reader.get_num_runs() > 1);
+        REQUIRE(sorted_reader.get_spilled_bytes() > 0);
+      } else {
+        REQUIRE(sorted_reader.get_num_runs() == 0);
+      }
+      std::vector<Trajectory> sorted = sorted_reader.read_all_trajectories();
+      REQUIRE(sorted.size() == expected.size());
+      for (int i = 0; i < sorted.size(); ++i) {
+        REQUIRE(sorted[i].id == expected[i].id);
+        REQUIRE(sorted[i].geom == expected[i].geom);
+        REQUIRE(sorted[i].timestamps.size() ==
+                expected[i].geom.get_num_points());
+      }
+    }
+    std::remove(point_file.c_str());
+  }
+  SECTION( "binary_trajectory_file_test" ) {
+    std::string binary_file = "trips_test.fmmt";
+    FMM::CONFIG::GPSConfig gps_config("../data/trips.csv");
+    REQUIRE(convert_to_trajectory_file(gps_config, binary_file) ==
+            trajectories.size());
+    FMM::CONFIG::GPSConfig binary_config(binary_file);
+    REQUIRE(binary_config.get_gps_format() == 3);
+    GPSReader binary_reader(binary_config);
+    REQUIRE(!binary_reader.has_timestamp());
+    std::vector<Trajectory> converted = binary_reader.read_all_trajectories();
+    REQUIRE(converted.size() == trajectories.size());
+    for (int i = 0; i < converted.size(); ++i) {
+      REQUIRE(converted[i].id == trajectories[i].id);
+      REQUIRE(converted[i].geom == trajectories[i].geom);
+    }
+    // The timestamp field of a GDAL file is not read
+    FMM::CONFIG::GPSConfig gdal_config("../data/network.gpkg");
+    gdal_config.timestamp = "source";
+    REQUIRE(gdal_config.get_gps_format() == 0);
+    {
+      GPSReader gdal_reader(gdal_config);
+      REQUIRE(!gdal_reader.has_timestamp());
+    }
+    REQUIRE(convert_to_trajectory_file(gdal_config, binary_file) ==
+            network.get_edge_count());
+    REQUIRE(!GPSReader(binary_config).has_timestamp());
+    // One trajectory per block with timestamps
+    {
+      TrajectoryFileWriter writer(binary_file, true, 1);
+      for (Trajectory trajectory : trajectories) {
+        for (int i = 0; i < trajectory.geom.get_num_points(); ++i) {
+          trajectory.timestamps.push_back(i * 0.5);
+        }
+        writer.write(trajectory);
+      }
+    }
+    BinaryTrajectoryReader block_reader(binary_file);
+    REQUIRE(block_reader.has_timestamp());
+    REQUIRE(block_reader.get_num_blocks() == trajectories.size());
+    uint64_t last = trajectories.size() - 1;
+    std::vector<Trajectory> block;
+    REQUIRE_THROWS_AS(block_reader.read_block(last + 1, &block),
+                      std::out_of_range);
+    REQUIRE_THROWS_AS(block_reader.seek_block(last + 1), std::out_of_range);
+    block_reader.read_block(last, &block);
+    REQUIRE(block.size() == 1);
+    REQUIRE(block[0].geom == trajectories[last].geom);
+    REQUIRE(block[0].timestamps.back() ==
+            (trajectories[last].geom.get_num_points() - 1) * 0.5);
+    block_reader.seek_block(last);
+    REQUIRE(block_reader.read_next_trajectory().id == trajectories[last].id);
+    REQUIRE(!block_reader.has_next_trajectory());
+    block_reader.close();
+    std::remove(binary_file.c_str());
+  }
+  SECTION( "csv_result_writer_test" ) {
+    const Trajectory &trajectory = trajectories[0];
+    auto ubodt = UBODT::read_ubodt_csv("../data/ubodt.txt",multiplier);
+    FastMapMatch model(network,graph,ubodt);
+    FastMapMatchConfig config{4,0.4,0.5};
+    MatchResult result = model.match_traj(trajectory,config);
+    FMM::CONFIG::OutputConfig output_config;
+    output_config.write_tpath = true;
+    CSVMatchResultWriter writer("result_test.csv", output_config);
+    std::string text;
+    writer.format_result(trajectory, result, &text);
+    REQUIRE(text == std::to_string(result.id) + ";2,5,13,14,23;2|2,5,13|13,14|"
+            "14,23;LINESTRING(2 0.250988700565,2 1,2 2,3 2,4 2,"
+            "4 2.45776836158)\n");
+    // The geometry read back is the same with the round trip precision
+    output_config.precision = 17;
+    output_config.write_cpath = false;
+    output_config.write_tpath = false;
+    text.clear();
+    writer.format_result(trajectory, result, &text);
+    std::string wkt = text.substr(text.find(';') + 1);
+    wkt.pop_back();
+    REQUIRE(wkt2linestring(wkt) == result.mgeom);
+    std::remove("result_test.csv");
+  }
+  SECTION( "binary_result_file_test" ) {
+    auto ubodt = UBODT::read_ubodt_csv("../data/ubodt.txt",multiplier);
+    FastMapMatch model(network,graph,ubodt);
+    FastMapMatchConfig config{4,0.4,0.5};
+    std::vector<MatchResult> results;
+    for (const Trajectory &trajectory : trajectories) {
+      results.push_back(model.match_traj(trajectory,config));
+    }
+    FMM::CONFIG::ResultConfig result_config;
+    result_config.file = "result_test.fmmr";
+    result_config.output_config.write_opath = true;
+    result_config.output_config.write_error = true;
+    result_config.output_config.write_tpath = true;
+    REQUIRE(result_config.get_result_format() == 1);
+    {
+      ResultWriter writer(result_config);
+      for (int i = 0; i < results.size(); ++i) {
+        writer.write_result(trajectories[i], results[i]);
+      }
+    }
+    BinaryMatchResultReader result_reader(result_config.file);
+    REQUIRE(result_reader.get_fields() == (RESULT_FIELD_OPATH |
+      RESULT_FIELD_ERROR | RESULT_FIELD_CPATH | RESULT_FIELD_TPATH |
+      RESULT_FIELD_MGEOM));
+    std::vector<ResultRecord> records = result_reader.read_all_results();
+    REQUIRE(records.size() == results.size());
+    for (int i = 0; i < records.size(); ++i) {
+      const MatchResult &result = results[i];
+      REQUIRE(records[i].id == result.id);
+      REQUIRE(records[i].opath == std::vector<int64_t>(
+        result.opath.begin(), result.opath.end()));
+      REQUIRE(records[i].cpath == std::vector<int64_t>(
+        result.cpath.begin(), result.cpath.end()));
+      REQUIRE(records[i].error.size() == result.opt_candidate_path.size());
+      REQUIRE(records[i].pgeom.empty());
+      REQUIRE(records[i].mgeom.size() == 2 * result.mgeom.get_num_points());
+      if (!result.cpath.empty()) {
+        REQUIRE(records[i].indices == std::vector<int32_t>(
+          result.indices.begin(), result.indices.end()));
+        REQUIRE(records[i].error[0] ==
+                float(result.opt_candidate_path[0].c.dist));
+        REQUIRE(records[i].mgeom[0] == result.mgeom.get_x(0));
+      }
+    }
+    // One result per block
+    {
+      BinaryMatchResultWriter writer(result_config.file,
+                                     result_config.output_config, 1);
+      for (int i = 0; i < results.size(); ++i) {
+        writer.write_result(trajectories[i], results[i]);
+      }
+    }
+    BinaryMatchResultReader block_reader(result_config.file);
+    REQUIRE(block_reader.get_num_blocks() == results.size());
+    uint64_t last = results.size() - 1;
+    std::vector<ResultRecord> block;
+    REQUIRE_THROWS_AS(block_reader.read_block(last + 1, &block),
+                      std::out_of_range);
+    REQUIRE_THROWS_AS(block_reader.seek_block(last + 1), std::out_of_range);
+    block_reader.read_block(last, &block);
+    REQUIRE(block.size() == 1);
+    REQUIRE(block[0].id == results[last].id);
+    block_reader.seek_block(last);
+    REQUIRE(block_reader.read_next_result().id == results[last].id);
+    REQUIRE(!block_reader.has_next_result());
+    std::remove(result_config.file.c_str());
+  }
+  SECTION( "compressed_file_test" ) {
+    REQUIRE(is_gzip_file("ubodt.txt.gz"));
+    REQUIRE(!is_gzip_file("ubodt.txt"));
+    REQUIRE(strip_gzip_extension("ubodt.bin.gz") == "ubodt.bin");
+    std::string text;
+    for (int i = 0; i < 200000; ++i) {
+      text += std::to_string(i) + ";" + std::to_string(i * 0.5) + "\n";
+    }
+    std::string compressed_file = "compressed_test.txt.gz";
+    {
+      OutputFileStream ofs(compressed_file);
+      REQUIRE(ofs.is_open());
+      ofs.write(text.data(), text.size() / 2);
+      ofs.flush();
+      ofs << text.substr(text.size() / 2);
+      ofs.close();
+    }
+    std::ifstream raw(compressed_file, std::ios::binary);
+    REQUIRE(raw.get() == 0x1f);
+    REQUIRE(raw.get() == 0x8b);
+    raw.close();
+    InputFileStream ifs(compressed_file);
+    REQUIRE(ifs.is_open());
+    std::string decompressed((std::istreambuf_iterator<char>(ifs)),
+                             std::istreambuf_iterator<char>());
+    REQUIRE(decompressed == text);
+    std::remove(compressed_file.c_str());
+    // UBODT written and read in compressed files
+    UBODTGenAlgorithm ubodt_gen(network,graph);
+    ubodt_gen.generate_ubodt("ubodt_test.txt", 3, false, false);
+    ubodt_gen.generate_ubodt("ubodt_test.txt.gz", 3, false, true);
+    ubodt_gen.generate_ubodt("ubodt_test.bin.gz", 3, true, false);
+    auto ubodt = UBODT::read_ubodt_file("ubodt_test.txt",multiplier);
+    for (std::string file : {"ubodt_test.txt.gz", "ubodt_test.bin.gz"}) {
+      auto compressed = UBODT::read_ubodt_file(file,multiplier);
+      REQUIRE(compressed->get_num_rows() == ubodt->get_num_rows());
+      for (NodeIndex s = 0; s < multiplier; ++s) {
+        for (NodeIndex t = 0; t < multiplier; ++t) {
+          Record *expected = ubodt->look_up(s,t);
+          Record *r = compressed->look_up(s,t);
+          REQUIRE((r == nullptr) == (expected == nullptr));
+          if (r != nullptr) {
+            REQUIRE(r->next_e == expected->next_e);
+            REQUIRE(r->cost == Approx(expected->cost));
+          }
+        }
+      }
+      std::remove(file.c_str());
+    }
+    std::remove("ubodt_test.txt");
+  }
+  SECTION( "compressed_file_write_fail_test" ) {
+    // A full device fails the writes of the background thread, which are
+    // thrown without leaving the thread running.
+    std::string full_file = "full_test.txt.gz";
+    REQUIRE(symlink("/dev/full", full_file.c_str()) == 0);
+    std::vector<char> data(1 << 20);
+    unsigned int seed = 1;
+    for (char &c : data) {
+      seed = seed * 1103515245 + 12345;
+      c = static_cast<char>(seed >> 16);
+    }
+    REQUIRE_THROWS_AS([&] {
+      OutputFileStream ofs(full_file);
+      REQUIRE(ofs.is_open());
+      for (int i = 0; i < 40; ++i) {
+        ofs.write(data.data(), data.size());
+      }
+      ofs.close();
+    }(), std::runtime_error);
+    // An error found only when the file is closed
+    {
+      OutputFileStream ofs(full_file);
+      ofs.write(data.data(), data.size());
+      REQUIRE_THROWS_AS(ofs.close(), std::runtime_error);
+      REQUIRE(!ofs.is_open());
+    }
+    std::remove(full_file.c_str());
+  }
+  SECTION( "standard_stream_test" ) {
+    // Trajectories piped into the standard input, gzip compressed
+    std::string input_file = "stdin_test.csv.gz";
+    {
+      OutputFileStream ofs(input_file);
+      std::ifstream trips("../data/trips.csv");
+      ofs << trips.rdbuf();
+      ofs.close();
+    }
+    FMM::CONFIG::GPSConfig gps_config("-");
+    REQUIRE(gps_config.get_gps_format() == 1);
+    REQUIRE(gps_config.validate());
+    gps_config.mmap = true;
+    REQUIRE(!gps_config.validate());
+    gps_config.mmap = false;
+    int saved_stdin = dup(STDIN_FILENO);
+    int fd = open(input_file.c_str(), O_RDONLY);
+    dup2(fd, STDIN_FILENO);
+    close(fd);
+    std::vector<Trajectory> piped;
+    {
+      GPSReader stdin_reader(gps_config);
+      while (stdin_reader.has_next_trajectory()) {
+        piped.push_back(stdin_reader.read_next_trajectory());
+      }
+    }
+    dup2(saved_stdin, STDIN_FILENO);
+    close(saved_stdin);
+    std::remove(input_file.c_str());
+    REQUIRE(piped.size() == trajectories.size());
+    for (int i = 0; i < piped.size(); ++i) {
+      REQUIRE(piped[i].id == trajectories[i].id);
+      REQUIRE(piped[i].geom == trajectories[i].geom);
+    }
+    // Results written to the standard output
+    const char *args[] = {"fmm", "--gps", "-", "-o", "-"};
+    REQUIRE(FMM::CONFIG::ResultConfig::is_standard_output(
+      5, const_cast<char **>(args)));
+    REQUIRE(!FMM::CONFIG::ResultConfig::is_standard_output(
+      3, const_cast<char **>(args)));
+    FMM::CONFIG::ResultConfig result_config;
+    result_config.file = "-";
+    REQUIRE(result_config.validate());
+    REQUIRE(result_config.get_result_format() == 0);
+    auto ubodt = UBODT::read_ubodt_csv("../data/ubodt.txt",multiplier);
+    FastMapMatch model(network,graph,ubodt);
+    FastMapMatchConfig config{4,0.4,0.5};
+    MatchResult result = model.match_traj(trajectories[0],config);
+    std::string output_file = "stdout_test.csv";
+    UTIL::log_to_stderr();
+    spdlog::set_pattern("[%l][%s:%-3#] %v");
+    std::cout.flush();
+    std::fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    fd = open(output_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+    {
+      ResultWriter writer(result_config);
+      writer.write_result(trajectories[0], result);
+    }
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    std::string text;
+    CSVMatchResultWriter("result_test.csv", result_config.output_config)
+      .format_result(trajectories[0], result, &text);
+    std::remove("result_test.csv");
+    std::ifstream ifs(output_file);
+    std::string written((std::istreambuf_iterator<char>(ifs)),
+                        std::istreambuf_iterator<char>());
+    REQUIRE(written == "id;cpath;mgeom\n" + text);
+    std::remove(output_file.c_str());
+  }
+  SECTION( "standard_stream_slow_producer_test" ) {
+    // A producer piping the trajectories slowly into the standard input,
+    // the result of the first trajectory is written to the standard
+    // output before the rest of the input arrives.
+    std::ifstream trips("../data/trips.csv");
+    std::string header, first_line;
+    std::getline(trips, header);
+    std::getline(trips, first_line);
+    std::string rest((std::istreambuf_iterator<char>(trips)),
+                     std::istreambuf_iterator<char>());
+    // Sent as two gzip members
+    std::vector<std::string> parts;
+    for (const std::string &text : {header + "\n" + first_line + "\n", rest}) {
+      std::string part_file = "part_test.csv.gz";
+      {
+        OutputFileStream ofs(part_file);
+        ofs << text;
+        ofs.close();
+      }
+      std::ifstream ifs(part_file, std::ios::binary);
+      parts.push_back(std::string((std::istreambuf_iterator<char>(ifs)),
+                                  std::istreambuf_iterator<char>()));
+      std::remove(part_file.c_str());
+    }
+    int input_pipe[2];
+    int output_pipe[2];
+    REQUIRE(pipe(input_pipe) == 0);
+    REQUIRE(pipe(output_pipe) == 0);
+    std::cout.flush();
+    std::fflush(stdout);
+    int saved_stdin = dup(STDIN_FILENO);
+    int saved_stdout = dup(STDOUT_FILENO);
+    dup2(input_pipe[0], STDIN_FILENO);
+    close(input_pipe[0]);
+    dup2(output_pipe[1], STDOUT_FILENO);
+    close(output_pipe[1]);
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool first_written = false;
+    bool written_early = false;
+    std::thread producer([&] {
+      ssize_t count = write(input_pipe[1], parts[0].data(), parts[0].size());
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        written_early = cv.wait_for(lock, std::chrono::seconds(10),
+                                    [&] { return first_written; });
+      }
+      count += write(input_pipe[1], parts[1].data(), parts[1].size());
+      close(input_pipe[1]);
+    });
+    std::string output;
+    std::thread consumer([&] {
+      char buf[4096];
+      ssize_t count;
+      while ((count = read(output_pipe[0], buf, sizeof(buf))) > 0) {
+        std::lock_guard<std::mutex> lock(mutex);
+        output.append(buf, count);
+        // The header and the first result
+        if (std::count(output.begin(), output.end(), '\n') >= 2) {
+          first_written = true;
+          cv.notify_all();
+        }
+      }
+      close(output_pipe[0]);
+    });
+    auto ubodt = UBODT::read_ubodt_csv("../data/ubodt.txt",multiplier);
+    FastMapMatch model(network,graph,ubodt);
+    FastMapMatchConfig config{4,0.4,0.5};
+    FMM::CONFIG::ResultConfig result_config;
+    result_config.file = "-";
+    FMM::CONFIG::GPSConfig gps_config("-");
+    {
+      GPSReader reader(gps_config);
+      ResultWriter writer(result_config);
+      MatchPipeline<MatchResult> pipeline(2, 1000);
+      pipeline.run(&reader, [&](const Trajectory &trajectory) {
+        return model.match_traj(trajectory,config);
+      }, [&](const Trajectory &trajectory, const MatchResult &result,
+             std::string *text) {
+        writer.format_result(trajectory, result, text);
+      }, [&](const Trajectory &trajectory, const MatchResult &result,
+             const std::string &text) {
+        writer.write_text(text);
+      }, [&writer] { writer.flush(); });
+    }
+    producer.join();
+    // The write end of the output pipe is closed with the standard output
+    dup2(saved_stdin, STDIN_FILENO);
+    close(saved_stdin);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    consumer.join();
+    REQUIRE(written_early);
+    REQUIRE(std::count(output.begin(), output.end(), '\n') ==
+            trajectories.size() + 1);
+  }
+  SECTION( "fmm_server_test" ) {
+    const char *args[] = {"fmm_server", "--network", "../data/network.gpkg",
+      "--ubodt", "../data/ubodt.txt", "-k", "4", "-r", "0.4", "-e", "0.5",
+      "--http", "fmm_server_http.sock", "--binary", "fmm_server_binary.sock",
+      "--threads", "2", "--max_connections", "1"};
+    FMMServerConfig server_config(19, const_cast<char **>(args));
+    FMMServer server(server_config);
+    std::thread server_thread(&FMMServer::run, &server);
+    auto ubodt = UBODT::read_ubodt_csv("../data/ubodt.txt",multiplier);
+    FastMapMatch model(network,graph,ubodt);
+    FastMapMatchConfig config{4,0.4,0.5};
+    std::vector<MatchResult> expected;
+    for (const Trajectory &trajectory : trajectories) {
+      expected.push_back(model.match_traj(trajectory,config));
+    }
+    // Connect once the server is listening
+    auto connect_to = [](const std::string &path) {
+      sockaddr_un addr{};
+      addr.sun_family = AF_UNIX;
+      std::strcpy(addr.sun_path, path.c_str());
+      for (int i = 0; i < 500; ++i) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (connect(fd, reinterpret_cast<sockaddr *>(&addr),
+                    sizeof(addr)) == 0) {
+          return fd;
+        }
+        close(fd);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      return -1;
+    };
+    auto send_text = [](int fd, const std::string &text) {
+      return send(fd, text.data(), text.size(), 0) ==
+        static_cast<ssize_t>(text.size());
+    };
+    auto receive_text = [](int fd) {
+      std::string text;
+      char data[4096];
+      ssize_t n;
+      while ((n = recv(fd, data, sizeof(data), 0)) > 0) text.append(data, n);
+      return text;
+    };
+    // HTTP/JSON protocol
+    std::string body = "{\"trajectories\":[";
+    for (int i = 0; i < trajectories.size(); ++i) {
+      if (i > 0) body += ",";
+      body += "{\"id\":" + std::to_string(trajectories[i].id) +
+        ",\"wkt\":\"" + trajectories[i].geom.export_wkt(17) + "\"}";
+    }
+    body += "]}";
+    int fd = connect_to("fmm_server_http.sock");
+    REQUIRE(fd >= 0);
+    REQUIRE(send_text(fd, "POST /match HTTP/1.1\r\nContent-Length: " +
+                      std::to_string(body.size()) +
+                      "\r\nConnection: close\r\n\r\n" + body));
+    std::string response = receive_text(fd);
+    close(fd);
+    REQUIRE(response.compare(0, 15, "HTTP/1.1 200 OK") == 0);
+    auto join = [](const std::vector<long long> &values) {
+      std::string text;
+      for (int i = 0; i < values.size(); ++i) {
+        text += (i > 0 ? "," : "") + std::to_string(values[i]);
+      }
+      return text;
+    };
+    for (const MatchResult &result : expected) {
+      REQUIRE(response.find("{\"id\":" + std::to_string(result.id) +
+                            ",\"opath\":[" + join(result.opath) +
+                            "],\"cpath\":[" + join(result.cpath) + "]") !=
+              std::string::npos);
+    }
+    // A connection waits until the one served is closed
+    int idle_fd = connect_to("fmm_server_http.sock");
+    REQUIRE(idle_fd >= 0);
+    fd = connect_to("fmm_server_http.sock");
+    REQUIRE(fd >= 0);
+    REQUIRE(send_text(fd, "GET /stats HTTP/1.1\r\n"
+                      "Connection: close\r\n\r\n"));
+    pollfd waiting{fd, POLLIN, 0};
+    REQUIRE(poll(&waiting, 1, 200) == 0);
+    close(idle_fd);
+    response = receive_text(fd);
+    close(fd);
+    REQUIRE(response.compare(0, 15, "HTTP/1.1 200 OK") == 0);
+    REQUIRE_THROWS(server.handle_json("{\"trajectories\":["));
+    // Binary protocol
+    std::string payload;
+    uint32_t count = trajectories.size();
+    payload.append(reinterpret_cast<const char *>(&count), sizeof(count));
+    for (const Trajectory &trajectory : trajectories) {
+      int32_t id = trajectory.id;
+      uint32_t n = trajectory.geom.get_num_points();
+      payload.append(reinterpret_cast<const char *>(&id), sizeof(id));
+      payload.append(reinterpret_cast<const char *>(&n), sizeof(n));
+      for (uint32_t j = 0; j < n; ++j) {
+        double x = trajectory.geom.get_x(j);
+        payload.append(reinterpret_cast<const char *>(&x), sizeof(x));
+      }
+      for (uint32_t j = 0; j < n; ++j) {
+        double y = trajectory.geom.get_y(j);
+        payload.append(reinterpret_cast<const char *>(&y), sizeof(y));
+      }
+    }
+    uint32_t size = payload.size();
+    fd = connect_to("fmm_server_binary.sock");
+    REQUIRE(fd >= 0);
+    REQUIRE(send_text(fd, std::string(reinterpret_cast<const char *>(&size),
+                                      sizeof(size)) + payload));
+    shutdown(fd, SHUT_WR);
+    response = receive_text(fd);
+    close(fd);
+    REQUIRE(response.size() >= sizeof(uint32_t) + 5 * sizeof(uint32_t));
+    std::memcpy(&size, response.data(), sizeof(size));
+    REQUIRE(size == response.size() - sizeof(size));
+    int32_t status;
+    std::memcpy(&status, response.data() + sizeof(size), sizeof(status));
+    std::memcpy(&count, response.data() + 2 * sizeof(size), sizeof(count));
+    REQUIRE(status == 0);
+    REQUIRE(count == expected.size());
+    const char *pos = response.data() + 6 * sizeof(uint32_t);
+    const char *end = response.data() + response.size();
+    for (const MatchResult &result : expected) {
+      ResultRecord record;
+      pos = read_result_record(pos, end, FMMServer::BINARY_RESULT_FIELDS,
+                               &record);
+      REQUIRE(record.id == result.id);
+      REQUIRE(record.cpath == std::vector<int64_t>(result.cpath.begin(),
+                                                   result.cpath.end()));
+    }
+    uint32_t num_failed;
+    REQUIRE(end - pos == sizeof(num_failed));
+    std::memcpy(&num_failed, pos, sizeof(num_failed));
+    REQUIRE(num_failed == 0);
+    REQUIRE(server.get_stats().find("\"requests\":2,\"trajectories\":" +
+                                    std::to_string(2 * expected.size())) !=
+            std::string::npos);
+    // An invalid trajectory does not fail the others of the request
+    response = server.handle_json(
+      "{\"trajectories\":[{\"id\":7,\"wkt\":\"LINESTRING(0\"},"
+      "{\"id\":" + std::to_string(trajectories[0].id) + ",\"wkt\":\"" +
+      trajectories[0].geom.export_wkt(17) + "\"}]}");
+    REQUIRE(response.find("{\"id\":7,\"error\":\"Invalid wkt") !=
+            std::string::npos);
+    REQUIRE(response.find("{\"id\":" + std::to_string(expected[0].id) +
+                          ",\"opath\":[" + join(expected[0].opath) + "]") !=
+            std::string::npos);
+    server.stop();
+    server_thread.join();
+  }
+  SECTION( "ubodt_batch_lookup_test" ) {
+    auto ubodt = UBODT::read_ubodt_csv("../data/ubodt.txt",multiplier);
+    std::vector<std::pair<NodeIndex,NodeIndex>> od_pairs;
+    for (NodeIndex s = 0; s < multiplier; ++s) {
+      for (NodeIndex t = 0; t < multiplier; ++t) {
+        od_pairs.push_back({s,t});
+        od_pairs.push_back({t,s});
+      }
+    }
+    std::vector<Record *> records = ubodt->look_up_batch(od_pairs);
+    REQUIRE(records.size() == od_pairs.size());
+    for (int i = 0; i < od_pairs.size(); ++i) {
+      REQUIRE(records[i] == ubodt->look_up(od_pairs[i].first,
+                                           od_pairs[i].second));
+    }
+  }
+  SECTION( "ubodt_cache_test" ) {
+    auto ubodt = UBODT::read_ubodt_csv("../data/ubodt.txt",multiplier);
+    for (NodeIndex s = 0; s < multiplier; ++s) {
+      for (NodeIndex t = 0; t < multiplier; ++t) {
+        REQUIRE(ubodt->look_up_cached(s,t) == ubodt->look_up(s,t));
+        REQUIRE(ubodt->look_up_cached(s,t) == ubodt->look_up(s,t));
+        std::vector<EdgeIndex> path = ubodt->look_sp_path(s,t);
+        REQUIRE_THAT(ubodt->look_sp_path(s,t),Catch::Equals(path));
+      }
+    }
+    UBODTCacheStats stats = ubodt->get_cache_stats();
+    REQUIRE(stats.hits + stats.misses == 2 * multiplier * multiplier);
+    REQUIRE(stats.hits >= multiplier * multiplier);
+    REQUIRE(stats.path_hits >= multiplier * (multiplier - 1));
+    // A hit returns the path stored in the cache without a copy
+    const std::vector<EdgeIndex> &cached = ubodt->look_sp_path(0,5);
+    REQUIRE(&ubodt->look_sp_path(0,5) == &cached);
+    // Pending statistics are kept when the thread switches tables
+    auto other = UBODT::read_ubodt_csv("../data/ubodt.txt",multiplier);
+    ubodt->look_up_cached(0,5);
+    other->look_up_cached(0,5);
+    other->look_up_cached(0,5);
+    UBODTCacheStats ubodt_stats = ubodt->get_cache_stats();
+    REQUIRE(ubodt_stats.hits + ubodt_stats.misses ==
+            stats.hits + stats.misses + 1);
+    REQUIRE(ubodt_stats.path_hits + ubodt_stats.path_misses ==
+            stats.path_hits + stats.path_misses + 2);
+    UBODTCacheStats other_stats = other->get_cache_stats();
+    REQUIRE(other_stats.misses == 1);
+    REQUIRE(other_stats.hits == 1);
+  }
+  SECTION( "ubodt_predecessor_path_test" ) {
+    auto ubodt = UBODT::read_ubodt_csv("../data/ubodt.txt",multiplier);
+    for (NodeIndex s = 0; s < multiplier; ++s) {
+      for (NodeIndex t = 0; t < multiplier; ++t) {
+        Record *r = ubodt->look_up(s,t);
+        if (s == t || r == nullptr) continue;
+        std::vector<EdgeIndex> expected;
+        while (r->first_n != t) {
+          expected.push_back(r->next_e);
+          r = ubodt->look_up(r->first_n,t);
+        }
+        expected.push_back(r->next_e);
+        REQUIRE_THAT(ubodt->look_sp_path(s,t),Catch::Equals(expected));
+      }
+    }
+  }
+  SECTION( "ubodt_predecessor_tie_test" ) {
+    // Paths 1-3 and 1-2-3 have the same cost, the row of 1 to 3 stores
+    // the latter while the row of 0 to 3 reaches 3 from 1 directly.
+    UBODT ubodt(7, 10);
+    auto insert = [&ubodt](NodeIndex source, NodeIndex target,
+                           NodeIndex first_n, NodeIndex prev_n,
+                           EdgeIndex next_e, double cost) {
+      Record *r = (Record *) malloc(sizeof(Record));
+      *r = Record{source, target, first_n, prev_n, next_e, next_e, cost,
+                  nullptr, nullptr};
+      ubodt.insert(r);
+    };
+    insert(0, 1, 1, 0, 10, 1);
+    insert(0, 3, 1, 1, 10, 3);
+    insert(1, 2, 2, 1, 12, 1);
+    insert(1, 3, 2, 2, 12, 2);
+    insert(2, 3, 3, 2, 23, 1);
+    ubodt.link_predecessors();
+    REQUIRE(ubodt.look_up(0,3)->prev_r == nullptr);
+    REQUIRE_THAT(ubodt.look_sp_path(0,3),
+                 Catch::Equals<EdgeIndex>({10, 12, 23}));
+    REQUIRE(ubodt.look_up(1,3)->prev_r == ubodt.look_up(1,2));
+    REQUIRE_THAT(ubodt.look_sp_path(1,3),
+                 Catch::Equals<EdgeIndex>({12, 23}));
+  }
+  SECTION( "composite_graph_test" ) {
+    const Trajectory &trajectory = trajectories[0];
+    Traj_Candidates tc = network.search_tr_cs_knn(trajectory.geom,4,0.4);
+    DummyGraph dg(tc);
+    CompositeGraph cg(graph,dg);
+    for (const Point_Candidates &pcs : tc) {
+      for (const Candidate &c : pcs) {
+        REQUIRE(cg.check_dummy_node(c.index));
+        bool to_target = false;
+        for (const CompEdgeProperty &e : cg.out_edges(c.index)) {
+          if (e.v == c.edge->target &&
+              std::abs(e.cost - (c.edge->length - c.offset)) < 1e-6) {
+            to_target = true;
+          }
+        }
+        REQUIRE(to_target);
+        int network_edges = boost::out_degree(
+          c.edge->source, graph.get_boost_graph());
+        int total_edges = 0;
+        bool from_source = false;
+        for (const CompEdgeProperty &e : cg.out_edges(c.edge->source)) {
+          ++total_edges;
+          if (e.v == c.index && std::abs(e.cost - c.offset) < 1e-6) {
+            from_source = true;
+          }
+        }
+        REQUIRE(from_source);
+        REQUIRE(total_edges > network_edges);
+        REQUIRE(cg.get_edge_index(c.edge->source, c.index, c.offset) ==
+                c.edge->index);
+        // Both end nodes of a candidate edge are in the dummy graph
+        REQUIRE(dg.containNodeIndex(c.index));
+        REQUIRE(dg.containNodeIndex(c.edge->source));
+        REQUIRE(dg.containNodeIndex(c.edge->target));
+        REQUIRE(dg.get_external_index(
+          dg.get_internal_index(c.edge->target)) == c.edge->target);
+        REQUIRE(boost::geometry::equals(cg.get_node_point(c.index),
+                                        c.point));
+        REQUIRE(boost::geometry::equals(
+          cg.get_node_point(c.edge->source),
+          graph.get_vertex_point(c.edge->source)));
+      }
+    }
+    const Graph_T &dummy_g = dg.get_boost_graph();
+    REQUIRE(boost::num_vertices(dummy_g) == dg.get_num_vertices());
+    REQUIRE(boost::num_edges(dummy_g) == dg.get_num_edges());
+    REQUIRE_FALSE(dg.containNodeIndex(
+      std::numeric_limits<NodeIndex>::max()));
+  }
 }
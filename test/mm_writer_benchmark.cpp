@@ -0,0 +1,208 @@
+#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include "catch2/catch.hpp"
+
+#include "util/debug.hpp"
+#include "util/util.hpp"
+#include "network/network.hpp"
+#include "mm/fmm/fmm_algorithm.hpp"
+#include "io/gps_reader.hpp"
+#include "io/mm_writer.hpp"
+
+#include <sstream>
+
+using namespace FMM;
+using namespace FMM::IO;
+using namespace FMM::CORE;
+using namespace FMM::NETWORK;
+using namespace FMM::MM;
+
+namespace {
+
+// A row formatted with std::stringstream as the CSV writer did before
+// it appended to a fmt buffer, which is the reference of the output.
+std::string format_row_with_stream(const FMM::CONFIG::OutputConfig &config,
+                                   const Trajectory &traj,
+                                   const MatchResult &result) {
+  std::stringstream buf;
+  const MatchedCandidatePath &path = result.opt_candidate_path;
+  int N = path.size();
+  buf << result.id;
+  if (config.write_opath) {
+    buf << ";" << result.opath;
+  }
+  if (config.write_error) {
+    buf << ";";
+    for (int i = 0; i < N; ++i) {
+      buf << path[i].c.dist << (i == N - 1 ? "" : ",");
+    }
+  }
+  if (config.write_offset) {
+    buf << ";";
+    for (int i = 0; i < N; ++i) {
+      buf << path[i].c.offset << (i == N - 1 ? "" : ",");
+    }
+  }
+  if (config.write_spdist) {
+    buf << ";";
+    for (int i = 1; i < N; ++i) {
+      buf << path[i].sp_dist << (i == N - 1 ? "" : ",");
+    }
+  }
+  if (config.write_pgeom) {
+    buf << ";";
+    if (N > 0) {
+      LineString pline;
+      for (int i = 0; i < N; ++i) {
+        pline.add_point(path[i].c.point);
+      }
+      buf << pline;
+    }
+  }
+  if (config.write_cpath) {
+    buf << ";" << result.cpath;
+  }
+  if (config.write_tpath) {
+    buf << ";";
+    if (!result.cpath.empty()) {
+      int J = result.indices.size();
+      for (int j = 0; j < J - 1; ++j) {
+        for (int i = result.indices[j]; i < result.indices[j + 1]; ++i) {
+          buf << result.cpath[i] << ",";
+        }
+        buf << result.cpath[result.indices[j + 1]];
+        if (j < J - 2) buf << "|";
+      }
+    }
+  }
+  if (config.write_mgeom) {
+    buf << ";" << result.mgeom;
+  }
+  if (config.write_ep) {
+    buf << ";";
+    for (int i = 0; i < N; ++i) {
+      buf << path[i].ep << (i == N - 1 ? "" : ",");
+    }
+  }
+  if (config.write_tp) {
+    buf << ";";
+    for (int i = 0; i < N; ++i) {
+      buf << path[i].tp << (i == N - 1 ? "" : ",");
+    }
+  }
+  if (config.write_length) {
+    buf << ";";
+    for (int i = 0; i < N; ++i) {
+      buf << path[i].c.edge->length << (i == N - 1 ? "" : ",");
+    }
+  }
+  int T = traj.timestamps.size();
+  if (config.write_duration) {
+    buf << ";";
+    for (int i = 1; i < T; ++i) {
+      buf << traj.timestamps[i] - traj.timestamps[i - 1]
+          << (i == T - 1 ? "" : ",");
+    }
+  }
+  if (config.write_speed) {
+    buf << ";";
+    if (N > 0) {
+      for (int i = 1; i < T; ++i) {
+        double duration = traj.timestamps[i] - traj.timestamps[i - 1];
+        buf << (duration > 0 ? path[i].sp_dist / duration : 0)
+            << (i == T - 1 ? "" : ",");
+      }
+    }
+  }
+  buf << '\n';
+  return buf.str();
+}
+
+FMM::CONFIG::OutputConfig all_fields_config() {
+  FMM::CONFIG::OutputConfig config;
+  config.write_opath = true;
+  config.write_error = true;
+  config.write_offset = true;
+  config.write_spdist = true;
+  config.write_pgeom = true;
+  config.write_tpath = true;
+  config.write_ep = true;
+  config.write_tp = true;
+  config.write_length = true;
+  config.write_duration = true;
+  config.write_speed = true;
+  return config;
+}
+
+} // namespace
+
+TEST_CASE( "mm writer is benchmarked", "[mm_writer]" ) {
+  spdlog::set_level(spdlog::level::warn);
+  Network network("../data/network.gpkg");
+  NetworkGraph graph(network);
+  auto ubodt = UBODT::read_ubodt_csv("../data/ubodt.txt",
+                                     network.get_node_count());
+  FastMapMatch model(network, graph, ubodt);
+  FastMapMatchConfig config{4, 0.4, 0.5};
+  CSVTrajectoryReader reader("../data/trips.csv", "id", "geom");
+  std::vector<Trajectory> trajectories = reader.read_all_trajectories();
+  std::vector<MatchResult> results;
+  for (Trajectory &trajectory : trajectories) {
+    for (int i = 0; i < trajectory.geom.get_num_points(); ++i) {
+      trajectory.timestamps.push_back(i * 1.5);
+    }
+    results.push_back(model.match_traj(trajectory, config));
+  }
+  FMM::CONFIG::OutputConfig default_config;
+  FMM::CONFIG::OutputConfig all_config = all_fields_config();
+  FMM::CONFIG::OutputConfig no_geometry_config = all_fields_config();
+  no_geometry_config.write_pgeom = false;
+  no_geometry_config.write_mgeom = false;
+  // The rows are the same as the ones formatted with std::stringstream
+  for (const FMM::CONFIG::OutputConfig *output_config :
+       {&default_config, &all_config, &no_geometry_config}) {
+    CSVMatchResultWriter writer("benchmark_result.csv", *output_config);
+    for (int i = 0; i < trajectories.size(); ++i) {
+      std::string text;
+      writer.format_result(trajectories[i], results[i], &text);
+      REQUIRE(text == format_row_with_stream(*output_config, trajectories[i],
+                                             results[i]));
+    }
+  }
+  CSVMatchResultWriter default_writer("benchmark_default.csv",
+                                      default_config);
+  CSVMatchResultWriter all_writer("benchmark_all.csv", all_config);
+  BENCHMARK("stringstream, default fields") {
+    std::string text;
+    for (int i = 0; i < trajectories.size(); ++i) {
+      text += format_row_with_stream(default_config, trajectories[i],
+                                     results[i]);
+    }
+    return text;
+  };
+  BENCHMARK("fmt buffer, default fields") {
+    std::string text;
+    for (int i = 0; i < trajectories.size(); ++i) {
+      default_writer.format_result(trajectories[i], results[i], &text);
+    }
+    return text;
+  };
+  BENCHMARK("stringstream, all fields") {
+    std::string text;
+    for (int i = 0; i < trajectories.size(); ++i) {
+      text += format_row_with_stream(all_config, trajectories[i],
+                                     results[i]);
+    }
+    return text;
+  };
+  BENCHMARK("fmt buffer, all fields") {
+    std::string text;
+    for (int i = 0; i < trajectories.size(); ++i) {
+      all_writer.format_result(trajectories[i], results[i], &text);
+    }
+    return text;
+  };
+  std::remove("benchmark_result.csv");
+  std::remove("benchmark_default.csv");
+  std::remove("benchmark_all.csv");
+}
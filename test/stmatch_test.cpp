@@ -0,0 +1,305 @@
+#define CATCH_CONFIG_MAIN
+#include "catch2/catch.hpp"
+
+#include "util/debug.hpp"
+#include "network/network.hpp"
+#include "network/network_graph.hpp"
+#include "mm/stmatch/stmatch_algorithm.hpp"
+#include "core/gps.hpp"
+#include "io/gps_reader.hpp"
+#include "algorithm/geom_algorithm.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+
+using namespace FMM;
+using namespace FMM::IO;
+using namespace FMM::CORE;
+using namespace FMM::NETWORK;
+using namespace FMM::MM;
+
+/**
+ * Exposes the steps of STMATCH::match_traj to build the complete path
+ * without the paths found in update_tg.
+ */
+class STMATCHTester : public STMATCH {
+ public:
+  STMATCHTester(const Network &network, const NetworkGraph &graph) :
+    STMATCH(network, graph), network_(network), graph_(graph) {};
+  C_Path match_cpath_by_search(const Trajectory &traj,
+                               const STMATCHConfig &config) {
+    Traj_Candidates tc = network_.search_tr_cs_knn(
+      traj.geom, config.k, config.radius);
+    if (tc.empty()) return C_Path();
+    DummyGraph dg(tc, config.reverse_tolerance);
+    CompositeGraph cg(graph_, dg);
+    TransitionGraph tg(tc, config.gps_error);
+    update_tg(&tg, cg, traj, config);
+    TGOpath tg_opath = tg.backtrack();
+    std::vector<int> indices;
+    return build_cpath(tg_opath, &indices, config.reverse_tolerance);
+  };
+  using STMATCH::shortest_path_upperbound;
+ private:
+  const Network &network_;
+  const NetworkGraph &graph_;
+};
+
+TEST_CASE( "stmatch is tested", "[stmatch]" ) {
+  spdlog::set_level((spdlog::level::level_enum) 0);
+  spdlog::set_pattern("[%l][%s:%-3#] %v");
+  Network network("../data/network.gpkg");
+  NetworkGraph graph(network);
+  CSVTrajectoryReader reader("../data/trips.csv","id","geom");
+  std::vector<Trajectory> trajectories = reader.read_all_trajectories();
+  STMATCHConfig config{4,0.4,0.5};
+  SECTION( "online_session_test" ) {
+    STMATCH model(network,graph);
+    for (const Trajectory &trajectory : trajectories) {
+      MatchResult result = model.match_traj(trajectory,config);
+      STMATCHSession session(model,config,100);
+      OnlineMatchPath online_path;
+      for (int i = 0; i < trajectory.geom.get_num_points(); ++i) {
+        OnlineMatchPath finalized = session.push_point(
+          trajectory.geom.get_x(i), trajectory.geom.get_y(i));
+        online_path.insert(online_path.end(),
+                           finalized.begin(), finalized.end());
+      }
+      OnlineMatchPath finalized = session.flush();
+      online_path.insert(online_path.end(),
+                         finalized.begin(), finalized.end());
+      O_Path opath;
+      for (int i = 0; i < online_path.size(); ++i) {
+        REQUIRE(online_path[i].point_index == i);
+        opath.push_back(online_path[i].mc.c.edge->id);
+      }
+      REQUIRE_THAT(opath,Catch::Equals<EdgeID>(result.opath));
+    }
+  }
+  SECTION( "layer_router_test" ) {
+    // Sources at 3/4 and targets at 1/4 of every edge, so that the
+    // candidates on the same edge are connected through the network.
+    const std::vector<Edge> &edges = network.get_edges();
+    std::vector<Candidate> source_cs, target_cs;
+    for (const Edge &e : edges) {
+      Edge *edge = const_cast<Edge *>(&e);
+      source_cs.push_back(Candidate{0, e.length * 0.75, 0, edge, Point()});
+      target_cs.push_back(Candidate{0, e.length * 0.25, 0, edge, Point()});
+    }
+    std::vector<const Candidate *> sources, targets;
+    for (const Candidate &c : source_cs) sources.push_back(&c);
+    for (const Candidate &c : target_cs) targets.push_back(&c);
+    LayerRouter router(graph);
+    for (double delta : {1e9, 4.3}) {
+      LayerRoutes routes = router.search(sources, targets, delta, 0);
+      for (int i = 0; i < sources.size(); ++i) {
+        const Candidate *a = sources[i];
+        PredecessorMap pmap;
+        DistanceMap dmap;
+        graph.single_source_upperbound_dijkstra(
+          a->edge->target, 1e9, &pmap, &dmap);
+        double head = a->edge->length - a->offset;
+        for (int j = 0; j < targets.size(); ++j) {
+          const Candidate *b = targets[j];
+          auto iter = dmap.find(b->edge->source);
+          double expected = std::numeric_limits<double>::max();
+          if (iter != dmap.end()) {
+            expected = head + iter->second + b->offset;
+          }
+          if (expected > delta) {
+            REQUIRE(routes.get_distance(i, j) ==
+                    std::numeric_limits<double>::max());
+            REQUIRE(routes.get_path(i, j).empty());
+            continue;
+          }
+          REQUIRE(routes.get_distance(i, j) == Approx(expected));
+          // The path connects the two candidates with the same length
+          std::vector<EdgeIndex> path = routes.get_path(i, j);
+          NodeIndex u = a->edge->target;
+          double length = 0;
+          for (EdgeIndex e : path) {
+            REQUIRE(edges[e].source == u);
+            u = edges[e].target;
+            length += edges[e].length;
+          }
+          REQUIRE(u == b->edge->source);
+          REQUIRE(length == Approx(iter->second));
+        }
+      }
+    }
+  }
+  SECTION( "astar_upperbound_test" ) {
+    STMATCHTester model(network,graph);
+    for (const Trajectory &trajectory : trajectories) {
+      Traj_Candidates tc = network.search_tr_cs_knn(
+        trajectory.geom, config.k, config.radius);
+      DummyGraph dg(tc, config.reverse_tolerance);
+      CompositeGraph cg(graph, dg);
+      std::vector<double> eu_dists = ALGORITHM::cal_eu_dist(trajectory.geom);
+      for (int i = 0; i + 1 < tc.size(); ++i) {
+        double delta = eu_dists[i] * config.factor * 4;
+        std::vector<NodeIndex> targets;
+        for (const Candidate &c : tc[i + 1]) targets.push_back(c.index);
+        for (const Candidate &c : tc[i]) {
+          PredecessorMap pmap, astar_pmap;
+          DistanceMap dmap, astar_dmap;
+          std::vector<double> distances = model.shortest_path_upperbound(
+            i, cg, c.index, targets, delta, &pmap, &dmap, false);
+          std::vector<double> astar_distances =
+            model.shortest_path_upperbound(
+              i, cg, c.index, targets, delta, &astar_pmap, &astar_dmap,
+              true);
+          for (int j = 0; j < targets.size(); ++j) {
+            // Distances beyond delta are not settled in either search
+            if (distances[j] <= delta) {
+              REQUIRE(astar_distances[j] == Approx(distances[j]));
+            } else {
+              REQUIRE(astar_distances[j] > delta);
+            }
+          }
+        }
+      }
+    }
+  }
+  SECTION( "transition_cache_test" ) {
+    const double inf = std::numeric_limits<double>::infinity();
+    TransitionCache cache(4, 1);
+    double cost = 0;
+    std::vector<EdgeIndex> path;
+    // Miss on an empty cache
+    REQUIRE_FALSE(cache.find(1, 2, 10, &cost, &path));
+    cache.insert(1, 2, 3.5, 10, {7, 8});
+    REQUIRE(cache.find(1, 2, 100, &cost, &path));
+    REQUIRE(cost == 3.5);
+    REQUIRE_THAT(path, Catch::Equals<EdgeIndex>({7, 8}));
+    // An unreached pair only answers the queries with a smaller bound
+    cache.insert(2, 1, inf, 5, {});
+    REQUIRE(cache.find(2, 1, 4, &cost, &path));
+    REQUIRE(cost == inf);
+    REQUIRE_FALSE(cache.find(2, 1, 6, &cost, &path));
+    cache.insert(2, 1, inf, 8, {});
+    REQUIRE(cache.find(2, 1, 6, &cost, &path));
+    // The least recently used entry is evicted
+    cache.insert(3, 4, 1, 10, {});
+    cache.insert(4, 5, 1, 10, {});
+    REQUIRE(cache.find(1, 2, 10, &cost, &path));
+    cache.insert(5, 6, 1, 10, {});
+    REQUIRE(cache.get_size() == 4);
+    REQUIRE_FALSE(cache.find(2, 1, 4, &cost, &path));
+    REQUIRE(cache.find(1, 2, 10, &cost, &path));
+    TransitionCacheStats stats = cache.get_stats();
+    REQUIRE(stats.hits == 5);
+    REQUIRE(stats.misses == 3);
+    REQUIRE(stats.insertions == 5);
+    REQUIRE(stats.evictions == 1);
+    // The capacity is split exactly over the shards
+    for (std::size_t capacity : {3, 20, 100}) {
+      TransitionCache sharded_cache(capacity, 16);
+      for (NodeIndex i = 0; i < 1000; ++i) {
+        sharded_cache.insert(i, i + 1, 1, 10, {});
+      }
+      REQUIRE(sharded_cache.get_size() == capacity);
+    }
+  }
+  SECTION( "transition_cache_thread_test" ) {
+    TransitionCache cache(64);
+    const int num_threads = 4;
+    const int num_queries = 2000;
+    std::vector<std::thread> threads;
+    std::atomic<long long> wrong{0};
+    for (int t = 0; t < num_threads; ++t) {
+      threads.push_back(std::thread([&cache, &wrong, t]() {
+        double cost = 0;
+        std::vector<EdgeIndex> path;
+        for (int i = 0; i < num_queries; ++i) {
+          NodeIndex source = (i * 7 + t) % 100;
+          NodeIndex target = source + 1;
+          if (cache.find(source, target, 10, &cost, &path)) {
+            if (cost != source || path.size() != 1 || path[0] != target) {
+              ++wrong;
+            }
+          } else {
+            cache.insert(source, target, source, 10, {target});
+          }
+        }
+      }));
+    }
+    for (std::thread &thread : threads) thread.join();
+    REQUIRE(wrong == 0);
+    TransitionCacheStats stats = cache.get_stats();
+    REQUIRE(stats.hits + stats.misses == num_threads * num_queries);
+    REQUIRE(stats.hits > 0);
+    REQUIRE(cache.get_size() <= 64);
+    REQUIRE(stats.insertions - stats.evictions == cache.get_size());
+  }
+  SECTION( "transition_cache_size_test" ) {
+    STMATCH model(network,graph);
+    STMATCHConfig cache_config(4,0.4,0.5,30,1.5,0,0,0,false,false,100);
+    STMATCHConfig other_config(4,0.4,0.5,30,1.5,0,0,0,false,false,50);
+    model.match_traj(trajectories[0],cache_config);
+    REQUIRE(model.get_cache_stats().insertions > 0);
+    REQUIRE_NOTHROW(model.match_traj(trajectories[1],cache_config));
+    REQUIRE_THROWS_AS(model.match_traj(trajectories[0],other_config),
+                      std::invalid_argument);
+  }
+  SECTION( "config_validate_test" ) {
+    REQUIRE(STMATCHConfig(4,0.4,0.5,30,1.5,0,0,0,true).validate());
+    REQUIRE(STMATCHConfig(4,0.4,0.5,30,1.5,0,0,0,false,true).validate());
+    REQUIRE_FALSE(
+      STMATCHConfig(4,0.4,0.5,30,1.5,0,0,0,true,true).validate());
+  }
+  SECTION( "reused_path_test" ) {
+    STMATCHTester model(network,graph);
+    std::vector<STMATCHConfig> configs{
+      config,
+      STMATCHConfig(4,0.4,0.5,30,1.5,0,0,0,true),
+      STMATCHConfig(4,0.4,0.5,30,1.5,0,0,0,false,false,100)};
+    for (const STMATCHConfig &c : configs) {
+      // Run twice so that the cache is hit in the second run
+      for (int run = 0; run < 2; ++run) {
+        for (const Trajectory &trajectory : trajectories) {
+          MatchResult result = model.match_traj(trajectory,c);
+          REQUIRE_THAT(result.cpath, Catch::Equals<EdgeID>(
+            model.match_cpath_by_search(trajectory,c)));
+        }
+      }
+    }
+  }
+  SECTION( "online_session_max_lag_test" ) {
+    STMATCH model(network,graph);
+    const int max_lag = 2;
+    for (const Trajectory &trajectory : trajectories) {
+      int num_points = trajectory.geom.get_num_points();
+      Traj_Candidates tc = network.search_tr_cs_knn(
+        trajectory.geom, config.k, config.radius);
+      STMATCHSession session(model,config,max_lag);
+      OnlineMatchPath online_path;
+      for (int i = 0; i < num_points; ++i) {
+        OnlineMatchPath finalized = session.push_point(
+          trajectory.geom.get_x(i), trajectory.geom.get_y(i));
+        online_path.insert(online_path.end(),
+                           finalized.begin(), finalized.end());
+        // No more than max_lag points are left undecided
+        REQUIRE((int) online_path.size() >= i + 1 - max_lag);
+      }
+      OnlineMatchPath finalized = session.flush();
+      online_path.insert(online_path.end(),
+                         finalized.begin(), finalized.end());
+      REQUIRE(online_path.size() == num_points);
+      for (int i = 0; i < online_path.size(); ++i) {
+        const OnlineMatch &decision = online_path[i];
+        REQUIRE(decision.point_index == i);
+        // The decision is one of the candidates of the point
+        const Point_Candidates &pcs = tc[i];
+        REQUIRE(std::any_of(pcs.begin(), pcs.end(),
+          [&decision](const Candidate &c) {
+            return c.edge->id == decision.mc.c.edge->id &&
+              c.offset == decision.mc.c.offset;
+          }));
+      }
+    }
+  }
+}
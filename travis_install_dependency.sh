@@ -7,5 +7,5 @@ else
   sudo add-apt-repository -y ppa:ubuntugis/ppa;
   sudo apt-get -q update;
   sudo apt-get -y install libboost-dev libboost-serialization-dev gdal-bin libgdal-dev make cmake;
-  sudo apt-get -y install swig python-dev;
+  sudo apt-get -y install swig python-dev python-numpy;
 fi